@@ -0,0 +1,222 @@
+/**
+ * Copyright (c) 2014 Markku Linnoskivi
+ *
+ * See the file LICENSE.txt for copying permission.
+ */
+#ifndef LITESTORE_BENCH_COMMON_H
+#define LITESTORE_BENCH_COMMON_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "litestore/litestore.h"
+
+
+namespace ls
+{
+namespace bench
+{
+
+typedef std::chrono::steady_clock Clock;
+
+inline
+uint64_t elapsedNs(const Clock::time_point& begin)
+{
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            Clock::now() - begin).count());
+}
+
+/**
+ * Collects raw latency samples, exact percentiles.
+ */
+class Latencies
+{
+public:
+    void add(uint64_t ns)
+    {
+        samples_.push_back(ns);
+    }
+    void merge(const Latencies& other)
+    {
+        samples_.insert(samples_.end(),
+                        other.samples_.begin(), other.samples_.end());
+    }
+    size_t count() const
+    {
+        return samples_.size();
+    }
+    /**
+     * @param p Percentile in range [0, 100].
+     */
+    uint64_t percentile(double p)
+    {
+        if (samples_.empty())
+        {
+            return 0;
+        }
+        std::sort(samples_.begin(), samples_.end());
+        const size_t i = static_cast<size_t>(
+            p / 100.0 * static_cast<double>(samples_.size() - 1) + 0.5);
+        return samples_[std::min(i, samples_.size() - 1)];
+    }
+    /**
+     * Write the latency fields of a JSON object, in microseconds.
+     */
+    void writeJson(FILE* out)
+    {
+        fprintf(out,
+                "\"count\": %zu, \"p50_us\": %.2f, \"p90_us\": %.2f, "
+                "\"p99_us\": %.2f, \"p999_us\": %.2f, \"max_us\": %.2f",
+                count(),
+                static_cast<double>(percentile(50.0)) / 1000.0,
+                static_cast<double>(percentile(90.0)) / 1000.0,
+                static_cast<double>(percentile(99.0)) / 1000.0,
+                static_cast<double>(percentile(99.9)) / 1000.0,
+                static_cast<double>(percentile(100.0)) / 1000.0);
+    }
+
+private:
+    std::vector<uint64_t> samples_;
+};
+
+/**
+ * Fixed width keys, so that the key size is configurable.
+ */
+inline
+std::string makeKey(uint64_t i, size_t keySize)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%020llu", static_cast<unsigned long long>(i));
+    std::string key("k");
+    key.append(buf);
+    if (key.size() < keySize)
+    {
+        key.append(keySize - key.size(), 'x');
+    }
+    return key;
+}
+
+inline
+std::string makeValue(std::mt19937_64& rng, size_t valueSize)
+{
+    std::string value(valueSize, '\0');
+    for (size_t i = 0; i < valueSize; ++i)
+    {
+        value[i] = static_cast<char>('a' + rng() % 26);
+    }
+    return value;
+}
+
+inline
+litestore_slice_t slice(const std::string& str)
+{
+    return litestore_slice(str.c_str(), 0, str.length());
+}
+
+inline
+litestore_blob_t blob(const std::string& str)
+{
+    return litestore_make_blob(str.c_str(), str.length());
+}
+
+inline
+int ignoreValue(litestore_blob_t value, void* user_data)
+{
+    (void)value;
+    (void)user_data;
+    return LITESTORE_OK;
+}
+
+inline
+void printError(const int error, const char* desc, void* user_data)
+{
+    (void)user_data;
+    fprintf(stderr, "litestore error (%d): %s\n", error, desc);
+}
+
+/**
+ * Command line of form: --name value --flag ...
+ */
+class Args
+{
+public:
+    Args(int argc, char** argv)
+    {
+        for (int i = 1; i < argc; ++i)
+        {
+            std::string name(argv[i]);
+            if (name.compare(0, 2, "--") != 0)
+            {
+                throw std::runtime_error("Unexpected argument: " + name);
+            }
+            name = name.substr(2);
+            if (i + 1 < argc && strncmp(argv[i + 1], "--", 2) != 0)
+            {
+                values_[name] = argv[++i];
+            }
+            else
+            {
+                values_[name] = "1";
+            }
+        }
+    }
+    bool has(const std::string& name) const
+    {
+        return values_.count(name) > 0;
+    }
+    std::string str(const std::string& name, const std::string& def) const
+    {
+        std::map<std::string, std::string>::const_iterator i =
+            values_.find(name);
+        return i == values_.end() ? def : i->second;
+    }
+    long long num(const std::string& name, long long def) const
+    {
+        return has(name) ? std::stoll(str(name, "")) : def;
+    }
+
+private:
+    std::map<std::string, std::string> values_;
+};
+
+/**
+ * Populate the store with keys [0, count), in transactions of batch keys.
+ */
+inline
+void populate(litestore* ctx, uint64_t count, size_t keySize,
+              size_t valueSize, uint64_t batch)
+{
+    std::mt19937_64 rng(42);
+    for (uint64_t i = 0; i < count; ++i)
+    {
+        if (i % batch == 0)
+        {
+            litestore_begin_tx(ctx);
+        }
+        const std::string key = makeKey(i, keySize);
+        const std::string value = makeValue(rng, valueSize);
+        if (litestore_update(ctx, slice(key), blob(value)) != LITESTORE_OK)
+        {
+            throw std::runtime_error("Populating failed");
+        }
+        if (i % batch == batch - 1 || i + 1 == count)
+        {
+            litestore_commit_tx(ctx);
+        }
+    }
+}
+
+}  // namespace bench
+}  // namespace ls
+
+#endif  // LITESTORE_BENCH_COMMON_H
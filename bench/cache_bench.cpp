@@ -0,0 +1,142 @@
+/**
+ * Copyright (c) 2014 Markku Linnoskivi
+ *
+ * See the file LICENSE.txt for copying permission.
+ *
+ * Read latency against the page cache and I/O options.
+ *
+ * Populates a store (if needed) and runs random reads with different
+ * mmap_size and cache_size settings. One JSON object per line is written
+ * for each configuration.
+ *
+ * Compare runs where the store is smaller than RAM with runs where
+ * keys * value-size exceeds it, e.g.
+ *   litestore_bench_cache --db big.db --keys 20000000 --value-size 1024
+ */
+#include <sys/stat.h>
+
+#include <exception>
+
+#include "bench_common.h"
+
+
+namespace
+{
+using namespace ls::bench;
+
+struct Config
+{
+    const char* name;
+    long long mmapSize;
+    int cacheSize;
+};
+
+long long fileSize(const std::string& path)
+{
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 ? static_cast<long long>(st.st_size)
+                                        : 0;
+}
+
+void run(const std::string& db, const Config& config, const Args& args,
+         uint64_t keys, size_t keySize, long long storeBytes)
+{
+    litestore_opts opts = litestore_opts();
+    opts.error_callback = &printError;
+    opts.mmap_size = config.mmapSize;
+    opts.cache_size = config.cacheSize;
+    litestore* ctx = NULL;
+    if (litestore_open(db.c_str(), opts, &ctx) != LITESTORE_OK)
+    {
+        throw std::runtime_error("Failed to open " + db);
+    }
+
+    const uint64_t reads = static_cast<uint64_t>(args.num("reads", 100000));
+    std::mt19937_64 rng(7);
+    std::uniform_int_distribution<uint64_t> pick(0, keys - 1);
+    Latencies latencies;
+
+    const Clock::time_point begin = Clock::now();
+    for (uint64_t i = 0; i < reads; ++i)
+    {
+        const std::string key = makeKey(pick(rng), keySize);
+        const Clock::time_point opBegin = Clock::now();
+        if (litestore_read(ctx, slice(key), &ignoreValue, NULL)
+            != LITESTORE_OK)
+        {
+            throw std::runtime_error("Read failed for " + key);
+        }
+        latencies.add(elapsedNs(opBegin));
+    }
+    const double seconds = static_cast<double>(elapsedNs(begin)) / 1e9;
+    litestore_close(ctx);
+
+    printf("{\"bench\": \"cache\", \"config\": \"%s\", "
+           "\"mmap_size\": %lld, \"cache_size\": %d, "
+           "\"store_bytes\": %lld, \"keys\": %llu, "
+           "\"ops_per_sec\": %.1f, ",
+           config.name, config.mmapSize, config.cacheSize, storeBytes,
+           static_cast<unsigned long long>(keys),
+           static_cast<double>(reads) / seconds);
+    latencies.writeJson(stdout);
+    printf("}\n");
+    fflush(stdout);
+}
+
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    try
+    {
+        const Args args(argc, argv);
+        const std::string db = args.str("db", "litestore_bench_cache.db");
+        const uint64_t keys = static_cast<uint64_t>(args.num("keys", 100000));
+        const size_t keySize = static_cast<size_t>(args.num("key-size", 16));
+        const size_t valueSize =
+            static_cast<size_t>(args.num("value-size", 512));
+
+        if (fileSize(db) == 0 || args.has("populate"))
+        {
+            litestore_opts opts = litestore_opts();
+            opts.error_callback = &printError;
+            opts.page_size = static_cast<int>(args.num("page-size", 0));
+            litestore* ctx = NULL;
+            if (litestore_open(db.c_str(), opts, &ctx) != LITESTORE_OK)
+            {
+                throw std::runtime_error("Failed to open " + db);
+            }
+            populate(ctx, keys, keySize, valueSize, 10000);
+            litestore_close(ctx);
+        }
+        const long long storeBytes = fileSize(db);
+
+        if (args.has("mmap-size") || args.has("cache-size"))
+        {
+            const Config custom = {
+                "custom", args.num("mmap-size", 0),
+                static_cast<int>(args.num("cache-size", 0))};
+            run(db, custom, args, keys, keySize, storeBytes);
+        }
+        else
+        {
+            const int storeKiB = static_cast<int>(storeBytes / 1024 + 1);
+            const Config configs[] = {
+                {"default", 0, 0},
+                {"mmap", storeBytes, 0},
+                {"cache", 0, -storeKiB},
+                {"mmap_small_cache", storeBytes, -2048}
+            };
+            for (size_t i = 0; i < sizeof(configs) / sizeof(configs[0]); ++i)
+            {
+                run(db, configs[i], args, keys, keySize, storeBytes);
+            }
+        }
+    }
+    catch (const std::exception& e)
+    {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,446 @@
+/**
+ * Copyright (c) 2014 Markku Linnoskivi
+ *
+ * See the file LICENSE.txt for copying permission.
+ *
+ * YCSB style workloads against the Litestore API.
+ *
+ * Workloads (as in YCSB core workloads):
+ *   A  50% read, 50% update
+ *   B  95% read, 5% update
+ *   C  100% read
+ *   D  95% read (latest keys), 5% insert
+ *   E  95% scan (read_keys with a key prefix), 5% insert
+ *   F  50% read, 50% read-modify-write
+ *
+ * Options:
+ *   --db FILE          Store file, recreated for each workload.
+ *   --workload X       One of A-F, or "all" (default).
+ *   --keys N           Keys loaded before running (default 100000).
+ *   --key-size N       Bytes per key (default 24).
+ *   --value-size N     Bytes per value (default 100).
+ *   --ops N            Operations per thread (default 100000).
+ *   --threads N        Threads, each with its own connection (default 1).
+ *   --distribution D   "zipfian" (default) or "uniform".
+ *   --scan-digits N    Key digits wildcarded in scans, 1 = 10 keys.
+ *   --busy-timeout MS  Lock wait for concurrent connections (default 5000).
+ *
+ * One JSON object per line is written for each workload.
+ */
+#include <atomic>
+#include <cmath>
+#include <exception>
+#include <mutex>
+#include <set>
+#include <thread>
+
+#include "bench_common.h"
+
+
+namespace
+{
+using namespace ls::bench;
+
+enum OpType
+{
+    READ = 0,
+    UPDATE,
+    INSERT,
+    SCAN,
+    READ_MODIFY_WRITE,
+    OP_TYPE_COUNT
+};
+
+const char* OP_NAMES[OP_TYPE_COUNT] = {
+    "read", "update", "insert", "scan", "read_modify_write"
+};
+
+struct Workload
+{
+    char name;
+    double read;
+    double update;
+    double insert;
+    double scan;
+    double readModifyWrite;
+    bool latest;  // reads prefer recently inserted keys
+};
+
+const Workload WORKLOADS[] = {
+    {'A', 0.50, 0.50, 0.00, 0.00, 0.00, false},
+    {'B', 0.95, 0.05, 0.00, 0.00, 0.00, false},
+    {'C', 1.00, 0.00, 0.00, 0.00, 0.00, false},
+    {'D', 0.95, 0.00, 0.05, 0.00, 0.00, true},
+    {'E', 0.00, 0.00, 0.05, 0.95, 0.00, false},
+    {'F', 0.50, 0.00, 0.00, 0.00, 0.50, false}
+};
+
+/**
+ * Zipfian generator over [0, n), Gray et al. "Quickly generating
+ * billion-record synthetic databases" as used by YCSB.
+ */
+class Zipfian
+{
+public:
+    explicit Zipfian(uint64_t n, double theta = 0.99)
+        : n_(n),
+          theta_(theta),
+          alpha_(1.0 / (1.0 - theta)),
+          zetan_(zeta(n, theta)),
+          eta_((1.0 - std::pow(2.0 / static_cast<double>(n), 1.0 - theta))
+               / (1.0 - zeta(2, theta) / zetan_))
+    {}
+    uint64_t next(std::mt19937_64& rng) const
+    {
+        const double u = std::uniform_real_distribution<double>(0, 1)(rng);
+        const double uz = u * zetan_;
+        if (uz < 1.0)
+        {
+            return 0;
+        }
+        if (uz < 1.0 + std::pow(0.5, theta_))
+        {
+            return 1;
+        }
+        const uint64_t v = static_cast<uint64_t>(
+            static_cast<double>(n_)
+            * std::pow(eta_ * u - eta_ + 1.0, alpha_));
+        return std::min(v, n_ - 1);
+    }
+
+private:
+    static double zeta(uint64_t n, double theta)
+    {
+        double sum = 0.0;
+        for (uint64_t i = 1; i <= n; ++i)
+        {
+            sum += 1.0 / std::pow(static_cast<double>(i), theta);
+        }
+        return sum;
+    }
+
+    uint64_t n_;
+    double theta_;
+    double alpha_;
+    double zetan_;
+    double eta_;
+};
+
+uint64_t fnv1a(uint64_t v)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for (int i = 0; i < 8; ++i)
+    {
+        h ^= (v >> (i * 8)) & 0xff;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+struct Config
+{
+    std::string db;
+    uint64_t keys;
+    size_t keySize;
+    size_t valueSize;
+    uint64_t ops;
+    unsigned threads;
+    bool zipfian;
+    int scanDigits;
+    int busyTimeout;
+};
+
+struct Shared
+{
+    Shared(const Config& config)
+        : zipf(config.keys),
+          inserted(config.keys),
+          acknowledged(config.keys),
+          errors(0)
+    {}
+    // Key i is done, acknowledged once all keys before it are done.
+    void acknowledge(uint64_t i)
+    {
+        std::lock_guard<std::mutex> lock(ackMutex);
+        done.insert(i);
+        uint64_t next = acknowledged.load();
+        while (!done.empty() && *done.begin() == next)
+        {
+            done.erase(done.begin());
+            ++next;
+        }
+        acknowledged.store(next);
+    }
+    Zipfian zipf;
+    std::atomic<uint64_t> inserted;  // next key to insert
+    // keys below are inserted, the latest reads pick from these
+    std::atomic<uint64_t> acknowledged;
+    std::mutex ackMutex;
+    std::set<uint64_t> done;  // inserted out of order, above acknowledged
+    std::atomic<uint64_t> errors;
+};
+
+struct ThreadResult
+{
+    Latencies latencies[OP_TYPE_COUNT];
+};
+
+uint64_t chooseKey(const Config& config, const Workload& w, Shared& shared,
+                   std::mt19937_64& rng)
+{
+    const uint64_t count = shared.acknowledged.load();
+    if (w.latest)
+    {
+        const uint64_t back = shared.zipf.next(rng);
+        return back < count ? count - 1 - back : 0;
+    }
+    if (config.zipfian)
+    {
+        // scrambled, so that the hot keys are spread over the key space
+        return fnv1a(shared.zipf.next(rng)) % config.keys;
+    }
+    return std::uniform_int_distribution<uint64_t>(0, config.keys - 1)(rng);
+}
+
+int countKey(litestore_slice_t key, int type, void* user_data)
+{
+    (void)key;
+    (void)type;
+    ++*static_cast<uint64_t*>(user_data);
+    return LITESTORE_OK;
+}
+
+int copyValue(litestore_blob_t value, void* user_data)
+{
+    static_cast<std::string*>(user_data)->assign(
+        static_cast<const char*>(value.data), value.size);
+    return LITESTORE_OK;
+}
+
+int runOp(litestore* ctx, OpType op, const Config& config, const Workload& w,
+          Shared& shared, std::mt19937_64& rng, const std::string& value)
+{
+    switch (op)
+    {
+        case READ:
+        {
+            const std::string key =
+                makeKey(chooseKey(config, w, shared, rng), config.keySize);
+            return litestore_read(ctx, slice(key), &ignoreValue, NULL);
+        }
+        case UPDATE:
+        {
+            const std::string key =
+                makeKey(chooseKey(config, w, shared, rng), config.keySize);
+            return litestore_update(ctx, slice(key), blob(value));
+        }
+        case INSERT:
+        {
+            const uint64_t i = shared.inserted.fetch_add(1);
+            const std::string key = makeKey(i, config.keySize);
+            const int rv = litestore_create(ctx, slice(key), blob(value));
+            // a failed insert is acknowledged too, not to stall the rest
+            shared.acknowledge(i);
+            return rv;
+        }
+        case SCAN:
+        {
+            std::string pattern =
+                makeKey(chooseKey(config, w, shared, rng), config.keySize);
+            // the numeric part of the key starts after 'k'
+            const size_t digits = static_cast<size_t>(config.scanDigits);
+            pattern.replace(21 - digits, digits, digits, '?');
+            uint64_t found = 0;
+            return litestore_read_keys(ctx, slice(pattern), &countKey, &found);
+        }
+        case READ_MODIFY_WRITE:
+        {
+            const std::string key =
+                makeKey(chooseKey(config, w, shared, rng), config.keySize);
+            std::string old;
+            int rv = litestore_begin_tx(ctx);
+            if (rv == LITESTORE_OK)
+            {
+                rv = litestore_read(ctx, slice(key), &copyValue, &old);
+                if (rv == LITESTORE_OK)
+                {
+                    old.replace(0, std::min(old.size(), value.size()), value);
+                    rv = litestore_update(ctx, slice(key), blob(old));
+                }
+                if (rv == LITESTORE_OK)
+                {
+                    rv = litestore_commit_tx(ctx);
+                }
+                else
+                {
+                    litestore_rollback_tx(ctx);
+                }
+            }
+            return rv;
+        }
+        case OP_TYPE_COUNT:
+        default:
+            break;
+    }
+    return LITESTORE_ERR;
+}
+
+OpType chooseOp(const Workload& w, std::mt19937_64& rng)
+{
+    double r = std::uniform_real_distribution<double>(0, 1)(rng);
+    const double weights[OP_TYPE_COUNT] = {
+        w.read, w.update, w.insert, w.scan, w.readModifyWrite
+    };
+    for (int i = 0; i < OP_TYPE_COUNT; ++i)
+    {
+        if (r < weights[i])
+        {
+            return static_cast<OpType>(i);
+        }
+        r -= weights[i];
+    }
+    return READ;
+}
+
+void runThread(unsigned id, const Config& config, const Workload& w,
+               Shared& shared, ThreadResult& result)
+{
+    litestore_opts opts = litestore_opts();
+    opts.error_callback = &printError;
+    opts.busy_timeout = config.busyTimeout;
+    litestore* ctx = NULL;
+    if (litestore_open(config.db.c_str(), opts, &ctx) != LITESTORE_OK)
+    {
+        shared.errors += config.ops;
+        return;
+    }
+
+    std::mt19937_64 rng(1000 + id);
+    const std::string value = makeValue(rng, config.valueSize);
+    for (uint64_t i = 0; i < config.ops; ++i)
+    {
+        const OpType op = chooseOp(w, rng);
+        const Clock::time_point begin = Clock::now();
+        if (runOp(ctx, op, config, w, shared, rng, value) == LITESTORE_OK)
+        {
+            result.latencies[op].add(elapsedNs(begin));
+        }
+        else
+        {
+            ++shared.errors;
+        }
+    }
+    litestore_close(ctx);
+}
+
+void runWorkload(const Config& config, const Workload& w)
+{
+    remove(config.db.c_str());
+    {
+        litestore_opts opts = litestore_opts();
+        opts.error_callback = &printError;
+        litestore* ctx = NULL;
+        if (litestore_open(config.db.c_str(), opts, &ctx) != LITESTORE_OK)
+        {
+            throw std::runtime_error("Failed to open " + config.db);
+        }
+        populate(ctx, config.keys, config.keySize, config.valueSize, 10000);
+        litestore_close(ctx);
+    }
+
+    Shared shared(config);
+    std::vector<ThreadResult> results(config.threads);
+    std::vector<std::thread> threads;
+
+    const Clock::time_point begin = Clock::now();
+    for (unsigned i = 0; i < config.threads; ++i)
+    {
+        threads.push_back(std::thread(&runThread, i, std::cref(config),
+                                      std::cref(w), std::ref(shared),
+                                      std::ref(results[i])));
+    }
+    for (size_t i = 0; i < threads.size(); ++i)
+    {
+        threads[i].join();
+    }
+    const double seconds = static_cast<double>(elapsedNs(begin)) / 1e9;
+
+    Latencies total[OP_TYPE_COUNT];
+    uint64_t done = 0;
+    for (size_t t = 0; t < results.size(); ++t)
+    {
+        for (int op = 0; op < OP_TYPE_COUNT; ++op)
+        {
+            total[op].merge(results[t].latencies[op]);
+        }
+    }
+    for (int op = 0; op < OP_TYPE_COUNT; ++op)
+    {
+        done += total[op].count();
+    }
+
+    printf("{\"bench\": \"ycsb\", \"workload\": \"%c\", \"threads\": %u, "
+           "\"keys\": %llu, \"key_size\": %zu, \"value_size\": %zu, "
+           "\"distribution\": \"%s\", \"ops\": %llu, \"errors\": %llu, "
+           "\"seconds\": %.3f, \"ops_per_sec\": %.1f, \"latency\": {",
+           w.name, config.threads,
+           static_cast<unsigned long long>(config.keys),
+           config.keySize, config.valueSize,
+           config.zipfian ? "zipfian" : "uniform",
+           static_cast<unsigned long long>(done),
+           static_cast<unsigned long long>(shared.errors.load()),
+           seconds, static_cast<double>(done) / seconds);
+    bool first = true;
+    for (int op = 0; op < OP_TYPE_COUNT; ++op)
+    {
+        if (total[op].count() > 0)
+        {
+            printf("%s\"%s\": {", first ? "" : ", ", OP_NAMES[op]);
+            total[op].writeJson(stdout);
+            printf("}");
+            first = false;
+        }
+    }
+    printf("}}\n");
+    fflush(stdout);
+}
+
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    try
+    {
+        const Args args(argc, argv);
+        Config config;
+        config.db = args.str("db", "litestore_bench.db");
+        config.keys = static_cast<uint64_t>(args.num("keys", 100000));
+        // 'k' + 20 digits is the minimum
+        config.keySize = std::max(static_cast<size_t>(args.num("key-size", 24)),
+                                  static_cast<size_t>(21));
+        config.valueSize = static_cast<size_t>(args.num("value-size", 100));
+        config.ops = static_cast<uint64_t>(args.num("ops", 100000));
+        config.threads = static_cast<unsigned>(args.num("threads", 1));
+        config.zipfian = args.str("distribution", "zipfian") != "uniform";
+        config.scanDigits = static_cast<int>(
+            std::min(std::max(args.num("scan-digits", 1), 1LL), 20LL));
+        config.busyTimeout = static_cast<int>(args.num("busy-timeout", 5000));
+        const std::string workload = args.str("workload", "all");
+
+        for (size_t i = 0; i < sizeof(WORKLOADS) / sizeof(WORKLOADS[0]); ++i)
+        {
+            if (workload == "all"
+                || (workload.size() == 1 && workload[0] == WORKLOADS[i].name))
+            {
+                runWorkload(config, WORKLOADS[i]);
+            }
+        }
+        remove(config.db.c_str());
+    }
+    catch (const std::exception& e)
+    {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
@@ -28,7 +28,8 @@ enum
     LITESTORE_OK = 0,
     LITESTORE_ERR = -1,
     LITESTORE_UNKNOWN_ENTITY = -2,
-    LITESTORE_UNSUPPORTED_VERSION = -3
+    LITESTORE_UNSUPPORTED_VERSION = -3,
+    LITESTORE_IN_PROGRESS = -4
 };
 
 /**
@@ -37,7 +38,12 @@ enum
 enum
 {
     LITESTORE_NULL_T = 0,
-    LITESTORE_RAW_T = 1
+    LITESTORE_RAW_T = 1,
+    LITESTORE_KV_T = 2,
+    LITESTORE_ARRAY_T = 3,
+    LITESTORE_INT_T = 4,
+    LITESTORE_FLOAT_T = 5,
+    LITESTORE_JSON_T = 6
 };
 
 /**
@@ -54,13 +60,230 @@ void* litestore_native_ctx(litestore* ctx);
  */
 typedef void (*litestore_error)(const int error, const char* desc,
                                 void* user_data);
+/**
+ * Information about an executed SQL statement.
+ */
+typedef struct
+{
+    const char* operation;  /* logical operation, e.g. "gen_read" */
+    const char* sql;  /* the statement */
+    long long elapsed_ns;  /* wall time of the execution */
+    int rows;  /* rows stepped */
+    int vm_steps;  /* virtual machine steps */
+    int sorts;  /* sort operations */
+    int fullscan_steps;  /* steps in full table scans */
+} litestore_trace_info;
+/**
+ * Callback called for each SQL statement executed.
+ *
+ * @param info The statement information, valid during the call.
+ * @param user_data
+ */
+typedef void (*litestore_trace_cb)(const litestore_trace_info* info,
+                                   void* user_data);
+/**
+ * Compression codec for values.
+ *
+ * The id is stored with each compressed value, so it must not change
+ * while stores written with it exist. Id 0 means no compression and
+ * LITESTORE_CODEC_LZ and LITESTORE_CODEC_LZ_DICT are the built-in codecs.
+ * litestore_open fails for user codecs with other ids or duplicate ids.
+ */
+typedef struct
+{
+    int id;  /* 3..255 for user codecs */
+    /* @return Max compressed size of size bytes. */
+    size_t (*bound)(size_t size, void* user_data);
+    /* @return LITESTORE_OK, dst_size set to the compressed size. */
+    int (*compress)(const void* src, size_t src_size,
+                    void* dst, size_t dst_cap, size_t* dst_size,
+                    void* user_data);
+    /* @return LITESTORE_OK if exactly dst_size bytes were produced. */
+    int (*decompress)(const void* src, size_t src_size,
+                      void* dst, size_t dst_size,
+                      void* user_data);
+    void* user_data;  /* passed to the functions */
+} litestore_codec;
+/**
+ * Built-in codec ids.
+ */
+enum
+{
+    LITESTORE_CODEC_NONE = 0,
+    LITESTORE_CODEC_LZ = 1,  /* fast LZ77, byte oriented */
+    LITESTORE_CODEC_LZ_DICT = 2  /* LZ with a trained dictionary */
+};
+/**
+ * Merge operator, folds operands recorded with litestore_merge into
+ * a raw value.
+ *
+ * The id is stored with each operand, so it must not change while stores
+ * written with it exist. LITESTORE_MERGE_APPEND and LITESTORE_MERGE_ADD
+ * are the built-in operators.
+ */
+typedef struct
+{
+    int id;  /* 3..255 for user operators */
+    /* @return Max size of the merged value. */
+    size_t (*bound)(litestore_blob_t value,
+                    const litestore_blob_t* operands, size_t count,
+                    void* user_data);
+    /* Fold the operands (oldest first) into value, which is empty if the
+       key was created by a merge.
+       @return LITESTORE_OK, dst_size set to the size of the result. */
+    int (*merge)(litestore_blob_t value,
+                 const litestore_blob_t* operands, size_t count,
+                 void* dst, size_t dst_cap, size_t* dst_size,
+                 void* user_data);
+    void* user_data;  /* passed to the functions */
+} litestore_merge_operator;
+/**
+ * Built-in merge operator ids.
+ */
+enum
+{
+    LITESTORE_MERGE_APPEND = 1,  /* concatenate the operands */
+    /* 8 byte little endian integers, the sum wraps around */
+    LITESTORE_MERGE_ADD = 2
+};
+/**
+ * Adds a term to the secondary index of a value, @see litestore_index.
+ *
+ * @param term The term, not empty.
+ * @param terms As given to litestore_index.extract.
+ * @return LITESTORE_OK on success, LITESTORE_ERR otherwise.
+ */
+typedef int (*litestore_index_term_fn)(litestore_blob_t term, void* terms);
+/**
+ * Secondary index over raw values.
+ *
+ * The terms of a value are extracted on create and update, and kept in
+ * an index along with the key, within the same transaction. Terms are
+ * ordered with memcmp, @see litestore_key_int for encoding them.
+ */
+typedef struct
+{
+    int id;  /* stored with the terms, must not change */
+    /* Call add_term for each term of value.
+       @return LITESTORE_OK, otherwise the write fails. */
+    int (*extract)(litestore_blob_t value,
+                   litestore_index_term_fn add_term, void* terms,
+                   void* user_data);
+    void* user_data;  /* passed to extract */
+} litestore_index;
+/**
+ * Memory allocation hooks.
+ *
+ * Replaces the heap used by SQLite (sqlite3_config(SQLITE_CONFIG_MALLOC))
+ * and by Litestore for the context object.
+ * The hooks are process wide and must be thread safe if connections are
+ * used from multiple threads.
+ * Memory returned by malloc_fn and realloc_fn must be 8 byte aligned.
+ */
+typedef struct
+{
+    void* (*malloc_fn)(size_t size, void* user_data);
+    void* (*realloc_fn)(void* ptr, size_t size, void* user_data);
+    void (*free_fn)(void* ptr, void* user_data);
+    void* user_data;  /* passed to the hooks */
+} litestore_allocator;
 /**
  * Structure used to pass data to open.
+ *
+ * Zero initialize the structure, all zero fields mean defaults.
+ *
+ * Process wide memory options (allocator, page_cache* and enabling
+ * hard_heap_limit) configure SQLite itself and can only be applied before
+ * SQLite is initialized, I.E. they must be given on the first
+ * litestore_open of the process (or after litestore_shutdown).
+ * Later opens may repeat the same values, other values make open fail.
+ *
+ * Memory budget:
+ * soft_heap_limit makes SQLite recycle page cache before the process heap
+ * grows past the limit, so reads fall back to I/O.
+ * hard_heap_limit fails allocations (LITESTORE_ERR) past the limit.
+ * memory_budget bounds a single connection, it sizes the page cache
+ * (unless cache_size is given) and releases cache memory at the end of
+ * a transaction when the connection is over budget.
+ *
+ * With mmap_size set, reads are served straight from the OS page cache
+ * instead of being copied to SQLite's own page cache first.
+ * @see http://www.sqlite.org/pragma.html
+ *
+ * busy_timeout is needed when multiple connections write to the same
+ * store, without it a call fails immediately if another connection
+ * holds the lock.
+ *
+ * Values are compressed with the codec given in compression (or later
+ * with litestore_set_compression), values smaller than compress_min_size
+ * (default 64 bytes) or not compressing well are stored as is. Reads
+ * decompress transparently with the codec the value was written with,
+ * so all the codecs used in a store must be available (codecs).
+ *
+ * With dedup set, raw values of 64 bytes or more are stored once by
+ * content (SHA-256) and shared by all the keys holding the same value.
+ * Shared values are reference counted and removed with the last key.
+ * Stores with shared values can be opened without dedup, later writes are
+ * then stored per key.
+ *
+ * Raw values of value_log_threshold bytes or more (after compression)
+ * are appended to value log files <store>-vlog.<n> next to the store,
+ * only their location is kept in the store. This keeps the store small
+ * and the page cache for keys. The files are a part of the store: copy
+ * them along with the store file (litestore_backup_step does not).
+ * Space of overwritten values is reclaimed with litestore_vlog_gc_step.
+ *
+ * merge_operators are the user operators for litestore_merge, all the
+ * operators used in a store must be available.
+ *
+ * indexes are the secondary indexes of the store, all of them must be
+ * given so that they are kept up to date.
+ *
+ * Lookaside is a per connection slab allocator for small allocations.
+ * Litestore allocates the slab along with the context so it costs no
+ * extra allocations, and SQLite serves most of its small, short lived
+ * allocations (statement execution) from it instead of the global heap.
  */
 typedef struct
 {
     litestore_error error_callback; /* called on internal (sql) errors */
     void* err_user_data;  /* passed to error_callback */
+    /* process wide memory */
+    const litestore_allocator* allocator;  /* NULL for system malloc */
+    void* page_cache;  /* page cache buffer, NULL for none */
+    int page_cache_slot_size;  /* page size + header, 8 byte multiple */
+    int page_cache_slots;  /* number of slots in page_cache */
+    long long soft_heap_limit;  /* bytes, 0 for no limit */
+    long long hard_heap_limit;  /* bytes, 0 for no limit */
+    /* per connection memory */
+    int lookaside_slot_size;  /* 0 for SQLite default, 8 byte multiple */
+    int lookaside_slots;  /* 0 for SQLite default */
+    long long memory_budget;  /* bytes, 0 for no budget */
+    /* page cache and I/O, 0 for SQLite defaults */
+    long long mmap_size;  /* bytes of the store read through mmap */
+    int cache_size;  /* pages if positive, KiB if negative */
+    int page_size;  /* power of two 512 - 65536, only for new stores */
+    /* concurrency */
+    int busy_timeout;  /* ms to wait for locks held by other connections */
+    /* profiling, NULL for no tracing */
+    litestore_trace_cb trace_callback;  /* called for each statement */
+    void* trace_user_data;  /* passed to trace_callback */
+    /* compression */
+    const litestore_codec* codecs;  /* user codecs, NULL for none */
+    int codec_count;  /* number of codecs */
+    int compression;  /* codec id for writes, 0 for none */
+    int compress_min_size;  /* bytes, 0 for default */
+    /* deduplication */
+    int dedup;  /* store equal values once (boolean) */
+    /* value log, not for ":memory:" stores */
+    int value_log_threshold;  /* bytes, 0 for no value log */
+    long long value_log_segment_size;  /* bytes per file, 0 for 64MB */
+    /* merge */
+    const litestore_merge_operator* merge_operators;  /* NULL for none */
+    int merge_operator_count;  /* number of merge_operators */
+    /* secondary indexes */
+    const litestore_index* indexes;  /* NULL for none */
+    int index_count;  /* number of indexes */
 } litestore_opts;
 /**
  * Open a connection to the store in db_file_name.
@@ -85,6 +308,208 @@ int litestore_open(const char* file_name,
  * @param ctx The context allocated by litestore_open.
  */
 void litestore_close(litestore* ctx);
+/**
+ * Release process wide resources.
+ *
+ * All connections must be closed. Process wide options can be given
+ * again on the next open.
+ *
+ * @return LITESTORE_OK on success,
+ *         LITESTORE_ERR otherwise.
+ */
+int litestore_shutdown(void);
+/**
+ * Memory usage, @see litestore_memory_usage.
+ */
+typedef struct
+{
+    /* process wide */
+    long long process_used;  /* bytes currently allocated by SQLite */
+    long long process_highwater;  /* max. of process_used */
+    long long soft_heap_limit;
+    long long hard_heap_limit;
+    /* the connection */
+    long long cache_used;  /* page cache */
+    long long schema_used;
+    long long stmt_used;  /* prepared statements */
+    long long memory_budget;
+    long long budget_releases;  /* times cache was released for budget */
+} litestore_memory_t;
+/**
+ * Report current memory usage.
+ *
+ * @param ctx
+ * @param usage Filled with the usage.
+ * @return LITESTORE_OK on success,
+ *         LITESTORE_ERR otherwise.
+ */
+int litestore_memory_usage(litestore* ctx, litestore_memory_t* usage);
+/**
+ * Operations measured in litestore_stats_t.
+ * The _null variants are counted with their raw counterparts.
+ */
+enum
+{
+    LITESTORE_OP_CREATE = 0,
+    LITESTORE_OP_READ,
+    LITESTORE_OP_UPDATE,
+    LITESTORE_OP_DELETE,
+    LITESTORE_OP_READ_KEYS,
+    LITESTORE_OP_BEGIN_TX,
+    LITESTORE_OP_COMMIT_TX,
+    LITESTORE_OP_ROLLBACK_TX,
+    LITESTORE_OP_EXPORT,
+    LITESTORE_OP_IMPORT,
+    LITESTORE_OP_COUNT
+};
+
+/**
+ * Number of buckets in litestore_histogram_t.
+ * Values below 8 ns have a bucket each, after that each power of two is
+ * split in 8 buckets (max. 12.5% error). The last bucket holds values
+ * of 2^39 ns (~9 min) and above.
+ */
+#define LITESTORE_HISTOGRAM_BUCKETS 304
+
+/**
+ * Latency histogram, in nanoseconds.
+ */
+typedef struct
+{
+    long long count;
+    long long total_ns;
+    long long max_ns;
+    long long buckets[LITESTORE_HISTOGRAM_BUCKETS];
+} litestore_histogram_t;
+
+/**
+ * Latencies of the API calls, indexed with LITESTORE_OP_*.
+ * Only calls made by the user are measured, implicit transactions are
+ * part of the operation that created them.
+ *
+ * The time an operation waited for locks held by other connections
+ * (@see litestore_opts.busy_timeout) is separated from the time spent
+ * executing it.
+ */
+typedef struct
+{
+    litestore_histogram_t exec[LITESTORE_OP_COUNT];
+    litestore_histogram_t lock_wait[LITESTORE_OP_COUNT];
+} litestore_stats_t;
+
+/**
+ * Copy the statistics collected since open (or last reset).
+ * Collecting statistics allocates nothing.
+ *
+ * @param ctx
+ * @param stats Filled with the statistics.
+ * @return LITESTORE_OK on success,
+ *         LITESTORE_ERR otherwise.
+ */
+int litestore_stats_get(litestore* ctx, litestore_stats_t* stats);
+/**
+ * Reset the statistics, including the I/O counters.
+ *
+ * @param ctx
+ * @return LITESTORE_OK on success,
+ *         LITESTORE_ERR otherwise.
+ */
+int litestore_stats_reset(litestore* ctx);
+/**
+ * Value at the given percentile of the histogram.
+ *
+ * @param h The histogram.
+ * @param percentile In range [0, 100].
+ * @return Upper bound of the bucket the percentile falls in (ns),
+ *         0 for an empty histogram.
+ */
+long long litestore_histogram_percentile(const litestore_histogram_t* h,
+                                         const double percentile);
+/**
+ * Page cache counters of the connection.
+ */
+typedef struct
+{
+    long long cache_hit;
+    long long cache_miss;
+    long long cache_write;  /* pages written to the database file */
+    long long cache_spill;  /* dirty pages spilled before commit,
+                               0 with SQLite older than 3.23 */
+} litestore_io_counters_t;
+/**
+ * I/O statistics of the connection, collected with sqlite3_db_status.
+ */
+typedef struct
+{
+    litestore_io_counters_t total;  /* since open (or last reset) */
+    /* part of total done by the API calls, indexed with LITESTORE_OP_* */
+    litestore_io_counters_t ops[LITESTORE_OP_COUNT];
+    /* lookaside, @see litestore_opts.lookaside_slots */
+    long long lookaside_used;
+    long long lookaside_highwater;
+    long long lookaside_hit;
+    long long lookaside_miss_size;
+    long long lookaside_miss_full;
+    /* memory of the connection, bytes */
+    long long cache_used;
+    long long schema_used;
+    long long stmt_used;
+    long long wal_size;  /* size of the -wal file, 0 when not in WAL mode */
+} litestore_io_stats_t;
+/**
+ * Get the I/O statistics of the connection.
+ * The counters are reset with litestore_stats_reset().
+ *
+ * @param ctx
+ * @param stats Filled with the statistics.
+ * @return LITESTORE_OK on success,
+ *         LITESTORE_ERR otherwise.
+ */
+int litestore_io_stats(litestore* ctx, litestore_io_stats_t* stats);
+/**
+ * Set the codec used for the following writes, e.g. for writing
+ * incompressible values as is.
+ *
+ * @param ctx
+ * @param codec_id LITESTORE_CODEC_* or a user codec id.
+ * @return LITESTORE_OK on success,
+ *         LITESTORE_ERR if the codec is unknown.
+ */
+int litestore_set_compression(litestore* ctx, const int codec_id);
+/**
+ * Train a compression dictionary from a random sample of the stored
+ * values, for LITESTORE_CODEC_LZ_DICT.
+ *
+ * Small values share structure (field names, common prefixes) that plain
+ * LZ can not find within a single value, matches against the dictionary
+ * can. The dictionary is stored in the store, the new one is used for the
+ * following writes, values written with older ones stay readable (see
+ * litestore_reencode_step). Can not be called inside a transaction.
+ *
+ * @param ctx
+ * @param samples Number of values sampled.
+ * @param dict_size Dictionary size in bytes, 256..32768.
+ * @return LITESTORE_OK on success,
+ *         LITESTORE_ERR otherwise, e.g. if the store is empty.
+ */
+int litestore_dict_train(litestore* ctx,
+                         const int samples,
+                         const int dict_size);
+/**
+ * Rewrite stored values with the current codec and dictionary, count
+ * values at a time.
+ *
+ * Call repeatedly while LITESTORE_IN_PROGRESS is returned, e.g. after
+ * litestore_dict_train or litestore_set_compression. Values already
+ * stored with the current codec are skipped.
+ *
+ * @param ctx
+ * @param count Values checked per call.
+ * @return LITESTORE_OK when all values are done,
+ *         LITESTORE_IN_PROGRESS if more calls are needed,
+ *         LITESTORE_ERR otherwise.
+ */
+int litestore_reencode_step(litestore* ctx, const int count);
 /**
  * Begin transaction.
  *
@@ -114,6 +539,76 @@ int litestore_commit_tx(litestore* ctx);
  * @ctx The context allocated by litestore_open.
  */
 int litestore_rollback_tx(litestore* ctx);
+/**
+ * Change events, @see litestore_watch
+ */
+enum
+{
+    LITESTORE_CREATED = 1,
+    LITESTORE_UPDATED = 2,
+    LITESTORE_DELETED = 3
+};
+/**
+ * A key changed by a transaction, the last change of the key in it.
+ * A key created and updated is LITESTORE_CREATED, a key deleted and
+ * created again is LITESTORE_UPDATED, a key created and deleted is not
+ * reported.
+ */
+typedef struct
+{
+    const char* key;
+    size_t key_length;
+    int event;  /* LITESTORE_CREATED, _UPDATED or _DELETED */
+} litestore_change_t;
+/**
+ * Callback for the changes of a committed transaction.
+ *
+ * @param changes The changed keys in ascending (memcmp) order, valid
+ *                during the call.
+ * @param count Number of changes.
+ * @param user_data
+ */
+typedef void (*litestore_watch_cb)(const litestore_change_t* changes,
+                                   size_t count,
+                                   void* user_data);
+/**
+ * Watch the keys with a prefix for changes made through this context.
+ *
+ * After each transaction that changed such keys is committed, the
+ * callback is called once with all of them, a write outside a
+ * transaction before it returns. Changes that are rolled
+ * back are never reported. Keys expire unnoticed until purged, and
+ * maintenance steps (e.g. litestore_reencode_step) that keep the values
+ * are not reported.
+ * Namespaces are not watched.
+ * The callback may use the store, but not (un)watch.
+ * Not allowed within a transaction.
+ *
+ * @param ctx
+ * @param prefix The key prefix, empty for all keys.
+ * @param callback The callback.
+ * @param user_data User provided data passed to the callback.
+ * @return LITESTORE_OK on success,
+ *         LITESTORE_ERR otherwise.
+ */
+int litestore_watch(litestore* ctx,
+                    litestore_slice_t prefix,
+                    litestore_watch_cb callback,
+                    void* user_data);
+/**
+ * Stop the watches with the callback and user_data.
+ * Not allowed within a transaction.
+ *
+ * @param ctx
+ * @param callback The callback.
+ * @param user_data The user data given to litestore_watch.
+ * @return LITESTORE_OK on success,
+ *         LITESTORE_UNKNOWN_ENTITY if there was no such watch,
+ *         LITESTORE_ERR otherwise.
+ */
+int litestore_unwatch(litestore* ctx,
+                      litestore_watch_cb callback,
+                      void* user_data);
 /**
  * Create 'null' value int the store.
  * Inserts the given key in the store.
@@ -201,6 +696,36 @@ int litestore_read(litestore* ctx,
 int litestore_update(litestore* ctx,
                      litestore_slice_t key,
                      litestore_blob_t value);
+/**
+ * Record a merge operand for a 'raw' value, without reading the value.
+ * The operands are folded into the value by the operator on read, and
+ * written to it by litestore_merge_compact_step or the next update.
+ * If the key does not exist, it will be created with an empty value.
+ *
+ * @param ctx
+ * @param key The key.
+ * @param operator_id LITESTORE_MERGE_* or a user operator id.
+ * @param operand The operand, may be empty but not NULL.
+ * @return LITESTORE_OK on success,
+ *         LITESTORE_ERR otherwise (e.g. not 'raw' or unknown operator).
+ */
+int litestore_merge(litestore* ctx,
+                    litestore_slice_t key,
+                    const int operator_id,
+                    litestore_blob_t operand);
+/**
+ * Fold the merge operands of count values into the stored values.
+ *
+ * Call repeatedly while LITESTORE_IN_PROGRESS is returned, e.g. when idle.
+ * Values that merge to an empty value keep their operands.
+ *
+ * @param ctx
+ * @param count Values compacted per call.
+ * @return LITESTORE_OK when all values are done,
+ *         LITESTORE_IN_PROGRESS if more calls are needed,
+ *         LITESTORE_ERR otherwise.
+ */
+int litestore_merge_compact_step(litestore* ctx, const int count);
 /**
  * Delete the given entry from the store.
  * Deletes all types.
@@ -212,6 +737,48 @@ int litestore_update(litestore* ctx,
  *         LITESTORE_ERR on other error.
  */
 int litestore_delete(litestore* ctx, litestore_slice_t key);
+/**
+ * Set the time a key expires at. An expired key is unknown to reads and
+ * can be created again, it is deleted by litestore_expire_step.
+ * The expiry time is kept over updates of the value.
+ *
+ * @param ctx
+ * @param key The key.
+ * @param expires_at Seconds since the epoch, 0 to never expire.
+ * @return LITESTORE_OK on success,
+ *         LITESTORE_UNKNOWN_ENTITY if the key does not exist,
+ *         LITESTORE_ERR otherwise.
+ */
+int litestore_expire(litestore* ctx,
+                     litestore_slice_t key,
+                     const long long expires_at);
+/**
+ * Read the time a key expires at.
+ *
+ * @param ctx
+ * @param key The key.
+ * @param expires_at Seconds since the epoch, 0 if the key never expires.
+ * @return LITESTORE_OK on success,
+ *         LITESTORE_UNKNOWN_ENTITY if the key does not exist,
+ *         LITESTORE_ERR otherwise.
+ */
+int litestore_expires_at(litestore* ctx,
+                         litestore_slice_t key,
+                         long long* expires_at);
+/**
+ * Delete up to count expired keys, oldest expiry first, in a transaction
+ * of its own (unless one is active).
+ *
+ * Call repeatedly while LITESTORE_IN_PROGRESS is returned, e.g. from a
+ * timer. Small counts keep the write lock short.
+ *
+ * @param ctx
+ * @param count Keys deleted per call.
+ * @return LITESTORE_OK when no expired keys are left,
+ *         LITESTORE_IN_PROGRESS if more calls are needed,
+ *         LITESTORE_ERR otherwise.
+ */
+int litestore_expire_step(litestore* ctx, const int count);
 /**
  * Callback used with read_keys.
  *
@@ -241,6 +808,765 @@ int litestore_read_keys(litestore* ctx,
                         litestore_slice_t key_pattern,
                         litestore_read_keys_cb callback,
                         void* user_data);
+/**
+ * Read the keys in [first, last) in ascending (memcmp) order.
+ * With composite keys (@see litestore_key_int) a range covers exactly
+ * the tuples in it, litestore_key_prefix_end gives the end of a prefix.
+ * Stops if the callback returns other than LITESTORE_OK.
+ *
+ * @param ctx
+ * @param first The first key.
+ * @param last The key after the range, an empty slice for no end.
+ * @param callback A callback called for each key.
+ * @param user_data User provided data passed to the callback.
+ * @return LITESTORE_OK on success,
+ *         LITESTORE_ERR otherwise.
+ */
+int litestore_read_key_range(litestore* ctx,
+                             litestore_slice_t first,
+                             litestore_slice_t last,
+                             litestore_read_keys_cb callback,
+                             void* user_data);
+/**
+ * Read the keys with the given term in a secondary index, in the order
+ * the keys were created. Stops if the callback returns other than
+ * LITESTORE_OK.
+ *
+ * @param ctx
+ * @param index_id The id of the index.
+ * @param term The term.
+ * @param callback A callback called for each key.
+ * @param user_data User provided data passed to the callback.
+ * @return LITESTORE_OK on success,
+ *         LITESTORE_ERR otherwise.
+ */
+int litestore_index_find(litestore* ctx,
+                         const int index_id,
+                         litestore_blob_t term,
+                         litestore_read_keys_cb callback,
+                         void* user_data);
+/**
+ * Read the keys with terms in [first, last) in a secondary index, in
+ * term order.
+ *
+ * @param ctx
+ * @param index_id The id of the index.
+ * @param first The first term, empty for the first of the index.
+ * @param last The term after the range, empty for no end.
+ * @param callback A callback called for each key.
+ * @param user_data User provided data passed to the callback.
+ * @return LITESTORE_OK on success,
+ *         LITESTORE_ERR otherwise.
+ */
+int litestore_index_range(litestore* ctx,
+                          const int index_id,
+                          litestore_blob_t first,
+                          litestore_blob_t last,
+                          litestore_read_keys_cb callback,
+                          void* user_data);
+/**
+ * Extract the terms of count raw values again, e.g. after an index was
+ * added or its extractor changed.
+ * Merge operands are indexed when compacted (or the value updated).
+ *
+ * Call repeatedly while LITESTORE_IN_PROGRESS is returned.
+ *
+ * @param ctx
+ * @param count Values indexed per call.
+ * @return LITESTORE_OK when all values are done,
+ *         LITESTORE_IN_PROGRESS if more calls are needed,
+ *         LITESTORE_ERR otherwise.
+ */
+int litestore_index_build_step(litestore* ctx, const int count);
+/**
+ * Create an empty map ('kv') object.
+ * Will fail if key exists.
+ *
+ * @param ctx
+ * @param key The key.
+ * @return LITESTORE_OK on success,
+ *         LITESTORE_ERR otherwise.
+ */
+int litestore_create_kv(litestore* ctx, litestore_slice_t key);
+/**
+ * Set a field of a map, only the field is written.
+ * If the key does not exist, a map will be created.
+ * If the old type is other than 'kv' the data will be deleted.
+ *
+ * @param ctx
+ * @param key The key.
+ * @param field The field, compared as bytes.
+ * @param value The value, may be empty but not NULL.
+ * @return LITESTORE_OK on success,
+ *         LITESTORE_ERR otherwise.
+ */
+int litestore_kv_set(litestore* ctx,
+                     litestore_slice_t key,
+                     litestore_slice_t field,
+                     litestore_blob_t value);
+/**
+ * Read a field of a map.
+ *
+ * @param ctx
+ * @param key The key.
+ * @param field The field.
+ * @param callback A callback that will be called for the value.
+ * @param user_data User provided data passed to the callback.
+ * @return LITESTORE_OK on success,
+ *         LITESTORE_UNKNOWN_ENTITY if the field is not found,
+ *         Callback return if other than LITESTORE_OK,
+ *         LITESTORE_ERR otherwise (e.g. key not found or not a map).
+ */
+int litestore_kv_get(litestore* ctx,
+                     litestore_slice_t key,
+                     litestore_slice_t field,
+                     litestore_read_cb callback,
+                     void* user_data);
+/**
+ * Delete a field of a map. The map itself is kept, even if empty.
+ *
+ * @param ctx
+ * @param key The key.
+ * @param field The field.
+ * @return LITESTORE_OK on success,
+ *         LITESTORE_UNKNOWN_ENTITY if the key or field is not found,
+ *         LITESTORE_ERR otherwise.
+ */
+int litestore_kv_delete(litestore* ctx,
+                        litestore_slice_t key,
+                        litestore_slice_t field);
+/**
+ * Callback used with kv_iterate.
+ *
+ * @param field The field.
+ * @param value The value of the field.
+ * @param user_data The user provided data.
+ * @return LITESTORE_OK to continue, anything else stops the iteration.
+ */
+typedef int (*litestore_kv_cb)(litestore_slice_t field,
+                               litestore_blob_t value,
+                               void* user_data);
+/**
+ * Iterate the fields of a map, in ascending (memcmp) order of the fields.
+ *
+ * @param ctx
+ * @param key The key.
+ * @param callback A callback called for each field.
+ * @param user_data User provided data passed to the callback.
+ * @return LITESTORE_OK on success,
+ *         Callback return if other than LITESTORE_OK,
+ *         LITESTORE_ERR otherwise.
+ */
+int litestore_kv_iterate(litestore* ctx,
+                         litestore_slice_t key,
+                         litestore_kv_cb callback,
+                         void* user_data);
+/**
+ * Create an empty array object.
+ * Will fail if key exists.
+ *
+ * @param ctx
+ * @param key The key.
+ * @return LITESTORE_OK on success,
+ *         LITESTORE_ERR otherwise.
+ */
+int litestore_create_array(litestore* ctx, litestore_slice_t key);
+/**
+ * Append a value to the end of an array, only the new item is written.
+ * If the key does not exist, an array will be created.
+ * If the old type is other than 'array' the data will be deleted.
+ *
+ * @param ctx
+ * @param key The key.
+ * @param value The value, may be empty but not NULL.
+ * @param index The index of the new item (out), may be NULL.
+ * @return LITESTORE_OK on success,
+ *         LITESTORE_ERR otherwise.
+ */
+int litestore_array_append(litestore* ctx,
+                           litestore_slice_t key,
+                           litestore_blob_t value,
+                           size_t* index);
+/**
+ * Read an item of an array.
+ *
+ * @param ctx
+ * @param key The key.
+ * @param index The index of the item, from 0.
+ * @param callback A callback that will be called for the value.
+ * @param user_data User provided data passed to the callback.
+ * @return LITESTORE_OK on success,
+ *         LITESTORE_UNKNOWN_ENTITY if the index is out of range,
+ *         Callback return if other than LITESTORE_OK,
+ *         LITESTORE_ERR otherwise (e.g. key not found or not an array).
+ */
+int litestore_array_get(litestore* ctx,
+                        litestore_slice_t key,
+                        const size_t index,
+                        litestore_read_cb callback,
+                        void* user_data);
+/**
+ * Replace an existing item of an array.
+ *
+ * @param ctx
+ * @param key The key.
+ * @param index The index of the item, from 0.
+ * @param value The value, may be empty but not NULL.
+ * @return LITESTORE_OK on success,
+ *         LITESTORE_UNKNOWN_ENTITY if the key is not found or
+ *         the index is out of range,
+ *         LITESTORE_ERR otherwise.
+ */
+int litestore_array_set(litestore* ctx,
+                        litestore_slice_t key,
+                        const size_t index,
+                        litestore_blob_t value);
+/**
+ * Callback used with array_range.
+ *
+ * @param index The index of the item.
+ * @param value The value of the item.
+ * @param user_data The user provided data.
+ * @return LITESTORE_OK to continue, anything else stops the iteration.
+ */
+typedef int (*litestore_array_cb)(size_t index,
+                                  litestore_blob_t value,
+                                  void* user_data);
+/**
+ * Read a range of items of an array, in order.
+ * The range may extend past the end of the array.
+ *
+ * @param ctx
+ * @param key The key.
+ * @param first The index of the first item.
+ * @param count Max. number of items, (size_t)-1 for all.
+ * @param callback A callback called for each item.
+ * @param user_data User provided data passed to the callback.
+ * @return LITESTORE_OK on success,
+ *         Callback return if other than LITESTORE_OK,
+ *         LITESTORE_ERR otherwise.
+ */
+int litestore_array_range(litestore* ctx,
+                          litestore_slice_t key,
+                          const size_t first,
+                          const size_t count,
+                          litestore_array_cb callback,
+                          void* user_data);
+/**
+ * Remove the items of an array from the given length on.
+ * Nothing is removed if the array is already shorter.
+ *
+ * @param ctx
+ * @param key The key.
+ * @param length The new length.
+ * @return LITESTORE_OK on success,
+ *         LITESTORE_UNKNOWN_ENTITY if the key is not found,
+ *         LITESTORE_ERR otherwise.
+ */
+int litestore_array_truncate(litestore* ctx,
+                             litestore_slice_t key,
+                             const size_t length);
+/**
+ * Get the number of items of an array.
+ *
+ * @param ctx
+ * @param key The key.
+ * @param length The length (out).
+ * @return LITESTORE_OK on success,
+ *         LITESTORE_ERR otherwise.
+ */
+int litestore_array_length(litestore* ctx,
+                           litestore_slice_t key,
+                           size_t* length);
+/**
+ * Create an integer object.
+ * Will fail if key exists.
+ *
+ * @param ctx
+ * @param key The key.
+ * @param value The value.
+ * @return LITESTORE_OK on success,
+ *         LITESTORE_ERR otherwise.
+ */
+int litestore_create_int(litestore* ctx,
+                         litestore_slice_t key,
+                         const long long value);
+/**
+ * Read an integer object.
+ *
+ * @param ctx
+ * @param key The key.
+ * @param value The value (out).
+ * @return LITESTORE_OK on success,
+ *         LITESTORE_ERR otherwise (e.g. key not found or not an int).
+ */
+int litestore_read_int(litestore* ctx,
+                       litestore_slice_t key,
+                       long long* value);
+/**
+ * Update an object to an integer.
+ * If the key does not exist, it will be created.
+ * If the old type is other than 'int' or 'float' the data will be deleted.
+ *
+ * @param ctx
+ * @param key The key.
+ * @param value The value.
+ * @return LITESTORE_OK on success,
+ *         LITESTORE_ERR otherwise.
+ */
+int litestore_update_int(litestore* ctx,
+                         litestore_slice_t key,
+                         const long long value);
+/**
+ * Add to an integer, atomically within the store.
+ * An existing integer is updated with a single statement.
+ * If the key does not exist, it will be created with the value delta.
+ *
+ * @param ctx
+ * @param key The key.
+ * @param delta The value to add, may be negative.
+ * @param new_value The value after the addition (out), may be NULL.
+ * @return LITESTORE_OK on success,
+ *         LITESTORE_ERR otherwise (e.g. not an int or on overflow).
+ */
+int litestore_incr(litestore* ctx,
+                   litestore_slice_t key,
+                   const long long delta,
+                   long long* new_value);
+/**
+ * Create a float object.
+ * Will fail if key exists.
+ *
+ * @param ctx
+ * @param key The key.
+ * @param value The value, not NaN.
+ * @return LITESTORE_OK on success,
+ *         LITESTORE_ERR otherwise.
+ */
+int litestore_create_float(litestore* ctx,
+                           litestore_slice_t key,
+                           const double value);
+/**
+ * Read a float object.
+ *
+ * @param ctx
+ * @param key The key.
+ * @param value The value (out).
+ * @return LITESTORE_OK on success,
+ *         LITESTORE_ERR otherwise (e.g. key not found or not a float).
+ */
+int litestore_read_float(litestore* ctx,
+                         litestore_slice_t key,
+                         double* value);
+/**
+ * Update an object to a float.
+ * If the key does not exist, it will be created.
+ * If the old type is other than 'int' or 'float' the data will be deleted.
+ *
+ * @param ctx
+ * @param key The key.
+ * @param value The value, not NaN.
+ * @return LITESTORE_OK on success,
+ *         LITESTORE_ERR otherwise.
+ */
+int litestore_update_float(litestore* ctx,
+                           litestore_slice_t key,
+                           const double value);
+/**
+ * Add to a float, atomically within the store.
+ * @see litestore_incr
+ *
+ * @param ctx
+ * @param key The key.
+ * @param delta The value to add, may be negative.
+ * @param new_value The value after the addition (out), may be NULL.
+ * @return LITESTORE_OK on success,
+ *         LITESTORE_ERR otherwise (e.g. not a float or the result is NaN).
+ */
+int litestore_incr_float(litestore* ctx,
+                         litestore_slice_t key,
+                         const double delta,
+                         double* new_value);
+/**
+ * Create a JSON object. The document is validated and stored minified.
+ * Will fail if key exists.
+ *
+ * @param ctx
+ * @param key The key.
+ * @param doc The document, UTF-8 JSON text.
+ * @return LITESTORE_OK on success,
+ *         LITESTORE_ERR otherwise (e.g. malformed JSON).
+ */
+int litestore_create_json(litestore* ctx,
+                          litestore_slice_t key,
+                          litestore_slice_t doc);
+/**
+ * Read a JSON object, the callback gets the document text.
+ *
+ * @param ctx
+ * @param key The key.
+ * @param callback A callback called with the document.
+ * @param user_data User provided data passed to the callback.
+ * @return LITESTORE_OK on success,
+ *         LITESTORE_ERR otherwise (e.g. key not found or not JSON).
+ */
+int litestore_read_json(litestore* ctx,
+                        litestore_slice_t key,
+                        litestore_read_cb callback,
+                        void* user_data);
+/**
+ * Read the part of a JSON object at a path, e.g. "$.tags[0]", extracted
+ * by the store. The callback gets the JSON text of the part.
+ *
+ * @param ctx
+ * @param key The key.
+ * @param path The JSON path.
+ * @param callback A callback called with the part.
+ * @param user_data User provided data passed to the callback.
+ * @return LITESTORE_OK on success,
+ *         LITESTORE_UNKNOWN_ENTITY if nothing is at the path,
+ *         LITESTORE_ERR otherwise (e.g. an invalid path).
+ */
+int litestore_read_json_path(litestore* ctx,
+                             litestore_slice_t key,
+                             litestore_slice_t path,
+                             litestore_read_cb callback,
+                             void* user_data);
+/**
+ * Update a JSON object.
+ * If the key does not exist, it will be created.
+ * If the old type is other than 'json' the data will be deleted.
+ *
+ * @param ctx
+ * @param key The key.
+ * @param doc The document, UTF-8 JSON text.
+ * @return LITESTORE_OK on success,
+ *         LITESTORE_ERR otherwise (e.g. malformed JSON).
+ */
+int litestore_update_json(litestore* ctx,
+                          litestore_slice_t key,
+                          litestore_slice_t doc);
+/**
+ * An index on the value at a JSON path of all the JSON objects.
+ * Handles are owned by the context.
+ */
+typedef struct litestore_json_index litestore_json_index;
+/**
+ * Open the index of a JSON path, creating it if needed (which indexes
+ * the existing documents). Not allowed within a transaction.
+ *
+ * @param ctx
+ * @param path The JSON path, e.g. "$.user.age".
+ * @param index The handle (out), valid until the index is dropped or
+ *              the context closed.
+ * @return LITESTORE_OK on success,
+ *         LITESTORE_ERR otherwise (e.g. an invalid path).
+ */
+int litestore_json_index_open(litestore* ctx,
+                              litestore_slice_t path,
+                              litestore_json_index** index);
+/**
+ * Drop the index of a JSON path. Not allowed within a transaction.
+ *
+ * @param ctx
+ * @param path The JSON path.
+ * @return LITESTORE_OK on success,
+ *         LITESTORE_UNKNOWN_ENTITY if there is no such index,
+ *         LITESTORE_ERR otherwise.
+ */
+int litestore_json_index_drop(litestore* ctx, litestore_slice_t path);
+/**
+ * Read the keys of the JSON objects with the given value at the path of
+ * the index, in the order the keys were created.
+ *
+ * @param index
+ * @param value The value as JSON, e.g. "42" or "\"red\"".
+ * @param callback A callback called for each key.
+ * @param user_data User provided data passed to the callback.
+ * @return LITESTORE_OK on success,
+ *         LITESTORE_ERR otherwise.
+ */
+int litestore_json_find(litestore_json_index* index,
+                        litestore_slice_t value,
+                        litestore_read_keys_cb callback,
+                        void* user_data);
+/**
+ * Read the keys of the JSON objects with values in [first, last) at the
+ * path of the index, in value order. Numbers sort before strings.
+ *
+ * @param index
+ * @param first The first value as JSON, empty for no start.
+ * @param last The value after the range as JSON, empty for no end.
+ * @param callback A callback called for each key.
+ * @param user_data User provided data passed to the callback.
+ * @return LITESTORE_OK on success,
+ *         LITESTORE_ERR otherwise.
+ */
+int litestore_json_range(litestore_json_index* index,
+                         litestore_slice_t first,
+                         litestore_slice_t last,
+                         litestore_read_keys_cb callback,
+                         void* user_data);
+/**
+ * A namespace, raw values in a table of their own. Keys of different
+ * namespaces (and of the objects above) do not collide.
+ * Handles are owned by the context.
+ */
+typedef struct litestore_ns litestore_ns;
+/**
+ * Open a namespace, it is created if it does not exist.
+ * No transaction may be active.
+ *
+ * @param ctx
+ * @param name Name of the namespace.
+ * @param ns The namespace (out), valid until dropped or the context is
+ *           closed. The same handle is returned for the same name.
+ * @return LITESTORE_OK on success,
+ *         LITESTORE_ERR otherwise.
+ */
+int litestore_ns_open(litestore* ctx,
+                      litestore_slice_t name,
+                      litestore_ns** ns);
+/**
+ * Drop a namespace and all of its values, by dropping its table.
+ * Frees the handle. No transaction may be active.
+ *
+ * @param ctx
+ * @param name Name of the namespace.
+ * @return LITESTORE_OK on success,
+ *         LITESTORE_UNKNOWN_ENTITY if the namespace does not exist,
+ *         LITESTORE_ERR otherwise.
+ */
+int litestore_ns_drop(litestore* ctx, litestore_slice_t name);
+/**
+ * Set the codec used for writes to the namespace (initially the codec of
+ * the context), @see litestore_set_compression.
+ *
+ * @param ns
+ * @param codec_id LITESTORE_CODEC_* or a user codec id.
+ * @return LITESTORE_OK on success,
+ *         LITESTORE_ERR if the codec is unknown.
+ */
+int litestore_ns_set_compression(litestore_ns* ns, const int codec_id);
+/**
+ * Set the value of a key in the namespace, created if it does not exist.
+ *
+ * @param ns
+ * @param key The key.
+ * @param value The value, may be empty but not NULL.
+ * @return LITESTORE_OK on success,
+ *         LITESTORE_ERR otherwise.
+ */
+int litestore_ns_put(litestore_ns* ns,
+                     litestore_slice_t key,
+                     litestore_blob_t value);
+/**
+ * Read the value of a key in the namespace.
+ *
+ * @param ns
+ * @param key The key.
+ * @param callback A callback that will be called for the value.
+ * @param user_data User provided data passed to the callback.
+ * @return LITESTORE_OK on success,
+ *         LITESTORE_UNKNOWN_ENTITY if the key does not exist,
+ *         Callback return if other than LITESTORE_OK,
+ *         LITESTORE_ERR otherwise.
+ */
+int litestore_ns_get(litestore_ns* ns,
+                     litestore_slice_t key,
+                     litestore_read_cb callback,
+                     void* user_data);
+/**
+ * Delete a key from the namespace.
+ *
+ * @param ns
+ * @param key The key.
+ * @return LITESTORE_OK on success,
+ *         LITESTORE_UNKNOWN_ENTITY if the key does not exist,
+ *         LITESTORE_ERR otherwise.
+ */
+int litestore_ns_delete(litestore_ns* ns, litestore_slice_t key);
+/**
+ * Callback for litestore_ns_scan.
+ *
+ * @param key The key.
+ * @param value The value.
+ * @param user_data The user provided data.
+ * @return LITESTORE_OK to continue, anything else stops the scan.
+ */
+typedef int (*litestore_ns_cb)(litestore_slice_t key,
+                               litestore_blob_t value,
+                               void* user_data);
+/**
+ * Scan the namespace in ascending order of the keys, from the first key
+ * equal to or greater than first.
+ *
+ * @param ns
+ * @param first Where to start, an empty slice for the beginning.
+ * @param callback A callback called for each key.
+ * @param user_data User provided data passed to the callback.
+ * @return LITESTORE_OK on success,
+ *         Callback return if other than LITESTORE_OK,
+ *         LITESTORE_ERR otherwise.
+ */
+int litestore_ns_scan(litestore_ns* ns,
+                      litestore_slice_t first,
+                      litestore_ns_cb callback,
+                      void* user_data);
+/**
+ * Flags for litestore_bulk_begin.
+ */
+enum
+{
+    /* Keys are appended in ascending (memcmp) order, checked on append. */
+    LITESTORE_BULK_SORTED = 1
+};
+/**
+ * Begin a bulk load, for seeding a store with many keys.
+ *
+ * Until litestore_bulk_end the store runs with synchronous = OFF, an
+ * in-memory rollback journal (unless in WAL mode), foreign keys off and
+ * without the secondary indexes. All appends run in a single transaction,
+ * other writes (e.g. litestore_update, litestore_delete) fail until
+ * litestore_bulk_end. A crash during the load can leave the store
+ * corrupt, load into a new store.
+ *
+ * Sorted input is the fastest, since all inserts go to the end of the
+ * key index.
+ *
+ * @param ctx
+ * @param flags LITESTORE_BULK_* or 0.
+ * @return LITESTORE_OK on success,
+ *         LITESTORE_ERR otherwise (e.g. a transaction is active).
+ */
+int litestore_bulk_begin(litestore* ctx, const int flags);
+/**
+ * Append a key to the bulk load.
+ * Creates a 'raw' value, or a 'null' value if value.data is NULL.
+ * Will fail if key exists.
+ *
+ * @param ctx
+ * @param key The key.
+ * @param value The value.
+ * @return LITESTORE_OK on success,
+ *         LITESTORE_ERR otherwise.
+ */
+int litestore_bulk_append(litestore* ctx,
+                          litestore_slice_t key,
+                          litestore_blob_t value);
+/**
+ * End the bulk load.
+ * Commits the load, builds the indexes and restores the normal mode.
+ * Finally checks the foreign keys and the integrity of the store.
+ *
+ * To discard the load call litestore_rollback_tx before this.
+ *
+ * @param ctx
+ * @return LITESTORE_OK on success,
+ *         LITESTORE_ERR otherwise.
+ */
+int litestore_bulk_end(litestore* ctx);
+/**
+ * Write all the objects of the store to the given file descriptor,
+ * in key order.
+ *
+ * The format is a header followed by CRC32 checksummed blocks of
+ * length prefixed records (key, type, value). The store is locked
+ * for writing during the export, for a consistent copy.
+ * Namespaces (@see litestore_ns_open) are not exported, copy them
+ * with litestore_ns_scan, or the whole store with litestore_backup_step.
+ *
+ * @param ctx
+ * @param fd An open file descriptor, e.g. a file or a socket.
+ * @return LITESTORE_OK on success,
+ *         LITESTORE_ERR otherwise.
+ */
+int litestore_export(litestore* ctx, int fd);
+/**
+ * Read objects written by litestore_export to the store.
+ * Uses a bulk load (@see litestore_bulk_begin), so no transaction may be
+ * active. The import is discarded if a key exists or the input is
+ * corrupt. Namespaces are not imported, @see litestore_export.
+ *
+ * @param ctx
+ * @param fd An open file descriptor.
+ * @return LITESTORE_OK on success,
+ *         LITESTORE_ERR otherwise.
+ */
+int litestore_import(litestore* ctx, int fd);
+/**
+ * Progress of a backup.
+ */
+typedef struct
+{
+    int remaining;  /* pages still to be copied */
+    int page_count;  /* pages in the store */
+} litestore_backup_progress_t;
+/**
+ * Copy the store to the given file, a few pages at a time.
+ *
+ * Call repeatedly while LITESTORE_IN_PROGRESS is returned, e.g. from a
+ * timer. The store is locked only during each call, writers can run
+ * between the calls. Changes made through this context are copied to the
+ * backup as they happen, changes by other connections restart the copy.
+ * Also works for snapshotting a ":memory:" store.
+ *
+ * Only one backup per context can be in progress.
+ *
+ * @param ctx
+ * @param dest_path The backup file, overwritten.
+ * @param pages_per_step Pages copied per call, <= 0 for all.
+ * @param progress Filled with the progress, can be NULL.
+ * @return LITESTORE_OK when the backup is complete,
+ *         LITESTORE_IN_PROGRESS if more calls are needed,
+ *         LITESTORE_ERR otherwise (the backup is aborted).
+ */
+int litestore_backup_step(litestore* ctx,
+                          const char* dest_path,
+                          const int pages_per_step,
+                          litestore_backup_progress_t* progress);
+/**
+ * Abort a backup in progress, the backup file is left incomplete.
+ * Closing the context aborts a backup as well.
+ *
+ * @param ctx
+ * @return LITESTORE_OK on success,
+ *         LITESTORE_ERR otherwise.
+ */
+int litestore_backup_abort(litestore* ctx);
+/**
+ * Value log usage.
+ */
+typedef struct
+{
+    int segments;  /* number of files */
+    long long size;  /* bytes in the files */
+    long long live;  /* bytes of values still in use */
+} litestore_vlog_stats_t;
+/**
+ * Reclaim space of the value log, a few values at a time.
+ *
+ * Values still in use are moved out of the segment files that are at
+ * most half live. The emptied files are removed once no connection can
+ * read them from an older snapshot (WAL), by a later call or
+ * litestore_close. Call repeatedly while
+ * LITESTORE_IN_PROGRESS is returned, e.g. from a timer. Can not be
+ * called inside a transaction.
+ *
+ * @param ctx
+ * @param count Values moved per call.
+ * @return LITESTORE_OK when there is nothing to collect,
+ *         LITESTORE_IN_PROGRESS if more calls are needed,
+ *         LITESTORE_ERR otherwise.
+ */
+int litestore_vlog_gc_step(litestore* ctx, const int count);
+/**
+ * @param ctx
+ * @param stats Filled with the value log usage.
+ * @return LITESTORE_OK on success,
+ *         LITESTORE_ERR otherwise.
+ */
+int litestore_vlog_stats(litestore* ctx, litestore_vlog_stats_t* stats);
 
 
 #ifdef __cplusplus
@@ -66,6 +66,52 @@ litestore_slice_t litestore_slice(const char* str,
  */
 litestore_slice_t litestore_slice_str(const char* str);
 
+/**
+ * Order preserving key encoding.
+ *
+ * Keys may hold any bytes and are ordered with memcmp. A composite key is
+ * built by appending encoded components; such keys sort as the tuples of
+ * their components do, so (tenant, time, id) keys can be range scanned.
+ * The encoders write to dst, or only return the size if dst is NULL.
+ */
+#define LITESTORE_KEY_INT_SIZE 8
+/**
+ * Encode an integer component, 8 bytes big endian with the sign flipped.
+ *
+ * @return LITESTORE_KEY_INT_SIZE.
+ */
+size_t litestore_key_int(const long long value, char* dst);
+/**
+ * Encode a string (or any bytes) component: 0x00 is escaped as 0x00 0xff,
+ * and the end marked with 0x00 0x01.
+ *
+ * @return The encoded size.
+ */
+size_t litestore_key_str(litestore_slice_t str, char* dst);
+/**
+ * Decode an integer component from the beginning of src.
+ *
+ * @return The bytes read, 0 if src is too short.
+ */
+size_t litestore_key_read_int(litestore_slice_t src, long long* value);
+/**
+ * Decode a string component from the beginning of src.
+ *
+ * @param dst The string (out), may be NULL.
+ * @param length The length of the string (out).
+ * @return The bytes read, 0 if src holds no valid component.
+ */
+size_t litestore_key_read_str(litestore_slice_t src,
+                              char* dst,
+                              size_t* length);
+/**
+ * Turn a key prefix into the first key after all the keys starting with
+ * it, in place.
+ *
+ * @return The length of the end key, 0 if there is none (all 0xff).
+ */
+size_t litestore_key_prefix_end(char* key, const size_t length);
+
 
 #ifdef __cplusplus
 }  /* extern "C" */
@@ -3,14 +3,25 @@
  *
  * See the file LICENSE.txt for copying permission.
  */
+/* clock_gettime */
+#define _POSIX_C_SOURCE 200809L
+
 #include "litestore/litestore.h"
 
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <time.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 #include <sqlite3.h>
 
+#include "litestore_schema.h"
+
 
 #ifdef __cplusplus
 extern "C" {
@@ -18,27 +29,115 @@ extern "C" {
 
 #define UNUSED(x) (void)(x)
 
-/* Current schema version */
-#define LITESTORE_CURRENT_VERSION 1
+/**
+ * Change log of the watched keys, @see watch_notify. TEMP, per connection
+ * and only while watched. It is written in the transaction, so a rollback
+ * discards it. Values of a deleted object are not logged, the object is
+ * gone when the cascade deletes them. Nor are the rewrites of maintenance
+ * steps, @see watch_quiet
+ */
+#define WATCH_VALUE(table, op, row)                                     \
+    "CREATE TEMP TRIGGER IF NOT EXISTS watch_" table "_" op             \
+    "       AFTER " op " ON main." table                                \
+    "       WHEN NOT litestore_watch_quiet()"                           \
+    " BEGIN"                                                            \
+    "       INSERT INTO watch_log (name, event)"                        \
+    "              SELECT name, 2 FROM objects WHERE id = " row ".id;"  \
+    " END;"
+#define WATCH_VALUES(table)                     \
+    WATCH_VALUE(table, "INSERT", "new")         \
+    WATCH_VALUE(table, "UPDATE", "new")         \
+    WATCH_VALUE(table, "DELETE", "old")
+#define WATCH_DROP_VALUES(table)                                \
+    "DROP TRIGGER IF EXISTS temp.watch_" table "_INSERT;"       \
+    "DROP TRIGGER IF EXISTS temp.watch_" table "_UPDATE;"       \
+    "DROP TRIGGER IF EXISTS temp.watch_" table "_DELETE;"
+
+#define WATCH_SCHEMA                                                    \
+    "CREATE TEMP TABLE IF NOT EXISTS watch_log("                        \
+    "       seq INTEGER PRIMARY KEY NOT NULL,"                          \
+    "       name TEXT NOT NULL,"                                        \
+    "       event INTEGER NOT NULL"                                     \
+    ");"                                                                \
+    "CREATE TEMP TRIGGER IF NOT EXISTS watch_objects_INSERT"            \
+    "       AFTER INSERT ON main.objects"                               \
+    "       WHEN NOT litestore_watch_quiet()"                           \
+    " BEGIN"                                                            \
+    "       INSERT INTO watch_log (name, event) VALUES (new.name, 1);"  \
+    " END;"                                                             \
+    "CREATE TEMP TRIGGER IF NOT EXISTS watch_objects_UPDATE"            \
+    "       AFTER UPDATE ON main.objects"                               \
+    "       WHEN NOT litestore_watch_quiet()"                           \
+    " BEGIN"                                                            \
+    "       INSERT INTO watch_log (name, event) VALUES (new.name, 2);"  \
+    " END;"                                                             \
+    "CREATE TEMP TRIGGER IF NOT EXISTS watch_objects_DELETE"            \
+    "       AFTER DELETE ON main.objects"                               \
+    "       WHEN NOT litestore_watch_quiet()"                           \
+    " BEGIN"                                                            \
+    "       INSERT INTO watch_log (name, event) VALUES (old.name, 3);"  \
+    " END;"                                                             \
+    WATCH_VALUES("raw_data")                                            \
+    WATCH_VALUES("kv_data")                                             \
+    WATCH_VALUES("array_data")                                          \
+    WATCH_VALUES("num_data")                                            \
+    WATCH_VALUES("merge_operands")                                      \
+    WATCH_VALUES("json_data")
+
+#define WATCH_DROP_SCHEMA                                       \
+    WATCH_DROP_VALUES("objects")                                \
+    WATCH_DROP_VALUES("raw_data")                               \
+    WATCH_DROP_VALUES("kv_data")                                \
+    WATCH_DROP_VALUES("array_data")                             \
+    WATCH_DROP_VALUES("num_data")                               \
+    WATCH_DROP_VALUES("merge_operands")                         \
+    WATCH_DROP_VALUES("json_data")                              \
+    "DROP TABLE IF EXISTS temp.watch_log;"
+
+#define RAW_VALUE_COLUMNS                                               \
+    "coalesce(s.raw_value, r.raw_value), coalesce(s.codec, r.codec),"   \
+    " coalesce(s.raw_size, r.raw_size),"                                \
+    " v.segment, v.position, v.length, v.checksum"
+#define RAW_VALUE_JOIN                                  \
+    "LEFT JOIN shared_data s ON s.id = r.shared"        \
+    " LEFT JOIN value_log v ON v.id = r.logged"
+
+/* Nesting of API calls tracked for operation names */
+#define MAX_OP_DEPTH 8
+/* Statements traced at the same time (nested reads) */
+#define TRACE_SLOTS 4
 
 /**
- * The DB schema.
+ * A dictionary, bytes that precede the input of the compressor and the
+ * output of the decompressor, so that matches can refer to it.
  */
-#define LITESTORE_SCHEMA_V1                             \
-    "CREATE TABLE IF NOT EXISTS meta("                  \
-    "       schema_version INTEGER NOT NULL DEFAULT 1"  \
-    ");"                                                \
-    "CREATE TABLE IF NOT EXISTS objects("               \
-    "       id INTEGER PRIMARY KEY NOT NULL,"           \
-    "       name TEXT NOT NULL UNIQUE,"                 \
-    "       type INTEGER NOT NULL"                      \
-    ");"                                                \
-    "CREATE TABLE IF NOT EXISTS raw_data("              \
-    "       id INTEGER NOT NULL,"                       \
-    "       raw_value BLOB NOT NULL,"                   \
-    "       FOREIGN KEY(id) REFERENCES objects(id)"     \
-    "       ON DELETE CASCADE ON UPDATE RESTRICT"       \
-    ");"                                                \
+typedef struct
+{
+    sqlite3_int64 version;  /* 0 for no dictionary */
+    const unsigned char* data;
+    size_t size;
+    /* positions + 1 of the 4 byte sequences of data, 0 for none */
+    const unsigned int* table;
+} lz_dict;
+
+/* Buffers for folding merge operands */
+enum
+{
+    MERGE_DATA = 0,  /* the operands */
+    MERGE_LIST,  /* merge_operand per operand */
+    MERGE_BLOBS,  /* litestore_blob_t per operand */
+    MERGE_OUT,  /* results, two alternating */
+    MERGE_BUF_COUNT = MERGE_OUT + 2
+};
+
+/* A watch of keys, the prefix follows the struct */
+typedef struct watch_entry
+{
+    struct watch_entry* next;
+    litestore_watch_cb callback;
+    void* user_data;
+    size_t prefix_len;
+} watch_entry;
 
 /**
  * The LiteStore object.
@@ -47,29 +146,177 @@ struct litestore
 {
 litestore_opts opts;
 sqlite3* db;
+void* lookaside;  /* per connection slab, allocated along the context */
+long long budget_releases;
+/* stats */
+litestore_stats_t stats;
+int op_depth;  /* nesting of API calls, only the outermost is measured */
+sqlite3_int64 op_begin_ns;
+sqlite3_int64 lock_wait_ns;  /* waited for locks during the operation */
+sqlite3_int64 busy_begin_ns;  /* start of the current lock wait */
+const char* op_names[MAX_OP_DEPTH];
+litestore_io_counters_t io_total;
+litestore_io_counters_t io_ops[LITESTORE_OP_COUNT];
+/* trace, rows stepped per active statement */
+sqlite3_stmt* trace_stmts[TRACE_SLOTS];
+int trace_rows[TRACE_SLOTS];
 /* tx */
 sqlite3_stmt* begin_tx;
 sqlite3_stmt* commit_tx;
 sqlite3_stmt* rollback_tx;
 int tx_active;
+/* bulk load */
+int bulk_active;
+int bulk_appending;  /* in litestore_bulk_append, @see bulk_blocks */
+int bulk_flags;
+int bulk_synchronous;  /* restored at the end */
+char bulk_journal_mode[16];
+char* bulk_key;  /* last key appended, for LITESTORE_BULK_SORTED */
+int bulk_key_len;
+int bulk_key_cap;
+/* backup in progress */
+sqlite3* backup_db;
+sqlite3_backup* backup;
+char* backup_path;
+/* compression */
+int compression;  /* codec id for writes */
+unsigned char* scratch;  /* (de)compressed values */
+size_t scratch_cap;
+litestore_codec dict_codec;
+lz_dict dicts[2];  /* [0] the latest, for writes, [1] the last other read */
+sqlite3_int64 reencode_rowid;  /* progress of litestore_reencode_step */
+int reencode_table;  /* 0 raw_data, 1 shared_data */
+/* value log */
+int vlog_fd;  /* the active segment, for appends, -1 for none */
+sqlite3_int64 vlog_segment;
+int vlog_read_fd;  /* the last other segment read, -1 for none */
+sqlite3_int64 vlog_read_segment;
+int vlog_dirty;  /* appended in the transaction, synced at commit */
+unsigned char* vlog_buf;  /* values read from the log */
+size_t vlog_buf_cap;
+sqlite3_int64* vlog_retired;  /* emptied segments, @see vlog_release */
+size_t vlog_retired_count;
+size_t vlog_retired_cap;
+/* merge, buffers for folding the operands of a value, @see merge_value */
+unsigned char* merge_bufs[MERGE_BUF_COUNT];
+size_t merge_caps[MERGE_BUF_COUNT];
+sqlite3_int64 merge_compact_id;  /* progress of merge_compact_step */
 /* object */
 sqlite3_stmt* create_key;
 sqlite3_stmt* read_key;
 sqlite3_stmt* delete_key;
 sqlite3_stmt* update_type;
 sqlite3_stmt* read_keys;
+sqlite3_stmt* read_key_range;
 /* raw */
 sqlite3_stmt* create_data;
 sqlite3_stmt* read_data;
 sqlite3_stmt* update_data;
 sqlite3_stmt* delete_data;
+/* dedup */
+sqlite3_stmt* find_shared;
+sqlite3_stmt* create_shared;
+/* value log */
+sqlite3_stmt* active_segment;
+sqlite3_stmt* update_segment;
+sqlite3_stmt* create_logged;
+/* kv */
+sqlite3_stmt* set_field;
+sqlite3_stmt* read_field;
+sqlite3_stmt* read_fields;
+sqlite3_stmt* delete_field;
+sqlite3_stmt* delete_fields;
+/* array */
+sqlite3_stmt* array_length;
+sqlite3_stmt* append_item;
+sqlite3_stmt* read_item;
+sqlite3_stmt* read_items;
+sqlite3_stmt* update_item;
+sqlite3_stmt* delete_items;
+/* numbers */
+sqlite3_stmt* set_num;
+sqlite3_stmt* read_num;
+sqlite3_stmt* delete_num;
+sqlite3_stmt* incr_num;
+sqlite3_int64 captured_int;  /* the result of incr_num */
+double captured_float;
+/* merge */
+sqlite3_stmt* create_operand;
+sqlite3_stmt* read_operands;
+sqlite3_stmt* delete_operands;
+sqlite3_stmt* next_merged;
+/* expiry */
+sqlite3_stmt* set_expiry;
+sqlite3_stmt* delete_expiry;
+sqlite3_stmt* next_expired;
+sqlite3_stmt* purge_key;
+sqlite3_stmt* delete_id;
+/* secondary indexes */
+sqlite3_stmt* add_term;
+sqlite3_stmt* delete_terms;
+sqlite3_stmt* index_find;
+sqlite3_stmt* index_range;
+sqlite3_stmt* next_raw;
+sqlite3_int64 index_build_id;  /* progress of index_build_step */
+/* json */
+sqlite3_stmt* set_json;
+sqlite3_stmt* read_json;
+sqlite3_stmt* read_json_path;
+sqlite3_stmt* delete_json;
+/* namespaces opened */
+litestore_ns* namespaces;
+/* json path indexes opened */
+litestore_json_index* json_indexes;
+/* watches, @see watch_notify */
+watch_entry* watches;
+sqlite3_stmt* watch_read;
+sqlite3_stmt* watch_clear;
+int watch_changes;  /* sqlite3_total_changes when last delivered */
+int watch_delivering;
+int watch_quiet;  /* maintenance rewrites in progress, not logged */
+litestore_change_t* watch_list;  /* the changes delivered */
+size_t watch_list_cap;
+unsigned char* watch_keys;  /* their keys */
+size_t watch_keys_cap;
+};
+
+/**
+ * A namespace, raw values in a table of its own, ns_<id>.
+ */
+struct litestore_ns
+{
+litestore* ctx;
+litestore_ns* next;
+sqlite3_int64 id;
+int compression;  /* codec id for writes */
+sqlite3_stmt* put;
+sqlite3_stmt* get;
+sqlite3_stmt* del;
+sqlite3_stmt* scan;
+};
+
+/**
+ * An index on a JSON path, json_path_<id>.
+ */
+struct litestore_json_index
+{
+litestore* ctx;
+litestore_json_index* next;
+sqlite3_int64 id;
+sqlite3_stmt* find;
+sqlite3_stmt* range;
 };
 
 /* Possible db.objects.type values */
 enum
 {
     LS_NULL = LITESTORE_NULL_T,
-    LS_RAW = LITESTORE_RAW_T
+    LS_RAW = LITESTORE_RAW_T,
+    LS_KV = LITESTORE_KV_T,
+    LS_ARRAY = LITESTORE_ARRAY_T,
+    LS_INT = LITESTORE_INT_T,
+    LS_FLOAT = LITESTORE_FLOAT_T,
+    LS_JSON = LITESTORE_JSON_T
 };
 
 /* The native db ID type */
@@ -80,20 +327,24 @@ typedef sqlite3_int64 litestore_id_t;
 /*----------------- HELPERS ---------------*/
 /*-----------------------------------------*/
 static
-void sqlite_error(litestore* ctx)
+void report_error(litestore* ctx, const int error, const char* desc)
 {
     if (ctx->opts.error_callback)
     {
-        (*ctx->opts.error_callback)(sqlite3_errcode(ctx->db),
-                                    sqlite3_errmsg(ctx->db),
-                                    ctx->opts.err_user_data);
+        (*ctx->opts.error_callback)(error, desc, ctx->opts.err_user_data);
     }
     else
     {
-        printf("ERROR: %s\n", sqlite3_errmsg(ctx->db));
+        printf("ERROR: %s\n", desc);
     }
 }
 
+static
+void sqlite_error(litestore* ctx)
+{
+    report_error(ctx, sqlite3_errcode(ctx->db), sqlite3_errmsg(ctx->db));
+}
+
 static
 int run_stmt(litestore* ctx, sqlite3_stmt* stmt)
 {
@@ -116,933 +367,8729 @@ int run_stmt(litestore* ctx, sqlite3_stmt* stmt)
 }
 
 /**
- * @return 1 on success, 0 on error (boolean value)
+ * @return The time keys expire against, seconds since the epoch.
  */
 static
-int opt_begin_tx(litestore* ctx)
+sqlite3_int64 expiry_now(void)
 {
-    if (!ctx->tx_active && litestore_begin_tx(ctx) == LITESTORE_OK)
-    {
-        return 1;
-    }
-    return 0;
+    return (sqlite3_int64)time(NULL);
 }
 
-/**
- * @return Return value of the tx function called.
- */
 static
-int opt_end_tx(litestore* ctx, int status)
+unsigned int crc32_update(unsigned int crc,
+                          const unsigned char* data,
+                          size_t len)
 {
-    if (status == LITESTORE_OK)
+    /* half-byte table, reflected polynomial 0xEDB88320 */
+    static const unsigned int table[16] = {
+        0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac,
+        0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+        0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+        0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c
+    };
+    crc = ~crc;
+    while (len--)
     {
-        return litestore_commit_tx(ctx);
+        crc ^= *data++;
+        crc = (crc >> 4) ^ table[crc & 0x0f];
+        crc = (crc >> 4) ^ table[crc & 0x0f];
     }
-    return litestore_rollback_tx(ctx);
+    return ~crc;
+}
+
+static
+void put_u32(unsigned char* p, const unsigned int v)
+{
+    p[0] = (unsigned char)v;
+    p[1] = (unsigned char)(v >> 8);
+    p[2] = (unsigned char)(v >> 16);
+    p[3] = (unsigned char)(v >> 24);
+}
+
+static
+unsigned int get_u32(const unsigned char* p)
+{
+    return (unsigned int)p[0] | ((unsigned int)p[1] << 8)
+        | ((unsigned int)p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+static
+void put_u64(unsigned char* p, const sqlite3_uint64 v)
+{
+    put_u32(p, (unsigned int)v);
+    put_u32(p + 4, (unsigned int)(v >> 32));
 }
 
+static
+sqlite3_uint64 get_u64(const unsigned char* p)
+{
+    return (sqlite3_uint64)get_u32(p)
+        | ((sqlite3_uint64)get_u32(p + 4) << 32);
+}
 
 /*-----------------------------------------*/
-/*----------------- INIT ------------------*/
+/*----------------- WATCH -----------------*/
 /*-----------------------------------------*/
+/**
+ * SQL function litestore_watch_quiet(), 1 while a maintenance step
+ * rewrites values without changing them, e.g. litestore_reencode_step.
+ */
 static
-int init_db(litestore* ctx)
+void watch_quiet(sqlite3_context* context, int argc, sqlite3_value** argv)
 {
-    if (sqlite3_exec(ctx->db, LITESTORE_SCHEMA_V1, NULL, NULL, NULL)
-        == SQLITE_OK)
-    {
-        /* @note For some reason the pragma won't work if run
-           inside the same TX as schema. */
-        return (sqlite3_exec(ctx->db, "PRAGMA foreign_keys = ON;",
-                             NULL, NULL, NULL)
-                == SQLITE_OK) ? LITESTORE_OK : LITESTORE_ERR;
-    }
-    return LITESTORE_ERR;
+    const litestore* ctx = (const litestore*)sqlite3_user_data(context);
+    UNUSED(argc);
+    UNUSED(argv);
+    sqlite3_result_int(context, ctx->watch_quiet);
 }
 
+/**
+ * Drop the change log and its triggers, when the last watch is gone.
+ */
 static
-int prepare_stmt(litestore* ctx, const char* sql, sqlite3_stmt** stmt)
+void watch_uninstall(litestore* ctx)
 {
-    if (sqlite3_prepare_v2(ctx->db, sql, -1, stmt, NULL) != SQLITE_OK)
+    sqlite3_finalize(ctx->watch_read);
+    ctx->watch_read = NULL;
+    sqlite3_finalize(ctx->watch_clear);
+    ctx->watch_clear = NULL;
+    if (sqlite3_exec(ctx->db, WATCH_DROP_SCHEMA, NULL, NULL, NULL)
+        != SQLITE_OK)
     {
-        return LITESTORE_ERR;
+        sqlite_error(ctx);
     }
-    return LITESTORE_OK;
 }
 
+/**
+ * Create the change log and its triggers, for the first watch.
+ */
 static
-int prepare_statements(litestore* ctx)
+int watch_install(litestore* ctx)
 {
-    /* object */
-    if (prepare_stmt(ctx,
-                     "INSERT INTO objects (name, type) VALUES (?, ?);",
-                     &(ctx->create_key)) != LITESTORE_OK
-        || prepare_stmt(ctx,
-                        "SELECT id, type FROM objects WHERE name = ?;",
-                        &(ctx->read_key)) != LITESTORE_OK
-        || prepare_stmt(ctx,
-                        "DELETE FROM objects WHERE name = ?;",
-                        &(ctx->delete_key)) != LITESTORE_OK
-        || prepare_stmt(ctx,
-                        "UPDATE objects SET type = ? WHERE id = ?;",
-                        &(ctx->update_type)) != LITESTORE_OK
-        || prepare_stmt(ctx,
-                        "SELECT name, type FROM objects WHERE name GLOB ?;",
-                        &(ctx->read_keys)) != LITESTORE_OK
-        /* tx */
-        || prepare_stmt(ctx,
-                        "BEGIN IMMEDIATE TRANSACTION;",
-                        &(ctx->begin_tx)) != LITESTORE_OK
-        || prepare_stmt(ctx,
-                        "COMMIT TRANSACTION;",
-                        &(ctx->commit_tx)) != LITESTORE_OK
-        || prepare_stmt(ctx,
-                        "ROLLBACK TRANSACTION;",
-                        &(ctx->rollback_tx)) != LITESTORE_OK
-        /* raw */
-        || prepare_stmt(ctx,
-                        "INSERT INTO raw_data (id, raw_value) VALUES (?, ?);",
-                        &(ctx->create_data)) != LITESTORE_OK
-        || prepare_stmt(ctx,
-                        "SELECT raw_value FROM raw_data WHERE id = ?;",
-                        &(ctx->read_data)) != LITESTORE_OK
-        || prepare_stmt(ctx,
-                        "UPDATE raw_data SET raw_value = ? WHERE id = ?;",
-                        &(ctx->update_data)) != LITESTORE_OK
-        || prepare_stmt(ctx,
-                        "DELETE FROM raw_data WHERE id = ?;",
-                        &(ctx->delete_data)) != LITESTORE_OK)
+    /* a key and its first and last event in the transaction */
+    if (sqlite3_create_function(ctx->db, "litestore_watch_quiet", 0,
+                                SQLITE_UTF8, ctx, &watch_quiet,
+                                NULL, NULL) != SQLITE_OK
+        || sqlite3_exec(ctx->db, WATCH_SCHEMA, NULL, NULL, NULL) != SQLITE_OK
+        || sqlite3_prepare_v2(
+            ctx->db,
+            "SELECT g.name, f.event, l.event FROM"
+            " (SELECT name, min(seq) AS first, max(seq) AS last"
+            "  FROM watch_log GROUP BY name) AS g"
+            " JOIN watch_log AS f ON f.seq = g.first"
+            " JOIN watch_log AS l ON l.seq = g.last"
+            " ORDER BY g.name;",
+            -1, &ctx->watch_read, NULL) != SQLITE_OK
+        || sqlite3_prepare_v2(ctx->db, "DELETE FROM watch_log;",
+                              -1, &ctx->watch_clear, NULL) != SQLITE_OK)
     {
         sqlite_error(ctx);
+        watch_uninstall(ctx);
         return LITESTORE_ERR;
     }
-
+    ctx->watch_changes = sqlite3_total_changes(ctx->db);
     return LITESTORE_OK;
 }
 
 static
-int update_version_from(litestore* ctx, int version_in_db)
+void watch_free_all(litestore* ctx)
 {
-    int rv = LITESTORE_OK;
+    while (ctx->watches)
+    {
+        watch_entry* next = ctx->watches->next;
+        sqlite3_free(ctx->watches);
+        ctx->watches = next;
+    }
+    sqlite3_finalize(ctx->watch_read);
+    ctx->watch_read = NULL;
+    sqlite3_finalize(ctx->watch_clear);
+    ctx->watch_clear = NULL;
+    sqlite3_free(ctx->watch_list);
+    sqlite3_free(ctx->watch_keys);
+}
 
-    while (version_in_db != LITESTORE_CURRENT_VERSION && rv == LITESTORE_OK)
+/**
+ * Grow a buffer of the changes, kept for reuse.
+ *
+ * @return The buffer, NULL on error (the old one is kept).
+ */
+static
+void* watch_reserve(litestore* ctx, void* buf, size_t* cap, const size_t size)
+{
+    if (size > *cap)
     {
-        switch (version_in_db)
+        const size_t new_cap = size > 2 * *cap ? size : 2 * *cap;
+        buf = sqlite3_realloc64(buf, new_cap);
+        if (!buf)
         {
-            case 0:
-            {
-                const char* stmt =
-                    "INSERT INTO meta (schema_version) VALUES (?);";
-                sqlite3_stmt* save_version = NULL;
-                if (sqlite3_prepare_v2(ctx->db, stmt, strlen(stmt),
-                                       &save_version, NULL)
-                    == SQLITE_OK
-                    && sqlite3_bind_int(
-                        save_version, 1, LITESTORE_CURRENT_VERSION)
-                    == SQLITE_OK
-                    && sqlite3_step(save_version)
-                    == SQLITE_DONE)
-                {
-                    version_in_db = LITESTORE_CURRENT_VERSION;
-                }
-                else
-                {
-                    sqlite_error(ctx);
-                    rv = LITESTORE_ERR;
-                }
-                sqlite3_finalize(save_version);
-            }
-            break;
-
-            default:
-                rv = LITESTORE_UNSUPPORTED_VERSION;
-                break;
+            report_error(ctx, LITESTORE_ERR, "out of memory");
+            return NULL;
         }
+        *cap = new_cap;
     }
-
-    return rv;
+    return buf;
 }
 
+/**
+ * Collapse the log to a change per key, in key order.
+ */
 static
-int version_update(litestore* ctx)
+int watch_read_changes(litestore* ctx, size_t* count)
 {
-    int rv = LITESTORE_ERR;
+    int rv = LITESTORE_OK;
+    int rc = SQLITE_ROW;
+    size_t size = 0;
+    size_t i = 0;
+    const unsigned char* key = NULL;
+    litestore_change_t* list = NULL;
+    unsigned char* keys = NULL;
 
-    if (opt_begin_tx(ctx))
+    *count = 0;
+    while (rv == LITESTORE_OK
+           && (rc = sqlite3_step(ctx->watch_read)) == SQLITE_ROW)
     {
-        sqlite3_stmt* read_version = NULL;
-        const char* stmt = "SELECT schema_version FROM meta;";
-        if (sqlite3_prepare_v2(ctx->db, stmt, strlen(stmt), &read_version, NULL)
-            == SQLITE_OK)
+        const void* name = sqlite3_column_blob(ctx->watch_read, 0);
+        const size_t len = (size_t)sqlite3_column_bytes(ctx->watch_read, 0);
+        const int first = sqlite3_column_int(ctx->watch_read, 1);
+        const int last = sqlite3_column_int(ctx->watch_read, 2);
+
+        /* the key existed before unless created first, and after unless
+           deleted last */
+        const int existed = first != LITESTORE_CREATED;
+        const int exists = last != LITESTORE_DELETED;
+
+        if (!existed && !exists)
         {
-            if (sqlite3_step(read_version) == SQLITE_ROW)
-            {
-                const int version = sqlite3_column_int(read_version, 0);
-                if (version < LITESTORE_CURRENT_VERSION)
-                {
-                    rv = update_version_from(ctx, version);
-                }
-                else if (version > LITESTORE_CURRENT_VERSION)
-                {
-                    rv = LITESTORE_UNSUPPORTED_VERSION;
-                }
-            }
-            else
-            {
-                rv = update_version_from(ctx, 0);
-            }
-            sqlite3_finalize(read_version);
+            continue;
+        }
+        list = (litestore_change_t*)watch_reserve(
+            ctx, ctx->watch_list, &ctx->watch_list_cap,
+            (*count + 1) * sizeof(litestore_change_t));
+        if (list)
+        {
+            ctx->watch_list = list;
+            keys = (unsigned char*)watch_reserve(
+                ctx, ctx->watch_keys, &ctx->watch_keys_cap, size + len);
+        }
+        if (!list || !keys)
+        {
+            rv = LITESTORE_ERR;
         }
         else
         {
-            sqlite_error(ctx);
+            ctx->watch_keys = keys;
+            list[*count].key = NULL;
+            list[*count].key_length = len;
+            list[*count].event = !existed ? LITESTORE_CREATED
+                : !exists ? LITESTORE_DELETED : LITESTORE_UPDATED;
+            if (len > 0)
+            {
+                memcpy(keys + size, name, len);
+            }
+            ++*count;
+            size += len;
         }
+    }
+    if (rv == LITESTORE_OK && rc != SQLITE_DONE)
+    {
+        sqlite_error(ctx);
+        rv = LITESTORE_ERR;
+    }
+    sqlite3_reset(ctx->watch_read);
 
-        rv = opt_end_tx(ctx, rv);
+    /* the keys are in order, pointed to once the buffer is grown */
+    key = ctx->watch_keys;
+    for (i = 0; i < *count; ++i)
+    {
+        ctx->watch_list[i].key = (const char*)key;
+        key += ctx->watch_list[i].key_length;
     }
 
     return rv;
 }
 
 static
-void finalize_stmt(sqlite3_stmt** stmt)
-{
-    sqlite3_finalize(*stmt);
-    *stmt = NULL;
-}
-
-static
-int finalize_statements(litestore* ctx)
+int watch_matches(const watch_entry* watch, const litestore_change_t* change)
 {
-    /* key */
-    finalize_stmt(&(ctx->create_key));
-    finalize_stmt(&(ctx->read_key));
-    finalize_stmt(&(ctx->delete_key));
-    finalize_stmt(&(ctx->update_type));
-    finalize_stmt(&(ctx->read_keys));
-    /* tx */
-    finalize_stmt(&(ctx->begin_tx));
-    finalize_stmt(&(ctx->commit_tx));
-    finalize_stmt(&(ctx->rollback_tx));
-    /* object */
-    finalize_stmt(&(ctx->create_data));
-    finalize_stmt(&(ctx->read_data));
-    finalize_stmt(&(ctx->update_data));
-    finalize_stmt(&(ctx->delete_data));
-    
-    return LITESTORE_OK;
+    return change->key_length >= watch->prefix_len
+        && memcmp(change->key, watch + 1, watch->prefix_len) == 0;
 }
 
-
-/*-----------------------------------------*/
-/*----------------- CREATE ----------------*/
-/*-----------------------------------------*/
+/**
+ * Call each watch once with its keys, a range of the sorted changes.
+ */
 static
-int create_key(litestore* ctx,
-               const char* key,
-               const size_t key_len,
-               const int data_type,
-               litestore_id_t* id)
+void watch_deliver(litestore* ctx, const size_t count)
 {
-    if (ctx->create_key)
+    const watch_entry* watch = ctx->watches;
+    for (; watch; watch = watch->next)
     {
-        sqlite3_reset(ctx->create_key);
-        if (sqlite3_bind_text(ctx->create_key,
-                              1, key, key_len,
-                              SQLITE_STATIC) != SQLITE_OK
-            || sqlite3_bind_int(ctx->create_key,
-                                2, data_type) != SQLITE_OK)
+        size_t first = 0;
+        size_t last = 0;
+        while (first < count
+               && !watch_matches(watch, &ctx->watch_list[first]))
         {
-            sqlite_error(ctx);
-            return LITESTORE_ERR;
+            ++first;
         }
-        if (sqlite3_step(ctx->create_key) != SQLITE_DONE)
+        last = first;
+        while (last < count && watch_matches(watch, &ctx->watch_list[last]))
         {
-            sqlite_error(ctx);
-            return LITESTORE_ERR;
+            ++last;
         }
-        if (id)
+        if (last > first)
         {
-            *id = sqlite3_last_insert_rowid(ctx->db);
+            (*watch->callback)(&ctx->watch_list[first], last - first,
+                               watch->user_data);
         }
-        return LITESTORE_OK;
     }
-    return LITESTORE_ERR;
 }
 
+/**
+ * Deliver the changes committed, at the end of the outermost API call
+ * outside of a transaction. Nothing was written if the total changes
+ * of the connection stayed the same. The callbacks may write, their
+ * changes are delivered after them.
+ */
 static
-int create_data(litestore* ctx, litestore_id_t new_id, void* value)
+void watch_notify(litestore* ctx)
 {
-    int rv = LITESTORE_ERR;
-
-    litestore_blob_t* blob = (litestore_blob_t*)value;
-    if (ctx->create_data && blob->data && blob->size > 0)
+    if (!ctx->watches || ctx->tx_active || ctx->bulk_active
+        || ctx->watch_delivering)
     {
-        if (sqlite3_bind_int64(ctx->create_data, 1, new_id) == SQLITE_OK
-            && sqlite3_bind_blob(ctx->create_data,
-                                 2, blob->data, blob->size,
-                                 SQLITE_STATIC) == SQLITE_OK
-            && sqlite3_step(ctx->create_data) == SQLITE_DONE)
-        {
-            rv = LITESTORE_OK;
-        }
-        else
+        return;
+    }
+    ctx->watch_delivering = 1;
+    while (sqlite3_total_changes(ctx->db) != ctx->watch_changes)
+    {
+        size_t count = 0;
+        const int rv = watch_read_changes(ctx, &count);
+        run_stmt(ctx, ctx->watch_clear);
+        ctx->watch_changes = sqlite3_total_changes(ctx->db);
+        if (rv == LITESTORE_OK)
         {
-            sqlite_error(ctx);
+            watch_deliver(ctx, count);
         }
-        sqlite3_reset(ctx->create_data);
     }
-    return rv;
+    ctx->watch_delivering = 0;
 }
 
-typedef struct
-{
+/*-----------------------------------------*/
+/*----------------- STATS -----------------*/
+/*-----------------------------------------*/
+static
+sqlite3_int64 now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (sqlite3_int64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * Log-linear buckets: values below 2^SUB_BITS have a bucket each,
+ * after that each power of two is split into 2^SUB_BITS buckets.
+ */
+#define HIST_SUB_BITS 3
+#define HIST_SUB_COUNT (1 << HIST_SUB_BITS)
+
+static
+int hist_bucket(const sqlite3_int64 value)
+{
+    int msb = 0;
+    int bucket = 0;
+
+    if (value < HIST_SUB_COUNT)
+    {
+        return value < 0 ? 0 : (int)value;
+    }
+    while ((value >> (msb + 1)) != 0)
+    {
+        ++msb;
+    }
+    bucket = (msb - HIST_SUB_BITS + 1) * HIST_SUB_COUNT
+        + (int)((value >> (msb - HIST_SUB_BITS)) & (HIST_SUB_COUNT - 1));
+    return bucket < LITESTORE_HISTOGRAM_BUCKETS
+        ? bucket : LITESTORE_HISTOGRAM_BUCKETS - 1;
+}
+
+/**
+ * @return The largest value of the bucket.
+ */
+static
+sqlite3_int64 hist_bucket_max(const int bucket)
+{
+    const int exp = bucket / HIST_SUB_COUNT;
+    const sqlite3_int64 sub = bucket % HIST_SUB_COUNT;
+
+    if (exp == 0)
+    {
+        return sub;
+    }
+    return ((HIST_SUB_COUNT + sub + 1) << (exp - 1)) - 1;
+}
+
+static
+void hist_record(litestore_histogram_t* h, const sqlite3_int64 value)
+{
+    ++h->count;
+    h->total_ns += value;
+    if (value > h->max_ns)
+    {
+        h->max_ns = value;
+    }
+    ++h->buckets[hist_bucket(value)];
+}
+
+static
+int db_status(litestore* ctx, const int op, const int reset)
+{
+    int current = 0;
+    int highwater = 0;
+    sqlite3_db_status(ctx->db, op, &current, &highwater, reset);
+    return current;
+}
+
+/**
+ * Move the page cache counters of the connection to the context.
+ * SQLite's counters are reset, so that the int counters do not wrap.
+ *
+ * @param op The operation to attribute to, -1 for none.
+ */
+static
+void io_collect(litestore* ctx, const int op)
+{
+    litestore_io_counters_t delta;
+    delta.cache_hit = db_status(ctx, SQLITE_DBSTATUS_CACHE_HIT, 1);
+    delta.cache_miss = db_status(ctx, SQLITE_DBSTATUS_CACHE_MISS, 1);
+    delta.cache_write = db_status(ctx, SQLITE_DBSTATUS_CACHE_WRITE, 1);
+#ifdef SQLITE_DBSTATUS_CACHE_SPILL
+    delta.cache_spill = db_status(ctx, SQLITE_DBSTATUS_CACHE_SPILL, 1);
+#else
+    delta.cache_spill = 0;
+#endif
+    ctx->io_total.cache_hit += delta.cache_hit;
+    ctx->io_total.cache_miss += delta.cache_miss;
+    ctx->io_total.cache_write += delta.cache_write;
+    ctx->io_total.cache_spill += delta.cache_spill;
+    if (op >= 0)
+    {
+        ctx->io_ops[op].cache_hit += delta.cache_hit;
+        ctx->io_ops[op].cache_miss += delta.cache_miss;
+        ctx->io_ops[op].cache_write += delta.cache_write;
+        ctx->io_ops[op].cache_spill += delta.cache_spill;
+    }
+}
+
+/**
+ * Mark the start of an operation.
+ *
+ * @param name Logical name of the operation, reported by tracing.
+ */
+static
+void op_begin(litestore* ctx, const char* name)
+{
+    if (ctx)
+    {
+        if (ctx->op_depth < MAX_OP_DEPTH)
+        {
+            ctx->op_names[ctx->op_depth] = name;
+        }
+        if (ctx->op_depth++ == 0)
+        {
+            io_collect(ctx, -1);
+            ctx->lock_wait_ns = 0;
+            ctx->op_begin_ns = now_ns();
+        }
+    }
+}
+
+static
+void op_end(litestore* ctx, const int op)
+{
+    if (ctx && --ctx->op_depth == 0)
+    {
+        const sqlite3_int64 elapsed = now_ns() - ctx->op_begin_ns;
+        hist_record(&ctx->stats.exec[op], elapsed - ctx->lock_wait_ns);
+        hist_record(&ctx->stats.lock_wait[op], ctx->lock_wait_ns);
+        io_collect(ctx, op);
+        watch_notify(ctx);
+    }
+}
+
+/**
+ * @return Name of the innermost operation running.
+ */
+static
+const char* op_name(litestore* ctx)
+{
+    if (ctx->op_depth == 0)
+    {
+        return "open";
+    }
+    return ctx->op_names[ctx->op_depth <= MAX_OP_DEPTH
+                         ? ctx->op_depth - 1 : MAX_OP_DEPTH - 1];
+}
+
+/**
+ * Busy handler, waits up to opts.busy_timeout for a lock and
+ * accounts the wait to the current operation.
+ */
+static
+int busy_wait(void* data, int count)
+{
+    static const int delays[] = {1, 2, 5, 10, 15, 20, 25, 25, 25, 50, 50};
+    static const int delay_count = sizeof(delays) / sizeof(delays[0]);
+    litestore* ctx = (litestore*)data;
+    const sqlite3_int64 now = now_ns();
+    sqlite3_int64 waited = 0;
+    int delay = count < delay_count ? delays[count] : 100;
+
+    if (count == 0)
+    {
+        ctx->busy_begin_ns = now;
+    }
+    waited = (now - ctx->busy_begin_ns) / 1000000;
+    if (waited >= ctx->opts.busy_timeout)
+    {
+        return 0;
+    }
+    if (waited + delay > ctx->opts.busy_timeout)
+    {
+        delay = (int)(ctx->opts.busy_timeout - waited);
+    }
+    sqlite3_sleep(delay);
+    ctx->lock_wait_ns += now_ns() - now;
+    return 1;
+}
+
+/*-----------------------------------------*/
+/*----------------- TRACE -----------------*/
+/*-----------------------------------------*/
+static
+int trace_slot(litestore* ctx, sqlite3_stmt* stmt)
+{
+    int i = 0;
+    for (i = 0; i < TRACE_SLOTS; ++i)
+    {
+        if (ctx->trace_stmts[i] == stmt)
+        {
+            return i;
+        }
+    }
+    for (i = 0; i < TRACE_SLOTS; ++i)
+    {
+        if (!ctx->trace_stmts[i])
+        {
+            ctx->trace_stmts[i] = stmt;
+            ctx->trace_rows[i] = 0;
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * sqlite3_trace_v2 callback, counts rows and reports finished statements.
+ */
+static
+int trace_stmt(unsigned event, void* data, void* p, void* x)
+{
+    litestore* ctx = (litestore*)data;
+    sqlite3_stmt* stmt = (sqlite3_stmt*)p;
+    const int slot = trace_slot(ctx, stmt);
+
+    if (event == SQLITE_TRACE_ROW)
+    {
+        if (slot >= 0)
+        {
+            ++ctx->trace_rows[slot];
+        }
+    }
+    else if (event == SQLITE_TRACE_PROFILE)
+    {
+        litestore_trace_info info;
+        info.operation = op_name(ctx);
+        info.sql = sqlite3_sql(stmt);
+        info.elapsed_ns = *(sqlite3_int64*)x;
+        info.rows = slot >= 0 ? ctx->trace_rows[slot] : 0;
+        info.vm_steps =
+            sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_VM_STEP, 1);
+        info.sorts = sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_SORT, 1);
+        info.fullscan_steps =
+            sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_FULLSCAN_STEP, 1);
+        if (slot >= 0)
+        {
+            ctx->trace_stmts[slot] = NULL;
+        }
+        (*ctx->opts.trace_callback)(&info, ctx->opts.trace_user_data);
+    }
+    return 0;
+}
+
+
+/**
+ * A bulk load only appends, other writes would run without the foreign
+ * keys and indexes it drops.
+ *
+ * @return 1 if writes are refused (boolean value)
+ */
+static
+int bulk_blocks(const litestore* ctx)
+{
+    return ctx->bulk_active && !ctx->bulk_appending;
+}
+
+/**
+ * @return 1 on success, 0 on error (boolean value)
+ */
+static
+int opt_begin_tx(litestore* ctx)
+{
+    if (!ctx->tx_active && litestore_begin_tx(ctx) == LITESTORE_OK)
+    {
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @return Return value of the tx function called.
+ */
+static
+int opt_end_tx(litestore* ctx, int status)
+{
+    if (status == LITESTORE_OK)
+    {
+        return litestore_commit_tx(ctx);
+    }
+    return litestore_rollback_tx(ctx);
+}
+
+
+/*-----------------------------------------*/
+/*----------------- MEMORY ----------------*/
+/*-----------------------------------------*/
+/* Process wide settings given to SQLite, @see configure_process */
+static const litestore_allocator* g_allocator = NULL;
+static const void* g_page_cache = NULL;
+static sqlite3_mem_methods g_default_methods;
+/* Bytes allocated through g_allocator, enforced against g_hard_limit. */
+static sqlite3_int64 g_heap_used = 0;
+static sqlite3_int64 g_hard_limit = 0;
+
+/* Blocks given to SQLite are prefixed with their size (for xSize),
+   the prefix also keeps the 8 byte alignment. */
+#define MEM_PREFIX sizeof(sqlite3_int64)
+
+/* The context is padded so that the lookaside slab stays aligned. */
+#define CTX_SIZE ((sizeof(litestore) + 7) & ~((size_t)7))
+
+static
+void* system_malloc(size_t size, void* user_data)
+{
+    UNUSED(user_data);
+    return malloc(size);
+}
+
+static
+void* system_realloc(void* ptr, size_t size, void* user_data)
+{
+    UNUSED(user_data);
+    return realloc(ptr, size);
+}
+
+static
+void system_free(void* ptr, void* user_data)
+{
+    UNUSED(user_data);
+    free(ptr);
+}
+
+/* Used to enforce the hard heap limit when no allocator is given. */
+static const litestore_allocator g_system_allocator = {
+    &system_malloc, &system_realloc, &system_free, NULL
+};
+
+static
+void* mem_alloc(const litestore_allocator* a, const size_t size)
+{
+    return a ? (*a->malloc_fn)(size, a->user_data) : malloc(size);
+}
+
+static
+void mem_release(const litestore_allocator* a, void* ptr)
+{
+    if (a)
+    {
+        (*a->free_fn)(ptr, a->user_data);
+    }
+    else
+    {
+        free(ptr);
+    }
+}
+
+/**
+ * Account for delta bytes of heap.
+ * @return 1 if within the hard limit, 0 otherwise (nothing accounted).
+ */
+static
+int heap_reserve(const sqlite3_int64 delta)
+{
+    const sqlite3_int64 used = __sync_add_and_fetch(&g_heap_used, delta);
+    if (delta > 0 && g_hard_limit > 0 && used > g_hard_limit)
+    {
+        __sync_sub_and_fetch(&g_heap_used, delta);
+        return 0;
+    }
+    return 1;
+}
+
+static
+void* sqlite_malloc(int size)
+{
+    if (heap_reserve(size))
+    {
+        sqlite3_int64* p = (sqlite3_int64*)
+            (*g_allocator->malloc_fn)(MEM_PREFIX + size,
+                                      g_allocator->user_data);
+        if (p)
+        {
+            *p = size;
+            return p + 1;
+        }
+        heap_reserve(-size);
+    }
+    return NULL;
+}
+
+static
+void sqlite_free(void* ptr)
+{
+    if (ptr)
+    {
+        sqlite3_int64* p = (sqlite3_int64*)ptr - 1;
+        heap_reserve(-*p);
+        (*g_allocator->free_fn)(p, g_allocator->user_data);
+    }
+}
+
+static
+void* sqlite_realloc(void* ptr, int size)
+{
+    const sqlite3_int64 old_size = *((sqlite3_int64*)ptr - 1);
+    if (heap_reserve(size - old_size))
+    {
+        sqlite3_int64* p = (sqlite3_int64*)
+            (*g_allocator->realloc_fn)((sqlite3_int64*)ptr - 1,
+                                       MEM_PREFIX + size,
+                                       g_allocator->user_data);
+        if (p)
+        {
+            *p = size;
+            return p + 1;
+        }
+        heap_reserve(old_size - size);
+    }
+    return NULL;
+}
+
+static
+int sqlite_size(void* ptr)
+{
+    return ptr ? (int)*((sqlite3_int64*)ptr - 1) : 0;
+}
+
+static
+int sqlite_roundup(int size)
+{
+    return (size + 7) & ~7;
+}
+
+static
+int sqlite_mem_init(void* app_data)
+{
+    UNUSED(app_data);
+    return SQLITE_OK;
+}
+
+static
+void sqlite_mem_shutdown(void* app_data)
+{
+    UNUSED(app_data);
+}
+
+static
+size_t lookaside_size(const litestore_opts* opts)
+{
+    if (opts->lookaside_slot_size > 0 && opts->lookaside_slots > 0)
+    {
+        return (size_t)opts->lookaside_slot_size
+            * (size_t)opts->lookaside_slots;
+    }
+    return 0;
+}
+
+/**
+ * Apply the process wide memory options.
+ * SQLite accepts these only before it is initialized, repeating
+ * the already applied values is fine.
+ */
+static
+int configure_process(litestore* ctx)
+{
+    static sqlite3_mem_methods methods = {
+        &sqlite_malloc, &sqlite_free, &sqlite_realloc, &sqlite_size,
+        &sqlite_roundup, &sqlite_mem_init, &sqlite_mem_shutdown, NULL
+    };
+    const litestore_opts* opts = &ctx->opts;
+    /* the hard limit is enforced by the allocator hooks */
+    const litestore_allocator* allocator =
+        opts->allocator ? opts->allocator
+        : (opts->hard_heap_limit > 0 && !g_allocator) ? &g_system_allocator
+        : NULL;
+
+    if (allocator && allocator != g_allocator)
+    {
+        sqlite3_mem_methods defaults;
+        if (sqlite3_config(SQLITE_CONFIG_GETMALLOC, &defaults) != SQLITE_OK
+            || sqlite3_config(SQLITE_CONFIG_MALLOC, &methods) != SQLITE_OK)
+        {
+            report_error(ctx, SQLITE_MISUSE,
+                         "allocator must be set before SQLite is used");
+            return LITESTORE_ERR;
+        }
+        if (!g_allocator)
+        {
+            g_default_methods = defaults;
+        }
+        g_allocator = allocator;
+    }
+    if (opts->page_cache && opts->page_cache != g_page_cache)
+    {
+        if (sqlite3_config(SQLITE_CONFIG_PAGECACHE,
+                           opts->page_cache,
+                           opts->page_cache_slot_size,
+                           opts->page_cache_slots) != SQLITE_OK)
+        {
+            report_error(ctx, SQLITE_MISUSE,
+                         "page cache must be set before SQLite is used");
+            return LITESTORE_ERR;
+        }
+        g_page_cache = opts->page_cache;
+    }
+    if (opts->hard_heap_limit > 0)
+    {
+        g_hard_limit = opts->hard_heap_limit;
+    }
+    if (opts->soft_heap_limit > 0)
+    {
+        sqlite3_soft_heap_limit64(opts->soft_heap_limit);
+    }
+
+    return LITESTORE_OK;
+}
+
+/**
+ * Apply the per connection memory options.
+ * Must be called right after open, before the connection is used.
+ */
+static
+int configure_connection(litestore* ctx)
+{
+    if (ctx->lookaside
+        && sqlite3_db_config(ctx->db, SQLITE_DBCONFIG_LOOKASIDE,
+                             ctx->lookaside,
+                             ctx->opts.lookaside_slot_size,
+                             ctx->opts.lookaside_slots) != SQLITE_OK)
+    {
+        sqlite_error(ctx);
+        return LITESTORE_ERR;
+    }
+    return LITESTORE_OK;
+}
+
+/**
+ * Shrink the page cache if the connection is over its memory budget.
+ * Called at the end of each transaction, when no pages are in use.
+ */
+static
+void enforce_memory_budget(litestore* ctx)
+{
+    if (ctx->opts.memory_budget > 0
+        && (db_status(ctx, SQLITE_DBSTATUS_CACHE_USED, 0)
+            + db_status(ctx, SQLITE_DBSTATUS_STMT_USED, 0))
+        > ctx->opts.memory_budget)
+    {
+        sqlite3_db_release_memory(ctx->db);
+        ++ctx->budget_releases;
+    }
+}
+
+
+/*-----------------------------------------*/
+/*----------------- INIT ------------------*/
+/*-----------------------------------------*/
+/**
+ * Run "PRAGMA name = value;", if value is non zero.
+ */
+static
+int set_pragma(litestore* ctx, const char* name, const sqlite3_int64 value)
+{
+    if (value != 0)
+    {
+        char sql[64];
+        sqlite3_snprintf(sizeof(sql), sql, "PRAGMA %s = %lld;", name, value);
+        if (sqlite3_exec(ctx->db, sql, NULL, NULL, NULL) != SQLITE_OK)
+        {
+            sqlite_error(ctx);
+            return LITESTORE_ERR;
+        }
+    }
+    return LITESTORE_OK;
+}
+
+static
+int init_db(litestore* ctx)
+{
+    /* the cache fits the memory budget, unless sized explicitly; KiB
+       rounded up, -0 would be the default cache */
+    const sqlite3_int64 cache_size =
+        ctx->opts.cache_size ? ctx->opts.cache_size
+        : -((ctx->opts.memory_budget + 1023) / 1024);
+
+    if (ctx->opts.busy_timeout > 0)
+    {
+        sqlite3_busy_handler(ctx->db, &busy_wait, ctx);
+    }
+    if (ctx->opts.trace_callback)
+    {
+        sqlite3_trace_v2(ctx->db, SQLITE_TRACE_PROFILE | SQLITE_TRACE_ROW,
+                         &trace_stmt, ctx);
+    }
+
+    /* page_size must precede the schema, it only affects new stores */
+    if (set_pragma(ctx, "page_size", ctx->opts.page_size) == LITESTORE_OK
+        && set_pragma(ctx, "cache_size", cache_size) == LITESTORE_OK
+        && set_pragma(ctx, "mmap_size", ctx->opts.mmap_size)
+        == LITESTORE_OK
+        && sqlite3_exec(ctx->db, LITESTORE_SCHEMA_V1, NULL, NULL, NULL)
+        == SQLITE_OK)
+    {
+        /* @note For some reason the pragma won't work if run
+           inside the same TX as schema. */
+        return (sqlite3_exec(ctx->db, "PRAGMA foreign_keys = ON;",
+                             NULL, NULL, NULL)
+                == SQLITE_OK) ? LITESTORE_OK : LITESTORE_ERR;
+    }
+    return LITESTORE_ERR;
+}
+
+static
+int prepare_stmt(litestore* ctx, const char* sql, sqlite3_stmt** stmt)
+{
+    if (sqlite3_prepare_v2(ctx->db, sql, -1, stmt, NULL) != SQLITE_OK)
+    {
+        return LITESTORE_ERR;
+    }
+    return LITESTORE_OK;
+}
+
+/**
+ * The transaction statements are needed for updating the schema,
+ * before the other statements can be prepared.
+ */
+static
+int prepare_tx_statements(litestore* ctx)
+{
+    if (prepare_stmt(ctx,
+                     "BEGIN IMMEDIATE TRANSACTION;",
+                     &(ctx->begin_tx)) != LITESTORE_OK
+        || prepare_stmt(ctx,
+                        "COMMIT TRANSACTION;",
+                        &(ctx->commit_tx)) != LITESTORE_OK
+        || prepare_stmt(ctx,
+                        "ROLLBACK TRANSACTION;",
+                        &(ctx->rollback_tx)) != LITESTORE_OK)
+    {
+        sqlite_error(ctx);
+        return LITESTORE_ERR;
+    }
+
+    return LITESTORE_OK;
+}
+
+/**
+ * SQL function litestore_capture(value, type), returns the value.
+ * Keeps the value for the caller of the statement, in place of RETURNING.
+ * Fails the statement if the value is not of the (SQLite) type,
+ * e.g. an integer overflowed to a float.
+ */
+static
+void capture_number(sqlite3_context* sctx, int argc, sqlite3_value** argv)
+{
+    litestore* ctx = (litestore*)sqlite3_user_data(sctx);
+    UNUSED(argc);
+
+    if (sqlite3_value_type(argv[0]) != sqlite3_value_int(argv[1]))
+    {
+        sqlite3_result_error(sctx, "numeric overflow", -1);
+        return;
+    }
+    ctx->captured_int = sqlite3_value_int64(argv[0]);
+    ctx->captured_float = sqlite3_value_double(argv[0]);
+    sqlite3_result_value(sctx, argv[0]);
+}
+
+static
+int register_functions(litestore* ctx)
+{
+    if (sqlite3_create_function(ctx->db, "litestore_capture", 2, SQLITE_UTF8,
+                                ctx, &capture_number, NULL, NULL)
+        != SQLITE_OK)
+    {
+        sqlite_error(ctx);
+        return LITESTORE_ERR;
+    }
+    return LITESTORE_OK;
+}
+
+static
+int prepare_statements(litestore* ctx)
+{
+    /* object */
+    if (prepare_stmt(ctx,
+                     "INSERT INTO objects (name, type) VALUES (?, ?);",
+                     &(ctx->create_key)) != LITESTORE_OK
+        || prepare_stmt(ctx,
+                        "SELECT o.id, o.type, e.expires_at FROM objects o"
+                        " LEFT JOIN expiry e ON e.id = o.id"
+                        " WHERE o.name = ?;",
+                        &(ctx->read_key)) != LITESTORE_OK
+        || prepare_stmt(ctx,
+                        "DELETE FROM objects WHERE name = ?;",
+                        &(ctx->delete_key)) != LITESTORE_OK
+        || prepare_stmt(ctx,
+                        "UPDATE objects SET type = ? WHERE id = ?;",
+                        &(ctx->update_type)) != LITESTORE_OK
+        || prepare_stmt(ctx,
+                        "SELECT o.name, o.type FROM objects o"
+                        " LEFT JOIN expiry e ON e.id = o.id"
+                        " WHERE o.name GLOB ?"
+                        " AND (e.expires_at IS NULL OR e.expires_at > ?);",
+                        &(ctx->read_keys)) != LITESTORE_OK
+        || prepare_stmt(ctx,
+                        "SELECT o.name, o.type FROM objects o"
+                        " LEFT JOIN expiry e ON e.id = o.id"
+                        " WHERE o.name >= ? AND o.name < ?"
+                        " AND (e.expires_at IS NULL OR e.expires_at > ?)"
+                        " ORDER BY o.name;",
+                        &(ctx->read_key_range)) != LITESTORE_OK
+        /* raw */
+        || prepare_stmt(ctx,
+                        "INSERT INTO raw_data"
+                        " (id, raw_value, codec, raw_size, shared, logged)"
+                        " VALUES (?, ?, ?, ?, ?, ?);",
+                        &(ctx->create_data)) != LITESTORE_OK
+        || prepare_stmt(ctx,
+                        "SELECT " RAW_VALUE_COLUMNS ","
+                        " EXISTS (SELECT 1 FROM merge_operands m"
+                        "         WHERE m.id = r.id)"
+                        " FROM raw_data r "
+                        RAW_VALUE_JOIN " WHERE r.id = ?;",
+                        &(ctx->read_data)) != LITESTORE_OK
+        || prepare_stmt(ctx,
+                        "UPDATE raw_data SET raw_value = ?, codec = ?,"
+                        " raw_size = ?, shared = ?, logged = ? WHERE id = ?;",
+                        &(ctx->update_data)) != LITESTORE_OK
+        || prepare_stmt(ctx,
+                        "DELETE FROM raw_data WHERE id = ?;",
+                        &(ctx->delete_data)) != LITESTORE_OK
+        /* dedup */
+        || prepare_stmt(ctx,
+                        "SELECT id FROM shared_data WHERE hash = ?;",
+                        &(ctx->find_shared)) != LITESTORE_OK
+        || prepare_stmt(ctx,
+                        "INSERT INTO shared_data"
+                        " (hash, raw_value, codec, raw_size)"
+                        " VALUES (?, ?, ?, ?);",
+                        &(ctx->create_shared)) != LITESTORE_OK
+        /* value log */
+        || prepare_stmt(ctx,
+                        "SELECT max(id) FROM value_segments;",
+                        &(ctx->active_segment)) != LITESTORE_OK
+        || prepare_stmt(ctx,
+                        "UPDATE value_segments SET size = ? WHERE id = ?;",
+                        &(ctx->update_segment)) != LITESTORE_OK
+        || prepare_stmt(ctx,
+                        "INSERT INTO value_log"
+                        " (segment, position, length, checksum)"
+                        " VALUES (?, ?, ?, ?);",
+                        &(ctx->create_logged)) != LITESTORE_OK
+        /* kv */
+        || prepare_stmt(ctx,
+                        "INSERT OR REPLACE INTO kv_data (id, kv_key, kv_value)"
+                        " VALUES (?, ?, ?);",
+                        &(ctx->set_field)) != LITESTORE_OK
+        || prepare_stmt(ctx,
+                        "SELECT kv_value FROM kv_data"
+                        " WHERE id = ? AND kv_key = ?;",
+                        &(ctx->read_field)) != LITESTORE_OK
+        || prepare_stmt(ctx,
+                        "SELECT kv_key, kv_value FROM kv_data"
+                        " WHERE id = ? ORDER BY kv_key;",
+                        &(ctx->read_fields)) != LITESTORE_OK
+        || prepare_stmt(ctx,
+                        "DELETE FROM kv_data WHERE id = ? AND kv_key = ?;",
+                        &(ctx->delete_field)) != LITESTORE_OK
+        || prepare_stmt(ctx,
+                        "DELETE FROM kv_data WHERE id = ?;",
+                        &(ctx->delete_fields)) != LITESTORE_OK
+        /* array, max() is a single seek to the end of the object */
+        || prepare_stmt(ctx,
+                        "SELECT max(array_index) FROM array_data"
+                        " WHERE id = ?;",
+                        &(ctx->array_length)) != LITESTORE_OK
+        || prepare_stmt(ctx,
+                        "INSERT INTO array_data (id, array_index, array_value)"
+                        " VALUES (?, ?, ?);",
+                        &(ctx->append_item)) != LITESTORE_OK
+        || prepare_stmt(ctx,
+                        "SELECT array_value FROM array_data"
+                        " WHERE id = ? AND array_index = ?;",
+                        &(ctx->read_item)) != LITESTORE_OK
+        || prepare_stmt(ctx,
+                        "SELECT array_index, array_value FROM array_data"
+                        " WHERE id = ? AND array_index >= ?"
+                        " ORDER BY array_index LIMIT ?;",
+                        &(ctx->read_items)) != LITESTORE_OK
+        || prepare_stmt(ctx,
+                        "UPDATE array_data SET array_value = ?"
+                        " WHERE id = ? AND array_index = ?;",
+                        &(ctx->update_item)) != LITESTORE_OK
+        || prepare_stmt(ctx,
+                        "DELETE FROM array_data"
+                        " WHERE id = ? AND array_index >= ?;",
+                        &(ctx->delete_items)) != LITESTORE_OK
+        /* numbers */
+        || prepare_stmt(ctx,
+                        "INSERT OR REPLACE INTO num_data (id, num_value)"
+                        " VALUES (?, ?);",
+                        &(ctx->set_num)) != LITESTORE_OK
+        || prepare_stmt(ctx,
+                        "SELECT num_value FROM num_data WHERE id = ?;",
+                        &(ctx->read_num)) != LITESTORE_OK
+        || prepare_stmt(ctx,
+                        "DELETE FROM num_data WHERE id = ?;",
+                        &(ctx->delete_num)) != LITESTORE_OK
+        || prepare_stmt(ctx,
+                        "UPDATE num_data"
+                        " SET num_value = litestore_capture(num_value + ?, ?)"
+                        " WHERE id = (SELECT o.id FROM objects o"
+                        "             LEFT JOIN expiry e ON e.id = o.id"
+                        "             WHERE o.name = ? AND o.type = ?"
+                        "             AND (e.expires_at IS NULL"
+                        "                  OR e.expires_at > ?));",
+                        &(ctx->incr_num)) != LITESTORE_OK
+        /* merge */
+        || prepare_stmt(ctx,
+                        "INSERT INTO merge_operands (id, operator, operand)"
+                        " VALUES (?, ?, ?);",
+                        &(ctx->create_operand)) != LITESTORE_OK
+        || prepare_stmt(ctx,
+                        "SELECT operator, operand FROM merge_operands"
+                        " WHERE id = ? ORDER BY seq;",
+                        &(ctx->read_operands)) != LITESTORE_OK
+        || prepare_stmt(ctx,
+                        "DELETE FROM merge_operands WHERE id = ?;",
+                        &(ctx->delete_operands)) != LITESTORE_OK
+        || prepare_stmt(ctx,
+                        "SELECT id FROM merge_operands"
+                        " WHERE id > ? ORDER BY id LIMIT 1;",
+                        &(ctx->next_merged)) != LITESTORE_OK
+        /* expiry */
+        || prepare_stmt(ctx,
+                        "INSERT OR REPLACE INTO expiry (id, expires_at)"
+                        " VALUES (?, ?);",
+                        &(ctx->set_expiry)) != LITESTORE_OK
+        || prepare_stmt(ctx,
+                        "DELETE FROM expiry WHERE id = ?;",
+                        &(ctx->delete_expiry)) != LITESTORE_OK
+        || prepare_stmt(ctx,
+                        "SELECT id FROM expiry WHERE expires_at <= ?"
+                        " ORDER BY expires_at LIMIT 1;",
+                        &(ctx->next_expired)) != LITESTORE_OK
+        || prepare_stmt(ctx,
+                        "DELETE FROM objects WHERE name = ?"
+                        " AND EXISTS (SELECT 1 FROM expiry e"
+                        "             WHERE e.id = objects.id"
+                        "             AND e.expires_at <= ?);",
+                        &(ctx->purge_key)) != LITESTORE_OK
+        || prepare_stmt(ctx,
+                        "DELETE FROM objects WHERE id = ?;",
+                        &(ctx->delete_id)) != LITESTORE_OK
+        /* secondary indexes */
+        || prepare_stmt(ctx,
+                        "INSERT OR IGNORE INTO value_index (idx, term, id)"
+                        " VALUES (?, ?, ?);",
+                        &(ctx->add_term)) != LITESTORE_OK
+        || prepare_stmt(ctx,
+                        "DELETE FROM value_index WHERE id = ?;",
+                        &(ctx->delete_terms)) != LITESTORE_OK
+        || prepare_stmt(ctx,
+                        "SELECT o.name, o.type FROM value_index v"
+                        " JOIN objects o ON o.id = v.id"
+                        " LEFT JOIN expiry e ON e.id = o.id"
+                        " WHERE v.idx = ? AND v.term = ?"
+                        " AND (e.expires_at IS NULL OR e.expires_at > ?)"
+                        " ORDER BY v.id;",
+                        &(ctx->index_find)) != LITESTORE_OK
+        || prepare_stmt(ctx,
+                        "SELECT o.name, o.type FROM value_index v"
+                        " JOIN objects o ON o.id = v.id"
+                        " LEFT JOIN expiry e ON e.id = o.id"
+                        " WHERE v.idx = ?1 AND v.term >= ?2"
+                        " AND (?3 IS NULL OR v.term < ?3)"
+                        " AND (e.expires_at IS NULL OR e.expires_at > ?4)"
+                        " ORDER BY v.term, v.id;",
+                        &(ctx->index_range)) != LITESTORE_OK
+        || prepare_stmt(ctx,
+                        "SELECT id FROM raw_data"
+                        " WHERE id > ? ORDER BY id LIMIT 1;",
+                        &(ctx->next_raw)) != LITESTORE_OK
+        /* json, validated and minified by json() */
+        || prepare_stmt(ctx,
+                        "INSERT OR REPLACE INTO json_data (id, doc)"
+                        " VALUES (?, json(?));",
+                        &(ctx->set_json)) != LITESTORE_OK
+        || prepare_stmt(ctx,
+                        "SELECT doc FROM json_data WHERE id = ?;",
+                        &(ctx->read_json)) != LITESTORE_OK
+        || prepare_stmt(ctx,
+                        "SELECT json_type(doc, ?2),"
+                        " json_quote(json_extract(doc, ?2))"
+                        " FROM json_data WHERE id = ?1;",
+                        &(ctx->read_json_path)) != LITESTORE_OK
+        || prepare_stmt(ctx,
+                        "DELETE FROM json_data WHERE id = ?;",
+                        &(ctx->delete_json)) != LITESTORE_OK)
+    {
+        sqlite_error(ctx);
+        return LITESTORE_ERR;
+    }
+
+    return LITESTORE_OK;
+}
+
+static
+int update_version_from(litestore* ctx, int version_in_db)
+{
+    int rv = LITESTORE_OK;
+
+    while (version_in_db != LITESTORE_CURRENT_VERSION && rv == LITESTORE_OK)
+    {
+        switch (version_in_db)
+        {
+            case 0:
+            {
+                const char* stmt =
+                    "INSERT INTO meta (schema_version) VALUES (1);";
+                if (sqlite3_exec(ctx->db, stmt, NULL, NULL, NULL)
+                    == SQLITE_OK)
+                {
+                    version_in_db = 1;
+                }
+                else
+                {
+                    sqlite_error(ctx);
+                    rv = LITESTORE_ERR;
+                }
+            }
+            break;
+
+            case 1:
+            {
+                if (sqlite3_exec(ctx->db, LITESTORE_SCHEMA_V2,
+                                 NULL, NULL, NULL) == SQLITE_OK)
+                {
+                    version_in_db = 2;
+                }
+                else
+                {
+                    sqlite_error(ctx);
+                    rv = LITESTORE_ERR;
+                }
+            }
+            break;
+
+            case 2:
+            {
+                if (sqlite3_exec(ctx->db, LITESTORE_SCHEMA_V3,
+                                 NULL, NULL, NULL) == SQLITE_OK)
+                {
+                    version_in_db = 3;
+                }
+                else
+                {
+                    sqlite_error(ctx);
+                    rv = LITESTORE_ERR;
+                }
+            }
+            break;
+
+            case 3:
+            {
+                if (sqlite3_exec(ctx->db, LITESTORE_SCHEMA_V4,
+                                 NULL, NULL, NULL) == SQLITE_OK)
+                {
+                    version_in_db = 4;
+                }
+                else
+                {
+                    sqlite_error(ctx);
+                    rv = LITESTORE_ERR;
+                }
+            }
+            break;
+
+            case 4:
+            {
+                if (sqlite3_exec(ctx->db, LITESTORE_SCHEMA_V5,
+                                 NULL, NULL, NULL) == SQLITE_OK)
+                {
+                    version_in_db = 5;
+                }
+                else
+                {
+                    sqlite_error(ctx);
+                    rv = LITESTORE_ERR;
+                }
+            }
+            break;
+
+            case 5:
+            {
+                if (sqlite3_exec(ctx->db, LITESTORE_SCHEMA_V6,
+                                 NULL, NULL, NULL) == SQLITE_OK)
+                {
+                    version_in_db = 6;
+                }
+                else
+                {
+                    sqlite_error(ctx);
+                    rv = LITESTORE_ERR;
+                }
+            }
+            break;
+
+            case 6:
+            {
+                if (sqlite3_exec(ctx->db, LITESTORE_SCHEMA_V7,
+                                 NULL, NULL, NULL) == SQLITE_OK)
+                {
+                    version_in_db = 7;
+                }
+                else
+                {
+                    sqlite_error(ctx);
+                    rv = LITESTORE_ERR;
+                }
+            }
+            break;
+
+            case 7:
+            {
+                if (sqlite3_exec(ctx->db, LITESTORE_SCHEMA_V8,
+                                 NULL, NULL, NULL) == SQLITE_OK)
+                {
+                    version_in_db = 8;
+                }
+                else
+                {
+                    sqlite_error(ctx);
+                    rv = LITESTORE_ERR;
+                }
+            }
+            break;
+
+            case 8:
+            {
+                if (sqlite3_exec(ctx->db, LITESTORE_SCHEMA_V9,
+                                 NULL, NULL, NULL) == SQLITE_OK)
+                {
+                    version_in_db = 9;
+                }
+                else
+                {
+                    sqlite_error(ctx);
+                    rv = LITESTORE_ERR;
+                }
+            }
+            break;
+
+            case 9:
+            {
+                if (sqlite3_exec(ctx->db, LITESTORE_SCHEMA_V10,
+                                 NULL, NULL, NULL) == SQLITE_OK)
+                {
+                    version_in_db = 10;
+                }
+                else
+                {
+                    sqlite_error(ctx);
+                    rv = LITESTORE_ERR;
+                }
+            }
+            break;
+            case 10:
+            {
+                if (sqlite3_exec(ctx->db, LITESTORE_SCHEMA_V11,
+                                 NULL, NULL, NULL) == SQLITE_OK)
+                {
+                    version_in_db = 11;
+                }
+                else
+                {
+                    sqlite_error(ctx);
+                    rv = LITESTORE_ERR;
+                }
+            }
+            break;
+            case 11:
+            {
+                if (sqlite3_exec(ctx->db, LITESTORE_SCHEMA_V12,
+                                 NULL, NULL, NULL) == SQLITE_OK)
+                {
+                    version_in_db = 12;
+                }
+                else
+                {
+                    sqlite_error(ctx);
+                    rv = LITESTORE_ERR;
+                }
+            }
+            break;
+            case 12:
+            {
+                if (sqlite3_exec(ctx->db, LITESTORE_SCHEMA_V13,
+                                 NULL, NULL, NULL) == SQLITE_OK)
+                {
+                    version_in_db = 13;
+                }
+                else
+                {
+                    sqlite_error(ctx);
+                    rv = LITESTORE_ERR;
+                }
+            }
+            break;
+            case 13:
+            {
+                if (sqlite3_exec(ctx->db, LITESTORE_SCHEMA_V14,
+                                 NULL, NULL, NULL) == SQLITE_OK)
+                {
+                    version_in_db = 14;
+                }
+                else
+                {
+                    sqlite_error(ctx);
+                    rv = LITESTORE_ERR;
+                }
+            }
+            break;
+
+            default:
+                rv = LITESTORE_UNSUPPORTED_VERSION;
+                break;
+        }
+    }
+
+    return rv;
+}
+
+static
+int version_update(litestore* ctx)
+{
+    int rv = LITESTORE_ERR;
+
+    if (opt_begin_tx(ctx))
+    {
+        sqlite3_stmt* read_version = NULL;
+        const char* stmt = "SELECT schema_version FROM meta;";
+        if (sqlite3_prepare_v2(ctx->db, stmt, strlen(stmt), &read_version, NULL)
+            == SQLITE_OK)
+        {
+            if (sqlite3_step(read_version) == SQLITE_ROW)
+            {
+                const int version = sqlite3_column_int(read_version, 0);
+                if (version < LITESTORE_CURRENT_VERSION)
+                {
+                    rv = update_version_from(ctx, version);
+                }
+                else if (version > LITESTORE_CURRENT_VERSION)
+                {
+                    rv = LITESTORE_UNSUPPORTED_VERSION;
+                }
+            }
+            else
+            {
+                rv = update_version_from(ctx, 0);
+            }
+            sqlite3_finalize(read_version);
+        }
+        else
+        {
+            sqlite_error(ctx);
+        }
+
+        rv = opt_end_tx(ctx, rv);
+    }
+
+    return rv;
+}
+
+static
+void finalize_stmt(sqlite3_stmt** stmt)
+{
+    sqlite3_finalize(*stmt);
+    *stmt = NULL;
+}
+
+static
+int finalize_statements(litestore* ctx)
+{
+    /* key */
+    finalize_stmt(&(ctx->create_key));
+    finalize_stmt(&(ctx->read_key));
+    finalize_stmt(&(ctx->delete_key));
+    finalize_stmt(&(ctx->update_type));
+    finalize_stmt(&(ctx->read_keys));
+    finalize_stmt(&(ctx->read_key_range));
+    /* tx */
+    finalize_stmt(&(ctx->begin_tx));
+    finalize_stmt(&(ctx->commit_tx));
+    finalize_stmt(&(ctx->rollback_tx));
+    /* object */
+    finalize_stmt(&(ctx->create_data));
+    finalize_stmt(&(ctx->read_data));
+    finalize_stmt(&(ctx->update_data));
+    finalize_stmt(&(ctx->delete_data));
+    /* dedup */
+    finalize_stmt(&(ctx->find_shared));
+    finalize_stmt(&(ctx->create_shared));
+    /* value log */
+    finalize_stmt(&(ctx->active_segment));
+    finalize_stmt(&(ctx->update_segment));
+    finalize_stmt(&(ctx->create_logged));
+    /* kv */
+    finalize_stmt(&(ctx->set_field));
+    finalize_stmt(&(ctx->read_field));
+    finalize_stmt(&(ctx->read_fields));
+    finalize_stmt(&(ctx->delete_field));
+    finalize_stmt(&(ctx->delete_fields));
+    /* array */
+    finalize_stmt(&(ctx->array_length));
+    finalize_stmt(&(ctx->append_item));
+    finalize_stmt(&(ctx->read_item));
+    finalize_stmt(&(ctx->read_items));
+    finalize_stmt(&(ctx->update_item));
+    finalize_stmt(&(ctx->delete_items));
+    /* numbers */
+    finalize_stmt(&(ctx->set_num));
+    finalize_stmt(&(ctx->read_num));
+    finalize_stmt(&(ctx->delete_num));
+    finalize_stmt(&(ctx->incr_num));
+    /* merge */
+    finalize_stmt(&(ctx->create_operand));
+    finalize_stmt(&(ctx->read_operands));
+    finalize_stmt(&(ctx->delete_operands));
+    finalize_stmt(&(ctx->next_merged));
+    /* expiry */
+    finalize_stmt(&(ctx->set_expiry));
+    finalize_stmt(&(ctx->delete_expiry));
+    finalize_stmt(&(ctx->next_expired));
+    finalize_stmt(&(ctx->purge_key));
+    finalize_stmt(&(ctx->delete_id));
+    /* secondary indexes */
+    finalize_stmt(&(ctx->add_term));
+    finalize_stmt(&(ctx->delete_terms));
+    finalize_stmt(&(ctx->index_find));
+    finalize_stmt(&(ctx->index_range));
+    finalize_stmt(&(ctx->next_raw));
+    /* json */
+    finalize_stmt(&(ctx->set_json));
+    finalize_stmt(&(ctx->read_json));
+    finalize_stmt(&(ctx->read_json_path));
+    finalize_stmt(&(ctx->delete_json));
+
+    return LITESTORE_OK;
+}
+
+
+/*-----------------------------------------*/
+/*----------------- CODEC -----------------*/
+/*-----------------------------------------*/
+/* Values below this are not worth compressing */
+#define COMPRESS_MIN_SIZE 64
+#define LZ_HASH_BITS 12
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+/* The last literals of the input are never part of a match */
+#define LZ_LAST_LITERALS 5
+
+static
+size_t put_varint(unsigned char* p, sqlite3_uint64 v)
+{
+    size_t n = 0;
+    while (v >= 0x80)
+    {
+        p[n++] = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (unsigned char)v;
+    return n;
+}
+
+/**
+ * @return Bytes read, 0 if the varint is not valid.
+ */
+static
+size_t get_varint(const unsigned char* p,
+                  const unsigned char* end,
+                  sqlite3_uint64* v)
+{
+    size_t n = 0;
+    *v = 0;
+    while (p + n < end && n < 10)
+    {
+        *v |= (sqlite3_uint64)(p[n] & 0x7f) << (7 * n);
+        if (!(p[n++] & 0x80))
+        {
+            return n;
+        }
+    }
+    return 0;
+}
+
+/*
+ * LZ, a byte oriented LZ77 in the spirit of LZ4.
+ * A sequence is a token (literal count << 4 | match length - 4),
+ * extra literal count bytes, the literals, a 2 byte match offset and
+ * extra match length bytes. Counts of 15 continue in the following
+ * bytes, 255 at a time. The last sequence has only literals.
+ */
+static
+size_t lz_bound(size_t size, void* user_data)
+{
+    UNUSED(user_data);
+    return size + size / 255 + 16;
+}
+
+static
+unsigned int lz_read32(const unsigned char* p)
+{
+    unsigned int v = 0;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static
+unsigned char* lz_put_count(unsigned char* op, size_t count)
+{
+    while (count >= 255)
+    {
+        *op++ = 255;
+        count -= 255;
+    }
+    *op++ = (unsigned char)count;
+    return op;
+}
+
+static
+unsigned char* lz_put_literals(unsigned char* op,
+                               const unsigned char* literals,
+                               const size_t count,
+                               const size_t match_len)
+{
+    unsigned char* token = op++;
+    *token = (unsigned char)(((count >= 15 ? 15 : count) << 4)
+                             | (match_len >= 15 ? 15 : match_len));
+    if (count >= 15)
+    {
+        op = lz_put_count(op, count - 15);
+    }
+    memcpy(op, literals, count);
+    return op + count;
+}
+
+static
+unsigned int lz_hash(const unsigned int seq)
+{
+    return (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/**
+ * Hash the dictionary positions, table has 1 << LZ_HASH_BITS entries.
+ */
+static
+void lz_dict_index(const unsigned char* data, const size_t size,
+                   unsigned int* table)
+{
+    size_t i = 0;
+    memset(table, 0, sizeof(unsigned int) << LZ_HASH_BITS);
+    for (i = 0; i + LZ_MIN_MATCH <= size; ++i)
+    {
+        table[lz_hash(lz_read32(data + i))] = (unsigned int)i + 1;
+    }
+}
+
+static
+int lz_compress_dict(const void* src, size_t src_size,
+                     void* dst, size_t dst_cap, size_t* dst_size,
+                     const lz_dict* dict)
+{
+    const unsigned char* const in = (const unsigned char*)src;
+    const unsigned char* const in_end = in + src_size;
+    const unsigned char* const match_limit =
+        src_size > LZ_MIN_MATCH + LZ_LAST_LITERALS
+        ? in_end - LZ_LAST_LITERALS : in;
+    const unsigned char* ip = in;
+    const unsigned char* anchor = in;
+    unsigned char* op = (unsigned char*)dst;
+    /* positions + 1 of the last 4 byte sequences, 0 for none */
+    unsigned int table[1 << LZ_HASH_BITS];
+
+    if (dst_cap < lz_bound(src_size, NULL) || src_size > 0xffffffffu)
+    {
+        return LITESTORE_ERR;
+    }
+    memset(table, 0, sizeof(table));
+
+    while (ip + LZ_MIN_MATCH <= match_limit)
+    {
+        const unsigned int seq = lz_read32(ip);
+        const unsigned int h = lz_hash(seq);
+        /* the match, in the input or in the dictionary */
+        const unsigned char* ref = NULL;
+        const unsigned char* ref_end = in_end;
+        size_t offset = 0;
+
+        if (table[h] != 0)
+        {
+            ref = in + table[h] - 1;
+            offset = (size_t)(ip - ref);
+        }
+        if ((!ref || offset > LZ_MAX_OFFSET || lz_read32(ref) != seq)
+            && dict && dict->table[h] != 0)
+        {
+            ref = dict->data + dict->table[h] - 1;
+            ref_end = dict->data + dict->size;
+            offset = (size_t)(ip - in) + (size_t)(ref_end - ref);
+        }
+        table[h] = (unsigned int)(ip - in) + 1;
+
+        if (ref && offset <= LZ_MAX_OFFSET && ref + LZ_MIN_MATCH <= ref_end
+            && lz_read32(ref) == seq)
+        {
+            const unsigned char* mp = ip + LZ_MIN_MATCH;
+            const unsigned char* rp = ref + LZ_MIN_MATCH;
+            size_t match_len = 0;
+
+            /* matches in the dictionary end at its end */
+            while (mp < match_limit && rp < ref_end && *mp == *rp)
+            {
+                ++mp;
+                ++rp;
+            }
+            match_len = (size_t)(mp - ip) - LZ_MIN_MATCH;
+            op = lz_put_literals(op, anchor, (size_t)(ip - anchor),
+                                 match_len);
+            *op++ = (unsigned char)offset;
+            *op++ = (unsigned char)(offset >> 8);
+            if (match_len >= 15)
+            {
+                op = lz_put_count(op, match_len - 15);
+            }
+            ip = anchor = mp;
+        }
+        else
+        {
+            /* skip faster over data that does not compress */
+            ip += 1 + ((size_t)(ip - anchor) >> 6);
+        }
+    }
+    op = lz_put_literals(op, anchor, (size_t)(in_end - anchor), 0);
+    *dst_size = (size_t)(op - (unsigned char*)dst);
+
+    return LITESTORE_OK;
+}
+
+static
+int lz_compress(const void* src, size_t src_size,
+                void* dst, size_t dst_cap, size_t* dst_size,
+                void* user_data)
+{
+    UNUSED(user_data);
+    return lz_compress_dict(src, src_size, dst, dst_cap, dst_size, NULL);
+}
+
+/**
+ * Read a count continued in the following bytes.
+ */
+static
+int lz_get_count(const unsigned char** ip,
+                 const unsigned char* ip_end,
+                 size_t* count)
+{
+    unsigned char b = 255;
+    while (b == 255)
+    {
+        if (*ip >= ip_end)
+        {
+            return LITESTORE_ERR;
+        }
+        b = *(*ip)++;
+        *count += b;
+    }
+    return LITESTORE_OK;
+}
+
+static
+int lz_decompress_dict(const void* src, size_t src_size,
+                       void* dst, size_t dst_size,
+                       const lz_dict* dict)
+{
+    const unsigned char* ip = (const unsigned char*)src;
+    const unsigned char* const ip_end = ip + src_size;
+    unsigned char* const out = (unsigned char*)dst;
+    unsigned char* op = out;
+    unsigned char* const op_end = op + dst_size;
+    const size_t dict_size = dict ? dict->size : 0;
+
+    while (ip < ip_end)
+    {
+        const unsigned char token = *ip++;
+        size_t count = token >> 4;
+        size_t offset = 0;
+
+        if ((count == 15 && lz_get_count(&ip, ip_end, &count)
+             != LITESTORE_OK)
+            || count > (size_t)(ip_end - ip)
+            || count > (size_t)(op_end - op))
+        {
+            return LITESTORE_ERR;
+        }
+        memcpy(op, ip, count);
+        op += count;
+        ip += count;
+        if (ip == ip_end)
+        {
+            break;
+        }
+
+        if (ip_end - ip < 2)
+        {
+            return LITESTORE_ERR;
+        }
+        offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        count = token & 0x0f;
+        if ((count == 15 && lz_get_count(&ip, ip_end, &count)
+             != LITESTORE_OK)
+            || offset == 0 || offset > (size_t)(op - out) + dict_size
+            || count + LZ_MIN_MATCH > (size_t)(op_end - op))
+        {
+            return LITESTORE_ERR;
+        }
+        count += LZ_MIN_MATCH;
+        if (offset > (size_t)(op - out))
+        {
+            /* from the dictionary, up to its end */
+            const size_t back = offset - (size_t)(op - out);
+            if (count > back)
+            {
+                return LITESTORE_ERR;
+            }
+            memcpy(op, dict->data + dict_size - back, count);
+            op += count;
+            continue;
+        }
+        /* byte by byte, the match may overlap the output */
+        while (count--)
+        {
+            *op = *(op - offset);
+            ++op;
+        }
+    }
+
+    return op == op_end ? LITESTORE_OK : LITESTORE_ERR;
+}
+
+static
+int lz_decompress(const void* src, size_t src_size,
+                  void* dst, size_t dst_size,
+                  void* user_data)
+{
+    UNUSED(user_data);
+    return lz_decompress_dict(src, src_size, dst, dst_size, NULL);
+}
+
+static const litestore_codec lz_codec = {
+    LITESTORE_CODEC_LZ, &lz_bound, &lz_compress, &lz_decompress, NULL
+};
+
+/**
+ * @return The codec with the given id, NULL if not found.
+ */
+static
+const litestore_codec* find_codec(litestore* ctx, const int id)
+{
+    int i = 0;
+    if (id == LITESTORE_CODEC_LZ)
+    {
+        return &lz_codec;
+    }
+    if (id == LITESTORE_CODEC_LZ_DICT)
+    {
+        return &ctx->dict_codec;
+    }
+    for (i = 0; i < ctx->opts.codec_count; ++i)
+    {
+        if (ctx->opts.codecs[i].id == id)
+        {
+            return &ctx->opts.codecs[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * User codec ids must be unique and not those of the built-in codecs,
+ * find_codec would never return them.
+ */
+static
+int codecs_valid(litestore* ctx)
+{
+    int i = 0;
+    int j = 0;
+
+    if (ctx->opts.codec_count > 0 && !ctx->opts.codecs)
+    {
+        return 0;
+    }
+    for (i = 0; i < ctx->opts.codec_count; ++i)
+    {
+        const int id = ctx->opts.codecs[i].id;
+        if (id <= LITESTORE_CODEC_LZ_DICT || id > 255)
+        {
+            report_error(ctx, LITESTORE_ERR,
+                         "codecs: user codec ids are 3..255");
+            return 0;
+        }
+        for (j = 0; j < i; ++j)
+        {
+            if (ctx->opts.codecs[j].id == id)
+            {
+                report_error(ctx, LITESTORE_ERR,
+                             "codecs: duplicate codec id");
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+/**
+ * Grow a buffer of the context, kept for reuse.
+ */
+static
+unsigned char* buf_reserve(litestore* ctx,
+                           unsigned char** buf,
+                           size_t* cap,
+                           const size_t size)
+{
+    if (size > *cap)
+    {
+        unsigned char* tmp = (unsigned char*)sqlite3_realloc64(*buf, size);
+        if (!tmp)
+        {
+            report_error(ctx, LITESTORE_ERR, "out of memory");
+            return NULL;
+        }
+        *buf = tmp;
+        *cap = size;
+    }
+    return *buf;
+}
+
+/**
+ * Grow the scratch buffer, it is reused by all reads and writes.
+ */
+static
+unsigned char* scratch_reserve(litestore* ctx, const size_t size)
+{
+    return buf_reserve(ctx, &ctx->scratch, &ctx->scratch_cap, size);
+}
+
+/**
+ * A value as stored in raw_data.
+ */
+typedef struct
+{
+    const void* data;
+    size_t size;
+    int codec;
+    size_t raw_size;  /* 0 if not compressed */
+} stored_value;
+
+/**
+ * Compress the value with the codec, if it is worth it.
+ * The result may point to the scratch buffer.
+ */
+static
+int encode_with(litestore* ctx,
+                const int codec_id,
+                const litestore_blob_t* value,
+                stored_value* stored)
+{
+    const int min_size = ctx->opts.compress_min_size > 0
+        ? ctx->opts.compress_min_size : COMPRESS_MIN_SIZE;
+    const litestore_codec* codec = NULL;
+
+    stored->data = value->data;
+    stored->size = value->size;
+    stored->codec = LITESTORE_CODEC_NONE;
+    stored->raw_size = 0;
+
+    if (codec_id != LITESTORE_CODEC_NONE
+        && value->size >= (size_t)min_size
+        && (codec = find_codec(ctx, codec_id)) != NULL)
+    {
+        const size_t cap = (*codec->bound)(value->size, codec->user_data);
+        unsigned char* dst = scratch_reserve(ctx, cap);
+        size_t size = 0;
+        if (!dst)
+        {
+            return LITESTORE_ERR;
+        }
+        /* keep values that shrink less than 1/8 as is */
+        if ((*codec->compress)(value->data, value->size, dst, cap, &size,
+                               codec->user_data) == LITESTORE_OK
+            && size < value->size - value->size / 8)
+        {
+            stored->data = dst;
+            stored->size = size;
+            stored->codec = codec->id;
+            stored->raw_size = value->size;
+        }
+    }
+    return LITESTORE_OK;
+}
+
+/**
+ * Compress the value with the current codec.
+ */
+static
+int encode_value(litestore* ctx,
+                 const litestore_blob_t* value,
+                 stored_value* stored)
+{
+    return encode_with(ctx, ctx->compression, value, stored);
+}
+
+/**
+ * Decompress a stored value, the result may point to the scratch buffer.
+ */
+static
+int decode_value(litestore* ctx,
+                 const stored_value* stored,
+                 const void** data,
+                 size_t* size)
+{
+    const litestore_codec* codec = NULL;
+    unsigned char* dst = NULL;
+
+    if (stored->codec == LITESTORE_CODEC_NONE)
+    {
+        *data = stored->data;
+        *size = stored->size;
+        return LITESTORE_OK;
+    }
+    codec = find_codec(ctx, stored->codec);
+    if (!codec)
+    {
+        report_error(ctx, LITESTORE_ERR, "unknown codec");
+        return LITESTORE_ERR;
+    }
+    dst = scratch_reserve(ctx, stored->raw_size);
+    if (!dst)
+    {
+        return LITESTORE_ERR;
+    }
+    if ((*codec->decompress)(stored->data, stored->size,
+                             dst, stored->raw_size, codec->user_data)
+        != LITESTORE_OK)
+    {
+        report_error(ctx, LITESTORE_ERR, "corrupt compressed value");
+        return LITESTORE_ERR;
+    }
+    *data = dst;
+    *size = stored->raw_size;
+    return LITESTORE_OK;
+}
+
+/**
+ * Bind the stored value to statement parameters first, first + 1 (codec)
+ * and first + 2 (raw size).
+ */
+static
+int bind_value(sqlite3_stmt* stmt, const int first, const stored_value* v)
+{
+    return (sqlite3_bind_blob64(stmt, first, v->data, v->size,
+                                SQLITE_STATIC) == SQLITE_OK
+            && sqlite3_bind_int(stmt, first + 1, v->codec) == SQLITE_OK
+            && sqlite3_bind_int64(stmt, first + 2,
+                                  (sqlite3_int64)v->raw_size) == SQLITE_OK)
+        ? LITESTORE_OK : LITESTORE_ERR;
+}
+
+/**
+ * Read a stored value from columns first, first + 1 and first + 2.
+ */
+static
+void column_value(sqlite3_stmt* stmt, const int first, stored_value* v)
+{
+    v->data = sqlite3_column_blob(stmt, first);
+    v->size = (size_t)sqlite3_column_bytes(stmt, first);
+    v->codec = sqlite3_column_int(stmt, first + 1);
+    v->raw_size = (size_t)sqlite3_column_int64(stmt, first + 2);
+}
+
+
+/*-----------------------------------------*/
+/*--------------- VALUE LOG ---------------*/
+/*-----------------------------------------*/
+/* Default size of the segment files */
+#define VLOG_SEGMENT_SIZE (64 << 20)
+
+/**
+ * The rows of the value of a raw_data row, 0 for none.
+ */
+typedef struct
+{
+    sqlite3_int64 shared;  /* shared_data.id */
+    sqlite3_int64 logged;  /* value_log.id */
+} value_refs;
+
+static
+int bind_refs(sqlite3_stmt* stmt, const int first, const value_refs* refs)
+{
+    return ((refs->shared ? sqlite3_bind_int64(stmt, first, refs->shared)
+             : sqlite3_bind_null(stmt, first)) == SQLITE_OK
+            && (refs->logged
+                ? sqlite3_bind_int64(stmt, first + 1, refs->logged)
+                : sqlite3_bind_null(stmt, first + 1)) == SQLITE_OK)
+        ? LITESTORE_OK : LITESTORE_ERR;
+}
+
+/**
+ * The segment files are named <store>-vlog.<segment>.
+ */
+static
+int vlog_open(litestore* ctx, const sqlite3_int64 segment, const int flags)
+{
+    const char* db = sqlite3_db_filename(ctx->db, "main");
+    char* path = sqlite3_mprintf("%s-vlog.%lld", db ? db : "", segment);
+    int fd = -1;
+
+    if (path)
+    {
+        fd = open(path, O_RDWR | flags, 0644);
+    }
+    if (fd < 0)
+    {
+        report_error(ctx, LITESTORE_ERR, "can not open value log segment");
+    }
+    sqlite3_free(path);
+    return fd;
+}
+
+static
+int vlog_unlink(litestore* ctx, const sqlite3_int64 segment)
+{
+    const char* db = sqlite3_db_filename(ctx->db, "main");
+    char* path = sqlite3_mprintf("%s-vlog.%lld", db ? db : "", segment);
+    const int rv = (path && unlink(path) == 0) ? LITESTORE_OK : LITESTORE_ERR;
+
+    sqlite3_free(path);
+    return rv;
+}
+
+/**
+ * The value log files are kept next to the store file.
+ */
+static
+int vlog_check(litestore* ctx)
+{
+    const char* db = sqlite3_db_filename(ctx->db, "main");
+    if (ctx->opts.value_log_threshold > 0 && !(db && *db))
+    {
+        report_error(ctx, LITESTORE_ERR, "value log needs a store file");
+        return LITESTORE_ERR;
+    }
+    return LITESTORE_OK;
+}
+
+static
+void vlog_close(litestore* ctx)
+{
+    if (ctx->vlog_fd >= 0)
+    {
+        close(ctx->vlog_fd);
+    }
+    if (ctx->vlog_read_fd >= 0)
+    {
+        close(ctx->vlog_read_fd);
+    }
+    ctx->vlog_fd = -1;
+    ctx->vlog_read_fd = -1;
+    ctx->vlog_segment = 0;
+    ctx->vlog_read_segment = 0;
+}
+
+/**
+ * Remember an emptied segment, its file is removed by vlog_release.
+ */
+static
+int vlog_retire(litestore* ctx, const sqlite3_int64 segment)
+{
+    if (ctx->vlog_retired_count == ctx->vlog_retired_cap)
+    {
+        const size_t cap = ctx->vlog_retired_cap ? 2 * ctx->vlog_retired_cap
+            : 4;
+        sqlite3_int64* tmp = (sqlite3_int64*)sqlite3_realloc64(
+            ctx->vlog_retired, cap * sizeof(sqlite3_int64));
+        if (!tmp)
+        {
+            report_error(ctx, LITESTORE_ERR, "out of memory");
+            return LITESTORE_ERR;
+        }
+        ctx->vlog_retired = tmp;
+        ctx->vlog_retired_cap = cap;
+    }
+    ctx->vlog_retired[ctx->vlog_retired_count++] = segment;
+    return LITESTORE_OK;
+}
+
+/**
+ * Remove the files of the retired segments. In WAL mode another
+ * connection may still read a snapshot from before a segment was
+ * emptied, so the files are kept until a restarting checkpoint
+ * succeeds, it waits for all the readers to move past the last commit.
+ * Without WAL a commit already waits for the readers.
+ */
+static
+void vlog_release(litestore* ctx)
+{
+    size_t i = 0;
+
+    if (ctx->vlog_retired_count == 0 || ctx->tx_active
+        || sqlite3_wal_checkpoint_v2(ctx->db, "main",
+                                     SQLITE_CHECKPOINT_RESTART,
+                                     NULL, NULL) != SQLITE_OK)
+    {
+        return;
+    }
+    for (i = 0; i < ctx->vlog_retired_count; ++i)
+    {
+        const sqlite3_int64 segment = ctx->vlog_retired[i];
+        if (ctx->vlog_read_segment == segment && ctx->vlog_read_fd >= 0)
+        {
+            close(ctx->vlog_read_fd);
+            ctx->vlog_read_fd = -1;
+        }
+        vlog_unlink(ctx, segment);
+    }
+    ctx->vlog_retired_count = 0;
+}
+
+/**
+ * Make the appended values durable, before the rows pointing to them
+ * are committed.
+ */
+static
+int vlog_sync(litestore* ctx)
+{
+    if (ctx->vlog_dirty && ctx->vlog_fd >= 0 && fdatasync(ctx->vlog_fd) != 0)
+    {
+        report_error(ctx, LITESTORE_ERR, "value log sync failed");
+        return LITESTORE_ERR;
+    }
+    ctx->vlog_dirty = 0;
+    return LITESTORE_OK;
+}
+
+/**
+ * Switch appends to the given segment, created truncates a file left by
+ * a rolled back transaction.
+ */
+static
+int vlog_use_segment(litestore* ctx,
+                     const sqlite3_int64 segment,
+                     const int created)
+{
+    if (ctx->vlog_fd >= 0 && ctx->vlog_segment == segment)
+    {
+        return LITESTORE_OK;
+    }
+    if (ctx->vlog_fd >= 0)
+    {
+        if (vlog_sync(ctx) != LITESTORE_OK)
+        {
+            return LITESTORE_ERR;
+        }
+        close(ctx->vlog_fd);
+    }
+    ctx->vlog_fd = vlog_open(ctx, segment,
+                             created ? O_CREAT | O_TRUNC : 0);
+    ctx->vlog_segment = ctx->vlog_fd >= 0 ? segment : 0;
+    return ctx->vlog_fd >= 0 ? LITESTORE_OK : LITESTORE_ERR;
+}
+
+/**
+ * Append to the active segment, a new one is started when it is full.
+ * Called in a write transaction, so one connection appends at a time.
+ */
+static
+int vlog_append(litestore* ctx,
+                const void* data,
+                const size_t size,
+                sqlite3_int64* segment,
+                sqlite3_int64* position)
+{
+    const sqlite3_int64 segment_size = ctx->opts.value_log_segment_size > 0
+        ? ctx->opts.value_log_segment_size : VLOG_SEGMENT_SIZE;
+    sqlite3_int64 active = 0;
+    sqlite3_int64 end = 0;
+    const unsigned char* p = (const unsigned char*)data;
+    size_t written = 0;
+    struct stat st;
+
+    sqlite3_reset(ctx->active_segment);
+    if (sqlite3_step(ctx->active_segment) != SQLITE_ROW)
+    {
+        sqlite_error(ctx);
+        sqlite3_reset(ctx->active_segment);
+        return LITESTORE_ERR;
+    }
+    active = sqlite3_column_int64(ctx->active_segment, 0);
+    sqlite3_reset(ctx->active_segment);
+
+    /* the end of the file, rolled back appends are left as garbage */
+    if (active > 0)
+    {
+        if (vlog_use_segment(ctx, active, 0) != LITESTORE_OK
+            || fstat(ctx->vlog_fd, &st) != 0)
+        {
+            report_error(ctx, LITESTORE_ERR, "value log not available");
+            return LITESTORE_ERR;
+        }
+        end = (sqlite3_int64)st.st_size;
+    }
+    if (active == 0 || (end > 0 && end + (sqlite3_int64)size > segment_size))
+    {
+        /* the full segment is final, its size counts rolled back appends
+           as garbage too */
+        if (active > 0)
+        {
+            sqlite3_reset(ctx->update_segment);
+            if (sqlite3_bind_int64(ctx->update_segment, 1, end) != SQLITE_OK
+                || sqlite3_bind_int64(ctx->update_segment, 2, active)
+                != SQLITE_OK)
+            {
+                sqlite_error(ctx);
+                return LITESTORE_ERR;
+            }
+            if (run_stmt(ctx, ctx->update_segment) != LITESTORE_OK)
+            {
+                return LITESTORE_ERR;
+            }
+        }
+        if (sqlite3_exec(ctx->db, "INSERT INTO value_segments DEFAULT VALUES;",
+                         NULL, NULL, NULL) != SQLITE_OK)
+        {
+            sqlite_error(ctx);
+            return LITESTORE_ERR;
+        }
+        active = sqlite3_last_insert_rowid(ctx->db);
+        end = 0;
+        if (vlog_use_segment(ctx, active, 1) != LITESTORE_OK)
+        {
+            return LITESTORE_ERR;
+        }
+    }
+
+    while (written < size)
+    {
+        const ssize_t n = pwrite(ctx->vlog_fd, p + written, size - written,
+                                 (off_t)(end + (sqlite3_int64)written));
+        if (n < 0 && errno != EINTR)
+        {
+            report_error(ctx, LITESTORE_ERR, "value log write failed");
+            return LITESTORE_ERR;
+        }
+        written += n > 0 ? (size_t)n : 0;
+    }
+    ctx->vlog_dirty = 1;
+    *segment = active;
+    *position = end;
+
+    sqlite3_reset(ctx->update_segment);
+    if (sqlite3_bind_int64(ctx->update_segment, 1,
+                           end + (sqlite3_int64)size) != SQLITE_OK
+        || sqlite3_bind_int64(ctx->update_segment, 2, active) != SQLITE_OK)
+    {
+        sqlite_error(ctx);
+        return LITESTORE_ERR;
+    }
+    return run_stmt(ctx, ctx->update_segment);
+}
+
+/**
+ * Read a value from the log to the value log buffer.
+ */
+static
+int vlog_read(litestore* ctx,
+              const sqlite3_int64 segment,
+              const sqlite3_int64 position,
+              const size_t length,
+              const unsigned int checksum,
+              const void** data)
+{
+    int fd = -1;
+    unsigned char* buf = NULL;
+    size_t done = 0;
+
+    if (ctx->vlog_fd >= 0 && ctx->vlog_segment == segment)
+    {
+        fd = ctx->vlog_fd;
+    }
+    else
+    {
+        if (ctx->vlog_read_fd < 0 || ctx->vlog_read_segment != segment)
+        {
+            if (ctx->vlog_read_fd >= 0)
+            {
+                close(ctx->vlog_read_fd);
+            }
+            ctx->vlog_read_fd = vlog_open(ctx, segment, 0);
+            ctx->vlog_read_segment = segment;
+        }
+        fd = ctx->vlog_read_fd;
+    }
+    buf = buf_reserve(ctx, &ctx->vlog_buf, &ctx->vlog_buf_cap,
+                      length > 0 ? length : 1);
+    if (fd < 0 || !buf)
+    {
+        return LITESTORE_ERR;
+    }
+
+    while (done < length)
+    {
+        const ssize_t n = pread(fd, buf + done, length - done,
+                                (off_t)(position + (sqlite3_int64)done));
+        if (n == 0 || (n < 0 && errno != EINTR))
+        {
+            break;
+        }
+        done += n > 0 ? (size_t)n : 0;
+    }
+    if (done != length || crc32_update(0, buf, length) != checksum)
+    {
+        report_error(ctx, LITESTORE_ERR, "corrupt value log");
+        return LITESTORE_ERR;
+    }
+    *data = buf;
+    return LITESTORE_OK;
+}
+
+/**
+ * Move an encoded value to the log, the value_log row is its location.
+ */
+static
+int log_value(litestore* ctx, const stored_value* stored, sqlite3_int64* logged)
+{
+    sqlite3_int64 segment = 0;
+    sqlite3_int64 position = 0;
+    const unsigned int checksum =
+        crc32_update(0, (const unsigned char*)stored->data, stored->size);
+
+    if (vlog_append(ctx, stored->data, stored->size, &segment, &position)
+        != LITESTORE_OK)
+    {
+        return LITESTORE_ERR;
+    }
+    sqlite3_reset(ctx->create_logged);
+    if (sqlite3_bind_int64(ctx->create_logged, 1, segment) != SQLITE_OK
+        || sqlite3_bind_int64(ctx->create_logged, 2, position) != SQLITE_OK
+        || sqlite3_bind_int64(ctx->create_logged, 3,
+                              (sqlite3_int64)stored->size) != SQLITE_OK
+        || sqlite3_bind_int64(ctx->create_logged, 4, checksum) != SQLITE_OK
+        || run_stmt(ctx, ctx->create_logged) != LITESTORE_OK)
+    {
+        sqlite_error(ctx);
+        return LITESTORE_ERR;
+    }
+    *logged = sqlite3_last_insert_rowid(ctx->db);
+    return LITESTORE_OK;
+}
+
+/**
+ * Read a value selected with RAW_VALUE_COLUMNS from column first on,
+ * a value in the log is read to the value log buffer.
+ */
+static
+int column_raw(litestore* ctx,
+               sqlite3_stmt* stmt,
+               const int first,
+               stored_value* v)
+{
+    column_value(stmt, first, v);
+    if (sqlite3_column_type(stmt, first + 3) != SQLITE_NULL)
+    {
+        v->size = (size_t)sqlite3_column_int64(stmt, first + 5);
+        return vlog_read(ctx,
+                         sqlite3_column_int64(stmt, first + 3),
+                         sqlite3_column_int64(stmt, first + 4),
+                         v->size,
+                         (unsigned int)sqlite3_column_int64(stmt, first + 6),
+                         &v->data);
+    }
+    return LITESTORE_OK;
+}
+
+
+/*-----------------------------------------*/
+/*--------------- DICTIONARY --------------*/
+/*-----------------------------------------*/
+/*
+ * Dictionary compression, LZ with a dictionary trained from the stored
+ * values. The dictionaries are kept in the dictionaries table, the
+ * version a value was compressed with is a varint prefix of the value.
+ */
+#define DICT_MIN_SIZE 256
+#define DICT_MAX_SIZE 32768
+/* Only values up to this size are sampled for training */
+#define DICT_SAMPLE_MAX_SIZE 4096
+#define DICT_SEGMENT_SIZE 64
+#define DICT_GRAM_SIZE 8
+#define DICT_COUNT_BITS 16
+
+static
+void dict_free(lz_dict* dict)
+{
+    sqlite3_free((void*)dict->table);
+    memset(dict, 0, sizeof(lz_dict));
+}
+
+/**
+ * Make a dictionary of the given bytes, indexed for compression.
+ */
+static
+int dict_make(litestore* ctx,
+              const sqlite3_int64 version,
+              const void* data,
+              const size_t size,
+              lz_dict* dict)
+{
+    const size_t table_size = sizeof(unsigned int) << LZ_HASH_BITS;
+    unsigned char* block = (unsigned char*)sqlite3_malloc64(table_size + size);
+
+    if (!block)
+    {
+        report_error(ctx, LITESTORE_ERR, "out of memory");
+        return LITESTORE_ERR;
+    }
+    memcpy(block + table_size, data, size);
+    lz_dict_index(block + table_size, size, (unsigned int*)block);
+    dict->version = version;
+    dict->table = (const unsigned int*)block;
+    dict->data = block + table_size;
+    dict->size = size;
+    return LITESTORE_OK;
+}
+
+/**
+ * Load a dictionary from the store.
+ *
+ * @param version 0 for the latest.
+ * @return LITESTORE_OK on success,
+ *         LITESTORE_UNKNOWN_ENTITY if there is no such dictionary,
+ *         LITESTORE_ERR otherwise.
+ */
+static
+int dict_load(litestore* ctx, const sqlite3_int64 version, lz_dict* dict)
+{
+    int rv = LITESTORE_ERR;
+    sqlite3_stmt* stmt = NULL;
+    const char* sql = version == 0
+        ? "SELECT version, dictionary FROM dictionaries"
+          " ORDER BY version DESC LIMIT 1;"
+        : "SELECT version, dictionary FROM dictionaries WHERE version = ?;";
+
+    if (sqlite3_prepare_v2(ctx->db, sql, -1, &stmt, NULL) == SQLITE_OK
+        && (version == 0
+            || sqlite3_bind_int64(stmt, 1, version) == SQLITE_OK))
+    {
+        const int rc = sqlite3_step(stmt);
+        if (rc == SQLITE_ROW)
+        {
+            rv = dict_make(ctx, sqlite3_column_int64(stmt, 0),
+                           sqlite3_column_blob(stmt, 1),
+                           (size_t)sqlite3_column_bytes(stmt, 1), dict);
+        }
+        else if (rc == SQLITE_DONE)
+        {
+            rv = LITESTORE_UNKNOWN_ENTITY;
+        }
+        else
+        {
+            sqlite_error(ctx);
+        }
+    }
+    else
+    {
+        sqlite_error(ctx);
+    }
+    sqlite3_finalize(stmt);
+
+    return rv;
+}
+
+/**
+ * @return The dictionary of the given version, loaded if needed,
+ *         NULL on error.
+ */
+static
+const lz_dict* dict_get(litestore* ctx, const sqlite3_int64 version)
+{
+    if (ctx->dicts[0].version == version)
+    {
+        return &ctx->dicts[0];
+    }
+    if (ctx->dicts[1].version != version)
+    {
+        dict_free(&ctx->dicts[1]);
+        if (dict_load(ctx, version, &ctx->dicts[1]) != LITESTORE_OK)
+        {
+            return NULL;
+        }
+    }
+    return &ctx->dicts[1];
+}
+
+static
+size_t dict_bound(size_t size, void* user_data)
+{
+    return lz_bound(size, user_data) + 10;
+}
+
+/**
+ * Compress with the latest dictionary, plain LZ (version 0) if none
+ * has been trained.
+ */
+static
+int dict_compress(const void* src, size_t src_size,
+                  void* dst, size_t dst_cap, size_t* dst_size,
+                  void* user_data)
+{
+    litestore* ctx = (litestore*)user_data;
+    const lz_dict* dict = ctx->dicts[0].version ? &ctx->dicts[0] : NULL;
+    unsigned char* p = (unsigned char*)dst;
+    const size_t n = put_varint(p, (sqlite3_uint64)ctx->dicts[0].version);
+    size_t size = 0;
+
+    if (lz_compress_dict(src, src_size, p + n, dst_cap - n, &size, dict)
+        != LITESTORE_OK)
+    {
+        return LITESTORE_ERR;
+    }
+    *dst_size = n + size;
+    return LITESTORE_OK;
+}
+
+static
+int dict_decompress(const void* src, size_t src_size,
+                    void* dst, size_t dst_size,
+                    void* user_data)
+{
+    litestore* ctx = (litestore*)user_data;
+    const unsigned char* p = (const unsigned char*)src;
+    sqlite3_uint64 version = 0;
+    const size_t n = get_varint(p, p + src_size, &version);
+    const lz_dict* dict = NULL;
+
+    if (n == 0
+        || (version != 0
+            && (dict = dict_get(ctx, (sqlite3_int64)version)) == NULL))
+    {
+        return LITESTORE_ERR;
+    }
+    return lz_decompress_dict(p + n, src_size - n, dst, dst_size, dict);
+}
+
+static const litestore_codec dict_codec = {
+    LITESTORE_CODEC_LZ_DICT, &dict_bound, &dict_compress, &dict_decompress,
+    NULL
+};
+
+/**
+ * @return The dictionary version of a stored value, -1 if the value
+ *         is not dictionary compressed.
+ */
+static
+sqlite3_int64 dict_version(const stored_value* stored)
+{
+    sqlite3_uint64 version = 0;
+    const unsigned char* p = (const unsigned char*)stored->data;
+    if (stored->codec != LITESTORE_CODEC_LZ_DICT
+        || get_varint(p, p + stored->size, &version) == 0)
+    {
+        return -1;
+    }
+    return (sqlite3_int64)version;
+}
+
+static
+unsigned int dict_gram_hash(const unsigned char* p)
+{
+    sqlite3_uint64 v = 0;
+    memcpy(&v, p, DICT_GRAM_SIZE);
+    return (unsigned int)((v * 0x9E3779B97F4A7C15ull)
+                          >> (64 - DICT_COUNT_BITS));
+}
+
+typedef struct
+{
+    size_t offset;
+    size_t size;
+    sqlite3_uint64 score;
+} dict_segment;
+
+static
+int dict_segment_cmp(const void* a, const void* b)
+{
+    const sqlite3_uint64 sa = ((const dict_segment*)a)->score;
+    const sqlite3_uint64 sb = ((const dict_segment*)b)->score;
+    return sa < sb ? 1 : (sa > sb ? -1 : 0);
+}
+
+/**
+ * Sum of the counts of the grams of a segment, grams seen only once
+ * (in this segment) do not count.
+ */
+static
+sqlite3_uint64 dict_segment_score(const unsigned char* samples,
+                                  const dict_segment* seg,
+                                  const unsigned int* counts)
+{
+    sqlite3_uint64 score = 0;
+    size_t i = 0;
+    for (i = 0; i + DICT_GRAM_SIZE <= seg->size; ++i)
+    {
+        const unsigned int c =
+            counts[dict_gram_hash(samples + seg->offset + i)];
+        score += c > 1 ? c : 0;
+    }
+    return score;
+}
+
+/**
+ * Build a dictionary of the segments of the samples whose byte sequences
+ * are the most common. The best segments are placed last, closest to
+ * the data, so that their matches have the shortest offsets.
+ *
+ * @param ends Ends of the samples in samples.
+ */
+static
+int dict_build(litestore* ctx,
+               const unsigned char* samples,
+               const size_t* ends,
+               const int sample_count,
+               unsigned char* dict,
+               size_t* dict_size)
+{
+    const size_t total = sample_count > 0 ? ends[sample_count - 1] : 0;
+    const size_t max_segments =
+        total / DICT_SEGMENT_SIZE + (size_t)sample_count;
+    unsigned int* counts = (unsigned int*)sqlite3_malloc64(
+        sizeof(unsigned int) << DICT_COUNT_BITS);
+    dict_segment* segs = (dict_segment*)sqlite3_malloc64(
+        sizeof(dict_segment) * (max_segments + 1));
+    size_t seg_count = 0;
+    size_t used = 0;
+    size_t i = 0;
+    int s = 0;
+
+    if (!counts || !segs)
+    {
+        sqlite3_free(counts);
+        sqlite3_free(segs);
+        report_error(ctx, LITESTORE_ERR, "out of memory");
+        return LITESTORE_ERR;
+    }
+    memset(counts, 0, sizeof(unsigned int) << DICT_COUNT_BITS);
+
+    for (s = 0; s < sample_count; ++s)
+    {
+        const size_t begin = s > 0 ? ends[s - 1] : 0;
+        size_t offset = begin;
+        for (i = begin; i + DICT_GRAM_SIZE <= ends[s]; ++i)
+        {
+            ++counts[dict_gram_hash(samples + i)];
+        }
+        for (; offset + DICT_GRAM_SIZE <= ends[s];
+             offset += DICT_SEGMENT_SIZE)
+        {
+            dict_segment* seg = &segs[seg_count++];
+            seg->offset = offset;
+            seg->size = ends[s] - offset < DICT_SEGMENT_SIZE
+                ? ends[s] - offset : DICT_SEGMENT_SIZE;
+        }
+    }
+    for (i = 0; i < seg_count; ++i)
+    {
+        segs[i].score = dict_segment_score(samples, &segs[i], counts);
+    }
+    qsort(segs, seg_count, sizeof(dict_segment), &dict_segment_cmp);
+
+    /* greedy, skip segments whose content is already in */
+    for (i = 0; i < seg_count && used + segs[i].size <= *dict_size; ++i)
+    {
+        size_t j = 0;
+        const sqlite3_uint64 score =
+            dict_segment_score(samples, &segs[i], counts);
+        if (score == 0 || score < segs[i].score / 2)
+        {
+            continue;
+        }
+        used += segs[i].size;
+        memcpy(dict + *dict_size - used, samples + segs[i].offset,
+               segs[i].size);
+        for (j = 0; j + DICT_GRAM_SIZE <= segs[i].size; ++j)
+        {
+            counts[dict_gram_hash(samples + segs[i].offset + j)] = 0;
+        }
+    }
+    /* move to the start of the buffer */
+    memmove(dict, dict + *dict_size - used, used);
+    *dict_size = used;
+
+    sqlite3_free(counts);
+    sqlite3_free(segs);
+    return LITESTORE_OK;
+}
+
+/**
+ * Sample values at random rowids of raw_data.
+ *
+ * @param samples Grown with sqlite3_realloc64.
+ * @param ends Ends of the samples, sample_count entries.
+ * @return Number of samples taken, -1 on error.
+ */
+static
+int dict_sample(litestore* ctx,
+                const int sample_count,
+                unsigned char** samples,
+                size_t* ends)
+{
+    sqlite3_stmt* max_id = NULL;
+    sqlite3_stmt* pick = NULL;
+    sqlite3_int64 max_rowid = 0;
+    size_t total = 0;
+    int count = 0;
+    int i = 0;
+
+    if (sqlite3_prepare_v2(ctx->db, "SELECT max(rowid) FROM raw_data;",
+                           -1, &max_id, NULL) != SQLITE_OK
+        || sqlite3_prepare_v2(ctx->db,
+                              "SELECT " RAW_VALUE_COLUMNS " FROM raw_data r "
+                              RAW_VALUE_JOIN " WHERE r.rowid >= ? LIMIT 1;",
+                              -1, &pick, NULL) != SQLITE_OK)
+    {
+        sqlite_error(ctx);
+        count = -1;
+    }
+    else if (sqlite3_step(max_id) == SQLITE_ROW)
+    {
+        max_rowid = sqlite3_column_int64(max_id, 0);
+    }
+
+    for (i = 0; count >= 0 && max_rowid > 0 && i < sample_count; ++i)
+    {
+        sqlite3_int64 r = 0;
+        sqlite3_randomness(sizeof(r), &r);
+        r = (r < 0 ? -(r + 1) : r) % max_rowid + 1;
+        sqlite3_bind_int64(pick, 1, r);
+        if (sqlite3_step(pick) == SQLITE_ROW)
+        {
+            stored_value stored;
+            const void* data = NULL;
+            size_t size = 0;
+            if (column_raw(ctx, pick, 0, &stored) == LITESTORE_OK
+                && decode_value(ctx, &stored, &data, &size) == LITESTORE_OK
+                && size <= DICT_SAMPLE_MAX_SIZE)
+            {
+                unsigned char* tmp = (unsigned char*)sqlite3_realloc64(
+                    *samples, total + size);
+                if (!tmp)
+                {
+                    report_error(ctx, LITESTORE_ERR, "out of memory");
+                    count = -1;
+                }
+                else
+                {
+                    *samples = tmp;
+                    memcpy(*samples + total, data, size);
+                    total += size;
+                    ends[count++] = total;
+                }
+            }
+        }
+        sqlite3_reset(pick);
+    }
+    sqlite3_finalize(max_id);
+    sqlite3_finalize(pick);
+
+    return count;
+}
+
+/**
+ * Train a new dictionary and make it the one used for writes.
+ */
+static
+int dict_train(litestore* ctx, const int sample_count, size_t dict_size)
+{
+    int rv = LITESTORE_ERR;
+    unsigned char* samples = NULL;
+    unsigned char* dict = (unsigned char*)sqlite3_malloc64(dict_size);
+    size_t* ends = (size_t*)sqlite3_malloc64(sizeof(size_t) * sample_count);
+    int count = 0;
+    sqlite3_stmt* save = NULL;
+
+    if (!dict || !ends)
+    {
+        report_error(ctx, LITESTORE_ERR, "out of memory");
+    }
+    else if ((count = dict_sample(ctx, sample_count, &samples, ends)) == 0)
+    {
+        report_error(ctx, LITESTORE_ERR, "no values to train with");
+    }
+    else if (count > 0
+             && dict_build(ctx, samples, ends, count, dict, &dict_size)
+             == LITESTORE_OK)
+    {
+        if (sqlite3_prepare_v2(ctx->db,
+                               "INSERT INTO dictionaries (dictionary)"
+                               " VALUES (?);",
+                               -1, &save, NULL) == SQLITE_OK
+            && sqlite3_bind_blob64(save, 1, dict, dict_size, SQLITE_STATIC)
+            == SQLITE_OK
+            && sqlite3_step(save) == SQLITE_DONE)
+        {
+            lz_dict trained;
+            rv = dict_make(ctx, sqlite3_last_insert_rowid(ctx->db),
+                           dict, dict_size, &trained);
+            if (rv == LITESTORE_OK)
+            {
+                /* the previous one is still the most used for reads */
+                dict_free(&ctx->dicts[1]);
+                ctx->dicts[1] = ctx->dicts[0];
+                ctx->dicts[0] = trained;
+            }
+        }
+        else
+        {
+            sqlite_error(ctx);
+        }
+        sqlite3_finalize(save);
+    }
+    sqlite3_free(samples);
+    sqlite3_free(ends);
+    sqlite3_free(dict);
+
+    return rv;
+}
+
+
+/*-----------------------------------------*/
+/*----------------- DEDUP -----------------*/
+/*-----------------------------------------*/
+/* Values below this are not worth a shared row */
+#define DEDUP_MIN_SIZE 64
+#define SHA256_SIZE 32
+#define ROTR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static const unsigned int sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static
+void sha256_block(unsigned int* h, const unsigned char* p)
+{
+    unsigned int w[64];
+    unsigned int a = h[0], b = h[1], c = h[2], d = h[3];
+    unsigned int e = h[4], f = h[5], g = h[6], k = h[7];
+    int i = 0;
+
+    for (i = 0; i < 16; ++i)
+    {
+        w[i] = (unsigned int)p[4 * i] << 24
+            | (unsigned int)p[4 * i + 1] << 16
+            | (unsigned int)p[4 * i + 2] << 8
+            | (unsigned int)p[4 * i + 3];
+    }
+    for (i = 16; i < 64; ++i)
+    {
+        const unsigned int s0 = ROTR32(w[i - 15], 7)
+            ^ ROTR32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        const unsigned int s1 = ROTR32(w[i - 2], 17)
+            ^ ROTR32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    for (i = 0; i < 64; ++i)
+    {
+        const unsigned int t1 = k
+            + (ROTR32(e, 6) ^ ROTR32(e, 11) ^ ROTR32(e, 25))
+            + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+        const unsigned int t2 =
+            (ROTR32(a, 2) ^ ROTR32(a, 13) ^ ROTR32(a, 22))
+            + ((a & b) ^ (a & c) ^ (b & c));
+        k = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+    h[5] += f;
+    h[6] += g;
+    h[7] += k;
+}
+
+static
+void sha256(const void* data, const size_t size, unsigned char* digest)
+{
+    unsigned int h[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    const unsigned char* p = (const unsigned char*)data;
+    const sqlite3_uint64 bits = (sqlite3_uint64)size * 8;
+    unsigned char tail[128];
+    size_t rest = size;
+    size_t tail_size = 0;
+    int i = 0;
+
+    for (; rest >= 64; rest -= 64, p += 64)
+    {
+        sha256_block(h, p);
+    }
+    /* padding, 0x80 and the length in bits as the last 8 bytes */
+    memset(tail, 0, sizeof(tail));
+    memcpy(tail, p, rest);
+    tail[rest] = 0x80;
+    tail_size = rest < 56 ? 64 : 128;
+    for (i = 0; i < 8; ++i)
+    {
+        tail[tail_size - 1 - i] = (unsigned char)(bits >> (8 * i));
+    }
+    sha256_block(h, tail);
+    if (tail_size == 128)
+    {
+        sha256_block(h, tail + 64);
+    }
+    for (i = 0; i < 8; ++i)
+    {
+        digest[4 * i] = (unsigned char)(h[i] >> 24);
+        digest[4 * i + 1] = (unsigned char)(h[i] >> 16);
+        digest[4 * i + 2] = (unsigned char)(h[i] >> 8);
+        digest[4 * i + 3] = (unsigned char)h[i];
+    }
+}
+
+/**
+ * Find the shared row of the value, or add one.
+ * The reference is counted when a raw_data row points to it.
+ */
+static
+int share_value(litestore* ctx,
+                const litestore_blob_t* value,
+                sqlite3_int64* shared)
+{
+    int rv = LITESTORE_ERR;
+    unsigned char digest[SHA256_SIZE];
+    int rc = SQLITE_ERROR;
+
+    sha256(value->data, value->size, digest);
+    sqlite3_reset(ctx->find_shared);
+    if (sqlite3_bind_blob(ctx->find_shared, 1, digest, SHA256_SIZE,
+                          SQLITE_STATIC) == SQLITE_OK)
+    {
+        rc = sqlite3_step(ctx->find_shared);
+    }
+    if (rc == SQLITE_ROW)
+    {
+        *shared = sqlite3_column_int64(ctx->find_shared, 0);
+        rv = LITESTORE_OK;
+    }
+    else if (rc == SQLITE_DONE)
+    {
+        stored_value stored;
+        /* compressed once, for all the keys */
+        if (encode_value(ctx, value, &stored) == LITESTORE_OK)
+        {
+            sqlite3_reset(ctx->create_shared);
+            if (sqlite3_bind_blob(ctx->create_shared, 1, digest, SHA256_SIZE,
+                                  SQLITE_STATIC) == SQLITE_OK
+                && bind_value(ctx->create_shared, 2, &stored) == LITESTORE_OK
+                && sqlite3_step(ctx->create_shared) == SQLITE_DONE)
+            {
+                *shared = sqlite3_last_insert_rowid(ctx->db);
+                rv = LITESTORE_OK;
+            }
+            else
+            {
+                sqlite_error(ctx);
+            }
+            sqlite3_reset(ctx->create_shared);
+        }
+    }
+    else
+    {
+        sqlite_error(ctx);
+    }
+    sqlite3_reset(ctx->find_shared);
+
+    return rv;
+}
+
+/**
+ * Prepare a value for a raw_data row: encoded in the row, in dedup mode
+ * a reference to the shared row, or if large a reference to the log.
+ */
+static
+int store_value(litestore* ctx,
+                const litestore_blob_t* value,
+                stored_value* stored,
+                value_refs* refs)
+{
+    int rv = LITESTORE_OK;
+
+    refs->shared = 0;
+    refs->logged = 0;
+    if (ctx->opts.dedup && value->size >= DEDUP_MIN_SIZE)
+    {
+        rv = share_value(ctx, value, &refs->shared);
+    }
+    else
+    {
+        rv = encode_value(ctx, value, stored);
+        if (rv == LITESTORE_OK && ctx->opts.value_log_threshold > 0
+            && stored->size >= (size_t)ctx->opts.value_log_threshold)
+        {
+            rv = log_value(ctx, stored, &refs->logged);
+        }
+        else
+        {
+            return rv;
+        }
+    }
+    /* an empty blob, not NULL, the codec applies to a logged value */
+    stored->data = "";
+    stored->size = 0;
+    if (refs->shared)
+    {
+        stored->codec = LITESTORE_CODEC_NONE;
+        stored->raw_size = 0;
+    }
+    return rv;
+}
+
+
+/*-----------------------------------------*/
+/*----------------- MERGE -----------------*/
+/*-----------------------------------------*/
+/*
+ * Merge operands are kept in merge_operands until the value is rewritten
+ * (update, compaction), reads fold them into the stored value.
+ */
+typedef struct
+{
+    int op;
+    size_t offset;  /* in MERGE_DATA */
+    size_t size;
+} merge_operand;
+
+static
+size_t append_bound(litestore_blob_t value,
+                    const litestore_blob_t* operands,
+                    size_t count,
+                    void* user_data)
+{
+    size_t size = value.size;
+    size_t i = 0;
+    UNUSED(user_data);
+    for (i = 0; i < count; ++i)
+    {
+        size += operands[i].size;
+    }
+    return size;
+}
+
+static
+int append_merge(litestore_blob_t value,
+                 const litestore_blob_t* operands,
+                 size_t count,
+                 void* dst, size_t dst_cap, size_t* dst_size,
+                 void* user_data)
+{
+    unsigned char* p = (unsigned char*)dst;
+    size_t i = 0;
+    UNUSED(dst_cap);
+    UNUSED(user_data);
+    if (value.size > 0)
+    {
+        memcpy(p, value.data, value.size);
+        p += value.size;
+    }
+    for (i = 0; i < count; ++i)
+    {
+        if (operands[i].size > 0)
+        {
+            memcpy(p, operands[i].data, operands[i].size);
+            p += operands[i].size;
+        }
+    }
+    *dst_size = (size_t)(p - (unsigned char*)dst);
+    return LITESTORE_OK;
+}
+
+static
+size_t add_bound(litestore_blob_t value,
+                 const litestore_blob_t* operands,
+                 size_t count,
+                 void* user_data)
+{
+    UNUSED(value);
+    UNUSED(operands);
+    UNUSED(count);
+    UNUSED(user_data);
+    return 8;
+}
+
+/**
+ * The value and the operands are 8 byte little endian integers,
+ * the sum wraps around.
+ */
+static
+int add_merge(litestore_blob_t value,
+              const litestore_blob_t* operands,
+              size_t count,
+              void* dst, size_t dst_cap, size_t* dst_size,
+              void* user_data)
+{
+    sqlite3_uint64 sum = 0;
+    size_t i = 0;
+    UNUSED(dst_cap);
+    UNUSED(user_data);
+    if (value.size == 8)
+    {
+        sum = get_u64((const unsigned char*)value.data);
+    }
+    else if (value.size != 0)
+    {
+        return LITESTORE_ERR;
+    }
+    for (i = 0; i < count; ++i)
+    {
+        if (operands[i].size != 8)
+        {
+            return LITESTORE_ERR;
+        }
+        sum += get_u64((const unsigned char*)operands[i].data);
+    }
+    put_u64((unsigned char*)dst, sum);
+    *dst_size = 8;
+    return LITESTORE_OK;
+}
+
+static const litestore_merge_operator append_operator = {
+    LITESTORE_MERGE_APPEND, &append_bound, &append_merge, NULL
+};
+static const litestore_merge_operator add_operator = {
+    LITESTORE_MERGE_ADD, &add_bound, &add_merge, NULL
+};
+
+/**
+ * @return The merge operator with the given id, NULL if not found.
+ */
+static
+const litestore_merge_operator* find_merge_operator(litestore* ctx,
+                                                    const int id)
+{
+    int i = 0;
+    if (id == LITESTORE_MERGE_APPEND)
+    {
+        return &append_operator;
+    }
+    if (id == LITESTORE_MERGE_ADD)
+    {
+        return &add_operator;
+    }
+    for (i = 0; i < ctx->opts.merge_operator_count; ++i)
+    {
+        if (ctx->opts.merge_operators[i].id == id)
+        {
+            return &ctx->opts.merge_operators[i];
+        }
+    }
+    return NULL;
+}
+
+static
+void merge_free(litestore* ctx)
+{
+    int i = 0;
+    for (i = 0; i < MERGE_BUF_COUNT; ++i)
+    {
+        sqlite3_free(ctx->merge_bufs[i]);
+        ctx->merge_bufs[i] = NULL;
+        ctx->merge_caps[i] = 0;
+    }
+}
+
+static
+unsigned char* merge_reserve(litestore* ctx, const int buf, const size_t size)
+{
+    /* never 0, a result may be empty */
+    return buf_reserve(ctx, &ctx->merge_bufs[buf], &ctx->merge_caps[buf],
+                       size > 0 ? size : 1);
+}
+
+/**
+ * Copy the operands of the object to MERGE_DATA, MERGE_LIST and
+ * MERGE_BLOBS, the rows are not valid after stepping.
+ *
+ * @return Number of operands, -1 on error.
+ */
+static
+int read_operands(litestore* ctx, const litestore_id_t id)
+{
+    int count = 0;
+    int rc = SQLITE_ERROR;
+    size_t total = 0;
+    merge_operand* list = NULL;
+
+    if (sqlite3_bind_int64(ctx->read_operands, 1, id) == SQLITE_OK)
+    {
+        while ((rc = sqlite3_step(ctx->read_operands)) == SQLITE_ROW)
+        {
+            const void* data = sqlite3_column_blob(ctx->read_operands, 1);
+            const size_t size =
+                (size_t)sqlite3_column_bytes(ctx->read_operands, 1);
+            unsigned char* dst = merge_reserve(ctx, MERGE_DATA, total + size);
+            list = (merge_operand*)merge_reserve(
+                ctx, MERGE_LIST, (count + 1) * sizeof(merge_operand));
+            if (!dst || !list)
+            {
+                break;
+            }
+            if (size > 0)
+            {
+                memcpy(dst + total, data, size);
+            }
+            list[count].op = sqlite3_column_int(ctx->read_operands, 0);
+            list[count].offset = total;
+            list[count].size = size;
+            total += size;
+            ++count;
+        }
+    }
+    if (rc != SQLITE_DONE && rc != SQLITE_ROW)
+    {
+        sqlite_error(ctx);
+    }
+    sqlite3_reset(ctx->read_operands);
+    if (rc != SQLITE_DONE)
+    {
+        return -1;
+    }
+
+    if (count > 0)
+    {
+        litestore_blob_t* blobs = (litestore_blob_t*)merge_reserve(
+            ctx, MERGE_BLOBS, count * sizeof(litestore_blob_t));
+        int i = 0;
+        if (!blobs)
+        {
+            return -1;
+        }
+        for (i = 0; i < count; ++i)
+        {
+            /* the members are const, copy in place */
+            const litestore_blob_t b = litestore_make_blob(
+                ctx->merge_bufs[MERGE_DATA] + list[i].offset, list[i].size);
+            memcpy(&blobs[i], &b, sizeof(b));
+        }
+    }
+    return count;
+}
+
+/**
+ * Fold the operands of the object into the value, oldest first.
+ * Consecutive operands of the same operator are merged in one call.
+ *
+ * @param data The value (in), the result in a MERGE_OUT buffer (out).
+ */
+static
+int merge_value(litestore* ctx,
+                const litestore_id_t id,
+                const void** data,
+                size_t* size)
+{
+    const int count = read_operands(ctx, id);
+    const merge_operand* list =
+        (const merge_operand*)ctx->merge_bufs[MERGE_LIST];
+    const litestore_blob_t* blobs =
+        (const litestore_blob_t*)ctx->merge_bufs[MERGE_BLOBS];
+    int out = 0;
+    int i = 0;
+
+    if (count < 0)
+    {
+        return LITESTORE_ERR;
+    }
+    while (i < count)
+    {
+        const litestore_merge_operator* op =
+            find_merge_operator(ctx, list[i].op);
+        const litestore_blob_t value = litestore_make_blob(*data, *size);
+        unsigned char* dst = NULL;
+        size_t cap = 0;
+        size_t dst_size = 0;
+        int run = 1;
+
+        while (i + run < count && list[i + run].op == list[i].op)
+        {
+            ++run;
+        }
+        if (!op)
+        {
+            report_error(ctx, LITESTORE_ERR, "unknown merge operator");
+            return LITESTORE_ERR;
+        }
+        cap = (*op->bound)(value, blobs + i, (size_t)run, op->user_data);
+        dst = merge_reserve(ctx, MERGE_OUT + out, cap);
+        if (!dst)
+        {
+            return LITESTORE_ERR;
+        }
+        if ((*op->merge)(value, blobs + i, (size_t)run,
+                         dst, cap, &dst_size, op->user_data) != LITESTORE_OK
+            || dst_size > cap)
+        {
+            report_error(ctx, LITESTORE_ERR, "merge failed");
+            return LITESTORE_ERR;
+        }
+        *data = dst;
+        *size = dst_size;
+        out = 1 - out;
+        i += run;
+    }
+    return LITESTORE_OK;
+}
+
+static
+int create_operand(litestore* ctx,
+                   const litestore_id_t id,
+                   const int op,
+                   const litestore_blob_t* operand)
+{
+    int rv = LITESTORE_ERR;
+
+    if (sqlite3_bind_int64(ctx->create_operand, 1, id) == SQLITE_OK
+        && sqlite3_bind_int(ctx->create_operand, 2, op) == SQLITE_OK
+        && sqlite3_bind_blob64(ctx->create_operand, 3,
+                               operand->data, operand->size,
+                               SQLITE_STATIC) == SQLITE_OK
+        && sqlite3_step(ctx->create_operand) == SQLITE_DONE)
+    {
+        rv = LITESTORE_OK;
+    }
+    else
+    {
+        sqlite_error(ctx);
+    }
+    sqlite3_reset(ctx->create_operand);
+
+    return rv;
+}
+
+
+/*-----------------------------------------*/
+/*----------------- INDEX -----------------*/
+/*-----------------------------------------*/
+/* The value being indexed, passed to add_term */
+typedef struct
+{
+    litestore* ctx;
+    int index_id;
+    litestore_id_t id;
+    int rv;  /* the first error */
+} index_terms;
+
+static
+int delete_terms(litestore* ctx, const litestore_id_t id)
+{
+    int rv = LITESTORE_ERR;
+
+    if (ctx->opts.index_count == 0)
+    {
+        return LITESTORE_OK;
+    }
+    if (sqlite3_bind_int64(ctx->delete_terms, 1, id) == SQLITE_OK
+        && sqlite3_step(ctx->delete_terms) == SQLITE_DONE)
+    {
+        rv = LITESTORE_OK;
+    }
+    else
+    {
+        sqlite_error(ctx);
+    }
+    sqlite3_reset(ctx->delete_terms);
+
+    return rv;
+}
+
+static
+int add_term(litestore_blob_t term, void* terms)
+{
+    index_terms* t = (index_terms*)terms;
+    int rv = LITESTORE_ERR;
+
+    if (term.data && term.size > 0
+        && sqlite3_bind_int(t->ctx->add_term, 1, t->index_id) == SQLITE_OK
+        && sqlite3_bind_blob64(t->ctx->add_term, 2, term.data,
+                               (sqlite3_uint64)term.size,
+                               SQLITE_STATIC) == SQLITE_OK
+        && sqlite3_bind_int64(t->ctx->add_term, 3, t->id) == SQLITE_OK)
+    {
+        rv = run_stmt(t->ctx, t->ctx->add_term);
+    }
+    if (rv != LITESTORE_OK)
+    {
+        t->rv = LITESTORE_ERR;
+    }
+    return rv;
+}
+
+/**
+ * Replace the terms of a raw value with the ones extracted from it.
+ */
+static
+int index_value(litestore* ctx,
+                const litestore_id_t id,
+                litestore_blob_t value)
+{
+    int rv = delete_terms(ctx, id);
+    int i = 0;
+
+    for (i = 0; i < ctx->opts.index_count && rv == LITESTORE_OK; ++i)
+    {
+        const litestore_index* index = &ctx->opts.indexes[i];
+        index_terms terms = {ctx, index->id, id, LITESTORE_OK};
+        if ((*index->extract)(value, &add_term, &terms, index->user_data)
+            != LITESTORE_OK
+            || terms.rv != LITESTORE_OK)
+        {
+            report_error(ctx, LITESTORE_ERR, "Failed to index a value");
+            rv = LITESTORE_ERR;
+        }
+    }
+
+    return rv;
+}
+
+static
+int indexes_valid(const litestore_opts* opts)
+{
+    int i = 0;
+
+    if (opts->index_count > 0 && !opts->indexes)
+    {
+        return 0;
+    }
+    for (i = 0; i < opts->index_count; ++i)
+    {
+        if (!opts->indexes[i].extract)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+
+/*-----------------------------------------*/
+/*----------------- CREATE ----------------*/
+/*-----------------------------------------*/
+/**
+ * Delete the key if it has expired, so that it can be created again.
+ */
+static
+int purge_expired_key(litestore* ctx,
+                      const char* key,
+                      const size_t key_len)
+{
+    if (sqlite3_bind_text(ctx->purge_key, 1, key, key_len,
+                          SQLITE_STATIC) == SQLITE_OK
+        && sqlite3_bind_int64(ctx->purge_key, 2, expiry_now()) == SQLITE_OK)
+    {
+        return run_stmt(ctx, ctx->purge_key);
+    }
+    sqlite_error(ctx);
+    return LITESTORE_ERR;
+}
+
+static
+int create_key(litestore* ctx,
+               const char* key,
+               const size_t key_len,
+               const int data_type,
+               litestore_id_t* id)
+{
+    if (ctx->create_key)
+    {
+        int rc = SQLITE_ERROR;
+        sqlite3_reset(ctx->create_key);
+        if (sqlite3_bind_text(ctx->create_key,
+                              1, key, key_len,
+                              SQLITE_STATIC) != SQLITE_OK
+            || sqlite3_bind_int(ctx->create_key,
+                                2, data_type) != SQLITE_OK)
+        {
+            sqlite_error(ctx);
+            return LITESTORE_ERR;
+        }
+        rc = sqlite3_step(ctx->create_key);
+        if (rc == SQLITE_CONSTRAINT)
+        {
+            /* an expired key is replaced, if not this fails again */
+            sqlite3_reset(ctx->create_key);
+            purge_expired_key(ctx, key, key_len);
+            rc = sqlite3_step(ctx->create_key);
+        }
+        if (rc != SQLITE_DONE)
+        {
+            sqlite_error(ctx);
+            sqlite3_reset(ctx->create_key);
+            return LITESTORE_ERR;
+        }
+        if (id)
+        {
+            *id = sqlite3_last_insert_rowid(ctx->db);
+        }
+        return LITESTORE_OK;
+    }
+    return LITESTORE_ERR;
+}
+
+static
+int insert_data(litestore* ctx,
+                const litestore_id_t new_id,
+                const stored_value* stored,
+                const value_refs* refs)
+{
+    int rv = LITESTORE_ERR;
+
+    if (sqlite3_bind_int64(ctx->create_data, 1, new_id) == SQLITE_OK
+        && bind_value(ctx->create_data, 2, stored) == LITESTORE_OK
+        && bind_refs(ctx->create_data, 5, refs) == LITESTORE_OK
+        && sqlite3_step(ctx->create_data) == SQLITE_DONE)
+    {
+        rv = LITESTORE_OK;
+    }
+    else
+    {
+        sqlite_error(ctx);
+    }
+    sqlite3_reset(ctx->create_data);
+    return rv;
+}
+
+static
+int create_data(litestore* ctx, litestore_id_t new_id, void* value)
+{
+    int rv = LITESTORE_ERR;
+
+    litestore_blob_t* blob = (litestore_blob_t*)value;
+    stored_value stored;
+    value_refs refs;
+    if (ctx->create_data && blob->data && blob->size > 0
+        && store_value(ctx, blob, &stored, &refs) == LITESTORE_OK)
+    {
+        rv = insert_data(ctx, new_id, &stored, &refs);
+        if (rv == LITESTORE_OK)
+        {
+            rv = index_value(ctx, new_id, *blob);
+        }
+    }
+    return rv;
+}
+
+typedef struct
+{
+    int object_type;
+    int (*create)(litestore*, litestore_id_t, void*);
+    void* data;
+} create_ctx;
+
+static
+int gen_create(litestore* ctx,
+               const char* key,
+               const size_t key_len,
+               create_ctx op)
+{
+    int rv = LITESTORE_ERR;
+
+    if (ctx && !bulk_blocks(ctx) && key && key_len > 0 && op.create && op.data)
+    {
+        op_begin(ctx, "gen_create");
+        const int own_tx = opt_begin_tx(ctx);
+
+        litestore_id_t new_id = 0;
+        rv = create_key(ctx, key, key_len, op.object_type, &new_id);
+        if (rv == LITESTORE_OK)
+        {
+            rv = (*op.create)(ctx, new_id, op.data);
+        }
+
+        if (own_tx)
+        {
+            opt_end_tx(ctx, rv);
+        }
+        op_end(ctx, LITESTORE_OP_CREATE);
+    }
+
+    return rv;
+}
+
+/*-----------------------------------------*/
+/*----------------- READ ------------------*/
+/*-----------------------------------------*/
+/**
+ * Look up a key, expired keys are unknown.
+ *
+ * @param expires_at Expiry time of the key, 0 for none (out), may be NULL.
+ */
+static
+int read_object(litestore* ctx,
+                const char* key,
+                const size_t key_len,
+                litestore_id_t* id,
+                int* type,
+                sqlite3_int64* expires_at)
+{
+    if (ctx->read_key && key && key_len > 0)
+    {
+        sqlite3_int64 expiry = 0;
+        sqlite3_reset(ctx->read_key);
+        if (sqlite3_bind_text(ctx->read_key,
+                              1, key, key_len,
+                              SQLITE_STATIC) != SQLITE_OK)
+        {
+            sqlite_error(ctx);
+            return LITESTORE_ERR;
+        }
+        /* expect only one aswer */
+        if (sqlite3_step(ctx->read_key) != SQLITE_ROW)
+        {
+            sqlite3_reset(ctx->read_key);
+            *id = 0;
+            *type = -1;
+            return LITESTORE_UNKNOWN_ENTITY;
+        }
+        *id = sqlite3_column_int64(ctx->read_key, 0);
+        *type = sqlite3_column_int(ctx->read_key, 1);
+        expiry = sqlite3_column_int64(ctx->read_key, 2);
+        /* an active statement would hold the read lock past the tx */
+        sqlite3_reset(ctx->read_key);
+        if (expiry != 0 && expiry <= expiry_now())
+        {
+            *id = 0;
+            *type = -1;
+            return LITESTORE_UNKNOWN_ENTITY;
+        }
+        if (expires_at)
+        {
+            *expires_at = expiry;
+        }
+        return LITESTORE_OK;
+    }
+    return LITESTORE_ERR;
+}
+
+static
+int read_object_type(litestore* ctx,
+                     const char* key,
+                     const size_t key_len,
+                     litestore_id_t* id,
+                     int* type)
+{
+    return read_object(ctx, key, key_len, id, type, NULL);
+}
+
+/**
+ * Read the value of a raw object, with the merge operands folded in.
+ * Leaves read_data active, the value may point to its row.
+ *
+ * @param merged Set if there were operands (out), may be NULL.
+ */
+static
+int read_value(litestore* ctx,
+               const litestore_id_t id,
+               const void** data,
+               size_t* size,
+               int* merged)
+{
+    int rv = LITESTORE_ERR;
+
+    if (sqlite3_bind_int64(ctx->read_data, 1, id) == SQLITE_OK
+        && sqlite3_step(ctx->read_data) == SQLITE_ROW)
+    {
+        stored_value stored;
+        /* the value is empty if the object was created by a merge */
+        const int operands = sqlite3_column_int(ctx->read_data, 7);
+        if (column_raw(ctx, ctx->read_data, 0, &stored) == LITESTORE_OK
+            && (stored.size > 0 || operands)
+            && decode_value(ctx, &stored, data, size) == LITESTORE_OK)
+        {
+            rv = operands ? merge_value(ctx, id, data, size) : LITESTORE_OK;
+        }
+        if (merged)
+        {
+            *merged = operands;
+        }
+    }
+    else
+    {
+        sqlite_error(ctx);
+    }
+
+    return rv;
+}
+
+static
+int read_data(litestore* ctx,
+              const litestore_id_t id,
+              const void* key,
+              const size_t key_len,
+              void* extra,
+              void* cb,
+              void* user_data)
+{
+    UNUSED(key);
+    UNUSED(key_len);
+    UNUSED(extra);
+    int rv = LITESTORE_ERR;
+
+    if (ctx->read_data && cb)
+    {
+        litestore_read_cb callback = (litestore_read_cb)cb;
+        const void* data = NULL;
+        size_t size = 0;
+
+        if (read_value(ctx, id, &data, &size, NULL) == LITESTORE_OK)
+        {
+            rv = (*callback)(litestore_make_blob(data, size), user_data);
+        }
+        sqlite3_reset(ctx->read_data);
+    }
+
+    return rv;
+}
+
+typedef struct
+{
+    int object_type;
+    int (*read)(litestore*, const litestore_id_t,
+                const void* /* key */, const size_t /* key_len */,
+                void* /* extra */, void* /* cb */, void* /* user_data */);
+    void* extra;
+    void* callback;
+    void* user_data;
+} read_ctx;
+
+static
+int gen_read(litestore* ctx,
+             const char* key,
+             const size_t key_len,
+             read_ctx op)
+{
+    int rv = LITESTORE_ERR;
+
+    if (ctx && key && key_len > 0 && op.read)
+    {
+        op_begin(ctx, "gen_read");
+        const int own_tx = opt_begin_tx(ctx);
+
+        litestore_id_t id = 0;
+        int type = -1;
+        rv = read_object_type(ctx, key, key_len, &id, &type);
+
+        if (rv == LITESTORE_OK && type == op.object_type)
+        {
+            rv = (*op.read)(ctx, id, key, key_len, op.extra,
+                            op.callback, op.user_data);
+        }
+        else
+        {
+            rv = LITESTORE_ERR;
+        }
+
+        if (own_tx)
+        {
+            opt_end_tx(ctx, rv);
+        }
+        op_end(ctx, LITESTORE_OP_READ);
+    }
+
+    return rv;
+}
+
+
+/*-----------------------------------------*/
+/*----------------- DELETE ----------------*/
+/*-----------------------------------------*/
+static
+int delete_data(litestore*ctx, const litestore_id_t id)
+{
+    if (ctx->delete_data)
+    {
+        sqlite3_reset(ctx->delete_data);
+        if ((sqlite3_bind_int64(ctx->delete_data, 1, id) != SQLITE_OK))
+        {
+            sqlite_error(ctx);
+            return LITESTORE_ERR;
+        }
+        if (sqlite3_step(ctx->delete_data) != SQLITE_DONE)
+        {
+            sqlite_error(ctx);
+            return LITESTORE_ERR;
+        }
+    }
+    else
+    {
+        return LITESTORE_ERR;
+    }
+    return LITESTORE_OK;
+}
+
+static
+int delete_fields(litestore* ctx, const litestore_id_t id)
+{
+    int rv = LITESTORE_ERR;
+
+    if (sqlite3_bind_int64(ctx->delete_fields, 1, id) == SQLITE_OK
+        && sqlite3_step(ctx->delete_fields) == SQLITE_DONE)
+    {
+        rv = LITESTORE_OK;
+    }
+    else
+    {
+        sqlite_error(ctx);
+    }
+    sqlite3_reset(ctx->delete_fields);
+
+    return rv;
+}
+
+/**
+ * Delete the items of an array from the given index on.
+ */
+static
+int delete_items(litestore* ctx,
+                 const litestore_id_t id,
+                 const size_t from)
+{
+    int rv = LITESTORE_ERR;
+
+    if (sqlite3_bind_int64(ctx->delete_items, 1, id) == SQLITE_OK
+        && sqlite3_bind_int64(ctx->delete_items, 2,
+                              (sqlite3_int64)from) == SQLITE_OK
+        && sqlite3_step(ctx->delete_items) == SQLITE_DONE)
+    {
+        rv = LITESTORE_OK;
+    }
+    else
+    {
+        sqlite_error(ctx);
+    }
+    sqlite3_reset(ctx->delete_items);
+
+    return rv;
+}
+
+static
+int delete_operands(litestore* ctx, const litestore_id_t id)
+{
+    int rv = LITESTORE_ERR;
+
+    if (sqlite3_bind_int64(ctx->delete_operands, 1, id) == SQLITE_OK
+        && sqlite3_step(ctx->delete_operands) == SQLITE_DONE)
+    {
+        rv = LITESTORE_OK;
+    }
+    else
+    {
+        sqlite_error(ctx);
+    }
+    sqlite3_reset(ctx->delete_operands);
+
+    return rv;
+}
+
+static
+int delete_number(litestore* ctx, const litestore_id_t id)
+{
+    int rv = LITESTORE_ERR;
+
+    if (sqlite3_bind_int64(ctx->delete_num, 1, id) == SQLITE_OK
+        && sqlite3_step(ctx->delete_num) == SQLITE_DONE)
+    {
+        rv = LITESTORE_OK;
+    }
+    else
+    {
+        sqlite_error(ctx);
+    }
+    sqlite3_reset(ctx->delete_num);
+
+    return rv;
+}
+
+static
+int delete_json(litestore* ctx, const litestore_id_t id)
+{
+    int rv = LITESTORE_ERR;
+
+    if (sqlite3_bind_int64(ctx->delete_json, 1, id) == SQLITE_OK
+        && sqlite3_step(ctx->delete_json) == SQLITE_DONE)
+    {
+        rv = LITESTORE_OK;
+    }
+    else
+    {
+        sqlite_error(ctx);
+    }
+    sqlite3_reset(ctx->delete_json);
+
+    return rv;
+}
+
+/**
+ * Delete the value of an object, but not the object itself.
+ */
+static
+int delete_value(litestore* ctx,
+                 const litestore_id_t id,
+                 const int type)
+{
+    switch (type)
+    {
+        case LS_RAW:
+            return delete_data(ctx, id) == LITESTORE_OK
+                && delete_operands(ctx, id) == LITESTORE_OK
+                ? delete_terms(ctx, id) : LITESTORE_ERR;
+        case LS_KV:
+            return delete_fields(ctx, id);
+        case LS_ARRAY:
+            return delete_items(ctx, id, 0);
+        case LS_INT:
+        case LS_FLOAT:
+            return delete_number(ctx, id);
+        case LS_JSON:
+            return delete_json(ctx, id);
+    }
+    return LITESTORE_OK;
+}
+
+
+/*-----------------------------------------*/
+/*----------------- UPDATE ----------------*/
+/*-----------------------------------------*/
+static
+int update_object_type(litestore* ctx,
+                       const litestore_id_t id,
+                       const int type)
+{
+    sqlite3_reset(ctx->update_type);
+    if (sqlite3_bind_int(ctx->update_type, 1, type) != SQLITE_OK
+        || sqlite3_bind_int64(ctx->update_type, 2, id) != SQLITE_OK)
+    {
+        sqlite_error(ctx);
+        return LITESTORE_ERR;
+    }
+    if (sqlite3_step(ctx->update_type) != SQLITE_DONE)
+    {
+        sqlite_error(ctx);
+        return LITESTORE_ERR;
+    }
+
+    return LITESTORE_OK;
+}
+
+static
+int update_null(litestore* ctx,
+                const litestore_id_t id,
+                const int old_type)
+{
+    return delete_value(ctx, id, old_type);
+}
+
+static
+int update_data(litestore* ctx,
+                const litestore_id_t id,
+                const int old_type,
+                void* data)
+{
+    /* the new value replaces the merged one */
+    int rv = old_type == LS_RAW
+        ? delete_operands(ctx, id)
+        : delete_value(ctx, id, old_type);
+
+    if (rv == LITESTORE_OK)
+    {
+        litestore_blob_t* value = (litestore_blob_t*)data;
+        stored_value stored;
+        value_refs refs;
+
+        /* try update, if it fails create */
+        if (store_value(ctx, value, &stored, &refs) == LITESTORE_OK
+            && bind_value(ctx->update_data, 1, &stored) == LITESTORE_OK
+            && bind_refs(ctx->update_data, 4, &refs) == LITESTORE_OK
+            && sqlite3_bind_int64(ctx->update_data, 6, id) == SQLITE_OK)
+        {
+            if (sqlite3_step(ctx->update_data) == SQLITE_DONE)
+            {
+                if (sqlite3_changes(ctx->db) == 0)
+                {
+                    /* the value is already stored (or logged) */
+                    rv = value->data && value->size > 0
+                        ? insert_data(ctx, id, &stored, &refs)
+                        : LITESTORE_ERR;
+                }
+            }
+            else
+            {
+                sqlite_error(ctx);
+                rv = LITESTORE_ERR;
+            }
+        }
+        else
+        {
+            sqlite_error(ctx);
+            rv = LITESTORE_ERR;
+        }
+        sqlite3_reset(ctx->update_data);
+    }
+    if (rv == LITESTORE_OK)
+    {
+        rv = index_value(ctx, id, *(litestore_blob_t*)data);
+    }
+
+    return rv;
+}
+
+typedef struct
+{
     int object_type;
+    int (*update)(litestore*, const litestore_id_t, const int, void*);
     int (*create)(litestore*, litestore_id_t, void*);
     void* data;
-} create_ctx;
+} update_ctx;
+
+static
+int gen_update(litestore* ctx,
+               const char* key,
+               const size_t key_len,
+               update_ctx op)
+{
+    int rv = LITESTORE_ERR;
+
+    if (ctx && !bulk_blocks(ctx) && key && key_len > 0 && op.update && op.data)
+    {
+        op_begin(ctx, "gen_update");
+        const int own_tx = opt_begin_tx(ctx);
+
+        litestore_id_t id = 0;
+        int old_type = -1;
+        rv = read_object_type(ctx, key, key_len, &id, &old_type);
+        if (rv == LITESTORE_OK)
+        {
+            rv = (*op.update)(ctx, id, old_type, op.data);
+            if (rv == LITESTORE_OK && old_type != op.object_type)
+            {
+                rv = update_object_type(ctx, id, op.object_type);
+            }
+        }
+        else if (rv == LITESTORE_UNKNOWN_ENTITY)
+        {
+            create_ctx s = {op.object_type, op.create, op.data};
+            rv = gen_create(ctx, key, key_len, s);
+        }
+
+        if (own_tx)
+        {
+            opt_end_tx(ctx, rv);
+        }
+        op_end(ctx, LITESTORE_OP_UPDATE);
+    }
+
+    return rv;
+}
+
+static inline
+int slice_valid(const litestore_slice_t s)
+{
+    return s.data && s.length > 0;
+}
+
+static inline
+int blob_valid(const litestore_blob_t b)
+{
+    return b.data && b.size > 0;
+}
+
+/* from litestore_helpers.h */
+litestore_blob_t litestore_make_blob(const void* data, const size_t size)
+{
+    litestore_blob_t tmp = {data, size};
+    return tmp;
+}
+
+/* from litestore_helpers.h */
+litestore_slice_t litestore_slice(const char* str,
+                                  const size_t begin,
+                                  const size_t end)
+{
+    if (str && end > begin)
+    {
+        litestore_slice_t tmp = {str + begin, end - begin};
+        return tmp;
+    }
+    litestore_slice_t tmp = {NULL, 0};
+    return tmp;
+}
+
+/* from litestore_helpers.h */
+litestore_slice_t litestore_slice_str(const char* str)
+{
+    return litestore_slice(str, 0, strlen(str));
+}
+
+size_t litestore_key_int(const long long value, char* dst)
+{
+    if (dst)
+    {
+        const unsigned long long u =
+            (unsigned long long)value ^ 0x8000000000000000ULL;
+        int i = 0;
+        for (; i < LITESTORE_KEY_INT_SIZE; ++i)
+        {
+            dst[i] = (char)((u >> (8 * (LITESTORE_KEY_INT_SIZE - 1 - i)))
+                            & 0xff);
+        }
+    }
+    return LITESTORE_KEY_INT_SIZE;
+}
+
+size_t litestore_key_str(litestore_slice_t str, char* dst)
+{
+    size_t size = 0;
+    size_t i = 0;
+    for (; i < str.length; ++i)
+    {
+        if (dst)
+        {
+            dst[size] = str.data[i];
+        }
+        ++size;
+        if (str.data[i] == '\0')
+        {
+            if (dst)
+            {
+                dst[size] = (char)0xff;
+            }
+            ++size;
+        }
+    }
+    if (dst)
+    {
+        dst[size] = '\0';
+        dst[size + 1] = (char)0x01;
+    }
+    return size + 2;
+}
+
+size_t litestore_key_read_int(litestore_slice_t src, long long* value)
+{
+    unsigned long long u = 0;
+    size_t i = 0;
+    if (src.length < LITESTORE_KEY_INT_SIZE)
+    {
+        return 0;
+    }
+    for (; i < LITESTORE_KEY_INT_SIZE; ++i)
+    {
+        u = (u << 8) | (unsigned char)src.data[i];
+    }
+    *value = (long long)(u ^ 0x8000000000000000ULL);
+    return LITESTORE_KEY_INT_SIZE;
+}
+
+size_t litestore_key_read_str(litestore_slice_t src,
+                              char* dst,
+                              size_t* length)
+{
+    size_t size = 0;
+    size_t i = 0;
+    while (i < src.length)
+    {
+        char c = src.data[i];
+        if (c == '\0')
+        {
+            if (i + 1 == src.length)
+            {
+                return 0;
+            }
+            if ((unsigned char)src.data[i + 1] == 0x01)
+            {
+                *length = size;
+                return i + 2;
+            }
+            if ((unsigned char)src.data[i + 1] != 0xff)
+            {
+                return 0;
+            }
+            ++i;  /* escaped 0x00 */
+        }
+        if (dst)
+        {
+            dst[size] = c;
+        }
+        ++size;
+        ++i;
+    }
+    return 0;
+}
+
+size_t litestore_key_prefix_end(char* key, const size_t length)
+{
+    size_t end = length;
+    while (end > 0 && (unsigned char)key[end - 1] == 0xff)
+    {
+        --end;
+    }
+    if (end > 0)
+    {
+        key[end - 1] = (char)((unsigned char)key[end - 1] + 1);
+    }
+    return end;
+}
+
+/*-----------------------------------------*/
+/*------------------ KV -------------------*/
+/*-----------------------------------------*/
+typedef struct
+{
+    litestore_slice_t field;
+    litestore_blob_t value;
+} kv_field;
+
+static
+int set_field(litestore* ctx, const litestore_id_t id, const kv_field* f)
+{
+    int rv = LITESTORE_ERR;
+
+    if (sqlite3_bind_int64(ctx->set_field, 1, id) == SQLITE_OK
+        && sqlite3_bind_blob(ctx->set_field, 2,
+                             f->field.data, (int)f->field.length,
+                             SQLITE_STATIC) == SQLITE_OK
+        && sqlite3_bind_blob(ctx->set_field, 3,
+                             f->value.data, (int)f->value.size,
+                             SQLITE_STATIC) == SQLITE_OK
+        && sqlite3_step(ctx->set_field) == SQLITE_DONE)
+    {
+        rv = LITESTORE_OK;
+    }
+    else
+    {
+        sqlite_error(ctx);
+    }
+    sqlite3_reset(ctx->set_field);
+
+    return rv;
+}
+
+static
+int create_kv(litestore* ctx, litestore_id_t new_id, void* data)
+{
+    return set_field(ctx, new_id, (const kv_field*)data);
+}
+
+static
+int update_kv(litestore* ctx,
+              const litestore_id_t id,
+              const int old_type,
+              void* data)
+{
+    int rv = LITESTORE_OK;
+
+    if (old_type != LS_KV)
+    {
+        rv = delete_value(ctx, id, old_type);
+    }
+    if (rv == LITESTORE_OK)
+    {
+        rv = set_field(ctx, id, (const kv_field*)data);
+    }
+
+    return rv;
+}
+
+static
+int read_field(litestore* ctx,
+               const litestore_id_t id,
+               const void* key,
+               const size_t key_len,
+               void* extra,
+               void* cb,
+               void* user_data)
+{
+    UNUSED(key);
+    UNUSED(key_len);
+    int rv = LITESTORE_ERR;
+    const litestore_slice_t* field = (const litestore_slice_t*)extra;
+    litestore_read_cb callback = (litestore_read_cb)cb;
+
+    if (sqlite3_bind_int64(ctx->read_field, 1, id) == SQLITE_OK
+        && sqlite3_bind_blob(ctx->read_field, 2,
+                             field->data, (int)field->length,
+                             SQLITE_STATIC) == SQLITE_OK)
+    {
+        const int rc = sqlite3_step(ctx->read_field);
+        if (rc == SQLITE_ROW)
+        {
+            const void* data = sqlite3_column_blob(ctx->read_field, 0);
+            const int size = sqlite3_column_bytes(ctx->read_field, 0);
+            rv = (*callback)(litestore_make_blob(data, (size_t)size),
+                             user_data);
+        }
+        else if (rc == SQLITE_DONE)
+        {
+            rv = LITESTORE_UNKNOWN_ENTITY;
+        }
+        else
+        {
+            sqlite_error(ctx);
+        }
+    }
+    else
+    {
+        sqlite_error(ctx);
+    }
+    sqlite3_reset(ctx->read_field);
+
+    return rv;
+}
+
+static
+int read_fields(litestore* ctx,
+                const litestore_id_t id,
+                const void* key,
+                const size_t key_len,
+                void* extra,
+                void* cb,
+                void* user_data)
+{
+    UNUSED(key);
+    UNUSED(key_len);
+    UNUSED(extra);
+    int rv = LITESTORE_ERR;
+    int rc = SQLITE_ERROR;
+    litestore_kv_cb callback = (litestore_kv_cb)cb;
+
+    if (sqlite3_bind_int64(ctx->read_fields, 1, id) == SQLITE_OK)
+    {
+        rv = LITESTORE_OK;
+        while (rv == LITESTORE_OK
+               && (rc = sqlite3_step(ctx->read_fields)) == SQLITE_ROW)
+        {
+            const void* field = sqlite3_column_blob(ctx->read_fields, 0);
+            const int field_len = sqlite3_column_bytes(ctx->read_fields, 0);
+            const void* value = sqlite3_column_blob(ctx->read_fields, 1);
+            const int value_len = sqlite3_column_bytes(ctx->read_fields, 1);
+            rv = (*callback)(
+                litestore_slice((const char*)field, 0, (size_t)field_len),
+                litestore_make_blob(value, (size_t)value_len),
+                user_data);
+        }
+        if (rv == LITESTORE_OK && rc != SQLITE_DONE)
+        {
+            sqlite_error(ctx);
+            rv = LITESTORE_ERR;
+        }
+    }
+    else
+    {
+        sqlite_error(ctx);
+    }
+    sqlite3_reset(ctx->read_fields);
+
+    return rv;
+}
+
+/*-----------------------------------------*/
+/*----------------- ARRAY -----------------*/
+/*-----------------------------------------*/
+typedef struct
+{
+    litestore_blob_t value;
+    size_t* index;  /* out, optional */
+} array_item;
+
+typedef struct
+{
+    size_t first;
+    size_t count;
+} array_range;
+
+static
+int array_length(litestore* ctx, const litestore_id_t id, size_t* length)
+{
+    int rv = LITESTORE_ERR;
+
+    if (sqlite3_bind_int64(ctx->array_length, 1, id) == SQLITE_OK
+        && sqlite3_step(ctx->array_length) == SQLITE_ROW)
+    {
+        /* NULL (0) for an empty array */
+        *length = sqlite3_column_type(ctx->array_length, 0) == SQLITE_NULL
+            ? 0 : (size_t)sqlite3_column_int64(ctx->array_length, 0) + 1;
+        rv = LITESTORE_OK;
+    }
+    else
+    {
+        sqlite_error(ctx);
+    }
+    sqlite3_reset(ctx->array_length);
+
+    return rv;
+}
+
+static
+int append_item(litestore* ctx,
+                const litestore_id_t id,
+                const int old_type,
+                void* data)
+{
+    array_item* item = (array_item*)data;
+    size_t index = 0;
+    int rv = old_type == LS_ARRAY
+        ? array_length(ctx, id, &index)
+        : delete_value(ctx, id, old_type);
+
+    if (rv == LITESTORE_OK)
+    {
+        if (sqlite3_bind_int64(ctx->append_item, 1, id) == SQLITE_OK
+            && sqlite3_bind_int64(ctx->append_item, 2,
+                                  (sqlite3_int64)index) == SQLITE_OK
+            && sqlite3_bind_blob(ctx->append_item, 3,
+                                 item->value.data, (int)item->value.size,
+                                 SQLITE_STATIC) == SQLITE_OK
+            && sqlite3_step(ctx->append_item) == SQLITE_DONE)
+        {
+            if (item->index)
+            {
+                *item->index = index;
+            }
+        }
+        else
+        {
+            sqlite_error(ctx);
+            rv = LITESTORE_ERR;
+        }
+        sqlite3_reset(ctx->append_item);
+    }
+
+    return rv;
+}
+
+static
+int create_array(litestore* ctx, litestore_id_t new_id, void* data)
+{
+    /* a new object, nothing to delete */
+    return append_item(ctx, new_id, LS_NULL, data);
+}
+
+static
+int read_length(litestore* ctx,
+                const litestore_id_t id,
+                const void* key,
+                const size_t key_len,
+                void* extra,
+                void* cb,
+                void* user_data)
+{
+    UNUSED(key);
+    UNUSED(key_len);
+    UNUSED(cb);
+    UNUSED(user_data);
+    return array_length(ctx, id, (size_t*)extra);
+}
+
+static
+int read_item(litestore* ctx,
+              const litestore_id_t id,
+              const void* key,
+              const size_t key_len,
+              void* extra,
+              void* cb,
+              void* user_data)
+{
+    UNUSED(key);
+    UNUSED(key_len);
+    int rv = LITESTORE_ERR;
+    const size_t index = *(const size_t*)extra;
+    litestore_read_cb callback = (litestore_read_cb)cb;
+
+    if (sqlite3_bind_int64(ctx->read_item, 1, id) == SQLITE_OK
+        && sqlite3_bind_int64(ctx->read_item, 2,
+                              (sqlite3_int64)index) == SQLITE_OK)
+    {
+        const int rc = sqlite3_step(ctx->read_item);
+        if (rc == SQLITE_ROW)
+        {
+            const void* data = sqlite3_column_blob(ctx->read_item, 0);
+            const int size = sqlite3_column_bytes(ctx->read_item, 0);
+            rv = (*callback)(litestore_make_blob(data, (size_t)size),
+                             user_data);
+        }
+        else if (rc == SQLITE_DONE)
+        {
+            rv = LITESTORE_UNKNOWN_ENTITY;
+        }
+        else
+        {
+            sqlite_error(ctx);
+        }
+    }
+    else
+    {
+        sqlite_error(ctx);
+    }
+    sqlite3_reset(ctx->read_item);
+
+    return rv;
+}
+
+static
+int read_items(litestore* ctx,
+               const litestore_id_t id,
+               const void* key,
+               const size_t key_len,
+               void* extra,
+               void* cb,
+               void* user_data)
+{
+    UNUSED(key);
+    UNUSED(key_len);
+    int rv = LITESTORE_ERR;
+    int rc = SQLITE_ERROR;
+    const array_range* range = (const array_range*)extra;
+    litestore_array_cb callback = (litestore_array_cb)cb;
+    /* a negative LIMIT is no limit */
+    const sqlite3_int64 limit = range->count < (size_t)LLONG_MAX
+        ? (sqlite3_int64)range->count : -1;
+
+    if (sqlite3_bind_int64(ctx->read_items, 1, id) == SQLITE_OK
+        && sqlite3_bind_int64(ctx->read_items, 2,
+                              (sqlite3_int64)range->first) == SQLITE_OK
+        && sqlite3_bind_int64(ctx->read_items, 3, limit) == SQLITE_OK)
+    {
+        rv = LITESTORE_OK;
+        while (rv == LITESTORE_OK
+               && (rc = sqlite3_step(ctx->read_items)) == SQLITE_ROW)
+        {
+            const void* value = sqlite3_column_blob(ctx->read_items, 1);
+            const int value_len = sqlite3_column_bytes(ctx->read_items, 1);
+            rv = (*callback)(
+                (size_t)sqlite3_column_int64(ctx->read_items, 0),
+                litestore_make_blob(value, (size_t)value_len),
+                user_data);
+        }
+        if (rv == LITESTORE_OK && rc != SQLITE_DONE)
+        {
+            sqlite_error(ctx);
+            rv = LITESTORE_ERR;
+        }
+    }
+    else
+    {
+        sqlite_error(ctx);
+    }
+    sqlite3_reset(ctx->read_items);
+
+    return rv;
+}
+
+/**
+ * @return LITESTORE_OK if key is an array,
+ *         LITESTORE_UNKNOWN_ENTITY if key is not found,
+ *         LITESTORE_ERR otherwise.
+ */
+static
+int read_array_id(litestore* ctx,
+                  litestore_slice_t key,
+                  litestore_id_t* id)
+{
+    int type = -1;
+    const int rv = read_object_type(ctx, key.data, key.length, id, &type);
+    if (rv == LITESTORE_OK && type != LS_ARRAY)
+    {
+        return LITESTORE_ERR;
+    }
+    return rv;
+}
+
+/*-----------------------------------------*/
+/*---------------- NUMBER -----------------*/
+/*-----------------------------------------*/
+typedef struct
+{
+    int type;  /* LS_INT or LS_FLOAT */
+    sqlite3_int64 i;
+    double f;
+} number;
+
+static
+int bind_number(sqlite3_stmt* stmt, const int index, const number* value)
+{
+    return value->type == LS_INT
+        ? sqlite3_bind_int64(stmt, index, value->i)
+        : sqlite3_bind_double(stmt, index, value->f);
+}
+
+static
+int set_number(litestore* ctx, const litestore_id_t id, const number* value)
+{
+    int rv = LITESTORE_ERR;
+
+    if (sqlite3_bind_int64(ctx->set_num, 1, id) == SQLITE_OK
+        && bind_number(ctx->set_num, 2, value) == SQLITE_OK
+        && sqlite3_step(ctx->set_num) == SQLITE_DONE)
+    {
+        rv = LITESTORE_OK;
+    }
+    else
+    {
+        sqlite_error(ctx);
+    }
+    sqlite3_reset(ctx->set_num);
+
+    return rv;
+}
+
+static
+int create_number(litestore* ctx, litestore_id_t new_id, void* data)
+{
+    return set_number(ctx, new_id, (const number*)data);
+}
+
+static
+int update_number(litestore* ctx,
+                  const litestore_id_t id,
+                  const int old_type,
+                  void* data)
+{
+    int rv = LITESTORE_OK;
+
+    /* the row of an int or float is replaced */
+    if (old_type != LS_INT && old_type != LS_FLOAT)
+    {
+        rv = delete_value(ctx, id, old_type);
+    }
+    if (rv == LITESTORE_OK)
+    {
+        rv = set_number(ctx, id, (const number*)data);
+    }
+
+    return rv;
+}
+
+static
+int read_number(litestore* ctx,
+                const litestore_id_t id,
+                const void* key,
+                const size_t key_len,
+                void* extra,
+                void* cb,
+                void* user_data)
+{
+    UNUSED(key);
+    UNUSED(key_len);
+    UNUSED(cb);
+    UNUSED(user_data);
+    int rv = LITESTORE_ERR;
+    number* value = (number*)extra;
+
+    if (sqlite3_bind_int64(ctx->read_num, 1, id) == SQLITE_OK
+        && sqlite3_step(ctx->read_num) == SQLITE_ROW)
+    {
+        value->i = sqlite3_column_int64(ctx->read_num, 0);
+        value->f = sqlite3_column_double(ctx->read_num, 0);
+        rv = LITESTORE_OK;
+    }
+    else
+    {
+        sqlite_error(ctx);
+    }
+    sqlite3_reset(ctx->read_num);
+
+    return rv;
+}
+
+/**
+ * Add to an int or float, or create it with the value.
+ * The existing object is updated by a single statement.
+ *
+ * @param value The delta (in), the new value (out).
+ */
+static
+int incr_number(litestore* ctx, litestore_slice_t key, number* value)
+{
+    int rv = LITESTORE_ERR;
+
+    if (ctx && !bulk_blocks(ctx) && slice_valid(key))
+    {
+        op_begin(ctx, "incr");
+        const int own_tx = opt_begin_tx(ctx);
+
+        if (bind_number(ctx->incr_num, 1, value) == SQLITE_OK
+            && sqlite3_bind_int(ctx->incr_num, 2,
+                                value->type == LS_INT
+                                ? SQLITE_INTEGER : SQLITE_FLOAT)
+            == SQLITE_OK
+            && sqlite3_bind_text(ctx->incr_num, 3, key.data, key.length,
+                                 SQLITE_STATIC) == SQLITE_OK
+            && sqlite3_bind_int(ctx->incr_num, 4, value->type) == SQLITE_OK
+            && sqlite3_bind_int64(ctx->incr_num, 5, expiry_now())
+            == SQLITE_OK
+            && sqlite3_step(ctx->incr_num) == SQLITE_DONE)
+        {
+            if (sqlite3_changes(ctx->db) == 1)
+            {
+                value->i = ctx->captured_int;
+                value->f = ctx->captured_float;
+                rv = LITESTORE_OK;
+            }
+            else
+            {
+                /* not found or of other type */
+                litestore_id_t id = 0;
+                int type = -1;
+                rv = read_object_type(ctx, key.data, key.length, &id, &type);
+                if (rv == LITESTORE_UNKNOWN_ENTITY)
+                {
+                    create_ctx op = {value->type, &create_number, value};
+                    rv = gen_create(ctx, key.data, key.length, op);
+                }
+                else
+                {
+                    rv = LITESTORE_ERR;
+                }
+            }
+        }
+        else
+        {
+            sqlite_error(ctx);
+        }
+        sqlite3_reset(ctx->incr_num);
+
+        if (own_tx)
+        {
+            opt_end_tx(ctx, rv);
+        }
+        op_end(ctx, LITESTORE_OP_UPDATE);
+    }
+
+    return rv;
+}
+
+/*-----------------------------------------*/
+/*----------------- JSON ------------------*/
+/*-----------------------------------------*/
+static
+int set_json(litestore* ctx, const litestore_id_t id, litestore_slice_t doc)
+{
+    int rv = LITESTORE_ERR;
+
+    if (sqlite3_bind_int64(ctx->set_json, 1, id) == SQLITE_OK
+        && sqlite3_bind_text(ctx->set_json, 2, doc.data, doc.length,
+                             SQLITE_STATIC) == SQLITE_OK
+        && sqlite3_step(ctx->set_json) == SQLITE_DONE)
+    {
+        rv = LITESTORE_OK;
+    }
+    else
+    {
+        sqlite_error(ctx);
+    }
+    sqlite3_reset(ctx->set_json);
+
+    return rv;
+}
+
+static
+int create_json(litestore* ctx, litestore_id_t new_id, void* data)
+{
+    return set_json(ctx, new_id, *(litestore_slice_t*)data);
+}
+
+static
+int update_json(litestore* ctx,
+                const litestore_id_t id,
+                const int old_type,
+                void* data)
+{
+    int rv = LITESTORE_OK;
+
+    /* the row of a document is replaced */
+    if (old_type != LS_JSON)
+    {
+        rv = delete_value(ctx, id, old_type);
+    }
+    if (rv == LITESTORE_OK)
+    {
+        rv = set_json(ctx, id, *(litestore_slice_t*)data);
+    }
+
+    return rv;
+}
+
+static
+int read_json(litestore* ctx,
+              const litestore_id_t id,
+              const void* key,
+              const size_t key_len,
+              void* extra,
+              void* cb,
+              void* user_data)
+{
+    UNUSED(key);
+    UNUSED(key_len);
+    UNUSED(extra);
+    int rv = LITESTORE_ERR;
+
+    if (sqlite3_bind_int64(ctx->read_json, 1, id) == SQLITE_OK
+        && sqlite3_step(ctx->read_json) == SQLITE_ROW)
+    {
+        litestore_read_cb callback = (litestore_read_cb)cb;
+        rv = (*callback)(
+            litestore_make_blob(sqlite3_column_text(ctx->read_json, 0),
+                                (size_t)sqlite3_column_bytes(
+                                    ctx->read_json, 0)),
+            user_data);
+    }
+    else
+    {
+        sqlite_error(ctx);
+    }
+    sqlite3_reset(ctx->read_json);
+
+    return rv;
+}
+
+/**
+ * Read a part of a document, extracted by JSON1.
+ *
+ * @param extra The path, a litestore_slice_t.
+ */
+static
+int read_json_path(litestore* ctx,
+                   const litestore_id_t id,
+                   const void* key,
+                   const size_t key_len,
+                   void* extra,
+                   void* cb,
+                   void* user_data)
+{
+    UNUSED(key);
+    UNUSED(key_len);
+    int rv = LITESTORE_ERR;
+    sqlite3_stmt* stmt = ctx->read_json_path;
+    const litestore_slice_t* path = (const litestore_slice_t*)extra;
+
+    if (sqlite3_bind_int64(stmt, 1, id) == SQLITE_OK
+        && sqlite3_bind_text(stmt, 2, path->data, path->length,
+                             SQLITE_STATIC) == SQLITE_OK
+        && sqlite3_step(stmt) == SQLITE_ROW)
+    {
+        /* the type is NULL if there is nothing at the path */
+        if (sqlite3_column_type(stmt, 0) == SQLITE_NULL)
+        {
+            rv = LITESTORE_UNKNOWN_ENTITY;
+        }
+        else
+        {
+            litestore_read_cb callback = (litestore_read_cb)cb;
+            rv = (*callback)(
+                litestore_make_blob(sqlite3_column_text(stmt, 1),
+                                    (size_t)sqlite3_column_bytes(stmt, 1)),
+                user_data);
+        }
+    }
+    else
+    {
+        sqlite_error(ctx);
+    }
+    sqlite3_reset(stmt);
+
+    return rv;
+}
+
+
+/*-----------------------------------------*/
+/*----------------- BULK ------------------*/
+/*-----------------------------------------*/
+static
+int exec_sql(litestore* ctx, const char* sql)
+{
+    if (sqlite3_exec(ctx->db, sql, NULL, NULL, NULL) != SQLITE_OK)
+    {
+        sqlite_error(ctx);
+        return LITESTORE_ERR;
+    }
+    return LITESTORE_OK;
+}
+
+/**
+ * Run a statement and copy the first column of the first row.
+ *
+ * @return LITESTORE_OK on success,
+ *         LITESTORE_UNKNOWN_ENTITY if no rows,
+ *         LITESTORE_ERR otherwise.
+ */
+static
+int query_text(litestore* ctx, const char* sql, char* value, const int size)
+{
+    int rv = LITESTORE_ERR;
+    sqlite3_stmt* stmt = NULL;
+
+    if (sqlite3_prepare_v2(ctx->db, sql, -1, &stmt, NULL) == SQLITE_OK)
+    {
+        const int rc = sqlite3_step(stmt);
+        if (rc == SQLITE_ROW)
+        {
+            const unsigned char* text = sqlite3_column_text(stmt, 0);
+            sqlite3_snprintf(size, value, "%s",
+                             text ? (const char*)text : "");
+            rv = LITESTORE_OK;
+        }
+        else if (rc == SQLITE_DONE)
+        {
+            rv = LITESTORE_UNKNOWN_ENTITY;
+        }
+        else
+        {
+            sqlite_error(ctx);
+        }
+    }
+    else
+    {
+        sqlite_error(ctx);
+    }
+    sqlite3_finalize(stmt);
+
+    return rv;
+}
+
+/**
+ * Keys appended with LITESTORE_BULK_SORTED must be ascending,
+ * in the order of the objects.name index (memcmp).
+ */
+static
+int bulk_check_order(litestore* ctx, litestore_slice_t key)
+{
+    if (ctx->bulk_key_len > 0)
+    {
+        const size_t last_len = (size_t)ctx->bulk_key_len;
+        const int cmp = memcmp(ctx->bulk_key, key.data,
+                               last_len < key.length ? last_len : key.length);
+        if (cmp > 0 || (cmp == 0 && last_len >= key.length))
+        {
+            report_error(ctx, LITESTORE_ERR, "bulk load: keys not sorted");
+            return LITESTORE_ERR;
+        }
+    }
+    if ((size_t)ctx->bulk_key_cap < key.length)
+    {
+        char* tmp = (char*)sqlite3_realloc(ctx->bulk_key, (int)key.length);
+        if (!tmp)
+        {
+            report_error(ctx, LITESTORE_ERR, "bulk load: out of memory");
+            return LITESTORE_ERR;
+        }
+        ctx->bulk_key = tmp;
+        ctx->bulk_key_cap = (int)key.length;
+    }
+    memcpy(ctx->bulk_key, key.data, key.length);
+    ctx->bulk_key_len = (int)key.length;
+    return LITESTORE_OK;
+}
+
+/**
+ * Restore the settings changed by litestore_bulk_begin.
+ */
+static
+int bulk_restore(litestore* ctx)
+{
+    int rv = exec_sql(ctx, "PRAGMA foreign_keys = ON;");
+    char sql[64];
+    /* each one on its own, a failure does not skip the rest */
+    sqlite3_snprintf(sizeof(sql), sql, "PRAGMA synchronous = %d;",
+                     ctx->bulk_synchronous);
+    if (exec_sql(ctx, sql) != LITESTORE_OK)
+    {
+        rv = LITESTORE_ERR;
+    }
+    sqlite3_snprintf(sizeof(sql), sql, "PRAGMA journal_mode = %s;",
+                     ctx->bulk_journal_mode);
+    if (exec_sql(ctx, sql) != LITESTORE_OK)
+    {
+        rv = LITESTORE_ERR;
+    }
+    return rv;
+}
+
+/**
+ * Run after the load, the store is not usable if these fail.
+ */
+static
+int bulk_check_integrity(litestore* ctx)
+{
+    char result[128];
+    int rv = query_text(ctx, "PRAGMA foreign_key_check;",
+                        result, sizeof(result));
+    if (rv == LITESTORE_OK)
+    {
+        report_error(ctx, LITESTORE_ERR,
+                     "bulk load: foreign key violation");
+        return LITESTORE_ERR;
+    }
+    if (rv == LITESTORE_UNKNOWN_ENTITY)
+    {
+        rv = query_text(ctx, "PRAGMA quick_check;", result, sizeof(result));
+        if (rv == LITESTORE_OK && strcmp(result, "ok") != 0)
+        {
+            report_error(ctx, LITESTORE_ERR, result);
+            rv = LITESTORE_ERR;
+        }
+    }
+    return rv == LITESTORE_OK ? LITESTORE_OK : LITESTORE_ERR;
+}
+
+/*-----------------------------------------*/
+/*----------------- EXPORT ----------------*/
+/*-----------------------------------------*/
+/* "LSEXPORT" + version */
+#define EXPORT_MAGIC "LSEXPORT"
+#define EXPORT_VERSION 1
+#define EXPORT_HEADER_SIZE 12
+/* Block: payload length, CRC32 of the payload, payload. */
+#define BLOCK_HEADER_SIZE 8
+#define BLOCK_SIZE (1 << 20)
+/* A record: varint key length, key, varint type, varint value length,
+   value. Max length of the three varints. */
+#define RECORD_OVERHEAD 30
+
+/**
+ * Buffered, block based reading and writing of the export format.
+ */
+typedef struct
+{
+    litestore* ctx;
+    int fd;
+    unsigned char* buf;  /* block header + payload */
+    size_t size;  /* payload bytes */
+    size_t cap;  /* payload capacity */
+} block_io;
+
+static
+int write_all(int fd, const unsigned char* data, size_t len)
+{
+    while (len > 0)
+    {
+        const ssize_t n = write(fd, data, len);
+        if (n < 0 && errno != EINTR)
+        {
+            return LITESTORE_ERR;
+        }
+        if (n > 0)
+        {
+            data += n;
+            len -= (size_t)n;
+        }
+    }
+    return LITESTORE_OK;
+}
+
+/**
+ * @return Bytes read, less than len only at the end of input,
+ *         -1 on error.
+ */
+static
+ssize_t read_all(int fd, unsigned char* data, const size_t len)
+{
+    size_t total = 0;
+    while (total < len)
+    {
+        const ssize_t n = read(fd, data + total, len - total);
+        if (n == 0)
+        {
+            break;
+        }
+        if (n < 0 && errno != EINTR)
+        {
+            return -1;
+        }
+        if (n > 0)
+        {
+            total += (size_t)n;
+        }
+    }
+    return (ssize_t)total;
+}
+
+static
+int block_reserve(block_io* io, const size_t payload)
+{
+    if (payload > io->cap)
+    {
+        unsigned char* tmp = (unsigned char*)sqlite3_realloc64(
+            io->buf, BLOCK_HEADER_SIZE + payload);
+        if (!tmp)
+        {
+            report_error(io->ctx, LITESTORE_ERR, "export: out of memory");
+            return LITESTORE_ERR;
+        }
+        io->buf = tmp;
+        io->cap = payload;
+    }
+    return LITESTORE_OK;
+}
+
+/**
+ * Write the buffered payload as a block, an empty block ends the export.
+ */
+static
+int block_flush(block_io* io)
+{
+    put_u32(io->buf, (unsigned int)io->size);
+    put_u32(io->buf + 4,
+            crc32_update(0, io->buf + BLOCK_HEADER_SIZE, io->size));
+    if (write_all(io->fd, io->buf, BLOCK_HEADER_SIZE + io->size)
+        != LITESTORE_OK)
+    {
+        report_error(io->ctx, LITESTORE_ERR, strerror(errno));
+        return LITESTORE_ERR;
+    }
+    io->size = 0;
+    return LITESTORE_OK;
+}
+
+static
+int export_record(block_io* io,
+                   const void* key, const size_t key_len,
+                   const int type,
+                   const void* value, const size_t value_len)
+{
+    const size_t len = RECORD_OVERHEAD + key_len + value_len;
+    unsigned char* p = NULL;
+
+    /* records larger than a block get a block of their own */
+    if (io->size > 0 && io->size + len > BLOCK_SIZE
+        && block_flush(io) != LITESTORE_OK)
+    {
+        return LITESTORE_ERR;
+    }
+    if (block_reserve(io, io->size + len) != LITESTORE_OK)
+    {
+        return LITESTORE_ERR;
+    }
+    p = io->buf + BLOCK_HEADER_SIZE + io->size;
+    p += put_varint(p, key_len);
+    memcpy(p, key, key_len);
+    p += key_len;
+    p += put_varint(p, (sqlite3_uint64)type);
+    p += put_varint(p, value_len);
+    if (value_len > 0)
+    {
+        memcpy(p, value, value_len);
+        p += value_len;
+    }
+    io->size = (size_t)(p - (io->buf + BLOCK_HEADER_SIZE));
+    return LITESTORE_OK;
+}
+
+/**
+ * The fields of a map are exported as the value:
+ * varint field length, field, varint value length, value.
+ */
+static
+int export_fields(litestore* ctx,
+                  const litestore_id_t id,
+                  const void** value,
+                  size_t* value_len)
+{
+    int rc = SQLITE_ERROR;
+    size_t size = 0;
+
+    if (sqlite3_bind_int64(ctx->read_fields, 1, id) == SQLITE_OK)
+    {
+        while ((rc = sqlite3_step(ctx->read_fields)) == SQLITE_ROW)
+        {
+            const void* field = sqlite3_column_blob(ctx->read_fields, 0);
+            const size_t field_len =
+                (size_t)sqlite3_column_bytes(ctx->read_fields, 0);
+            const void* data = sqlite3_column_blob(ctx->read_fields, 1);
+            const size_t data_len =
+                (size_t)sqlite3_column_bytes(ctx->read_fields, 1);
+            unsigned char* p =
+                scratch_reserve(ctx, size + 20 + field_len + data_len);
+            if (!p)
+            {
+                break;
+            }
+            p += size;
+            p += put_varint(p, field_len);
+            memcpy(p, field, field_len);
+            p += field_len;
+            p += put_varint(p, data_len);
+            if (data_len > 0)
+            {
+                memcpy(p, data, data_len);
+                p += data_len;
+            }
+            size = (size_t)(p - ctx->scratch);
+        }
+    }
+    if (rc != SQLITE_DONE && rc != SQLITE_ROW)
+    {
+        sqlite_error(ctx);
+    }
+    sqlite3_reset(ctx->read_fields);
+
+    *value = ctx->scratch;
+    *value_len = size;
+    return rc == SQLITE_DONE ? LITESTORE_OK : LITESTORE_ERR;
+}
+
+/**
+ * The items of an array are exported in order as the value:
+ * varint value length, value.
+ */
+static
+int export_items(litestore* ctx,
+                 const litestore_id_t id,
+                 const void** value,
+                 size_t* value_len)
+{
+    int rc = SQLITE_ERROR;
+    size_t size = 0;
+
+    if (sqlite3_bind_int64(ctx->read_items, 1, id) == SQLITE_OK
+        && sqlite3_bind_int64(ctx->read_items, 2, 0) == SQLITE_OK
+        && sqlite3_bind_int64(ctx->read_items, 3, -1) == SQLITE_OK)
+    {
+        while ((rc = sqlite3_step(ctx->read_items)) == SQLITE_ROW)
+        {
+            const void* data = sqlite3_column_blob(ctx->read_items, 1);
+            const size_t data_len =
+                (size_t)sqlite3_column_bytes(ctx->read_items, 1);
+            unsigned char* p = scratch_reserve(ctx, size + 10 + data_len);
+            if (!p)
+            {
+                break;
+            }
+            p += size;
+            p += put_varint(p, data_len);
+            if (data_len > 0)
+            {
+                memcpy(p, data, data_len);
+                p += data_len;
+            }
+            size = (size_t)(p - ctx->scratch);
+        }
+    }
+    if (rc != SQLITE_DONE && rc != SQLITE_ROW)
+    {
+        sqlite_error(ctx);
+    }
+    sqlite3_reset(ctx->read_items);
+
+    *value = ctx->scratch;
+    *value_len = size;
+    return rc == SQLITE_DONE ? LITESTORE_OK : LITESTORE_ERR;
+}
+
+/**
+ * Numbers are exported as 8 bytes, little endian,
+ * a float as its IEEE 754 bits.
+ */
+static
+void put_number(unsigned char* p, const number* value)
+{
+    sqlite3_uint64 bits = (sqlite3_uint64)value->i;
+    if (value->type == LS_FLOAT)
+    {
+        memcpy(&bits, &value->f, sizeof(bits));
+    }
+    put_u64(p, bits);
+}
+
+static
+void get_number(const unsigned char* p, number* value)
+{
+    const sqlite3_uint64 bits = get_u64(p);
+    value->i = (sqlite3_int64)bits;
+    memcpy(&value->f, &bits, sizeof(bits));
+}
+
+static
+int export_objects(litestore* ctx, block_io* io)
+{
+    int rv = LITESTORE_ERR;
+    int rc = SQLITE_ERROR;
+    sqlite3_stmt* stmt = NULL;
+    const char* sql =
+        "SELECT o.name, o.type, " RAW_VALUE_COLUMNS ", o.id, n.num_value, "
+        "EXISTS (SELECT 1 FROM merge_operands m WHERE m.id = o.id), j.doc "
+        "FROM objects o LEFT JOIN raw_data r ON r.id = o.id "
+        "LEFT JOIN num_data n ON n.id = o.id "
+        "LEFT JOIN json_data j ON j.id = o.id "
+        "LEFT JOIN expiry e ON e.id = o.id "
+        RAW_VALUE_JOIN
+        " WHERE e.expires_at IS NULL OR e.expires_at > ? ORDER BY o.name;";
+
+    /* expired keys are left out, the expiry times are not exported */
+    if (sqlite3_prepare_v2(ctx->db, sql, -1, &stmt, NULL) != SQLITE_OK
+        || sqlite3_bind_int64(stmt, 1, expiry_now()) != SQLITE_OK)
+    {
+        sqlite_error(ctx);
+        sqlite3_finalize(stmt);
+        return LITESTORE_ERR;
+    }
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+    {
+        stored_value stored;
+        unsigned char num[8];
+        const void* value = NULL;
+        size_t value_len = 0;
+        int rc_value = LITESTORE_ERR;
+        if (sqlite3_column_int(stmt, 1) == LS_KV)
+        {
+            rc_value = export_fields(ctx, sqlite3_column_int64(stmt, 9),
+                                     &value, &value_len);
+        }
+        else if (sqlite3_column_int(stmt, 1) == LS_ARRAY)
+        {
+            rc_value = export_items(ctx, sqlite3_column_int64(stmt, 9),
+                                    &value, &value_len);
+        }
+        else if (sqlite3_column_int(stmt, 1) == LS_INT
+                 || sqlite3_column_int(stmt, 1) == LS_FLOAT)
+        {
+            number n = {sqlite3_column_int(stmt, 1),
+                        sqlite3_column_int64(stmt, 10),
+                        sqlite3_column_double(stmt, 10)};
+            put_number(num, &n);
+            value = num;
+            value_len = sizeof(num);
+            rc_value = LITESTORE_OK;
+        }
+        else if (sqlite3_column_int(stmt, 1) == LS_JSON)
+        {
+            value = sqlite3_column_text(stmt, 12);
+            value_len = (size_t)sqlite3_column_bytes(stmt, 12);
+            rc_value = LITESTORE_OK;
+        }
+        /* exported uncompressed and merged, import compresses with its
+           settings */
+        else if (column_raw(ctx, stmt, 2, &stored) == LITESTORE_OK)
+        {
+            rc_value = decode_value(ctx, &stored, &value, &value_len);
+            if (rc_value == LITESTORE_OK && sqlite3_column_int(stmt, 11))
+            {
+                rc_value = merge_value(ctx, sqlite3_column_int64(stmt, 9),
+                                       &value, &value_len);
+            }
+        }
+        if (rc_value != LITESTORE_OK
+            || export_record(io,
+                             sqlite3_column_text(stmt, 0),
+                             (size_t)sqlite3_column_bytes(stmt, 0),
+                             sqlite3_column_int(stmt, 1),
+                             value, value_len)
+            != LITESTORE_OK)
+        {
+            break;
+        }
+    }
+    if (rc == SQLITE_DONE)
+    {
+        rv = LITESTORE_OK;
+    }
+    else if (rc != SQLITE_ROW)
+    {
+        sqlite_error(ctx);
+    }
+    sqlite3_finalize(stmt);
+
+    return rv;
+}
+
+static
+int import_fields(litestore* ctx,
+                  litestore_slice_t key,
+                  const unsigned char* p,
+                  const unsigned char* end)
+{
+    litestore_id_t id = 0;
+
+    if ((ctx->bulk_flags & LITESTORE_BULK_SORTED)
+        && bulk_check_order(ctx, key) != LITESTORE_OK)
+    {
+        return LITESTORE_ERR;
+    }
+    if (create_key(ctx, key.data, key.length, LS_KV, &id) != LITESTORE_OK)
+    {
+        return LITESTORE_ERR;
+    }
+    while (p < end)
+    {
+        sqlite3_uint64 field_len = 0;
+        sqlite3_uint64 value_len = 0;
+        const unsigned char* field = NULL;
+        size_t n = 0;
+
+        if ((n = get_varint(p, end, &field_len)) == 0
+            || field_len == 0
+            || field_len > (sqlite3_uint64)(end - p - n))
+        {
+            return LITESTORE_ERR;
+        }
+        field = p + n;
+        p = field + field_len;
+        if ((n = get_varint(p, end, &value_len)) == 0
+            || value_len > (sqlite3_uint64)(end - p - n))
+        {
+            return LITESTORE_ERR;
+        }
+        {
+            kv_field f = {
+                litestore_slice((const char*)field, 0, field_len),
+                litestore_make_blob(p + n, value_len)
+            };
+            if (set_field(ctx, id, &f) != LITESTORE_OK)
+            {
+                return LITESTORE_ERR;
+            }
+        }
+        p += n + value_len;
+    }
+    return LITESTORE_OK;
+}
+
+static
+int import_items(litestore* ctx,
+                 litestore_slice_t key,
+                 const unsigned char* p,
+                 const unsigned char* end)
+{
+    litestore_id_t id = 0;
+
+    if ((ctx->bulk_flags & LITESTORE_BULK_SORTED)
+        && bulk_check_order(ctx, key) != LITESTORE_OK)
+    {
+        return LITESTORE_ERR;
+    }
+    if (create_key(ctx, key.data, key.length, LS_ARRAY, &id)
+        != LITESTORE_OK)
+    {
+        return LITESTORE_ERR;
+    }
+    while (p < end)
+    {
+        sqlite3_uint64 value_len = 0;
+        size_t n = 0;
+
+        if ((n = get_varint(p, end, &value_len)) == 0
+            || value_len > (sqlite3_uint64)(end - p - n))
+        {
+            return LITESTORE_ERR;
+        }
+        {
+            array_item item = {litestore_make_blob(p + n, value_len), NULL};
+            /* appended in order, as the index of the previous + 1 */
+            if (append_item(ctx, id, LS_ARRAY, &item) != LITESTORE_OK)
+            {
+                return LITESTORE_ERR;
+            }
+        }
+        p += n + value_len;
+    }
+    return LITESTORE_OK;
+}
+
+static
+int import_number(litestore* ctx,
+                  litestore_slice_t key,
+                  const int type,
+                  const unsigned char* p,
+                  const size_t len)
+{
+    litestore_id_t id = 0;
+    number n = {type, 0, 0};
+
+    if (len != 8
+        || ((ctx->bulk_flags & LITESTORE_BULK_SORTED)
+            && bulk_check_order(ctx, key) != LITESTORE_OK)
+        || create_key(ctx, key.data, key.length, type, &id) != LITESTORE_OK)
+    {
+        return LITESTORE_ERR;
+    }
+    get_number(p, &n);
+    return set_number(ctx, id, &n);
+}
+
+static
+int import_json(litestore* ctx,
+                litestore_slice_t key,
+                const unsigned char* p,
+                const size_t len)
+{
+    litestore_id_t id = 0;
+
+    if (((ctx->bulk_flags & LITESTORE_BULK_SORTED)
+         && bulk_check_order(ctx, key) != LITESTORE_OK)
+        || create_key(ctx, key.data, key.length, LS_JSON, &id)
+        != LITESTORE_OK)
+    {
+        return LITESTORE_ERR;
+    }
+    return set_json(ctx, id, litestore_slice((const char*)p, 0, len));
+}
+
+/**
+ * An empty raw value, which only merges leave. It is stored as
+ * litestore_merge(..., "") stores it, an empty value with an empty
+ * operand, litestore_create rejects empty values.
+ */
+static
+int import_empty(litestore* ctx, litestore_slice_t key)
+{
+    const stored_value empty = {"", 0, LITESTORE_CODEC_NONE, 0};
+    const value_refs refs = {0, 0};
+    const litestore_blob_t operand = litestore_make_blob("", 0);
+    litestore_id_t id = 0;
+
+    if (((ctx->bulk_flags & LITESTORE_BULK_SORTED)
+         && bulk_check_order(ctx, key) != LITESTORE_OK)
+        || create_key(ctx, key.data, key.length, LS_RAW, &id)
+        != LITESTORE_OK)
+    {
+        return LITESTORE_ERR;
+    }
+    if (insert_data(ctx, id, &empty, &refs) != LITESTORE_OK)
+    {
+        return LITESTORE_ERR;
+    }
+    return create_operand(ctx, id, LITESTORE_MERGE_APPEND, &operand);
+}
+
+static
+int import_record(litestore* ctx,
+                  const unsigned char** pos,
+                  const unsigned char* end)
+{
+    const unsigned char* p = *pos;
+    sqlite3_uint64 key_len = 0;
+    sqlite3_uint64 type = 0;
+    sqlite3_uint64 value_len = 0;
+    const unsigned char* key = NULL;
+    size_t n = 0;
+
+    if ((n = get_varint(p, end, &key_len)) == 0
+        || key_len > (sqlite3_uint64)(end - p - n))
+    {
+        return LITESTORE_ERR;
+    }
+    key = p + n;
+    p = key + key_len;
+    if ((n = get_varint(p, end, &type)) == 0)
+    {
+        return LITESTORE_ERR;
+    }
+    p += n;
+    if ((n = get_varint(p, end, &value_len)) == 0
+        || value_len > (sqlite3_uint64)(end - p - n))
+    {
+        return LITESTORE_ERR;
+    }
+    p += n;
+    *pos = p + value_len;
+
+    switch (type)
+    {
+        case LS_NULL:
+            return litestore_bulk_append(
+                ctx, litestore_slice((const char*)key, 0, key_len),
+                litestore_make_blob(NULL, 0));
+        case LS_RAW:
+            if (value_len == 0)
+            {
+                return import_empty(
+                    ctx, litestore_slice((const char*)key, 0, key_len));
+            }
+            return litestore_bulk_append(
+                ctx, litestore_slice((const char*)key, 0, key_len),
+                litestore_make_blob(p, value_len));
+        case LS_KV:
+            return import_fields(
+                ctx, litestore_slice((const char*)key, 0, key_len),
+                p, p + value_len);
+        case LS_ARRAY:
+            return import_items(
+                ctx, litestore_slice((const char*)key, 0, key_len),
+                p, p + value_len);
+        case LS_INT:
+        case LS_FLOAT:
+            return import_number(
+                ctx, litestore_slice((const char*)key, 0, key_len),
+                (int)type, p, value_len);
+        case LS_JSON:
+            return import_json(
+                ctx, litestore_slice((const char*)key, 0, key_len),
+                p, value_len);
+        default:
+            return LITESTORE_ERR;
+    }
+}
+
+static
+int import_blocks(litestore* ctx, block_io* io)
+{
+    unsigned char header[BLOCK_HEADER_SIZE];
+    /* a block is full at BLOCK_SIZE, or holds a single larger record */
+    const sqlite3_uint64 max_len =
+        RECORD_OVERHEAD
+        + 2 * (sqlite3_uint64)sqlite3_limit(ctx->db, SQLITE_LIMIT_LENGTH, -1);
+
+    for (;;)
+    {
+        const unsigned char* p = NULL;
+        const unsigned char* end = NULL;
+        size_t len = 0;
+        size_t got = 0;
+
+        if (read_all(io->fd, header, BLOCK_HEADER_SIZE) != BLOCK_HEADER_SIZE)
+        {
+            report_error(ctx, LITESTORE_ERR, "import: truncated input");
+            return LITESTORE_ERR;
+        }
+        len = get_u32(header);
+        if (len == 0)
+        {
+            return LITESTORE_OK;
+        }
+        if (len > BLOCK_SIZE && len > max_len)
+        {
+            report_error(ctx, LITESTORE_ERR, "import: corrupt block");
+            return LITESTORE_ERR;
+        }
+        /* grown as the payload is read, the length is not trusted */
+        while (got < len)
+        {
+            const size_t n = len - got < BLOCK_SIZE ? len - got : BLOCK_SIZE;
+            if (block_reserve(io, got + n) != LITESTORE_OK)
+            {
+                return LITESTORE_ERR;
+            }
+            if (read_all(io->fd, io->buf + BLOCK_HEADER_SIZE + got, n)
+                != (ssize_t)n)
+            {
+                report_error(ctx, LITESTORE_ERR, "import: truncated input");
+                return LITESTORE_ERR;
+            }
+            got += n;
+        }
+        p = io->buf + BLOCK_HEADER_SIZE;
+        end = p + len;
+        if (crc32_update(0, p, len) != get_u32(header + 4))
+        {
+            report_error(ctx, LITESTORE_ERR, "import: corrupt block");
+            return LITESTORE_ERR;
+        }
+        while (p < end)
+        {
+            if (import_record(ctx, &p, end) != LITESTORE_OK)
+            {
+                report_error(ctx, LITESTORE_ERR, "import: invalid record");
+                return LITESTORE_ERR;
+            }
+        }
+    }
+}
+
+/*-----------------------------------------*/
+/*----------------- BACKUP ----------------*/
+/*-----------------------------------------*/
+/**
+ * Release the backup state.
+ *
+ * @return LITESTORE_OK if the backup finished without errors.
+ */
+static
+int backup_finish(litestore* ctx)
+{
+    int rv = LITESTORE_OK;
+    if (ctx->backup && sqlite3_backup_finish(ctx->backup) != SQLITE_OK)
+    {
+        report_error(ctx, sqlite3_errcode(ctx->backup_db),
+                     sqlite3_errmsg(ctx->backup_db));
+        rv = LITESTORE_ERR;
+    }
+    sqlite3_close(ctx->backup_db);
+    sqlite3_free(ctx->backup_path);
+    ctx->backup = NULL;
+    ctx->backup_db = NULL;
+    ctx->backup_path = NULL;
+    return rv;
+}
+
+static
+int backup_init(litestore* ctx, const char* dest_path)
+{
+    ctx->backup_path = sqlite3_mprintf("%s", dest_path);
+    if (!ctx->backup_path
+        || sqlite3_open_v2(dest_path, &ctx->backup_db,
+                           SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE,
+                           NULL) != SQLITE_OK)
+    {
+        report_error(ctx, LITESTORE_ERR, "backup: failed to open");
+        backup_finish(ctx);
+        return LITESTORE_ERR;
+    }
+    ctx->backup = sqlite3_backup_init(ctx->backup_db, "main",
+                                      ctx->db, "main");
+    if (!ctx->backup)
+    {
+        report_error(ctx, sqlite3_errcode(ctx->backup_db),
+                     sqlite3_errmsg(ctx->backup_db));
+        backup_finish(ctx);
+        return LITESTORE_ERR;
+    }
+    return LITESTORE_OK;
+}
+
+/*-----------------------------------------*/
+/*--------------- NAMESPACE ---------------*/
+/*-----------------------------------------*/
+static
+void ns_free(litestore_ns* ns)
+{
+    finalize_stmt(&(ns->put));
+    finalize_stmt(&(ns->get));
+    finalize_stmt(&(ns->del));
+    finalize_stmt(&(ns->scan));
+    sqlite3_free(ns);
+}
+
+static
+void ns_free_all(litestore* ctx)
+{
+    while (ctx->namespaces)
+    {
+        litestore_ns* next = ctx->namespaces->next;
+        ns_free(ctx->namespaces);
+        ctx->namespaces = next;
+    }
+}
+
+/**
+ * Free the handle of the namespace, if open.
+ */
+static
+void ns_close(litestore* ctx, const sqlite3_int64 id)
+{
+    litestore_ns** p = &(ctx->namespaces);
+    while (*p && (*p)->id != id)
+    {
+        p = &((*p)->next);
+    }
+    if (*p)
+    {
+        litestore_ns* ns = *p;
+        *p = ns->next;
+        ns_free(ns);
+    }
+}
+
+/**
+ * Prepare a statement for the table of the namespace,
+ * %lld in the format is the id.
+ */
+static
+int ns_prepare(litestore_ns* ns, const char* format, sqlite3_stmt** stmt)
+{
+    char* sql = sqlite3_mprintf(format, ns->id);
+    const int rv = sql ? prepare_stmt(ns->ctx, sql, stmt) : LITESTORE_ERR;
+    sqlite3_free(sql);
+    return rv;
+}
+
+/**
+ * The handle of an existing namespace, opened once per context.
+ */
+static
+int ns_handle(litestore* ctx, const sqlite3_int64 id, litestore_ns** ns)
+{
+    litestore_ns* n = ctx->namespaces;
+    while (n && n->id != id)
+    {
+        n = n->next;
+    }
+    if (!n)
+    {
+        n = (litestore_ns*)sqlite3_malloc64(sizeof(litestore_ns));
+        if (!n)
+        {
+            report_error(ctx, LITESTORE_ERR, "out of memory");
+            return LITESTORE_ERR;
+        }
+        memset(n, 0, sizeof(litestore_ns));
+        n->ctx = ctx;
+        n->id = id;
+        n->compression = ctx->compression;
+        if (ns_prepare(n,
+                       "INSERT OR REPLACE INTO ns_%lld"
+                       " (name, value, codec, raw_size) VALUES (?, ?, ?, ?);",
+                       &(n->put)) != LITESTORE_OK
+            || ns_prepare(n,
+                          "SELECT value, codec, raw_size FROM ns_%lld"
+                          " WHERE name = ?;",
+                          &(n->get)) != LITESTORE_OK
+            || ns_prepare(n,
+                          "DELETE FROM ns_%lld WHERE name = ?;",
+                          &(n->del)) != LITESTORE_OK
+            || ns_prepare(n,
+                          "SELECT name, value, codec, raw_size FROM ns_%lld"
+                          " WHERE name >= ? ORDER BY name;",
+                          &(n->scan)) != LITESTORE_OK)
+        {
+            sqlite_error(ctx);
+            ns_free(n);
+            return LITESTORE_ERR;
+        }
+        n->next = ctx->namespaces;
+        ctx->namespaces = n;
+    }
+    *ns = n;
+    return LITESTORE_OK;
+}
+
+static
+int ns_lookup(litestore* ctx, litestore_slice_t name, sqlite3_int64* id)
+{
+    int rv = LITESTORE_ERR;
+    sqlite3_stmt* stmt = NULL;
+
+    if (prepare_stmt(ctx, "SELECT id FROM namespaces WHERE name = ?;",
+                     &stmt) == LITESTORE_OK
+        && sqlite3_bind_text(stmt, 1, name.data, name.length,
+                             SQLITE_STATIC) == SQLITE_OK)
+    {
+        const int rc = sqlite3_step(stmt);
+        if (rc == SQLITE_ROW)
+        {
+            *id = sqlite3_column_int64(stmt, 0);
+            rv = LITESTORE_OK;
+        }
+        else if (rc == SQLITE_DONE)
+        {
+            rv = LITESTORE_UNKNOWN_ENTITY;
+        }
+    }
+    if (rv == LITESTORE_ERR)
+    {
+        sqlite_error(ctx);
+    }
+    sqlite3_finalize(stmt);
+
+    return rv;
+}
+
+static
+int ns_create(litestore* ctx, litestore_slice_t name, sqlite3_int64* id)
+{
+    int rv = LITESTORE_ERR;
+    sqlite3_stmt* stmt = NULL;
+
+    if (prepare_stmt(ctx, "INSERT INTO namespaces (name) VALUES (?);",
+                     &stmt) == LITESTORE_OK
+        && sqlite3_bind_text(stmt, 1, name.data, name.length,
+                             SQLITE_STATIC) == SQLITE_OK)
+    {
+        rv = run_stmt(ctx, stmt);
+    }
+    else
+    {
+        sqlite_error(ctx);
+    }
+    sqlite3_finalize(stmt);
+
+    if (rv == LITESTORE_OK)
+    {
+        /* clustered by the key, a scan reads adjacent pages */
+        char* sql = NULL;
+        *id = sqlite3_last_insert_rowid(ctx->db);
+        sql = sqlite3_mprintf("CREATE TABLE ns_%lld("
+                              "       name TEXT PRIMARY KEY NOT NULL,"
+                              "       value BLOB NOT NULL,"
+                              "       codec INTEGER NOT NULL,"
+                              "       raw_size INTEGER NOT NULL"
+                              ") WITHOUT ROWID;",
+                              *id);
+        rv = sql ? exec_sql(ctx, sql) : LITESTORE_ERR;
+        sqlite3_free(sql);
+    }
+
+    return rv;
+}
+
+/**
+ * Drop the table, its pages are freed without visiting the rows.
+ */
+static
+int ns_drop(litestore* ctx, const sqlite3_int64 id)
+{
+    char* sql = sqlite3_mprintf("DELETE FROM namespaces WHERE id = %lld;"
+                                "DROP TABLE ns_%lld;",
+                                id, id);
+    const int rv = sql ? exec_sql(ctx, sql) : LITESTORE_ERR;
+    sqlite3_free(sql);
+    return rv;
+}
+
+/*-----------------------------------------*/
+/*-------------- JSON INDEX ---------------*/
+/*-----------------------------------------*/
+static
+void json_index_free(litestore_json_index* index)
+{
+    finalize_stmt(&(index->find));
+    finalize_stmt(&(index->range));
+    sqlite3_free(index);
+}
+
+static
+void json_index_free_all(litestore* ctx)
+{
+    while (ctx->json_indexes)
+    {
+        litestore_json_index* next = ctx->json_indexes->next;
+        json_index_free(ctx->json_indexes);
+        ctx->json_indexes = next;
+    }
+}
+
+/**
+ * Free the handle of the index, if open.
+ */
+static
+void json_index_close(litestore* ctx, const sqlite3_int64 id)
+{
+    litestore_json_index** p = &(ctx->json_indexes);
+    while (*p && (*p)->id != id)
+    {
+        p = &((*p)->next);
+    }
+    if (*p)
+    {
+        litestore_json_index* index = *p;
+        *p = index->next;
+        json_index_free(index);
+    }
+}
+
+/**
+ * The path as an SQL literal. Expression indexes are only used for
+ * the same expression, so the path can not be a parameter.
+ */
+static
+char* json_path_literal(litestore_slice_t path)
+{
+    return sqlite3_mprintf("'%.*q'", (int)path.length, path.data);
+}
+
+/**
+ * The handle of an existing index, opened once per context.
+ */
+static
+int json_index_handle(litestore* ctx,
+                      const sqlite3_int64 id,
+                      litestore_slice_t path,
+                      litestore_json_index** index)
+{
+    litestore_json_index* x = ctx->json_indexes;
+    while (x && x->id != id)
+    {
+        x = x->next;
+    }
+    if (!x)
+    {
+        char* literal = json_path_literal(path);
+        char* find = NULL;
+        char* range = NULL;
+        x = (litestore_json_index*)sqlite3_malloc64(
+            sizeof(litestore_json_index));
+        if (x)
+        {
+            memset(x, 0, sizeof(litestore_json_index));
+            x->ctx = ctx;
+            x->id = id;
+        }
+        if (x && literal)
+        {
+            find = sqlite3_mprintf(
+                "SELECT o.name, o.type FROM json_data j"
+                " JOIN objects o ON o.id = j.id"
+                " LEFT JOIN expiry e ON e.id = o.id"
+                " WHERE json_extract(j.doc, %s) = json_extract(?1, '$')"
+                " AND (e.expires_at IS NULL OR e.expires_at > ?2)"
+                " ORDER BY j.id;",
+                literal);
+            /* -9e999 (-Inf) and x'' are below and above any value */
+            range = sqlite3_mprintf(
+                "SELECT o.name, o.type FROM json_data j"
+                " JOIN objects o ON o.id = j.id"
+                " LEFT JOIN expiry e ON e.id = o.id"
+                " WHERE json_extract(j.doc, %s)"
+                " >= coalesce(json_extract(?1, '$'), -9e999)"
+                " AND json_extract(j.doc, %s)"
+                " < coalesce(json_extract(?2, '$'), x'')"
+                " AND (e.expires_at IS NULL OR e.expires_at > ?3)"
+                " ORDER BY json_extract(j.doc, %s), j.id;",
+                literal, literal, literal);
+        }
+        sqlite3_free(literal);
+        if (!x || !find || !range
+            || prepare_stmt(ctx, find, &(x->find)) != LITESTORE_OK
+            || prepare_stmt(ctx, range, &(x->range)) != LITESTORE_OK)
+        {
+            if (!x || !find || !range)
+            {
+                report_error(ctx, LITESTORE_ERR, "out of memory");
+            }
+            else
+            {
+                sqlite_error(ctx);
+            }
+            sqlite3_free(find);
+            sqlite3_free(range);
+            if (x)
+            {
+                json_index_free(x);
+            }
+            return LITESTORE_ERR;
+        }
+        sqlite3_free(find);
+        sqlite3_free(range);
+        x->next = ctx->json_indexes;
+        ctx->json_indexes = x;
+    }
+    *index = x;
+    return LITESTORE_OK;
+}
+
+static
+int json_index_lookup(litestore* ctx,
+                      litestore_slice_t path,
+                      sqlite3_int64* id)
+{
+    int rv = LITESTORE_ERR;
+    sqlite3_stmt* stmt = NULL;
+
+    if (prepare_stmt(ctx, "SELECT id FROM json_indexes WHERE path = ?;",
+                     &stmt) == LITESTORE_OK
+        && sqlite3_bind_text(stmt, 1, path.data, path.length,
+                             SQLITE_STATIC) == SQLITE_OK)
+    {
+        const int rc = sqlite3_step(stmt);
+        if (rc == SQLITE_ROW)
+        {
+            *id = sqlite3_column_int64(stmt, 0);
+            rv = LITESTORE_OK;
+        }
+        else if (rc == SQLITE_DONE)
+        {
+            rv = LITESTORE_UNKNOWN_ENTITY;
+        }
+    }
+    if (rv == LITESTORE_ERR)
+    {
+        sqlite_error(ctx);
+    }
+    sqlite3_finalize(stmt);
+
+    return rv;
+}
+
+static
+int json_index_create(litestore* ctx,
+                      litestore_slice_t path,
+                      sqlite3_int64* id)
+{
+    int rv = LITESTORE_ERR;
+    sqlite3_stmt* stmt = NULL;
+
+    /* an invalid path fails here, not on the first write of a document */
+    if (prepare_stmt(ctx, "SELECT json_extract('{}', ?);",
+                     &stmt) == LITESTORE_OK
+        && sqlite3_bind_text(stmt, 1, path.data, path.length,
+                             SQLITE_STATIC) == SQLITE_OK
+        && sqlite3_step(stmt) == SQLITE_ROW)
+    {
+        sqlite3_finalize(stmt);
+        stmt = NULL;
+        if (prepare_stmt(ctx, "INSERT INTO json_indexes (path) VALUES (?);",
+                         &stmt) == LITESTORE_OK
+            && sqlite3_bind_text(stmt, 1, path.data, path.length,
+                                 SQLITE_STATIC) == SQLITE_OK)
+        {
+            rv = run_stmt(ctx, stmt);
+        }
+        else
+        {
+            sqlite_error(ctx);
+        }
+    }
+    else
+    {
+        sqlite_error(ctx);
+    }
+    sqlite3_finalize(stmt);
+
+    if (rv == LITESTORE_OK)
+    {
+        char* literal = json_path_literal(path);
+        char* sql = NULL;
+        *id = sqlite3_last_insert_rowid(ctx->db);
+        sql = literal
+            ? sqlite3_mprintf("CREATE INDEX json_path_%lld"
+                              " ON json_data(json_extract(doc, %s));",
+                              *id, literal)
+            : NULL;
+        rv = sql ? exec_sql(ctx, sql) : LITESTORE_ERR;
+        sqlite3_free(sql);
+        sqlite3_free(literal);
+    }
+
+    return rv;
+}
+
+static
+int json_index_drop(litestore* ctx, const sqlite3_int64 id)
+{
+    char* sql = sqlite3_mprintf("DELETE FROM json_indexes WHERE id = %lld;"
+                                "DROP INDEX json_path_%lld;",
+                                id, id);
+    const int rv = sql ? exec_sql(ctx, sql) : LITESTORE_ERR;
+    sqlite3_free(sql);
+    return rv;
+}
+
+/*-----------------------------------------*/
+/*------------------ API ------------------*/
+/*-----------------------------------------*/
+
+void* litestore_native_ctx(litestore* ctx)
+{
+    return ctx->db;
+}
+
+/*-----------------------------------------*/
+/*---------------- construction -----------*/
+/*-----------------------------------------*/
+int litestore_open(const char* file_name,
+                   litestore_opts opts,
+                   litestore** ctx)
+{
+    const size_t arena_size = lookaside_size(&opts);
+
+    if (opts.allocator
+        && !(opts.allocator->malloc_fn
+             && opts.allocator->realloc_fn
+             && opts.allocator->free_fn))
+    {
+        *ctx = NULL;
+        return LITESTORE_ERR;
+    }
+
+    *ctx = (litestore*)mem_alloc(opts.allocator, CTX_SIZE + arena_size);
+    if (*ctx)
+    {
+        memset(*ctx, 0, sizeof(litestore));
+        (*ctx)->opts = opts;
+        (*ctx)->compression = opts.compression;
+        (*ctx)->dict_codec = dict_codec;
+        (*ctx)->dict_codec.user_data = *ctx;
+        (*ctx)->vlog_fd = -1;
+        (*ctx)->vlog_read_fd = -1;
+        if (arena_size > 0)
+        {
+            (*ctx)->lookaside = (char*)(*ctx) + CTX_SIZE;
+        }
+        if (!codecs_valid(*ctx)
+            || (opts.compression != LITESTORE_CODEC_NONE
+                && !find_codec(*ctx, opts.compression))
+            || !indexes_valid(&opts)
+            || configure_process(*ctx) != LITESTORE_OK
+            || sqlite3_open(file_name, &(*ctx)->db) != SQLITE_OK
+            || vlog_check(*ctx) != LITESTORE_OK
+            || configure_connection(*ctx) != LITESTORE_OK
+            || init_db(*ctx) != LITESTORE_OK)
+        {
+            litestore_close(*ctx);
+            *ctx = NULL;
+            return LITESTORE_ERR;
+        }
+        if (prepare_tx_statements(*ctx) == LITESTORE_OK)
+        {
+            int rv = version_update(*ctx);
+            if (rv == LITESTORE_OK
+                && (register_functions(*ctx) != LITESTORE_OK
+                    || prepare_statements(*ctx) != LITESTORE_OK
+                    || dict_load(*ctx, 0, &(*ctx)->dicts[0])
+                    == LITESTORE_ERR))
+            {
+                rv = LITESTORE_ERR;
+            }
+            /* the version check is not an API call */
+            litestore_stats_reset(*ctx);
+            return rv;
+        }
+    }
+    return LITESTORE_ERR;
+}
+
+void litestore_close(litestore* ctx)
+{
+    if (ctx)
+    {
+        if (ctx->db)
+        {
+            backup_finish(ctx);
+            ns_free_all(ctx);
+            json_index_free_all(ctx);
+            watch_free_all(ctx);
+            vlog_release(ctx);
+            finalize_statements(ctx);
+            sqlite3_close(ctx->db);
+            ctx->db = NULL;
+        }
+        sqlite3_free(ctx->bulk_key);
+        sqlite3_free(ctx->scratch);
+        sqlite3_free(ctx->vlog_buf);
+        sqlite3_free(ctx->vlog_retired);
+        merge_free(ctx);
+        vlog_close(ctx);
+        dict_free(&ctx->dicts[0]);
+        dict_free(&ctx->dicts[1]);
+        mem_release(ctx->opts.allocator, ctx);
+    }
+}
+
+int litestore_shutdown(void)
+{
+    /* @note Would initialize SQLite again if called after shutdown. */
+    sqlite3_soft_heap_limit64(0);
+    if (sqlite3_shutdown() != SQLITE_OK)
+    {
+        return LITESTORE_ERR;
+    }
+    if (g_allocator)
+    {
+        sqlite3_config(SQLITE_CONFIG_MALLOC, &g_default_methods);
+        g_allocator = NULL;
+    }
+    if (g_page_cache)
+    {
+        sqlite3_config(SQLITE_CONFIG_PAGECACHE, NULL, 0, 0);
+        g_page_cache = NULL;
+    }
+    g_hard_limit = 0;
+    return LITESTORE_OK;
+}
+
+int litestore_memory_usage(litestore* ctx, litestore_memory_t* usage)
+{
+    if (ctx && usage)
+    {
+        sqlite3_int64 current = 0;
+        sqlite3_int64 highwater = 0;
+        sqlite3_status64(SQLITE_STATUS_MEMORY_USED, &current, &highwater, 0);
+        usage->process_used = current;
+        usage->process_highwater = highwater;
+        usage->soft_heap_limit = sqlite3_soft_heap_limit64(-1);
+        usage->hard_heap_limit = g_hard_limit;
+        usage->cache_used = db_status(ctx, SQLITE_DBSTATUS_CACHE_USED, 0);
+        usage->schema_used = db_status(ctx, SQLITE_DBSTATUS_SCHEMA_USED, 0);
+        usage->stmt_used = db_status(ctx, SQLITE_DBSTATUS_STMT_USED, 0);
+        usage->memory_budget = ctx->opts.memory_budget;
+        usage->budget_releases = ctx->budget_releases;
+        return LITESTORE_OK;
+    }
+    return LITESTORE_ERR;
+}
+
+int litestore_stats_get(litestore* ctx, litestore_stats_t* stats)
+{
+    if (ctx && stats)
+    {
+        memcpy(stats, &ctx->stats, sizeof(litestore_stats_t));
+        return LITESTORE_OK;
+    }
+    return LITESTORE_ERR;
+}
+
+int litestore_stats_reset(litestore* ctx)
+{
+    if (ctx)
+    {
+        memset(&ctx->stats, 0, sizeof(litestore_stats_t));
+        io_collect(ctx, -1);
+        memset(&ctx->io_total, 0, sizeof(litestore_io_counters_t));
+        memset(ctx->io_ops, 0, sizeof(ctx->io_ops));
+        return LITESTORE_OK;
+    }
+    return LITESTORE_ERR;
+}
+
+/**
+ * @return Size of the WAL file of the main database, 0 if none.
+ */
+static
+long long wal_size(litestore* ctx)
+{
+    const char* db = sqlite3_db_filename(ctx->db, "main");
+    long long size = 0;
+    if (db && *db)
+    {
+        char* wal = sqlite3_mprintf("%s-wal", db);
+        struct stat st;
+        if (wal && stat(wal, &st) == 0)
+        {
+            size = (long long)st.st_size;
+        }
+        sqlite3_free(wal);
+    }
+    return size;
+}
+
+int litestore_io_stats(litestore* ctx, litestore_io_stats_t* stats)
+{
+    if (ctx && stats)
+    {
+        int current = 0;
+        int highwater = 0;
+
+        io_collect(ctx, -1);
+        stats->total = ctx->io_total;
+        memcpy(stats->ops, ctx->io_ops, sizeof(ctx->io_ops));
+
+        sqlite3_db_status(ctx->db, SQLITE_DBSTATUS_LOOKASIDE_USED,
+                          &current, &highwater, 0);
+        stats->lookaside_used = current;
+        stats->lookaside_highwater = highwater;
+        sqlite3_db_status(ctx->db, SQLITE_DBSTATUS_LOOKASIDE_HIT,
+                          &current, &highwater, 0);
+        stats->lookaside_hit = highwater;
+        sqlite3_db_status(ctx->db, SQLITE_DBSTATUS_LOOKASIDE_MISS_SIZE,
+                          &current, &highwater, 0);
+        stats->lookaside_miss_size = highwater;
+        sqlite3_db_status(ctx->db, SQLITE_DBSTATUS_LOOKASIDE_MISS_FULL,
+                          &current, &highwater, 0);
+        stats->lookaside_miss_full = highwater;
+
+        stats->cache_used = db_status(ctx, SQLITE_DBSTATUS_CACHE_USED, 0);
+        stats->schema_used = db_status(ctx, SQLITE_DBSTATUS_SCHEMA_USED, 0);
+        stats->stmt_used = db_status(ctx, SQLITE_DBSTATUS_STMT_USED, 0);
+        stats->wal_size = wal_size(ctx);
+        return LITESTORE_OK;
+    }
+    return LITESTORE_ERR;
+}
+
+long long litestore_histogram_percentile(const litestore_histogram_t* h,
+                                         const double percentile)
+{
+    if (h && h->count > 0)
+    {
+        const double rank = percentile / 100.0 * (double)h->count;
+        long long seen = 0;
+        int i = 0;
+        for (i = 0; i < LITESTORE_HISTOGRAM_BUCKETS; ++i)
+        {
+            seen += h->buckets[i];
+            if (seen > 0 && (double)seen >= rank)
+            {
+                const sqlite3_int64 max = hist_bucket_max(i);
+                return max < h->max_ns ? max : h->max_ns;
+            }
+        }
+        return h->max_ns;
+    }
+    return 0;
+}
+
+int litestore_set_compression(litestore* ctx, const int codec_id)
+{
+    if (ctx && (codec_id == LITESTORE_CODEC_NONE || find_codec(ctx, codec_id)))
+    {
+        ctx->compression = codec_id;
+        return LITESTORE_OK;
+    }
+    return LITESTORE_ERR;
+}
+
+int litestore_dict_train(litestore* ctx,
+                         const int samples,
+                         const int dict_size)
+{
+    int rv = LITESTORE_ERR;
+
+    /* a rolled back dictionary could be in use, so not in a transaction */
+    if (ctx && !ctx->tx_active && samples > 0
+        && dict_size >= DICT_MIN_SIZE && dict_size <= DICT_MAX_SIZE)
+    {
+        if (opt_begin_tx(ctx))
+        {
+            rv = dict_train(ctx, samples, (size_t)dict_size);
+            if (opt_end_tx(ctx, rv) != LITESTORE_OK && rv == LITESTORE_OK)
+            {
+                /* not stored, do not write with it */
+                dict_free(&ctx->dicts[0]);
+                ctx->dicts[0] = ctx->dicts[1];
+                memset(&ctx->dicts[1], 0, sizeof(lz_dict));
+                rv = LITESTORE_ERR;
+            }
+        }
+    }
+    return rv;
+}
+
+/**
+ * @return 1 if the value is not stored with the current codec (boolean)
+ */
+static
+int needs_reencode(litestore* ctx, const stored_value* stored)
+{
+    return stored->codec != ctx->compression
+        || (stored->codec == LITESTORE_CODEC_LZ_DICT
+            && dict_version(stored) != ctx->dicts[0].version);
+}
+
+/* Re-encoded tables in order, shared values are not in raw_data rows */
+static const char* const reencode_select[] = {
+    "SELECT rowid, raw_value, codec, raw_size FROM raw_data"
+    " WHERE rowid > ? AND shared IS NULL AND logged IS NULL"
+    " ORDER BY rowid LIMIT ?;",
+    "SELECT rowid, raw_value, codec, raw_size FROM shared_data"
+    " WHERE rowid > ? ORDER BY rowid LIMIT ?;"
+};
+static const char* const reencode_update[] = {
+    "UPDATE raw_data SET raw_value = ?, codec = ?, raw_size = ?"
+    " WHERE rowid = ?;",
+    "UPDATE shared_data SET raw_value = ?, codec = ?, raw_size = ?"
+    " WHERE rowid = ?;"
+};
+
+int litestore_reencode_step(litestore* ctx, const int count)
+{
+    int rv = LITESTORE_ERR;
+    sqlite3_stmt* select = NULL;
+    sqlite3_stmt* update = NULL;
+    unsigned char* buf = NULL;
+    size_t buf_cap = 0;
+    sqlite3_int64 rowid = 0;
+    int rows = 0;
+    int rc = SQLITE_DONE;
+    int own_tx = 0;
+
+    if (!ctx || count <= 0 || bulk_blocks(ctx))
+    {
+        return LITESTORE_ERR;
+    }
+    own_tx = opt_begin_tx(ctx);
+    /* the values stay the same, watchers are not told */
+    ctx->watch_quiet = 1;
+    rowid = ctx->reencode_rowid;
+    if (prepare_stmt(ctx, reencode_select[ctx->reencode_table],
+                     &select) == LITESTORE_OK
+        && prepare_stmt(ctx, reencode_update[ctx->reencode_table],
+                        &update) == LITESTORE_OK
+        && sqlite3_bind_int64(select, 1, rowid) == SQLITE_OK
+        && sqlite3_bind_int(select, 2, count) == SQLITE_OK)
+    {
+        rv = LITESTORE_OK;
+        while (rv == LITESTORE_OK
+               && (rc = sqlite3_step(select)) == SQLITE_ROW)
+        {
+            stored_value old;
+            const void* data = NULL;
+            size_t size = 0;
+
+            ++rows;
+            rowid = sqlite3_column_int64(select, 0);
+            column_value(select, 1, &old);
+            if (!needs_reencode(ctx, &old))
+            {
+                continue;
+            }
+            rv = decode_value(ctx, &old, &data, &size);
+            /* decoding and encoding share the scratch buffer */
+            if (rv == LITESTORE_OK && size > buf_cap)
+            {
+                unsigned char* tmp =
+                    (unsigned char*)sqlite3_realloc64(buf, size);
+                rv = tmp ? LITESTORE_OK : LITESTORE_ERR;
+                buf = tmp ? tmp : buf;
+                buf_cap = tmp ? size : buf_cap;
+            }
+            if (rv == LITESTORE_OK)
+            {
+                const litestore_blob_t value = litestore_make_blob(buf, size);
+                stored_value encoded;
+                memcpy(buf, data, size);
+                rv = encode_value(ctx, &value, &encoded);
+                if (rv == LITESTORE_OK
+                    && (encoded.codec != old.codec
+                        || dict_version(&encoded) != dict_version(&old)))
+                {
+                    rv = (bind_value(update, 1, &encoded) == LITESTORE_OK
+                          && sqlite3_bind_int64(update, 4, rowid)
+                          == SQLITE_OK) ? run_stmt(ctx, update)
+                        : LITESTORE_ERR;
+                }
+            }
+        }
+        if (rc != SQLITE_ROW && rc != SQLITE_DONE)
+        {
+            sqlite_error(ctx);
+            rv = LITESTORE_ERR;
+        }
+    }
+    sqlite3_finalize(select);
+    sqlite3_finalize(update);
+    sqlite3_free(buf);
+    ctx->watch_quiet = 0;
+
+    if (own_tx && opt_end_tx(ctx, rv) != LITESTORE_OK)
+    {
+        rv = LITESTORE_ERR;
+    }
+    if (rv == LITESTORE_OK)
+    {
+        /* a full step means there may be more */
+        ctx->reencode_rowid = rows < count ? 0 : rowid;
+        rv = rows < count && ctx->reencode_table == 1
+            ? LITESTORE_OK : LITESTORE_IN_PROGRESS;
+        if (rows < count)
+        {
+            ctx->reencode_table = !ctx->reencode_table;
+        }
+    }
+    return rv;
+}
+
+/*-----------------------------------------*/
+/*---------------- tx ---------------------*/
+/*-----------------------------------------*/
+int litestore_begin_tx(litestore* ctx)
+{
+    op_begin(ctx, "begin_tx");
+    const int rv = run_stmt(ctx, ctx->begin_tx);
+    if (rv == LITESTORE_OK)
+    {
+        ctx->tx_active = 1;
+    }
+    op_end(ctx, LITESTORE_OP_BEGIN_TX);
+    return rv;
+}
+
+int litestore_commit_tx(litestore* ctx)
+{
+    op_begin(ctx, "commit_tx");
+    const int rv = vlog_sync(ctx) == LITESTORE_OK
+        ? run_stmt(ctx, ctx->commit_tx) : LITESTORE_ERR;
+    if (rv == LITESTORE_OK)
+    {
+        ctx->tx_active = 0;
+        enforce_memory_budget(ctx);
+    }
+    op_end(ctx, LITESTORE_OP_COMMIT_TX);
+    return rv;
+}
+
+int litestore_rollback_tx(litestore* ctx)
+{
+    op_begin(ctx, "rollback_tx");
+    const int rv = run_stmt(ctx, ctx->rollback_tx);
+    ctx->vlog_dirty = 0;
+    if (rv == LITESTORE_OK)
+    {
+        ctx->tx_active = 0;
+        enforce_memory_budget(ctx);
+    }
+    op_end(ctx, LITESTORE_OP_ROLLBACK_TX);
+    return rv;
+}
+
+/*-----------------------------------------*/
+/*---------------- watch ------------------*/
+/*-----------------------------------------*/
+int litestore_watch(litestore* ctx,
+                    litestore_slice_t prefix,
+                    litestore_watch_cb callback,
+                    void* user_data)
+{
+    watch_entry* watch = NULL;
+    watch_entry** p = NULL;
+
+    /* the triggers are not changed in a user tx */
+    if (!ctx || !callback || (prefix.length > 0 && !prefix.data)
+        || ctx->tx_active || ctx->bulk_active || ctx->watch_delivering)
+    {
+        return LITESTORE_ERR;
+    }
+    watch = (watch_entry*)sqlite3_malloc64(sizeof(watch_entry)
+                                           + prefix.length);
+    if (!watch)
+    {
+        report_error(ctx, LITESTORE_ERR, "out of memory");
+        return LITESTORE_ERR;
+    }
+    if (!ctx->watches && watch_install(ctx) != LITESTORE_OK)
+    {
+        sqlite3_free(watch);
+        return LITESTORE_ERR;
+    }
+    watch->next = NULL;
+    watch->callback = callback;
+    watch->user_data = user_data;
+    watch->prefix_len = prefix.length;
+    if (prefix.length > 0)
+    {
+        memcpy(watch + 1, prefix.data, prefix.length);
+    }
+    /* called in the order added */
+    p = &(ctx->watches);
+    while (*p)
+    {
+        p = &((*p)->next);
+    }
+    *p = watch;
+
+    return LITESTORE_OK;
+}
+
+int litestore_unwatch(litestore* ctx,
+                      litestore_watch_cb callback,
+                      void* user_data)
+{
+    int rv = LITESTORE_UNKNOWN_ENTITY;
+    watch_entry** p = NULL;
+
+    if (!ctx || ctx->tx_active || ctx->bulk_active || ctx->watch_delivering)
+    {
+        return LITESTORE_ERR;
+    }
+    p = &(ctx->watches);
+    while (*p)
+    {
+        if ((*p)->callback == callback && (*p)->user_data == user_data)
+        {
+            watch_entry* watch = *p;
+            *p = watch->next;
+            sqlite3_free(watch);
+            rv = LITESTORE_OK;
+        }
+        else
+        {
+            p = &((*p)->next);
+        }
+    }
+    if (rv == LITESTORE_OK && !ctx->watches)
+    {
+        watch_uninstall(ctx);
+    }
+
+    return rv;
+}
+
+/*-----------------------------------------*/
+/*---------------- null -------------------*/
+/*-----------------------------------------*/
+int litestore_create_null(litestore* ctx, litestore_slice_t key)
+{
+    int rv = LITESTORE_ERR;
+
+    if (ctx && !bulk_blocks(ctx) && slice_valid(key))
+    {
+        op_begin(ctx, "create_null");
+        const int own_tx = opt_begin_tx(ctx);
+
+        litestore_id_t new_id = 0;
+        rv = create_key(ctx, key.data, key.length, LS_NULL, &new_id);
+
+        if (own_tx)
+        {
+            opt_end_tx(ctx, rv);
+        }
+        op_end(ctx, LITESTORE_OP_CREATE);
+    }
+
+    return rv;
+}
+
+int litestore_read_null(litestore* ctx, litestore_slice_t key)
+{
+    int rv = LITESTORE_ERR;
+
+    if (ctx && slice_valid(key))
+    {
+        op_begin(ctx, "read_null");
+        const int own_tx = opt_begin_tx(ctx);
+
+        litestore_id_t id = 0;
+        int type = -1;
+        rv = read_object_type(ctx, key.data, key.length, &id, &type);
+
+        if (rv == LITESTORE_OK && type != LS_NULL)
+        {
+            rv = LITESTORE_ERR;
+        }
+
+        if (own_tx)
+        {
+            opt_end_tx(ctx, rv);
+        }
+        op_end(ctx, LITESTORE_OP_READ);
+    }
+
+    return rv;
+}
+
+int litestore_update_null(litestore* ctx, litestore_slice_t key)
+{
+    int rv = LITESTORE_ERR;
+    if (ctx && !bulk_blocks(ctx) && slice_valid(key))
+    {
+        op_begin(ctx, "update_null");
+        const int own_tx = opt_begin_tx(ctx);
+
+        litestore_id_t id = 0;
+        int old_type = -1;
+        rv = read_object_type(ctx, key.data, key.length, &id, &old_type);
+        if (rv == LITESTORE_OK)
+        {
+            rv = update_null(ctx, id, old_type);
+            if (rv == LITESTORE_OK && old_type != LS_NULL)
+            {
+                rv = update_object_type(ctx, id, LS_NULL);
+            }
+        }
+        else if (rv == LITESTORE_UNKNOWN_ENTITY)
+        {
+            rv = litestore_create_null(ctx, key);
+        }
+
+        if (own_tx)
+        {
+            opt_end_tx(ctx, rv);
+        }
+        op_end(ctx, LITESTORE_OP_UPDATE);
+    }
+    return rv;
+}
+
+/*-----------------------------------------*/
+/*---------------- object -----------------*/
+/*-----------------------------------------*/
+int litestore_create(litestore* ctx,
+                     litestore_slice_t key,
+                     litestore_blob_t value)
+{
+    create_ctx op = {LS_RAW, &create_data, &value};
+    return gen_create(ctx, key.data, key.length, op);
+}
+
+int litestore_read(litestore* ctx,
+                   litestore_slice_t key,
+                   litestore_read_cb callback,
+                   void* user_data)
+{
+    read_ctx op = {LS_RAW, &read_data, NULL, callback, user_data};
+    return gen_read(ctx, key.data, key.length, op);
+}
+
+int litestore_update(litestore* ctx,
+                     litestore_slice_t key,
+                     litestore_blob_t value)
+{
+    update_ctx op = {LS_RAW, &update_data, &create_data, &value};
+    return gen_update(ctx, key.data, key.length, op);
+}
+
+/*-----------------------------------------*/
+/*---------------- delete -----------------*/
+/*-----------------------------------------*/
+int litestore_delete(litestore* ctx, litestore_slice_t key)
+{
+    int rv = LITESTORE_ERR;
+
+    /* delete should cascade */
+    if (ctx && !bulk_blocks(ctx) && slice_valid(key) && ctx->delete_key)
+    {
+        op_begin(ctx, "delete");
+        const int own_tx = opt_begin_tx(ctx);
+
+        sqlite3_reset(ctx->delete_key);
+        if (sqlite3_bind_text(ctx->delete_key,
+                              1, key.data, key.length,
+                              SQLITE_STATIC) == SQLITE_OK)
+        {
+            if (sqlite3_step(ctx->delete_key) == SQLITE_DONE)
+            {
+                rv = (sqlite3_changes(ctx->db) == 1 ?
+                      LITESTORE_OK : LITESTORE_UNKNOWN_ENTITY);
+            }
+            else
+            {
+                sqlite_error(ctx);
+                rv = LITESTORE_ERR;
+            }
+        }
+        else
+        {
+            sqlite_error(ctx);
+            rv = LITESTORE_ERR;
+        }
+
+        if (own_tx)
+        {
+            opt_end_tx(ctx, rv);
+        }
+        op_end(ctx, LITESTORE_OP_DELETE);
+    }
+
+    return rv;
+}
+
+/**
+ * Pass the (name, type) rows of stmt to the callback, and reset it.
+ */
+static
+int read_key_rows(litestore* ctx,
+                  sqlite3_stmt* stmt,
+                  litestore_read_keys_cb callback,
+                  void* user_data)
+{
+    int rc = 0;
+
+    while ((rc = sqlite3_step(stmt)) != SQLITE_DONE)
+    {
+        if (rc == SQLITE_ROW)
+        {
+            const unsigned char* key = sqlite3_column_text(stmt, 0);
+            const int key_len = sqlite3_column_bytes(stmt, 0);
+            if ((*callback)(litestore_slice((const char*)key, 0, key_len),
+                            sqlite3_column_int(stmt, 1),
+                            user_data)
+                != LITESTORE_OK)
+            {
+                break;
+            }
+        }
+        else
+        {
+            sqlite_error(ctx);
+            break;
+        }
+    }  /* while */
+    sqlite3_reset(stmt);
+
+    return rc == SQLITE_DONE ? LITESTORE_OK : LITESTORE_ERR;
+}
+
+int litestore_read_keys(litestore* ctx,
+                        litestore_slice_t key_pattern,
+                        litestore_read_keys_cb callback,
+                        void* user_data)
+{
+    int rv = LITESTORE_ERR;
+
+    if (ctx->read_keys && callback)
+    {
+        op_begin(ctx, "read_keys");
+        const int own_tx = opt_begin_tx(ctx);
+
+        if (sqlite3_bind_text(ctx->read_keys, 1,
+                              key_pattern.data, key_pattern.length,
+                              SQLITE_STATIC) != SQLITE_OK
+            || sqlite3_bind_int64(ctx->read_keys, 2, expiry_now())
+            != SQLITE_OK)
+        {
+            sqlite_error(ctx);
+        }
+        else
+        {
+            rv = read_key_rows(ctx, ctx->read_keys, callback, user_data);
+        }
+
+        if (own_tx)
+        {
+            opt_end_tx(ctx, rv);
+        }
+        op_end(ctx, LITESTORE_OP_READ_KEYS);
+    }
+
+    return rv;
+}
+
+int litestore_read_key_range(litestore* ctx,
+                             litestore_slice_t first,
+                             litestore_slice_t last,
+                             litestore_read_keys_cb callback,
+                             void* user_data)
+{
+    int rv = LITESTORE_ERR;
+
+    if (ctx->read_key_range && callback)
+    {
+        op_begin(ctx, "read_key_range");
+        const int own_tx = opt_begin_tx(ctx);
+        sqlite3_stmt* stmt = ctx->read_key_range;
+        /* keys are TEXT, which sorts before any BLOB */
+        const int bound = slice_valid(last)
+            ? sqlite3_bind_text(stmt, 2, last.data, last.length,
+                                SQLITE_STATIC)
+            : sqlite3_bind_zeroblob(stmt, 2, 0);
+
+        if (sqlite3_bind_text(stmt, 1, first.data ? first.data : "",
+                              first.length, SQLITE_STATIC) != SQLITE_OK
+            || bound != SQLITE_OK
+            || sqlite3_bind_int64(stmt, 3, expiry_now()) != SQLITE_OK)
+        {
+            sqlite_error(ctx);
+        }
+        else
+        {
+            rv = read_key_rows(ctx, stmt, callback, user_data);
+        }
+
+        if (own_tx)
+        {
+            opt_end_tx(ctx, rv);
+        }
+        op_end(ctx, LITESTORE_OP_READ_KEYS);
+    }
+
+    return rv;
+}
+
+/*-----------------------------------------*/
+/*---------------- expiry -----------------*/
+/*-----------------------------------------*/
+int litestore_expire(litestore* ctx,
+                     litestore_slice_t key,
+                     const long long expires_at)
+{
+    int rv = LITESTORE_ERR;
+
+    if (ctx && !bulk_blocks(ctx) && slice_valid(key))
+    {
+        op_begin(ctx, "expire");
+        const int own_tx = opt_begin_tx(ctx);
+
+        litestore_id_t id = 0;
+        int type = -1;
+        rv = read_object_type(ctx, key.data, key.length, &id, &type);
+        if (rv == LITESTORE_OK && expires_at != 0)
+        {
+            rv = (sqlite3_bind_int64(ctx->set_expiry, 1, id) == SQLITE_OK
+                  && sqlite3_bind_int64(ctx->set_expiry, 2, expires_at)
+                  == SQLITE_OK) ? run_stmt(ctx, ctx->set_expiry)
+                : LITESTORE_ERR;
+        }
+        else if (rv == LITESTORE_OK)
+        {
+            rv = sqlite3_bind_int64(ctx->delete_expiry, 1, id) == SQLITE_OK
+                ? run_stmt(ctx, ctx->delete_expiry) : LITESTORE_ERR;
+        }
+
+        if (own_tx)
+        {
+            opt_end_tx(ctx, rv);
+        }
+        op_end(ctx, LITESTORE_OP_UPDATE);
+    }
+
+    return rv;
+}
+
+int litestore_expires_at(litestore* ctx,
+                         litestore_slice_t key,
+                         long long* expires_at)
+{
+    int rv = LITESTORE_ERR;
+
+    if (ctx && slice_valid(key) && expires_at)
+    {
+        op_begin(ctx, "expires_at");
+        const int own_tx = opt_begin_tx(ctx);
+
+        litestore_id_t id = 0;
+        int type = -1;
+        sqlite3_int64 expiry = 0;
+        rv = read_object(ctx, key.data, key.length, &id, &type, &expiry);
+        if (rv == LITESTORE_OK)
+        {
+            *expires_at = expiry;
+        }
+
+        if (own_tx)
+        {
+            opt_end_tx(ctx, rv);
+        }
+        op_end(ctx, LITESTORE_OP_READ);
+    }
+
+    return rv;
+}
+
+int litestore_expire_step(litestore* ctx, const int count)
+{
+    int rv = LITESTORE_ERR;
+    const sqlite3_int64 now = expiry_now();
+    int i = 0;
+
+    if (!ctx || count <= 0 || bulk_blocks(ctx))
+    {
+        return LITESTORE_ERR;
+    }
+    op_begin(ctx, "expire_step");
+    const int own_tx = opt_begin_tx(ctx);
+
+    rv = LITESTORE_IN_PROGRESS;
+    for (i = 0; i < count && rv == LITESTORE_IN_PROGRESS; ++i)
+    {
+        int rc = sqlite3_bind_int64(ctx->next_expired, 1, now) == SQLITE_OK
+            ? sqlite3_step(ctx->next_expired) : SQLITE_ERROR;
+        if (rc == SQLITE_ROW)
+        {
+            const sqlite3_int64 id =
+                sqlite3_column_int64(ctx->next_expired, 0);
+            sqlite3_reset(ctx->next_expired);
+            /* the values and the expiry cascade */
+            if (sqlite3_bind_int64(ctx->delete_id, 1, id) != SQLITE_OK
+                || run_stmt(ctx, ctx->delete_id) != LITESTORE_OK)
+            {
+                rv = LITESTORE_ERR;
+            }
+        }
+        else if (rc == SQLITE_DONE)
+        {
+            rv = LITESTORE_OK;
+        }
+        else
+        {
+            sqlite_error(ctx);
+            rv = LITESTORE_ERR;
+        }
+        sqlite3_reset(ctx->next_expired);
+    }
+
+    if (own_tx
+        && opt_end_tx(ctx, rv == LITESTORE_ERR ? rv : LITESTORE_OK)
+        != LITESTORE_OK)
+    {
+        rv = LITESTORE_ERR;
+    }
+    op_end(ctx, LITESTORE_OP_DELETE);
+
+    return rv;
+}
+
+/*-----------------------------------------*/
+/*---------------- kv ---------------------*/
+/*-----------------------------------------*/
+int litestore_create_kv(litestore* ctx, litestore_slice_t key)
+{
+    int rv = LITESTORE_ERR;
+
+    if (ctx && !bulk_blocks(ctx) && slice_valid(key))
+    {
+        op_begin(ctx, "create_kv");
+        const int own_tx = opt_begin_tx(ctx);
+
+        litestore_id_t new_id = 0;
+        rv = create_key(ctx, key.data, key.length, LS_KV, &new_id);
+
+        if (own_tx)
+        {
+            opt_end_tx(ctx, rv);
+        }
+        op_end(ctx, LITESTORE_OP_CREATE);
+    }
+
+    return rv;
+}
+
+int litestore_kv_set(litestore* ctx,
+                     litestore_slice_t key,
+                     litestore_slice_t field,
+                     litestore_blob_t value)
+{
+    if (ctx && slice_valid(field) && value.data)
+    {
+        kv_field f = {field, value};
+        update_ctx op = {LS_KV, &update_kv, &create_kv, &f};
+        return gen_update(ctx, key.data, key.length, op);
+    }
+    return LITESTORE_ERR;
+}
+
+int litestore_kv_get(litestore* ctx,
+                     litestore_slice_t key,
+                     litestore_slice_t field,
+                     litestore_read_cb callback,
+                     void* user_data)
+{
+    if (ctx && slice_valid(field) && callback)
+    {
+        read_ctx op = {LS_KV, &read_field, &field, callback, user_data};
+        return gen_read(ctx, key.data, key.length, op);
+    }
+    return LITESTORE_ERR;
+}
+
+int litestore_kv_delete(litestore* ctx,
+                        litestore_slice_t key,
+                        litestore_slice_t field)
+{
+    int rv = LITESTORE_ERR;
+
+    if (ctx && !bulk_blocks(ctx) && slice_valid(key) && slice_valid(field))
+    {
+        op_begin(ctx, "kv_delete");
+        const int own_tx = opt_begin_tx(ctx);
+
+        litestore_id_t id = 0;
+        int type = -1;
+        rv = read_object_type(ctx, key.data, key.length, &id, &type);
+        if (rv == LITESTORE_OK && type != LS_KV)
+        {
+            rv = LITESTORE_ERR;
+        }
+        else if (rv == LITESTORE_OK)
+        {
+            if (sqlite3_bind_int64(ctx->delete_field, 1, id) == SQLITE_OK
+                && sqlite3_bind_blob(ctx->delete_field, 2,
+                                     field.data, (int)field.length,
+                                     SQLITE_STATIC) == SQLITE_OK
+                && sqlite3_step(ctx->delete_field) == SQLITE_DONE)
+            {
+                rv = (sqlite3_changes(ctx->db) == 1 ?
+                      LITESTORE_OK : LITESTORE_UNKNOWN_ENTITY);
+            }
+            else
+            {
+                sqlite_error(ctx);
+                rv = LITESTORE_ERR;
+            }
+            sqlite3_reset(ctx->delete_field);
+        }
+
+        if (own_tx)
+        {
+            opt_end_tx(ctx, rv);
+        }
+        op_end(ctx, LITESTORE_OP_UPDATE);
+    }
+
+    return rv;
+}
+
+int litestore_kv_iterate(litestore* ctx,
+                         litestore_slice_t key,
+                         litestore_kv_cb callback,
+                         void* user_data)
+{
+    if (ctx && callback)
+    {
+        read_ctx op = {LS_KV, &read_fields, NULL, callback, user_data};
+        return gen_read(ctx, key.data, key.length, op);
+    }
+    return LITESTORE_ERR;
+}
+
+/*-----------------------------------------*/
+/*---------------- array ------------------*/
+/*-----------------------------------------*/
+int litestore_create_array(litestore* ctx, litestore_slice_t key)
+{
+    int rv = LITESTORE_ERR;
+
+    if (ctx && !bulk_blocks(ctx) && slice_valid(key))
+    {
+        op_begin(ctx, "create_array");
+        const int own_tx = opt_begin_tx(ctx);
+
+        litestore_id_t new_id = 0;
+        rv = create_key(ctx, key.data, key.length, LS_ARRAY, &new_id);
+
+        if (own_tx)
+        {
+            opt_end_tx(ctx, rv);
+        }
+        op_end(ctx, LITESTORE_OP_CREATE);
+    }
+
+    return rv;
+}
+
+int litestore_array_append(litestore* ctx,
+                           litestore_slice_t key,
+                           litestore_blob_t value,
+                           size_t* index)
+{
+    if (ctx && value.data)
+    {
+        array_item item = {value, index};
+        update_ctx op = {LS_ARRAY, &append_item, &create_array, &item};
+        return gen_update(ctx, key.data, key.length, op);
+    }
+    return LITESTORE_ERR;
+}
+
+int litestore_array_get(litestore* ctx,
+                        litestore_slice_t key,
+                        const size_t index,
+                        litestore_read_cb callback,
+                        void* user_data)
+{
+    if (ctx && callback)
+    {
+        size_t i = index;
+        read_ctx op = {LS_ARRAY, &read_item, &i, callback, user_data};
+        return gen_read(ctx, key.data, key.length, op);
+    }
+    return LITESTORE_ERR;
+}
+
+int litestore_array_set(litestore* ctx,
+                        litestore_slice_t key,
+                        const size_t index,
+                        litestore_blob_t value)
+{
+    int rv = LITESTORE_ERR;
+
+    if (ctx && !bulk_blocks(ctx) && slice_valid(key) && value.data)
+    {
+        op_begin(ctx, "array_set");
+        const int own_tx = opt_begin_tx(ctx);
+
+        litestore_id_t id = 0;
+        rv = read_array_id(ctx, key, &id);
+        if (rv == LITESTORE_OK)
+        {
+            if (sqlite3_bind_blob(ctx->update_item, 1,
+                                  value.data, (int)value.size,
+                                  SQLITE_STATIC) == SQLITE_OK
+                && sqlite3_bind_int64(ctx->update_item, 2, id) == SQLITE_OK
+                && sqlite3_bind_int64(ctx->update_item, 3,
+                                      (sqlite3_int64)index) == SQLITE_OK
+                && sqlite3_step(ctx->update_item) == SQLITE_DONE)
+            {
+                rv = (sqlite3_changes(ctx->db) == 1 ?
+                      LITESTORE_OK : LITESTORE_UNKNOWN_ENTITY);
+            }
+            else
+            {
+                sqlite_error(ctx);
+                rv = LITESTORE_ERR;
+            }
+            sqlite3_reset(ctx->update_item);
+        }
+
+        if (own_tx)
+        {
+            opt_end_tx(ctx, rv);
+        }
+        op_end(ctx, LITESTORE_OP_UPDATE);
+    }
+
+    return rv;
+}
+
+int litestore_array_range(litestore* ctx,
+                          litestore_slice_t key,
+                          const size_t first,
+                          const size_t count,
+                          litestore_array_cb callback,
+                          void* user_data)
+{
+    if (ctx && callback)
+    {
+        array_range range = {first, count};
+        read_ctx op = {LS_ARRAY, &read_items, &range, callback, user_data};
+        return gen_read(ctx, key.data, key.length, op);
+    }
+    return LITESTORE_ERR;
+}
+
+int litestore_array_truncate(litestore* ctx,
+                             litestore_slice_t key,
+                             const size_t length)
+{
+    int rv = LITESTORE_ERR;
+
+    if (ctx && !bulk_blocks(ctx) && slice_valid(key))
+    {
+        op_begin(ctx, "array_truncate");
+        const int own_tx = opt_begin_tx(ctx);
+
+        litestore_id_t id = 0;
+        rv = read_array_id(ctx, key, &id);
+        /* no array is that long */
+        if (rv == LITESTORE_OK && length < (size_t)LLONG_MAX)
+        {
+            rv = delete_items(ctx, id, length);
+        }
+
+        if (own_tx)
+        {
+            opt_end_tx(ctx, rv);
+        }
+        op_end(ctx, LITESTORE_OP_UPDATE);
+    }
+
+    return rv;
+}
+
+int litestore_array_length(litestore* ctx,
+                           litestore_slice_t key,
+                           size_t* length)
+{
+    if (ctx && length)
+    {
+        read_ctx op = {LS_ARRAY, &read_length, length, NULL, NULL};
+        return gen_read(ctx, key.data, key.length, op);
+    }
+    return LITESTORE_ERR;
+}
+
+/*-----------------------------------------*/
+/*---------------- numbers ----------------*/
+/*-----------------------------------------*/
+int litestore_create_int(litestore* ctx,
+                         litestore_slice_t key,
+                         const long long value)
+{
+    number n = {LS_INT, value, 0};
+    create_ctx op = {LS_INT, &create_number, &n};
+    return gen_create(ctx, key.data, key.length, op);
+}
+
+int litestore_read_int(litestore* ctx,
+                       litestore_slice_t key,
+                       long long* value)
+{
+    int rv = LITESTORE_ERR;
+    if (value)
+    {
+        number n = {LS_INT, 0, 0};
+        read_ctx op = {LS_INT, &read_number, &n, NULL, NULL};
+        rv = gen_read(ctx, key.data, key.length, op);
+        if (rv == LITESTORE_OK)
+        {
+            *value = n.i;
+        }
+    }
+    return rv;
+}
+
+int litestore_update_int(litestore* ctx,
+                         litestore_slice_t key,
+                         const long long value)
+{
+    number n = {LS_INT, value, 0};
+    update_ctx op = {LS_INT, &update_number, &create_number, &n};
+    return gen_update(ctx, key.data, key.length, op);
+}
+
+int litestore_incr(litestore* ctx,
+                   litestore_slice_t key,
+                   const long long delta,
+                   long long* new_value)
+{
+    number n = {LS_INT, delta, 0};
+    const int rv = incr_number(ctx, key, &n);
+    if (rv == LITESTORE_OK && new_value)
+    {
+        *new_value = n.i;
+    }
+    return rv;
+}
+
+int litestore_create_float(litestore* ctx,
+                           litestore_slice_t key,
+                           const double value)
+{
+    number n = {LS_FLOAT, 0, value};
+    create_ctx op = {LS_FLOAT, &create_number, &n};
+    return gen_create(ctx, key.data, key.length, op);
+}
+
+int litestore_read_float(litestore* ctx,
+                         litestore_slice_t key,
+                         double* value)
+{
+    int rv = LITESTORE_ERR;
+    if (value)
+    {
+        number n = {LS_FLOAT, 0, 0};
+        read_ctx op = {LS_FLOAT, &read_number, &n, NULL, NULL};
+        rv = gen_read(ctx, key.data, key.length, op);
+        if (rv == LITESTORE_OK)
+        {
+            *value = n.f;
+        }
+    }
+    return rv;
+}
+
+int litestore_update_float(litestore* ctx,
+                           litestore_slice_t key,
+                           const double value)
+{
+    number n = {LS_FLOAT, 0, value};
+    update_ctx op = {LS_FLOAT, &update_number, &create_number, &n};
+    return gen_update(ctx, key.data, key.length, op);
+}
+
+int litestore_incr_float(litestore* ctx,
+                         litestore_slice_t key,
+                         const double delta,
+                         double* new_value)
+{
+    number n = {LS_FLOAT, 0, delta};
+    const int rv = incr_number(ctx, key, &n);
+    if (rv == LITESTORE_OK && new_value)
+    {
+        *new_value = n.f;
+    }
+    return rv;
+}
+
+
+/*-----------------------------------------*/
+/*---------------- json -------------------*/
+/*-----------------------------------------*/
+int litestore_create_json(litestore* ctx,
+                          litestore_slice_t key,
+                          litestore_slice_t doc)
+{
+    create_ctx op = {LS_JSON, &create_json, &doc};
+    return slice_valid(doc)
+        ? gen_create(ctx, key.data, key.length, op)
+        : LITESTORE_ERR;
+}
+
+int litestore_read_json(litestore* ctx,
+                        litestore_slice_t key,
+                        litestore_read_cb callback,
+                        void* user_data)
+{
+    read_ctx op = {LS_JSON, &read_json, NULL, (void*)callback, user_data};
+    return callback
+        ? gen_read(ctx, key.data, key.length, op)
+        : LITESTORE_ERR;
+}
+
+int litestore_read_json_path(litestore* ctx,
+                             litestore_slice_t key,
+                             litestore_slice_t path,
+                             litestore_read_cb callback,
+                             void* user_data)
+{
+    read_ctx op = {LS_JSON, &read_json_path, &path, (void*)callback,
+                   user_data};
+    return callback && slice_valid(path)
+        ? gen_read(ctx, key.data, key.length, op)
+        : LITESTORE_ERR;
+}
+
+int litestore_update_json(litestore* ctx,
+                          litestore_slice_t key,
+                          litestore_slice_t doc)
+{
+    update_ctx op = {LS_JSON, &update_json, &create_json, &doc};
+    return slice_valid(doc)
+        ? gen_update(ctx, key.data, key.length, op)
+        : LITESTORE_ERR;
+}
+
+int litestore_json_index_open(litestore* ctx,
+                              litestore_slice_t path,
+                              litestore_json_index** index)
+{
+    int rv = LITESTORE_ERR;
+    sqlite3_int64 id = 0;
+
+    /* as for namespaces, the schema is not changed in a user tx */
+    if (!ctx || !slice_valid(path) || !index || ctx->tx_active
+        || ctx->bulk_active)
+    {
+        return LITESTORE_ERR;
+    }
+    *index = NULL;
+    op_begin(ctx, "json_index_open");
+    if (opt_begin_tx(ctx))
+    {
+        rv = json_index_lookup(ctx, path, &id);
+        if (rv == LITESTORE_UNKNOWN_ENTITY)
+        {
+            rv = json_index_create(ctx, path, &id);
+        }
+        if (opt_end_tx(ctx, rv) != LITESTORE_OK)
+        {
+            rv = LITESTORE_ERR;
+        }
+    }
+    if (rv == LITESTORE_OK)
+    {
+        rv = json_index_handle(ctx, id, path, index);
+    }
+    op_end(ctx, LITESTORE_OP_CREATE);
+
+    return rv;
+}
 
+int litestore_json_index_drop(litestore* ctx, litestore_slice_t path)
+{
+    int rv = LITESTORE_ERR;
+    sqlite3_int64 id = 0;
+
+    if (!ctx || !slice_valid(path) || ctx->tx_active || ctx->bulk_active)
+    {
+        return LITESTORE_ERR;
+    }
+    op_begin(ctx, "json_index_drop");
+    if (opt_begin_tx(ctx))
+    {
+        rv = json_index_lookup(ctx, path, &id);
+        if (rv == LITESTORE_OK)
+        {
+            rv = json_index_drop(ctx, id);
+        }
+        if (opt_end_tx(ctx, rv) != LITESTORE_OK)
+        {
+            rv = LITESTORE_ERR;
+        }
+        /* the handle stays valid if the drop was rolled back */
+        if (rv == LITESTORE_OK)
+        {
+            json_index_close(ctx, id);
+        }
+    }
+    op_end(ctx, LITESTORE_OP_DELETE);
+
+    return rv;
+}
+
+/**
+ * Bind a JSON value, or NULL for an empty one.
+ */
 static
-int gen_create(litestore* ctx,
-               const char* key,
-               const size_t key_len,
-               create_ctx op)
+int bind_json(sqlite3_stmt* stmt, const int index, litestore_slice_t value)
+{
+    return slice_valid(value)
+        ? sqlite3_bind_text(stmt, index, value.data, value.length,
+                            SQLITE_STATIC)
+        : sqlite3_bind_null(stmt, index);
+}
+
+int litestore_json_find(litestore_json_index* index,
+                        litestore_slice_t value,
+                        litestore_read_keys_cb callback,
+                        void* user_data)
 {
     int rv = LITESTORE_ERR;
 
-    if (ctx && key && key_len > 0 && op.create && op.data)
+    if (index && slice_valid(value) && callback)
     {
+        litestore* ctx = index->ctx;
+        op_begin(ctx, "json_find");
         const int own_tx = opt_begin_tx(ctx);
 
-        litestore_id_t new_id = 0;
-        rv = create_key(ctx, key, key_len, op.object_type, &new_id);
-        if (rv == LITESTORE_OK)
+        if (bind_json(index->find, 1, value) != SQLITE_OK
+            || sqlite3_bind_int64(index->find, 2, expiry_now()) != SQLITE_OK)
         {
-            rv = (*op.create)(ctx, new_id, op.data);
+            sqlite_error(ctx);
+        }
+        else
+        {
+            rv = read_key_rows(ctx, index->find, callback, user_data);
+        }
+
+        if (own_tx)
+        {
+            opt_end_tx(ctx, rv);
+        }
+        op_end(ctx, LITESTORE_OP_READ_KEYS);
+    }
+
+    return rv;
+}
+
+int litestore_json_range(litestore_json_index* index,
+                         litestore_slice_t first,
+                         litestore_slice_t last,
+                         litestore_read_keys_cb callback,
+                         void* user_data)
+{
+    int rv = LITESTORE_ERR;
+
+    if (index && callback)
+    {
+        litestore* ctx = index->ctx;
+        op_begin(ctx, "json_range");
+        const int own_tx = opt_begin_tx(ctx);
+
+        if (bind_json(index->range, 1, first) != SQLITE_OK
+            || bind_json(index->range, 2, last) != SQLITE_OK
+            || sqlite3_bind_int64(index->range, 3, expiry_now())
+            != SQLITE_OK)
+        {
+            sqlite_error(ctx);
+        }
+        else
+        {
+            rv = read_key_rows(ctx, index->range, callback, user_data);
         }
 
         if (own_tx)
         {
             opt_end_tx(ctx, rv);
         }
+        op_end(ctx, LITESTORE_OP_READ_KEYS);
     }
 
     return rv;
 }
 
+
 /*-----------------------------------------*/
-/*----------------- READ ------------------*/
+/*---------------- merge ------------------*/
 /*-----------------------------------------*/
-static
-int read_object_type(litestore* ctx,
-                     const char* key,
-                     const size_t key_len,
-                     litestore_id_t* id,
-                     int* type)
+int litestore_merge(litestore* ctx,
+                    litestore_slice_t key,
+                    const int operator_id,
+                    litestore_blob_t operand)
 {
-    if (ctx->read_key && key && key_len > 0)
+    int rv = LITESTORE_ERR;
+
+    if (ctx && !bulk_blocks(ctx) && slice_valid(key) && operand.data
+        && find_merge_operator(ctx, operator_id))
     {
-        sqlite3_reset(ctx->read_key);
-        if (sqlite3_bind_text(ctx->read_key,
-                              1, key, key_len,
-                              SQLITE_STATIC) != SQLITE_OK)
+        op_begin(ctx, "merge");
+        const int own_tx = opt_begin_tx(ctx);
+
+        litestore_id_t id = 0;
+        int type = -1;
+        rv = read_object_type(ctx, key.data, key.length, &id, &type);
+        if (rv == LITESTORE_UNKNOWN_ENTITY)
         {
-            sqlite_error(ctx);
-            return LITESTORE_ERR;
+            /* the operands are merged into an empty value */
+            const stored_value empty = {"", 0, LITESTORE_CODEC_NONE, 0};
+            const value_refs refs = {0, 0};
+            rv = create_key(ctx, key.data, key.length, LS_RAW, &id);
+            if (rv == LITESTORE_OK)
+            {
+                rv = insert_data(ctx, id, &empty, &refs);
+            }
         }
-        /* expect only one aswer */
-        if (sqlite3_step(ctx->read_key) != SQLITE_ROW)
+        else if (rv == LITESTORE_OK && type != LS_RAW)
         {
-            *id = 0;
-            *type = -1;
-            return LITESTORE_UNKNOWN_ENTITY;
+            rv = LITESTORE_ERR;
         }
-        *id = sqlite3_column_int64(ctx->read_key, 0);
-        *type = sqlite3_column_int(ctx->read_key, 1);
-        return LITESTORE_OK;
+        if (rv == LITESTORE_OK)
+        {
+            rv = create_operand(ctx, id, operator_id, &operand);
+        }
+
+        if (own_tx)
+        {
+            opt_end_tx(ctx, rv);
+        }
+        op_end(ctx, LITESTORE_OP_UPDATE);
     }
-    return LITESTORE_ERR;
+
+    return rv;
 }
 
+/**
+ * Replace the value of an object with the merged one.
+ */
 static
-int read_data(litestore* ctx,
-              const litestore_id_t id,
-              const void* key,
-              const size_t key_len,
-              void* extra,
-              void* cb,
-              void* user_data)
+int compact_value(litestore* ctx, const litestore_id_t id)
+{
+    const void* data = NULL;
+    size_t size = 0;
+    int merged = 0;
+    int rv = read_value(ctx, id, &data, &size, &merged);
+    /* a merged value is in the merge buffers, not in the row */
+    sqlite3_reset(ctx->read_data);
+    if (rv == LITESTORE_OK && merged && size > 0)
+    {
+        litestore_blob_t value = litestore_make_blob(data, size);
+        rv = update_data(ctx, id, LS_RAW, &value);
+    }
+    return rv;
+}
+
+int litestore_merge_compact_step(litestore* ctx, const int count)
+{
+    int rv = LITESTORE_ERR;
+    sqlite3_int64 id = 0;
+    int i = 0;
+
+    if (!ctx || count <= 0 || bulk_blocks(ctx))
+    {
+        return LITESTORE_ERR;
+    }
+    op_begin(ctx, "merge_compact");
+    const int own_tx = opt_begin_tx(ctx);
+
+    id = ctx->merge_compact_id;
+    rv = LITESTORE_IN_PROGRESS;
+    /* the merged values stay the same, watchers are not told */
+    ctx->watch_quiet = 1;
+    for (i = 0; i < count && rv == LITESTORE_IN_PROGRESS; ++i)
+    {
+        sqlite3_reset(ctx->next_merged);
+        int rc = sqlite3_bind_int64(ctx->next_merged, 1, id) == SQLITE_OK
+            ? sqlite3_step(ctx->next_merged) : SQLITE_ERROR;
+        if (rc == SQLITE_ROW)
+        {
+            id = sqlite3_column_int64(ctx->next_merged, 0);
+            sqlite3_reset(ctx->next_merged);
+            if (compact_value(ctx, id) != LITESTORE_OK)
+            {
+                rv = LITESTORE_ERR;
+            }
+        }
+        else if (rc == SQLITE_DONE)
+        {
+            id = 0;
+            rv = LITESTORE_OK;
+        }
+        else
+        {
+            sqlite_error(ctx);
+            rv = LITESTORE_ERR;
+        }
+    }
+    sqlite3_reset(ctx->next_merged);
+    ctx->watch_quiet = 0;
+
+    if (own_tx
+        && opt_end_tx(ctx, rv == LITESTORE_ERR ? rv : LITESTORE_OK)
+        != LITESTORE_OK)
+    {
+        rv = LITESTORE_ERR;
+    }
+    if (rv != LITESTORE_ERR)
+    {
+        /* values merging to empty keep their operands, go past them */
+        ctx->merge_compact_id = id;
+    }
+    op_end(ctx, LITESTORE_OP_UPDATE);
+
+    return rv;
+}
+
+
+/*-----------------------------------------*/
+/*---------------- index ------------------*/
+/*-----------------------------------------*/
+int litestore_index_find(litestore* ctx,
+                         const int index_id,
+                         litestore_blob_t term,
+                         litestore_read_keys_cb callback,
+                         void* user_data)
 {
-    UNUSED(key);
-    UNUSED(key_len);
-    UNUSED(extra);
     int rv = LITESTORE_ERR;
 
-    if (ctx->read_data && cb)
+    if (ctx && ctx->index_find && blob_valid(term) && callback)
     {
-        litestore_read_cb callback = (litestore_read_cb)cb;
+        op_begin(ctx, "index_find");
+        const int own_tx = opt_begin_tx(ctx);
+        sqlite3_stmt* stmt = ctx->index_find;
 
-        if (sqlite3_bind_int64(ctx->read_data, 1, id) == SQLITE_OK
-            && sqlite3_step(ctx->read_data) == SQLITE_ROW)
+        if (sqlite3_bind_int(stmt, 1, index_id) != SQLITE_OK
+            || sqlite3_bind_blob64(stmt, 2, term.data,
+                                   (sqlite3_uint64)term.size,
+                                   SQLITE_STATIC) != SQLITE_OK
+            || sqlite3_bind_int64(stmt, 3, expiry_now()) != SQLITE_OK)
         {
-            const void* raw_data =
-                sqlite3_column_blob(ctx->read_data, 0);
-            const int bytes =
-                sqlite3_column_bytes(ctx->read_data, 0);
-            if (bytes > 0)
-            {
-                rv = (*callback)(
-                    litestore_make_blob(raw_data, bytes), user_data);
-            }
+            sqlite_error(ctx);
         }
         else
         {
-            sqlite_error(ctx);
+            rv = read_key_rows(ctx, stmt, callback, user_data);
         }
-        sqlite3_reset(ctx->read_data);
+
+        if (own_tx)
+        {
+            opt_end_tx(ctx, rv);
+        }
+        op_end(ctx, LITESTORE_OP_READ_KEYS);
     }
 
     return rv;
 }
 
-typedef struct
-{
-    int object_type;
-    int (*read)(litestore*, const litestore_id_t,
-                const void* /* key */, const size_t /* key_len */,
-                void* /* extra */, void* /* cb */, void* /* user_data */);
-    void* extra;
-    void* callback;
-    void* user_data;
-} read_ctx;
-
-static
-int gen_read(litestore* ctx,
-             const char* key,
-             const size_t key_len,
-             read_ctx op)
+int litestore_index_range(litestore* ctx,
+                          const int index_id,
+                          litestore_blob_t first,
+                          litestore_blob_t last,
+                          litestore_read_keys_cb callback,
+                          void* user_data)
 {
     int rv = LITESTORE_ERR;
 
-    if (ctx && key && key_len > 0 && op.read)
+    if (ctx && ctx->index_range && callback)
     {
+        op_begin(ctx, "index_range");
         const int own_tx = opt_begin_tx(ctx);
+        sqlite3_stmt* stmt = ctx->index_range;
+        /* an empty BLOB is the least of the terms, NULL means no end */
+        const int first_rc = blob_valid(first)
+            ? sqlite3_bind_blob64(stmt, 2, first.data,
+                                  (sqlite3_uint64)first.size, SQLITE_STATIC)
+            : sqlite3_bind_zeroblob(stmt, 2, 0);
+        const int last_rc = blob_valid(last)
+            ? sqlite3_bind_blob64(stmt, 3, last.data,
+                                  (sqlite3_uint64)last.size, SQLITE_STATIC)
+            : sqlite3_bind_null(stmt, 3);
 
-        litestore_id_t id = 0;
-        int type = -1;
-        rv = read_object_type(ctx, key, key_len, &id, &type);
-
-        if (rv == LITESTORE_OK && type == op.object_type)
+        if (sqlite3_bind_int(stmt, 1, index_id) != SQLITE_OK
+            || first_rc != SQLITE_OK
+            || last_rc != SQLITE_OK
+            || sqlite3_bind_int64(stmt, 4, expiry_now()) != SQLITE_OK)
         {
-            rv = (*op.read)(ctx, id, key, key_len, op.extra,
-                            op.callback, op.user_data);
+            sqlite_error(ctx);
         }
         else
         {
-            rv = LITESTORE_ERR;
+            rv = read_key_rows(ctx, stmt, callback, user_data);
         }
 
         if (own_tx)
         {
             opt_end_tx(ctx, rv);
         }
+        op_end(ctx, LITESTORE_OP_READ_KEYS);
     }
 
     return rv;
 }
 
-
-/*-----------------------------------------*/
-/*----------------- DELETE ----------------*/
-/*-----------------------------------------*/
-static
-int delete_data(litestore*ctx, const litestore_id_t id)
+int litestore_index_build_step(litestore* ctx, const int count)
 {
-    if (ctx->delete_data)
+    int rv = LITESTORE_ERR;
+    sqlite3_int64 id = 0;
+    int i = 0;
+
+    if (!ctx || count <= 0 || bulk_blocks(ctx))
     {
-        sqlite3_reset(ctx->delete_data);
-        if ((sqlite3_bind_int64(ctx->delete_data, 1, id) != SQLITE_OK))
+        return LITESTORE_ERR;
+    }
+    op_begin(ctx, "index_build");
+    const int own_tx = opt_begin_tx(ctx);
+
+    id = ctx->index_build_id;
+    rv = LITESTORE_IN_PROGRESS;
+    for (i = 0; i < count && rv == LITESTORE_IN_PROGRESS; ++i)
+    {
+        sqlite3_reset(ctx->next_raw);
+        int rc = sqlite3_bind_int64(ctx->next_raw, 1, id) == SQLITE_OK
+            ? sqlite3_step(ctx->next_raw) : SQLITE_ERROR;
+        if (rc == SQLITE_ROW)
         {
-            sqlite_error(ctx);
-            return LITESTORE_ERR;
+            const void* data = NULL;
+            size_t size = 0;
+            id = sqlite3_column_int64(ctx->next_raw, 0);
+            sqlite3_reset(ctx->next_raw);
+            if (read_value(ctx, id, &data, &size, NULL) != LITESTORE_OK
+                || index_value(ctx, id, litestore_make_blob(data, size))
+                != LITESTORE_OK)
+            {
+                rv = LITESTORE_ERR;
+            }
+            sqlite3_reset(ctx->read_data);
         }
-        if (sqlite3_step(ctx->delete_data) != SQLITE_DONE)
+        else if (rc == SQLITE_DONE)
+        {
+            id = 0;
+            rv = LITESTORE_OK;
+        }
+        else
         {
             sqlite_error(ctx);
-            return LITESTORE_ERR;
+            rv = LITESTORE_ERR;
         }
     }
-    else
+    sqlite3_reset(ctx->next_raw);
+
+    if (own_tx
+        && opt_end_tx(ctx, rv == LITESTORE_ERR ? rv : LITESTORE_OK)
+        != LITESTORE_OK)
     {
-        return LITESTORE_ERR;
+        rv = LITESTORE_ERR;
     }
-    return LITESTORE_OK;
+    if (rv != LITESTORE_ERR)
+    {
+        ctx->index_build_id = id;
+    }
+    op_end(ctx, LITESTORE_OP_UPDATE);
+
+    return rv;
 }
 
 
 /*-----------------------------------------*/
-/*----------------- UPDATE ----------------*/
+/*---------------- namespace --------------*/
 /*-----------------------------------------*/
-static
-int update_object_type(litestore* ctx,
-                       const litestore_id_t id,
-                       const int type)
+int litestore_ns_open(litestore* ctx,
+                      litestore_slice_t name,
+                      litestore_ns** ns)
 {
-    sqlite3_reset(ctx->update_type);
-    if (sqlite3_bind_int(ctx->update_type, 1, type) != SQLITE_OK
-        || sqlite3_bind_int64(ctx->update_type, 2, id) != SQLITE_OK)
+    int rv = LITESTORE_ERR;
+    sqlite3_int64 id = 0;
+
+    /* the schema is not changed in a user tx, the handle would outlive
+       a rollback */
+    if (!ctx || !slice_valid(name) || !ns || ctx->tx_active
+        || ctx->bulk_active)
     {
-        sqlite_error(ctx);
         return LITESTORE_ERR;
     }
-    if (sqlite3_step(ctx->update_type) != SQLITE_DONE)
+    *ns = NULL;
+    op_begin(ctx, "ns_open");
+    if (opt_begin_tx(ctx))
     {
-        sqlite_error(ctx);
-        return LITESTORE_ERR;
+        rv = ns_lookup(ctx, name, &id);
+        if (rv == LITESTORE_UNKNOWN_ENTITY)
+        {
+            rv = ns_create(ctx, name, &id);
+        }
+        if (opt_end_tx(ctx, rv) != LITESTORE_OK)
+        {
+            rv = LITESTORE_ERR;
+        }
+    }
+    if (rv == LITESTORE_OK)
+    {
+        rv = ns_handle(ctx, id, ns);
     }
+    op_end(ctx, LITESTORE_OP_CREATE);
 
-    return LITESTORE_OK;
+    return rv;
 }
 
-static
-int update_null(litestore* ctx,
-                const litestore_id_t id,
-                const int old_type)
+int litestore_ns_drop(litestore* ctx, litestore_slice_t name)
 {
-    int rv = LITESTORE_OK;
+    int rv = LITESTORE_ERR;
+    sqlite3_int64 id = 0;
 
-    switch (old_type)
+    if (!ctx || !slice_valid(name) || ctx->tx_active || ctx->bulk_active)
     {
-        case LS_RAW:
-            rv = delete_data(ctx, id);
-            break;
+        return LITESTORE_ERR;
+    }
+    op_begin(ctx, "ns_drop");
+    if (opt_begin_tx(ctx))
+    {
+        rv = ns_lookup(ctx, name, &id);
+        if (rv == LITESTORE_OK)
+        {
+            rv = ns_drop(ctx, id);
+        }
+        if (opt_end_tx(ctx, rv) != LITESTORE_OK)
+        {
+            rv = LITESTORE_ERR;
+        }
+        /* the handle stays valid if the drop was rolled back */
+        if (rv == LITESTORE_OK)
+        {
+            ns_close(ctx, id);
+        }
     }
+    op_end(ctx, LITESTORE_OP_DELETE);
 
     return rv;
 }
 
-static
-int update_data(litestore* ctx,
-                const litestore_id_t id,
-                const int old_type,
-                void* data)
+int litestore_ns_set_compression(litestore_ns* ns, const int codec_id)
 {
-    UNUSED(old_type);
-    
-    int rv = LITESTORE_OK;
+    if (ns && (codec_id == LITESTORE_CODEC_NONE
+               || find_codec(ns->ctx, codec_id)))
+    {
+        ns->compression = codec_id;
+        return LITESTORE_OK;
+    }
+    return LITESTORE_ERR;
+}
 
-    if (rv == LITESTORE_OK)
+int litestore_ns_put(litestore_ns* ns,
+                     litestore_slice_t key,
+                     litestore_blob_t value)
+{
+    int rv = LITESTORE_ERR;
+
+    if (ns && !bulk_blocks(ns->ctx) && slice_valid(key) && value.data)
     {
-        litestore_blob_t* value = (litestore_blob_t*)data;
+        litestore* ctx = ns->ctx;
+        stored_value stored;
+        op_begin(ctx, "ns_put");
+        const int own_tx = opt_begin_tx(ctx);
 
-        /* try update, if it fails create */
-        if (sqlite3_bind_blob(ctx->update_data, 1,
-                              value->data, value->size,
-                              SQLITE_STATIC) == SQLITE_OK
-            && sqlite3_bind_int64(ctx->update_data, 2, id) == SQLITE_OK)
+        if (encode_with(ctx, ns->compression, &value, &stored)
+            == LITESTORE_OK
+            && sqlite3_bind_text(ns->put, 1, key.data, key.length,
+                                 SQLITE_STATIC) == SQLITE_OK
+            && bind_value(ns->put, 2, &stored) == LITESTORE_OK)
         {
-            if (sqlite3_step(ctx->update_data) == SQLITE_DONE)
-            {
-                if (sqlite3_changes(ctx->db) == 0)
-                {
-                    rv = create_data(ctx, id, value);
-                }
-            }
-            else
-            {
-                sqlite_error(ctx);
-                rv = LITESTORE_ERR;
-            }
+            rv = run_stmt(ctx, ns->put);
         }
         else
         {
             sqlite_error(ctx);
-            rv = LITESTORE_ERR;
         }
-        sqlite3_reset(ctx->update_data);
+
+        if (own_tx)
+        {
+            opt_end_tx(ctx, rv);
+        }
+        op_end(ctx, LITESTORE_OP_UPDATE);
     }
 
     return rv;
 }
 
-typedef struct
-{
-    int object_type;
-    int (*update)(litestore*, const litestore_id_t, const int, void*);
-    int (*create)(litestore*, litestore_id_t, void*);
-    void* data;
-} update_ctx;
-
-static
-int gen_update(litestore* ctx,
-               const char* key,
-               const size_t key_len,
-               update_ctx op)
+int litestore_ns_get(litestore_ns* ns,
+                     litestore_slice_t key,
+                     litestore_read_cb callback,
+                     void* user_data)
 {
     int rv = LITESTORE_ERR;
 
-    if (ctx && key && key_len > 0 && op.update && op.data)
+    if (ns && slice_valid(key) && callback)
     {
+        litestore* ctx = ns->ctx;
+        op_begin(ctx, "ns_get");
         const int own_tx = opt_begin_tx(ctx);
 
-        litestore_id_t id = 0;
-        int old_type = -1;
-        rv = read_object_type(ctx, key, key_len, &id, &old_type);
-        if (rv == LITESTORE_OK)
+        int rc = sqlite3_bind_text(ns->get, 1, key.data, key.length,
+                                   SQLITE_STATIC) == SQLITE_OK
+            ? sqlite3_step(ns->get) : SQLITE_ERROR;
+        if (rc == SQLITE_ROW)
         {
-            rv = (*op.update)(ctx, id, old_type, op.data);
-            if (rv == LITESTORE_OK && old_type != op.object_type)
+            stored_value stored;
+            const void* data = NULL;
+            size_t size = 0;
+            column_value(ns->get, 0, &stored);
+            if (decode_value(ctx, &stored, &data, &size) == LITESTORE_OK)
             {
-                rv = update_object_type(ctx, id, op.object_type);
+                rv = (*callback)(litestore_make_blob(data, size), user_data);
             }
         }
-        else if (rv == LITESTORE_UNKNOWN_ENTITY)
+        else if (rc == SQLITE_DONE)
         {
-            create_ctx s = {op.object_type, op.create, op.data};
-            rv = gen_create(ctx, key, key_len, s);
+            rv = LITESTORE_UNKNOWN_ENTITY;
+        }
+        else
+        {
+            sqlite_error(ctx);
         }
+        sqlite3_reset(ns->get);
 
         if (own_tx)
         {
             opt_end_tx(ctx, rv);
         }
+        op_end(ctx, LITESTORE_OP_READ);
     }
 
     return rv;
 }
 
-static inline
-int slice_valid(const litestore_slice_t s)
+int litestore_ns_delete(litestore_ns* ns, litestore_slice_t key)
 {
-    return s.data && s.length > 0;
-}
+    int rv = LITESTORE_ERR;
 
-static inline
-int blob_valid(const litestore_blob_t b)
-{
-    return b.data && b.size > 0;
-}
+    if (ns && !bulk_blocks(ns->ctx) && slice_valid(key))
+    {
+        litestore* ctx = ns->ctx;
+        op_begin(ctx, "ns_delete");
+        const int own_tx = opt_begin_tx(ctx);
 
-/* from litestore_helpers.h */
-litestore_blob_t litestore_make_blob(const void* data, const size_t size)
-{
-    litestore_blob_t tmp = {data, size};
-    return tmp;
-}
+        if (sqlite3_bind_text(ns->del, 1, key.data, key.length,
+                              SQLITE_STATIC) == SQLITE_OK)
+        {
+            rv = run_stmt(ctx, ns->del);
+            if (rv == LITESTORE_OK && sqlite3_changes(ctx->db) == 0)
+            {
+                rv = LITESTORE_UNKNOWN_ENTITY;
+            }
+        }
+        else
+        {
+            sqlite_error(ctx);
+        }
 
-/* from litestore_helpers.h */
-litestore_slice_t litestore_slice(const char* str,
-                                  const size_t begin,
-                                  const size_t end)
-{
-    if (str && end > begin)
-    {
-        litestore_slice_t tmp = {str + begin, end - begin};
-        return tmp;
+        if (own_tx)
+        {
+            opt_end_tx(ctx, rv);
+        }
+        op_end(ctx, LITESTORE_OP_DELETE);
     }
-    litestore_slice_t tmp = {NULL, 0};
-    return tmp;
-}
 
-/* from litestore_helpers.h */
-litestore_slice_t litestore_slice_str(const char* str)
-{
-    return litestore_slice(str, 0, strlen(str));
+    return rv;
 }
 
-/*-----------------------------------------*/
-/*------------------ API ------------------*/
-/*-----------------------------------------*/
-
-void* litestore_native_ctx(litestore* ctx)
+int litestore_ns_scan(litestore_ns* ns,
+                      litestore_slice_t first,
+                      litestore_ns_cb callback,
+                      void* user_data)
 {
-    return ctx->db;
-}
+    int rv = LITESTORE_ERR;
 
-/*-----------------------------------------*/
-/*---------------- construction -----------*/
-/*-----------------------------------------*/
-int litestore_open(const char* file_name,
-                   litestore_opts opts,
-                   litestore** ctx)
-{
-    *ctx = (litestore*)malloc(sizeof(litestore));
-    if (*ctx)
+    if (ns && callback)
     {
-        memset(*ctx, 0, sizeof(litestore));
-        (*ctx)->opts = opts;
-        if (sqlite3_open(file_name, &(*ctx)->db) != SQLITE_OK
-            || init_db(*ctx) != LITESTORE_OK)
+        litestore* ctx = ns->ctx;
+        int rc = SQLITE_ERROR;
+        op_begin(ctx, "ns_scan");
+        const int own_tx = opt_begin_tx(ctx);
+
+        if (sqlite3_bind_text(ns->scan, 1, first.data ? first.data : "",
+                              first.data ? first.length : 0,
+                              SQLITE_STATIC) == SQLITE_OK)
         {
-            litestore_close(*ctx);
-            *ctx = NULL;
-            return LITESTORE_ERR;
+            rv = LITESTORE_OK;
+            while (rv == LITESTORE_OK
+                   && (rc = sqlite3_step(ns->scan)) == SQLITE_ROW)
+            {
+                stored_value stored;
+                const void* data = NULL;
+                size_t size = 0;
+                column_value(ns->scan, 1, &stored);
+                rv = decode_value(ctx, &stored, &data, &size);
+                if (rv == LITESTORE_OK)
+                {
+                    rv = (*callback)(
+                        litestore_slice(
+                            (const char*)sqlite3_column_text(ns->scan, 0),
+                            0, (size_t)sqlite3_column_bytes(ns->scan, 0)),
+                        litestore_make_blob(data, size),
+                        user_data);
+                }
+            }
+            if (rv == LITESTORE_OK && rc != SQLITE_DONE)
+            {
+                sqlite_error(ctx);
+                rv = LITESTORE_ERR;
+            }
         }
-        if (prepare_statements(*ctx) == LITESTORE_OK)
+        else
         {
-            return version_update(*ctx);
+            sqlite_error(ctx);
         }
-    }
-    return LITESTORE_ERR;
-}
+        sqlite3_reset(ns->scan);
 
-void litestore_close(litestore* ctx)
-{
-    if (ctx)
-    {
-        if (ctx->db)
+        if (own_tx)
         {
-            finalize_statements(ctx);
-            sqlite3_close(ctx->db);
-            ctx->db = NULL;
+            opt_end_tx(ctx, rv);
         }
-        free(ctx);
+        op_end(ctx, LITESTORE_OP_READ_KEYS);
     }
+
+    return rv;
 }
 
+
 /*-----------------------------------------*/
-/*---------------- tx ---------------------*/
+/*---------------- bulk -------------------*/
 /*-----------------------------------------*/
-int litestore_begin_tx(litestore* ctx)
+int litestore_bulk_begin(litestore* ctx, const int flags)
 {
-    const int rv = run_stmt(ctx, ctx->begin_tx);
-    if (rv == LITESTORE_OK)
+    char synchronous[16];
+
+    if (!ctx || ctx->bulk_active || ctx->tx_active)
     {
-        ctx->tx_active = 1;
+        return LITESTORE_ERR;
+    }
+    /* pragmas are no-ops inside a transaction, set them first */
+    if (query_text(ctx, "PRAGMA synchronous;",
+                   synchronous, sizeof(synchronous)) != LITESTORE_OK
+        || query_text(ctx, "PRAGMA journal_mode;",
+                      ctx->bulk_journal_mode,
+                      sizeof(ctx->bulk_journal_mode)) != LITESTORE_OK)
+    {
+        return LITESTORE_ERR;
+    }
+    ctx->bulk_synchronous = atoi(synchronous);
+    /* WAL is kept, it can not be left while other connections use it */
+    if (sqlite3_stricmp(ctx->bulk_journal_mode, "wal") != 0
+        && exec_sql(ctx, "PRAGMA journal_mode = MEMORY;") != LITESTORE_OK)
+    {
+        return LITESTORE_ERR;
+    }
+    /* never left with the checks and syncs off */
+    if (exec_sql(ctx, "PRAGMA foreign_keys = OFF;"
+                 "PRAGMA synchronous = OFF;") != LITESTORE_OK)
+    {
+        bulk_restore(ctx);
+        return LITESTORE_ERR;
     }
-    return rv;
-}
 
-int litestore_commit_tx(litestore* ctx)
-{
-    const int rv = run_stmt(ctx, ctx->commit_tx);
-    if (rv == LITESTORE_OK)
+    ctx->bulk_active = 1;
+    ctx->bulk_flags = flags;
+    ctx->bulk_key_len = 0;
+    if (litestore_begin_tx(ctx) != LITESTORE_OK
+        || exec_sql(ctx, LITESTORE_DROP_INDEXES) != LITESTORE_OK)
     {
-        ctx->tx_active = 0;
+        litestore_bulk_end(ctx);
+        return LITESTORE_ERR;
     }
-    return rv;
+    return LITESTORE_OK;
 }
 
-int litestore_rollback_tx(litestore* ctx)
+int litestore_bulk_append(litestore* ctx,
+                          litestore_slice_t key,
+                          litestore_blob_t value)
 {
-    const int rv = run_stmt(ctx, ctx->rollback_tx);
-    if (rv == LITESTORE_OK)
+    int rv = LITESTORE_ERR;
+
+    if (!ctx || !ctx->bulk_active || !slice_valid(key))
     {
-        ctx->tx_active = 0;
+        return LITESTORE_ERR;
+    }
+    if ((ctx->bulk_flags & LITESTORE_BULK_SORTED)
+        && bulk_check_order(ctx, key) != LITESTORE_OK)
+    {
+        return LITESTORE_ERR;
     }
+    ctx->bulk_appending = 1;
+    rv = value.data ? litestore_create(ctx, key, value)
+        : litestore_create_null(ctx, key);
+    ctx->bulk_appending = 0;
     return rv;
 }
 
-/*-----------------------------------------*/
-/*---------------- null -------------------*/
-/*-----------------------------------------*/
-int litestore_create_null(litestore* ctx, litestore_slice_t key)
+int litestore_bulk_end(litestore* ctx)
 {
-    int rv = LITESTORE_ERR;
+    int rv = LITESTORE_OK;
 
-    if (ctx && slice_valid(key))
+    if (!ctx || !ctx->bulk_active)
     {
-        const int own_tx = opt_begin_tx(ctx);
-
-        litestore_id_t new_id = 0;
-        rv = create_key(ctx, key.data, key.length, LS_NULL, &new_id);
+        return LITESTORE_ERR;
+    }
+    ctx->bulk_active = 0;
 
-        if (own_tx)
-        {
-            opt_end_tx(ctx, rv);
-        }
+    /* the indexes are built once, from the sorted rows */
+    if (!ctx->tx_active)
+    {
+        rv = litestore_begin_tx(ctx);
+    }
+    if (rv == LITESTORE_OK)
+    {
+        rv = opt_end_tx(ctx, exec_sql(ctx, LITESTORE_INDEXES));
     }
 
+    if (bulk_restore(ctx) != LITESTORE_OK)
+    {
+        rv = LITESTORE_ERR;
+    }
+    if (rv == LITESTORE_OK)
+    {
+        rv = bulk_check_integrity(ctx);
+    }
     return rv;
 }
 
-int litestore_read_null(litestore* ctx, litestore_slice_t key)
+
+/*-----------------------------------------*/
+/*---------------- export -----------------*/
+/*-----------------------------------------*/
+int litestore_export(litestore* ctx, int fd)
 {
     int rv = LITESTORE_ERR;
 
-    if (ctx && slice_valid(key))
+    if (ctx && fd >= 0)
     {
+        block_io io = {ctx, fd, NULL, 0, 0};
+        op_begin(ctx, "export");
         const int own_tx = opt_begin_tx(ctx);
 
-        litestore_id_t id = 0;
-        int type = -1;
-        rv = read_object_type(ctx, key.data, key.length, &id, &type);
-
-        if (rv == LITESTORE_OK && type != LS_NULL)
+        if (block_reserve(&io, BLOCK_SIZE) == LITESTORE_OK)
         {
-            rv = LITESTORE_ERR;
+            memcpy(io.buf, EXPORT_MAGIC, 8);
+            put_u32(io.buf + 8, EXPORT_VERSION);
+            if (write_all(fd, io.buf, EXPORT_HEADER_SIZE) != LITESTORE_OK)
+            {
+                report_error(ctx, LITESTORE_ERR, strerror(errno));
+            }
+            else if (export_objects(ctx, &io) == LITESTORE_OK
+                     && (io.size == 0 || block_flush(&io) == LITESTORE_OK))
+            {
+                /* the end marker */
+                rv = block_flush(&io);
+            }
         }
+        sqlite3_free(io.buf);
 
         if (own_tx)
         {
             opt_end_tx(ctx, rv);
         }
+        op_end(ctx, LITESTORE_OP_EXPORT);
     }
 
     return rv;
 }
 
-int litestore_update_null(litestore* ctx, litestore_slice_t key)
+int litestore_import(litestore* ctx, int fd)
 {
     int rv = LITESTORE_ERR;
-    if (ctx && slice_valid(key))
+    unsigned char header[EXPORT_HEADER_SIZE];
+
+    if (ctx && fd >= 0 && !ctx->tx_active && !ctx->bulk_active)
     {
-        const int own_tx = opt_begin_tx(ctx);
+        block_io io = {ctx, fd, NULL, 0, 0};
+        op_begin(ctx, "import");
 
-        litestore_id_t id = 0;
-        int old_type = -1;
-        rv = read_object_type(ctx, key.data, key.length, &id, &old_type);
-        if (rv == LITESTORE_OK)
-        {
-            rv = update_null(ctx, id, old_type);
-            if (rv == LITESTORE_OK && old_type != LS_NULL)
-            {
-                rv = update_object_type(ctx, id, LS_NULL);
-            }
-        }
-        else if (rv == LITESTORE_UNKNOWN_ENTITY)
+        if (read_all(fd, header, EXPORT_HEADER_SIZE) != EXPORT_HEADER_SIZE
+            || memcmp(header, EXPORT_MAGIC, 8) != 0
+            || get_u32(header + 8) != EXPORT_VERSION)
         {
-            rv = litestore_create_null(ctx, key);
+            report_error(ctx, LITESTORE_ERR, "import: not an export");
         }
-
-        if (own_tx)
+        else if (litestore_bulk_begin(ctx, LITESTORE_BULK_SORTED)
+                 == LITESTORE_OK)
         {
-            opt_end_tx(ctx, rv);
+            rv = import_blocks(ctx, &io);
+            if (rv != LITESTORE_OK && ctx->tx_active)
+            {
+                litestore_rollback_tx(ctx);
+            }
+            if (litestore_bulk_end(ctx) != LITESTORE_OK)
+            {
+                rv = LITESTORE_ERR;
+            }
         }
+        sqlite3_free(io.buf);
+        op_end(ctx, LITESTORE_OP_IMPORT);
     }
+
     return rv;
 }
 
+
 /*-----------------------------------------*/
-/*---------------- object -----------------*/
+/*---------------- backup -----------------*/
 /*-----------------------------------------*/
-int litestore_create(litestore* ctx,
-                     litestore_slice_t key,
-                     litestore_blob_t value)
+int litestore_backup_step(litestore* ctx,
+                          const char* dest_path,
+                          const int pages_per_step,
+                          litestore_backup_progress_t* progress)
 {
-    create_ctx op = {LS_RAW, &create_data, &value};
-    return gen_create(ctx, key.data, key.length, op);
-}
+    int rv = LITESTORE_ERR;
+    int rc = SQLITE_OK;
 
-int litestore_read(litestore* ctx,
-                   litestore_slice_t key,
-                   litestore_read_cb callback,
-                   void* user_data)
-{
-    read_ctx op = {LS_RAW, &read_data, NULL, callback, user_data};
-    return gen_read(ctx, key.data, key.length, op);
+    if (!ctx || !dest_path)
+    {
+        return LITESTORE_ERR;
+    }
+    if (ctx->backup && strcmp(ctx->backup_path, dest_path) != 0)
+    {
+        report_error(ctx, LITESTORE_ERR, "backup: other backup in progress");
+        return LITESTORE_ERR;
+    }
+    if (!ctx->backup && backup_init(ctx, dest_path) != LITESTORE_OK)
+    {
+        return LITESTORE_ERR;
+    }
+
+    rc = sqlite3_backup_step(ctx->backup,
+                             pages_per_step > 0 ? pages_per_step : -1);
+    if (progress)
+    {
+        progress->remaining = sqlite3_backup_remaining(ctx->backup);
+        progress->page_count = sqlite3_backup_pagecount(ctx->backup);
+    }
+    switch (rc)
+    {
+        case SQLITE_OK:
+        case SQLITE_BUSY:
+        case SQLITE_LOCKED:
+            /* locked by others, retried on the next call */
+            rv = LITESTORE_IN_PROGRESS;
+            break;
+        case SQLITE_DONE:
+            rv = backup_finish(ctx);
+            break;
+        default:
+            backup_finish(ctx);
+            rv = LITESTORE_ERR;
+            break;
+    }
+    return rv;
 }
 
-int litestore_update(litestore* ctx,
-                     litestore_slice_t key,
-                     litestore_blob_t value)
+int litestore_backup_abort(litestore* ctx)
 {
-    update_ctx op = {LS_RAW, &update_data, &create_data, &value};
-    return gen_update(ctx, key.data, key.length, op);
+    if (ctx && ctx->backup)
+    {
+        backup_finish(ctx);
+        return LITESTORE_OK;
+    }
+    return LITESTORE_ERR;
 }
 
 /*-----------------------------------------*/
-/*---------------- delete -----------------*/
+/*---------------- value log --------------*/
 /*-----------------------------------------*/
-int litestore_delete(litestore* ctx, litestore_slice_t key)
+/**
+ * Move count values out of the most garbage segment (not the active one)
+ * that is at most half live.
+ *
+ * @param segment Set to the segment collected, 0 for none.
+ * @param emptied Set to 1 if the segment has no values left.
+ */
+static
+int vlog_collect(litestore* ctx,
+                 const int count,
+                 sqlite3_int64* segment,
+                 int* emptied)
 {
     int rv = LITESTORE_ERR;
+    int rows = 0;
+    int rc = SQLITE_ERROR;
+    sqlite3_stmt* pick = NULL;
+    sqlite3_stmt* values = NULL;
+    sqlite3_stmt* move = NULL;
 
-    /* delete should cascade */
-    if (ctx && slice_valid(key) && ctx->delete_key)
+    if (prepare_stmt(ctx,
+                     "SELECT id FROM value_segments"
+                     " WHERE id < (SELECT max(id) FROM value_segments)"
+                     " AND live * 2 <= size ORDER BY live LIMIT 1;",
+                     &pick) == LITESTORE_OK
+        && prepare_stmt(ctx,
+                        "SELECT id, position, length, checksum FROM value_log"
+                        " WHERE segment = ? LIMIT ?;",
+                        &values) == LITESTORE_OK
+        && prepare_stmt(ctx,
+                        "UPDATE value_log SET segment = ?, position = ?"
+                        " WHERE id = ?;",
+                        &move) == LITESTORE_OK
+        && ((rc = sqlite3_step(pick)) == SQLITE_ROW || rc == SQLITE_DONE))
     {
-        const int own_tx = opt_begin_tx(ctx);
+        *segment = rc == SQLITE_ROW ? sqlite3_column_int64(pick, 0) : 0;
+        rv = LITESTORE_OK;
+    }
+    else
+    {
+        sqlite_error(ctx);
+    }
 
-        sqlite3_reset(ctx->delete_key);
-        if (sqlite3_bind_text(ctx->delete_key,
-                              1, key.data, key.length,
-                              SQLITE_STATIC) == SQLITE_OK)
+    if (rv == LITESTORE_OK && *segment > 0)
+    {
+        rc = (sqlite3_bind_int64(values, 1, *segment) == SQLITE_OK
+              && sqlite3_bind_int(values, 2, count) == SQLITE_OK)
+            ? SQLITE_OK : SQLITE_ERROR;
+        while (rc != SQLITE_ERROR && rv == LITESTORE_OK
+               && (rc = sqlite3_step(values)) == SQLITE_ROW)
         {
-            if (sqlite3_step(ctx->delete_key) == SQLITE_DONE)
+            const void* data = NULL;
+            sqlite3_int64 to_segment = 0;
+            sqlite3_int64 to_position = 0;
+
+            ++rows;
+            rv = vlog_read(ctx, *segment,
+                           sqlite3_column_int64(values, 1),
+                           (size_t)sqlite3_column_int64(values, 2),
+                           (unsigned int)sqlite3_column_int64(values, 3),
+                           &data);
+            if (rv == LITESTORE_OK)
             {
-                rv = (sqlite3_changes(ctx->db) == 1 ?
-                      LITESTORE_OK : LITESTORE_UNKNOWN_ENTITY);
+                rv = vlog_append(ctx, data,
+                                 (size_t)sqlite3_column_int64(values, 2),
+                                 &to_segment, &to_position);
             }
-            else
+            if (rv == LITESTORE_OK)
             {
-                sqlite_error(ctx);
-                rv = LITESTORE_ERR;
+                rv = (sqlite3_bind_int64(move, 1, to_segment) == SQLITE_OK
+                      && sqlite3_bind_int64(move, 2, to_position) == SQLITE_OK
+                      && sqlite3_bind_int64(move, 3,
+                                            sqlite3_column_int64(values, 0))
+                      == SQLITE_OK) ? run_stmt(ctx, move) : LITESTORE_ERR;
             }
         }
-        else
+        if (rc != SQLITE_ROW && rc != SQLITE_DONE)
         {
             sqlite_error(ctx);
             rv = LITESTORE_ERR;
         }
-
-        if (own_tx)
+        *emptied = rows < count;
+        if (rv == LITESTORE_OK && *emptied)
         {
-            opt_end_tx(ctx, rv);
+            char* sql = sqlite3_mprintf(
+                "DELETE FROM value_segments WHERE id = %lld;", *segment);
+            if (!sql || sqlite3_exec(ctx->db, sql, NULL, NULL, NULL)
+                != SQLITE_OK)
+            {
+                sqlite_error(ctx);
+                rv = LITESTORE_ERR;
+            }
+            sqlite3_free(sql);
         }
     }
+    sqlite3_finalize(pick);
+    sqlite3_finalize(values);
+    sqlite3_finalize(move);
 
     return rv;
 }
 
-int litestore_read_keys(litestore* ctx,
-                        litestore_slice_t key_pattern,
-                        litestore_read_keys_cb callback,
-                        void* user_data)
+int litestore_vlog_gc_step(litestore* ctx, const int count)
 {
     int rv = LITESTORE_ERR;
+    sqlite3_int64 segment = 0;
+    int emptied = 0;
 
-    if (ctx->read_keys && callback)
+    /* the file is removed after the commit */
+    if (!ctx || count <= 0 || ctx->tx_active || ctx->bulk_active)
     {
-        const int own_tx = opt_begin_tx(ctx);
-
-        if (sqlite3_bind_text(ctx->read_keys, 1,
-                              key_pattern.data, key_pattern.length,
-                              SQLITE_STATIC)
-            != SQLITE_OK)
+        return LITESTORE_ERR;
+    }
+    /* segments emptied by earlier steps */
+    vlog_release(ctx);
+    if (opt_begin_tx(ctx))
+    {
+        /* relogged values stay the same, watchers are not told */
+        ctx->watch_quiet = 1;
+        rv = vlog_collect(ctx, count, &segment, &emptied);
+        ctx->watch_quiet = 0;
+        if (opt_end_tx(ctx, rv) != LITESTORE_OK)
         {
-            sqlite_error(ctx);
+            rv = LITESTORE_ERR;
         }
-        else
+    }
+    if (rv == LITESTORE_OK && segment > 0)
+    {
+        if (emptied)
         {
-            int rc = 0;
+            rv = vlog_retire(ctx, segment);
+            vlog_release(ctx);
+        }
+        /* more segments may qualify */
+        rv = rv == LITESTORE_OK ? LITESTORE_IN_PROGRESS : rv;
+    }
+    return rv;
+}
 
-            while ((rc = sqlite3_step(ctx->read_keys)) != SQLITE_DONE)
-            {
-                if (rc == SQLITE_ROW)
-                {
-                    const unsigned char* key =
-                        sqlite3_column_text(ctx->read_keys, 0);
-                    const int key_len =
-                        sqlite3_column_bytes(ctx->read_keys, 0);
-                    if ((*callback)(
-                            litestore_slice((const char*)key, 0, key_len),
-                            sqlite3_column_int(ctx->read_keys, 1),
-                            user_data)
-                        != LITESTORE_OK)
-                    {
-                        break;
-                    }
-                }
-                else
-                {
-                    sqlite_error(ctx);
-                    break;
-                }
-            }  /* while */
-            if (rc == SQLITE_DONE)
-            {
-                rv = LITESTORE_OK;
-            }
+int litestore_vlog_stats(litestore* ctx, litestore_vlog_stats_t* stats)
+{
+    int rv = LITESTORE_ERR;
+    sqlite3_stmt* stmt = NULL;
 
-            sqlite3_reset(ctx->read_keys);
+    if (ctx && stats
+        && prepare_stmt(ctx,
+                        "SELECT count(*), total(size), total(live)"
+                        " FROM value_segments;",
+                        &stmt) == LITESTORE_OK)
+    {
+        if (sqlite3_step(stmt) == SQLITE_ROW)
+        {
+            stats->segments = sqlite3_column_int(stmt, 0);
+            stats->size = sqlite3_column_int64(stmt, 1);
+            stats->live = sqlite3_column_int64(stmt, 2);
+            rv = LITESTORE_OK;
         }
-
-        if (own_tx)
+        else
         {
-            opt_end_tx(ctx, rv);
+            sqlite_error(ctx);
         }
     }
-
+    sqlite3_finalize(stmt);
     return rv;
 }
 
@@ -0,0 +1,280 @@
+/**
+ * Copyright (c) 2014 Markku Linnoskivi
+ *
+ * See the file LICENSE.txt for copying permission.
+ */
+#ifndef LITESTORE_SCHEMA_H
+#define LITESTORE_SCHEMA_H
+
+/*
+ * The schema of each version, private to the library. Stores are
+ * migrated from their version one step at a time, the query plan tests
+ * create stores of the older versions with these.
+ */
+
+/* Current schema version */
+#define LITESTORE_CURRENT_VERSION 14
+
+/**
+ * The DB schema.
+ */
+#define LITESTORE_SCHEMA_V1                             \
+    "CREATE TABLE IF NOT EXISTS meta("                  \
+    "       schema_version INTEGER NOT NULL DEFAULT 1"  \
+    ");"                                                \
+    "CREATE TABLE IF NOT EXISTS objects("               \
+    "       id INTEGER PRIMARY KEY NOT NULL,"           \
+    "       name TEXT NOT NULL UNIQUE,"                 \
+    "       type INTEGER NOT NULL"                      \
+    ");"                                                \
+    "CREATE TABLE IF NOT EXISTS raw_data("              \
+    "       id INTEGER NOT NULL,"                       \
+    "       raw_value BLOB NOT NULL,"                   \
+    "       FOREIGN KEY(id) REFERENCES objects(id)"     \
+    "       ON DELETE CASCADE ON UPDATE RESTRICT"       \
+    ");"                                                \
+
+/**
+ * Secondary indexes, dropped and rebuilt by bulk loads.
+ */
+#define LITESTORE_INDEXES                                       \
+    "CREATE INDEX IF NOT EXISTS raw_data_id ON raw_data(id);"
+#define LITESTORE_DROP_INDEXES                  \
+    "DROP INDEX IF EXISTS raw_data_id;"
+
+/**
+ * V2, index for the raw_data lookups by id.
+ */
+#define LITESTORE_SCHEMA_V2                     \
+    LITESTORE_INDEXES                           \
+    "UPDATE meta SET schema_version = 2;"
+
+/**
+ * V3, compressed values. raw_size is the size before compression.
+ */
+#define LITESTORE_SCHEMA_V3                                             \
+    "ALTER TABLE raw_data ADD COLUMN codec INTEGER NOT NULL DEFAULT 0;" \
+    "ALTER TABLE raw_data ADD COLUMN raw_size INTEGER NOT NULL DEFAULT 0;" \
+    "UPDATE meta SET schema_version = 3;"
+
+/**
+ * V4, compression dictionaries, the latest (highest) version is used for
+ * writes.
+ */
+#define LITESTORE_SCHEMA_V4                                     \
+    "CREATE TABLE IF NOT EXISTS dictionaries("                  \
+    "       version INTEGER PRIMARY KEY NOT NULL,"              \
+    "       dictionary BLOB NOT NULL"                           \
+    ");"                                                        \
+    "UPDATE meta SET schema_version = 4;"
+
+/**
+ * V5, values stored once by content (dedup). raw_data.shared points to
+ * the shared row, refs counts the raw_data rows pointing to it and is
+ * maintained by the triggers.
+ */
+#define LITESTORE_SCHEMA_V5                                             \
+    "CREATE TABLE IF NOT EXISTS shared_data("                           \
+    "       id INTEGER PRIMARY KEY NOT NULL,"                           \
+    "       hash BLOB NOT NULL UNIQUE,"                                 \
+    "       refs INTEGER NOT NULL DEFAULT 0,"                           \
+    "       raw_value BLOB NOT NULL,"                                   \
+    "       codec INTEGER NOT NULL DEFAULT 0,"                          \
+    "       raw_size INTEGER NOT NULL DEFAULT 0"                        \
+    ");"                                                                \
+    "ALTER TABLE raw_data ADD COLUMN shared INTEGER;"                   \
+    "CREATE TRIGGER IF NOT EXISTS shared_data_ref"                      \
+    "       AFTER INSERT ON raw_data WHEN new.shared IS NOT NULL "      \
+    "BEGIN"                                                             \
+    "       UPDATE shared_data SET refs = refs + 1"                     \
+    "              WHERE id = new.shared;"                              \
+    "END;"                                                              \
+    "CREATE TRIGGER IF NOT EXISTS shared_data_unref"                    \
+    "       AFTER DELETE ON raw_data WHEN old.shared IS NOT NULL "      \
+    "BEGIN"                                                             \
+    "       UPDATE shared_data SET refs = refs - 1"                     \
+    "              WHERE id = old.shared;"                              \
+    "       DELETE FROM shared_data WHERE id = old.shared AND refs <= 0;" \
+    "END;"                                                              \
+    "CREATE TRIGGER IF NOT EXISTS shared_data_reref"                    \
+    "       AFTER UPDATE OF shared ON raw_data"                         \
+    "       WHEN old.shared IS NOT new.shared "                         \
+    "BEGIN"                                                             \
+    "       UPDATE shared_data SET refs = refs + 1"                     \
+    "              WHERE id = new.shared;"                              \
+    "       UPDATE shared_data SET refs = refs - 1"                     \
+    "              WHERE id = old.shared;"                              \
+    "       DELETE FROM shared_data WHERE id = old.shared AND refs <= 0;" \
+    "END;"                                                              \
+    "UPDATE meta SET schema_version = 5;"
+
+/**
+ * V6, large values in the value log files. raw_data.logged points to the
+ * location of the value, live counts the bytes of a segment file still
+ * in use and is maintained by the triggers.
+ */
+#define LITESTORE_SCHEMA_V6                                             \
+    "CREATE TABLE IF NOT EXISTS value_segments("                        \
+    "       id INTEGER PRIMARY KEY NOT NULL,"                           \
+    "       size INTEGER NOT NULL DEFAULT 0,"                           \
+    "       live INTEGER NOT NULL DEFAULT 0"                            \
+    ");"                                                                \
+    "CREATE TABLE IF NOT EXISTS value_log("                             \
+    "       id INTEGER PRIMARY KEY NOT NULL,"                           \
+    "       segment INTEGER NOT NULL,"                                  \
+    "       position INTEGER NOT NULL,"                                 \
+    "       length INTEGER NOT NULL,"                                   \
+    "       checksum INTEGER NOT NULL"                                  \
+    ");"                                                                \
+    "CREATE INDEX IF NOT EXISTS value_log_segment ON value_log(segment);" \
+    "ALTER TABLE raw_data ADD COLUMN logged INTEGER;"                   \
+    "CREATE TRIGGER IF NOT EXISTS value_log_live"                       \
+    "       AFTER INSERT ON value_log "                                 \
+    "BEGIN"                                                             \
+    "       UPDATE value_segments SET live = live + new.length"         \
+    "              WHERE id = new.segment;"                             \
+    "END;"                                                              \
+    "CREATE TRIGGER IF NOT EXISTS value_log_dead"                       \
+    "       AFTER DELETE ON value_log "                                 \
+    "BEGIN"                                                             \
+    "       UPDATE value_segments SET live = live - old.length"         \
+    "              WHERE id = old.segment;"                             \
+    "END;"                                                              \
+    "CREATE TRIGGER IF NOT EXISTS value_log_moved"                      \
+    "       AFTER UPDATE OF segment ON value_log "                      \
+    "BEGIN"                                                             \
+    "       UPDATE value_segments SET live = live - old.length"         \
+    "              WHERE id = old.segment;"                             \
+    "       UPDATE value_segments SET live = live + new.length"         \
+    "              WHERE id = new.segment;"                             \
+    "END;"                                                              \
+    "CREATE TRIGGER IF NOT EXISTS raw_data_unlog"                       \
+    "       AFTER DELETE ON raw_data WHEN old.logged IS NOT NULL "      \
+    "BEGIN"                                                             \
+    "       DELETE FROM value_log WHERE id = old.logged;"               \
+    "END;"                                                              \
+    "CREATE TRIGGER IF NOT EXISTS raw_data_relog"                       \
+    "       AFTER UPDATE OF logged ON raw_data"                         \
+    "       WHEN old.logged IS NOT new.logged "                         \
+    "BEGIN"                                                             \
+    "       DELETE FROM value_log WHERE id = old.logged;"               \
+    "END;"                                                              \
+    "UPDATE meta SET schema_version = 6;"
+
+/**
+ * V7, map objects, a row per field.
+ */
+#define LITESTORE_SCHEMA_V7                                             \
+    "CREATE TABLE IF NOT EXISTS kv_data("                               \
+    "       id INTEGER NOT NULL,"                                       \
+    "       kv_key BLOB NOT NULL,"                                      \
+    "       kv_value BLOB NOT NULL,"                                    \
+    "       FOREIGN KEY(id) REFERENCES objects(id)"                     \
+    "       ON DELETE CASCADE ON UPDATE RESTRICT"                       \
+    ");"                                                                \
+    "CREATE UNIQUE INDEX IF NOT EXISTS kv_data_id_key"                  \
+    "       ON kv_data(id, kv_key);"                                    \
+    "UPDATE meta SET schema_version = 7;"
+
+/**
+ * V8, array objects, a row per item clustered by (id, array_index).
+ * Items are numbered densely from 0.
+ */
+#define LITESTORE_SCHEMA_V8                                             \
+    "CREATE TABLE IF NOT EXISTS array_data("                            \
+    "       id INTEGER NOT NULL,"                                       \
+    "       array_index INTEGER NOT NULL,"                              \
+    "       array_value BLOB NOT NULL,"                                 \
+    "       PRIMARY KEY(id, array_index),"                              \
+    "       FOREIGN KEY(id) REFERENCES objects(id)"                     \
+    "       ON DELETE CASCADE ON UPDATE RESTRICT"                       \
+    ") WITHOUT ROWID;"                                                  \
+    "UPDATE meta SET schema_version = 8;"
+
+/**
+ * V9, integer and float objects. num_value has no affinity, the storage
+ * class (INTEGER or REAL) is kept as written.
+ */
+#define LITESTORE_SCHEMA_V9                                             \
+    "CREATE TABLE IF NOT EXISTS num_data("                              \
+    "       id INTEGER PRIMARY KEY NOT NULL,"                           \
+    "       num_value NOT NULL,"                                        \
+    "       FOREIGN KEY(id) REFERENCES objects(id)"                     \
+    "       ON DELETE CASCADE ON UPDATE RESTRICT"                       \
+    ");"                                                                \
+    "UPDATE meta SET schema_version = 9;"
+
+/**
+ * V10, merge operands of raw objects, folded in seq order.
+ */
+#define LITESTORE_SCHEMA_V10                                            \
+    "CREATE TABLE IF NOT EXISTS merge_operands("                        \
+    "       seq INTEGER PRIMARY KEY NOT NULL,"                          \
+    "       id INTEGER NOT NULL,"                                       \
+    "       operator INTEGER NOT NULL,"                                 \
+    "       operand BLOB NOT NULL,"                                     \
+    "       FOREIGN KEY(id) REFERENCES objects(id)"                     \
+    "       ON DELETE CASCADE ON UPDATE RESTRICT"                       \
+    ");"                                                                \
+    "CREATE INDEX IF NOT EXISTS merge_operands_id"                      \
+    "       ON merge_operands(id);"                                     \
+    "UPDATE meta SET schema_version = 10;"
+
+/**
+ * V11, expiry times of keys, indexed for the purge.
+ */
+#define LITESTORE_SCHEMA_V11                                            \
+    "CREATE TABLE IF NOT EXISTS expiry("                                \
+    "       id INTEGER PRIMARY KEY NOT NULL,"                           \
+    "       expires_at INTEGER NOT NULL,"                               \
+    "       FOREIGN KEY(id) REFERENCES objects(id)"                     \
+    "       ON DELETE CASCADE ON UPDATE RESTRICT"                       \
+    ");"                                                                \
+    "CREATE INDEX IF NOT EXISTS expiry_time ON expiry(expires_at);"    \
+    "UPDATE meta SET schema_version = 11;"
+
+/**
+ * V12, namespaces, each with a table of its own, @see ns_create
+ * Ids are not reused, handles of other connections to a dropped
+ * namespace must not find a new table.
+ */
+#define LITESTORE_SCHEMA_V12                                            \
+    "CREATE TABLE IF NOT EXISTS namespaces("                            \
+    "       id INTEGER PRIMARY KEY AUTOINCREMENT NOT NULL,"             \
+    "       name TEXT NOT NULL UNIQUE"                                  \
+    ");"                                                                \
+    "UPDATE meta SET schema_version = 12;"
+
+/**
+ * V13, terms of secondary indexes, @see index_value
+ */
+#define LITESTORE_SCHEMA_V13                                            \
+    "CREATE TABLE IF NOT EXISTS value_index("                           \
+    "       idx INTEGER NOT NULL,"                                      \
+    "       term BLOB NOT NULL,"                                        \
+    "       id INTEGER NOT NULL,"                                       \
+    "       PRIMARY KEY(idx, term, id),"                                \
+    "       FOREIGN KEY(id) REFERENCES objects(id)"                     \
+    "       ON DELETE CASCADE ON UPDATE RESTRICT"                       \
+    ") WITHOUT ROWID;"                                                  \
+    "CREATE INDEX IF NOT EXISTS value_index_id ON value_index(id);"    \
+    "UPDATE meta SET schema_version = 13;"
+
+/**
+ * V14, JSON documents and the paths indexed, @see json_index_create
+ * Index ids are not reused, as namespace ids.
+ */
+#define LITESTORE_SCHEMA_V14                                            \
+    "CREATE TABLE IF NOT EXISTS json_data("                             \
+    "       id INTEGER PRIMARY KEY NOT NULL,"                           \
+    "       doc TEXT NOT NULL,"                                         \
+    "       FOREIGN KEY(id) REFERENCES objects(id)"                     \
+    "       ON DELETE CASCADE ON UPDATE RESTRICT"                       \
+    ");"                                                                \
+    "CREATE TABLE IF NOT EXISTS json_indexes("                          \
+    "       id INTEGER PRIMARY KEY AUTOINCREMENT NOT NULL,"             \
+    "       path TEXT NOT NULL UNIQUE"                                  \
+    ");"                                                                \
+    "UPDATE meta SET schema_version = 14;"
+
+#endif  /* LITESTORE_SCHEMA_H */
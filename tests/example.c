@@ -33,7 +33,9 @@ int main(const int argc, const char** argv)
 
     /* Open the connection */
     litestore* ls = NULL;
-    litestore_opts opts = {&err, NULL};
+    litestore_opts opts;
+    memset(&opts, 0, sizeof(opts));
+    opts.error_callback = &err;
     if (litestore_open(argv[1], opts, &ls) != LITESTORE_OK)
     {
         litestore_close(ls);
@@ -0,0 +1,245 @@
+/**
+ * Copyright (c) 2014 Markku Linnoskivi
+ *
+ * See the file LICENSE.txt for copying permission.
+ */
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <sqlite3.h>
+
+#include "litestore/litestore.h"
+#include "litestore_test_common.h"
+
+
+namespace ls
+{
+using namespace ::testing;
+
+namespace
+{
+
+struct Items
+{
+    Items()
+        : stopAfter(1000)
+    {}
+    std::vector<size_t> indexes;
+    std::vector<std::string> values;
+    size_t stopAfter;
+};
+
+int collect(size_t index, litestore_blob_t value, void* user_data)
+{
+    Items* items = static_cast<Items*>(user_data);
+    items->indexes.push_back(index);
+    items->values.push_back(
+        std::string(static_cast<const char*>(value.data), value.size));
+    return items->values.size() < items->stopAfter
+        ? LITESTORE_OK : LITESTORE_ERR;
+}
+
+struct LitestoreArrayTest : LitestoreTest
+{
+    std::string get(litestore* c, const std::string& key, size_t index)
+    {
+        std::string value;
+        const int rv = litestore_array_get(c, slice(key), index,
+                                           &str2str, &value);
+        if (rv == LITESTORE_UNKNOWN_ENTITY)
+        {
+            return "<missing>";
+        }
+        return rv == LITESTORE_OK ? value : "<error>";
+    }
+    std::string get(const std::string& key, size_t index)
+    {
+        return get(ctx, key, index);
+    }
+    size_t length(litestore* c, const std::string& key)
+    {
+        size_t len = 0;
+        if (litestore_array_length(c, slice(key), &len) != LITESTORE_OK)
+        {
+            throw std::runtime_error("array_length failed");
+        }
+        return len;
+    }
+    size_t length(const std::string& key)
+    {
+        return length(ctx, key);
+    }
+    void append(const std::string& key, int count)
+    {
+        ASSERT_LS_OK(litestore_begin_tx(ctx));
+        for (int i = 0; i < count; ++i)
+        {
+            ASSERT_LS_OK(litestore_array_append(
+                             ctx, slice(key), blob(std::to_string(i)),
+                             NULL));
+        }
+        ASSERT_LS_OK(litestore_commit_tx(ctx));
+    }
+};
+
+}  // namespace
+
+TEST_F(LitestoreArrayTest, append_and_get)
+{
+    size_t index = 100;
+    ASSERT_LS_OK(litestore_array_append(ctx, slice("arr"), blob("a"),
+                                        &index));
+    EXPECT_EQ(0u, index);
+    ASSERT_LS_OK(litestore_array_append(ctx, slice("arr"), blob("b"),
+                                        &index));
+    EXPECT_EQ(1u, index);
+    ASSERT_LS_OK(litestore_array_append(ctx, slice("arr"), blob(""),
+                                        &index));
+    EXPECT_EQ(2u, index);
+
+    EXPECT_EQ(3u, length("arr"));
+    EXPECT_EQ("a", get("arr", 0));
+    EXPECT_EQ("b", get("arr", 1));
+    EXPECT_EQ("", get("arr", 2));
+    EXPECT_EQ("<missing>", get("arr", 3));
+    EXPECT_EQ("<error>", get("noarr", 0));
+
+    const Objects objs = readObjects();
+    ASSERT_EQ(1u, objs.size());
+    EXPECT_EQ(LITESTORE_ARRAY_T, objs[0].type);
+}
+
+TEST_F(LitestoreArrayTest, append_writes_one_row)
+{
+    append("arr", 10000);
+    const int before = sqlite3_total_changes(db);
+    ASSERT_LS_OK(litestore_array_append(ctx, slice("arr"), blob("last"),
+                                        NULL));
+    EXPECT_EQ(1, sqlite3_total_changes(db) - before);
+    EXPECT_EQ(10001u, length("arr"));
+    EXPECT_EQ("last", get("arr", 10000));
+    EXPECT_EQ("9999", get("arr", 9999));
+}
+
+TEST_F(LitestoreArrayTest, set_by_index)
+{
+    append("arr", 3);
+    EXPECT_LS_OK(litestore_array_set(ctx, slice("arr"), 1, blob("new")));
+    EXPECT_EQ("new", get("arr", 1));
+    EXPECT_EQ(LITESTORE_UNKNOWN_ENTITY,
+              litestore_array_set(ctx, slice("arr"), 3, blob("x")));
+    EXPECT_EQ(LITESTORE_UNKNOWN_ENTITY,
+              litestore_array_set(ctx, slice("noarr"), 0, blob("x")));
+    EXPECT_EQ(3u, length("arr"));
+
+    ASSERT_LS_OK(litestore_create(ctx, slice("raw"), blob("raw")));
+    EXPECT_LS_ERR(litestore_array_set(ctx, slice("raw"), 0, blob("x")));
+}
+
+TEST_F(LitestoreArrayTest, range)
+{
+    append("arr", 10);
+    append("other", 3);
+
+    Items items;
+    ASSERT_LS_OK(litestore_array_range(ctx, slice("arr"), 7, 100,
+                                       &collect, &items));
+    ASSERT_EQ(3u, items.values.size());
+    EXPECT_EQ(7u, items.indexes[0]);
+    EXPECT_EQ("7", items.values[0]);
+    EXPECT_EQ("9", items.values[2]);
+
+    Items all;
+    ASSERT_LS_OK(litestore_array_range(ctx, slice("arr"), 0, (size_t)-1,
+                                       &collect, &all));
+    EXPECT_EQ(10u, all.values.size());
+
+    // the callback stops the iteration
+    Items two;
+    two.stopAfter = 2;
+    EXPECT_LS_ERR(litestore_array_range(ctx, slice("arr"), 2, 5,
+                                        &collect, &two));
+    ASSERT_EQ(2u, two.values.size());
+    EXPECT_EQ("3", two.values[1]);
+}
+
+TEST_F(LitestoreArrayTest, truncate)
+{
+    append("arr", 10);
+    ASSERT_LS_OK(litestore_array_truncate(ctx, slice("arr"), 20));
+    EXPECT_EQ(10u, length("arr"));
+    ASSERT_LS_OK(litestore_array_truncate(ctx, slice("arr"), 4));
+    EXPECT_EQ(4u, length("arr"));
+    EXPECT_EQ("<missing>", get("arr", 4));
+
+    // appends continue from the new end
+    size_t index = 0;
+    ASSERT_LS_OK(litestore_array_append(ctx, slice("arr"), blob("x"),
+                                        &index));
+    EXPECT_EQ(4u, index);
+
+    ASSERT_LS_OK(litestore_array_truncate(ctx, slice("arr"), 0));
+    EXPECT_EQ(0u, length("arr"));
+    EXPECT_TRUE(contains("arr"));
+    EXPECT_EQ(LITESTORE_UNKNOWN_ENTITY,
+              litestore_array_truncate(ctx, slice("noarr"), 0));
+}
+
+TEST_F(LitestoreArrayTest, type_changes)
+{
+    ASSERT_LS_OK(litestore_kv_set(ctx, slice("key"), slice("a"), blob("1")));
+    ASSERT_LS_OK(litestore_array_append(ctx, slice("key"), blob("x"), NULL));
+    EXPECT_EQ(1u, length("key"));
+    std::string value;
+    EXPECT_LS_ERR(litestore_kv_get(ctx, slice("key"), slice("a"),
+                                   &str2str, &value));
+
+    ASSERT_LS_OK(litestore_update(ctx, slice("key"), blob("raw")));
+    size_t len = 0;
+    EXPECT_LS_ERR(litestore_array_length(ctx, slice("key"), &len));
+    EXPECT_LS_OK(litestore_read(ctx, slice("key"), &str2str, &value));
+    EXPECT_EQ("raw", value);
+
+    ASSERT_LS_OK(litestore_create_array(ctx, slice("empty")));
+    EXPECT_EQ(0u, length("empty"));
+    EXPECT_LS_ERR(litestore_create_array(ctx, slice("empty")));
+    append("empty", 2);
+    ASSERT_LS_OK(litestore_delete(ctx, slice("empty")));
+
+    sqlite3_stmt* stmt = NULL;
+    sqlite3_prepare_v2(db, "SELECT count(*) FROM array_data;", -1, &stmt,
+                       NULL);
+    ASSERT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+    EXPECT_EQ(0, sqlite3_column_int(stmt, 0));
+    sqlite3_finalize(stmt);
+}
+
+TEST_F(LitestoreArrayTest, export_and_import)
+{
+    append("arr", 100);
+    ASSERT_LS_OK(litestore_array_set(ctx, slice("arr"), 50,
+                                     blob(std::string(1000, 'x'))));
+    ASSERT_LS_OK(litestore_create_array(ctx, slice("empty")));
+
+    FILE* file = tmpfile();
+    ASSERT_TRUE(file != NULL);
+    ASSERT_LS_OK(litestore_export(ctx, fileno(file)));
+    rewind(file);
+
+    litestore* target = NULL;
+    ASSERT_LS_OK(litestore_open(":memory:", litestore_opts(), &target));
+    EXPECT_LS_OK(litestore_import(target, fileno(file)));
+    fclose(file);
+
+    EXPECT_EQ(100u, length(target, "arr"));
+    EXPECT_EQ("0", get(target, "arr", 0));
+    EXPECT_EQ(std::string(1000, 'x'), get(target, "arr", 50));
+    EXPECT_EQ("99", get(target, "arr", 99));
+    EXPECT_EQ(0u, length(target, "empty"));
+    litestore_close(target);
+}
+
+}  // namespace ls
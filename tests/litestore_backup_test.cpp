@@ -0,0 +1,107 @@
+/**
+ * Copyright (c) 2014 Markku Linnoskivi
+ *
+ * See the file LICENSE.txt for copying permission.
+ */
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <string>
+
+#include "litestore/litestore.h"
+#include "litestore_test_common.h"
+
+
+namespace ls
+{
+using namespace ::testing;
+
+namespace
+{
+
+struct LitestoreBackupTest : LitestoreTest
+{
+    LitestoreBackupTest()
+        : LitestoreTest(),
+          file("litestore_backup_test.db"),
+          value(1000, 'v')
+    {
+        remove(file.c_str());
+        litestore_begin_tx(ctx);
+        for (int i = 0; i < 200; ++i)
+        {
+            litestore_create(ctx, slice(std::to_string(i)), blob(value));
+        }
+        litestore_commit_tx(ctx);
+    }
+    ~LitestoreBackupTest()
+    {
+        remove(file.c_str());
+    }
+    std::string readBackup(const std::string& key)
+    {
+        litestore* backup = NULL;
+        std::string read;
+        if (litestore_open(file.c_str(), litestore_opts(), &backup)
+            == LITESTORE_OK)
+        {
+            litestore_read(backup, slice(key), &str2str, &read);
+        }
+        litestore_close(backup);
+        return read;
+    }
+
+    std::string file;
+    std::string value;
+};
+
+}  // namespace
+
+TEST_F(LitestoreBackupTest, backup_in_steps)
+{
+    litestore_backup_progress_t progress;
+    int steps = 0;
+    int rv = LITESTORE_IN_PROGRESS;
+    while (rv == LITESTORE_IN_PROGRESS)
+    {
+        rv = litestore_backup_step(ctx, file.c_str(), 10, &progress);
+        ++steps;
+        if (steps == 2)
+        {
+            // changes through the context are part of the backup
+            EXPECT_LS_OK(litestore_create(ctx, slice("during"), blob("new")));
+        }
+    }
+    EXPECT_LS_OK(rv);
+    EXPECT_GT(steps, 2);
+    EXPECT_EQ(0, progress.remaining);
+    EXPECT_GT(progress.page_count, 10);
+
+    EXPECT_EQ(value, readBackup("199"));
+    EXPECT_EQ("new", readBackup("during"));
+}
+
+TEST_F(LitestoreBackupTest, backup_at_once)
+{
+    EXPECT_LS_OK(litestore_backup_step(ctx, file.c_str(), 0, NULL));
+    EXPECT_EQ(value, readBackup("0"));
+}
+
+TEST_F(LitestoreBackupTest, one_backup_at_a_time)
+{
+    ASSERT_EQ(LITESTORE_IN_PROGRESS,
+              litestore_backup_step(ctx, file.c_str(), 1, NULL));
+    EXPECT_LS_ERR(litestore_backup_step(ctx, "other.db", 1, NULL));
+    EXPECT_LS_OK(litestore_backup_abort(ctx));
+    EXPECT_LS_ERR(litestore_backup_abort(ctx));
+    EXPECT_LS_OK(litestore_backup_step(ctx, file.c_str(), 0, NULL));
+}
+
+TEST_F(LitestoreBackupTest, close_aborts)
+{
+    ASSERT_EQ(LITESTORE_IN_PROGRESS,
+              litestore_backup_step(ctx, file.c_str(), 1, NULL));
+    // the fixture closes the context
+}
+
+}  // namespace ls
@@ -0,0 +1,166 @@
+/**
+ * Copyright (c) 2014 Markku Linnoskivi
+ *
+ * See the file LICENSE.txt for copying permission.
+ */
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <string>
+
+#include <sqlite3.h>
+
+#include "litestore/litestore.h"
+#include "litestore_test_common.h"
+
+
+namespace ls
+{
+using namespace ::testing;
+
+namespace
+{
+
+std::string query(sqlite3* db, const std::string& sql)
+{
+    std::string value;
+    sqlite3_stmt* stmt = NULL;
+    sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, NULL);
+    if (sqlite3_step(stmt) == SQLITE_ROW)
+    {
+        value = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+    }
+    sqlite3_finalize(stmt);
+    return value;
+}
+
+// Denies the pragma given in user_data, when setting it.
+int denyPragma(void* user_data, int action, const char* name,
+               const char* value, const char*, const char*)
+{
+    if (action == SQLITE_PRAGMA && value
+        && sqlite3_stricmp(name, static_cast<const char*>(user_data)) == 0)
+    {
+        return SQLITE_DENY;
+    }
+    return SQLITE_OK;
+}
+
+struct LitestoreBulkTest : LitestoreTest
+{
+    std::string key(int i)
+    {
+        char buf[16];
+        snprintf(buf, sizeof(buf), "key%05d", i);
+        return buf;
+    }
+};
+
+}  // namespace
+
+TEST_F(LitestoreBulkTest, load_sorted)
+{
+    const std::string value("value");
+    ASSERT_LS_OK(litestore_bulk_begin(ctx, LITESTORE_BULK_SORTED));
+    EXPECT_EQ("0", query(db, "PRAGMA foreign_keys;"));
+    EXPECT_EQ("0", query(db, "PRAGMA synchronous;"));
+    for (int i = 0; i < 1000; ++i)
+    {
+        ASSERT_LS_OK(litestore_bulk_append(ctx, slice(key(i)), blob(value)));
+    }
+    ASSERT_LS_OK(litestore_bulk_append(ctx, slice("null"),
+                                       litestore_make_blob(NULL, 0)));
+    ASSERT_LS_OK(litestore_bulk_end(ctx));
+    EXPECT_TRUE(errors.empty());
+
+    EXPECT_EQ("1", query(db, "PRAGMA foreign_keys;"));
+    EXPECT_EQ("2", query(db, "PRAGMA synchronous;"));
+    EXPECT_EQ(1001u, readObjects().size());
+    std::string read;
+    EXPECT_LS_OK(litestore_read(ctx, slice(key(500)), &str2str, &read));
+    EXPECT_EQ(value, read);
+    EXPECT_LS_OK(litestore_read_null(ctx, slice("null")));
+    // the index is back
+    EXPECT_EQ("raw_data_id",
+              query(db, "SELECT name FROM sqlite_master "
+                    "WHERE type = 'index' AND tbl_name = 'raw_data';"));
+}
+
+TEST_F(LitestoreBulkTest, unsorted_key_fails)
+{
+    ASSERT_LS_OK(litestore_bulk_begin(ctx, LITESTORE_BULK_SORTED));
+    EXPECT_LS_OK(litestore_bulk_append(ctx, slice("b"), blob("v")));
+    EXPECT_LS_ERR(litestore_bulk_append(ctx, slice("a"), blob("v")));
+    EXPECT_LS_ERR(litestore_bulk_append(ctx, slice("b"), blob("v")));
+    EXPECT_LS_OK(litestore_bulk_append(ctx, slice("ba"), blob("v")));
+    EXPECT_LS_OK(litestore_bulk_end(ctx));
+    EXPECT_EQ(2u, readObjects().size());
+}
+
+TEST_F(LitestoreBulkTest, unsorted_allowed_without_flag)
+{
+    ASSERT_LS_OK(litestore_bulk_begin(ctx, 0));
+    EXPECT_LS_OK(litestore_bulk_append(ctx, slice("b"), blob("v")));
+    EXPECT_LS_OK(litestore_bulk_append(ctx, slice("a"), blob("v")));
+    EXPECT_LS_OK(litestore_bulk_end(ctx));
+    EXPECT_EQ(2u, readObjects().size());
+}
+
+TEST_F(LitestoreBulkTest, rollback_discards)
+{
+    ASSERT_LS_OK(litestore_bulk_begin(ctx, 0));
+    EXPECT_LS_OK(litestore_bulk_append(ctx, slice("a"), blob("v")));
+    EXPECT_LS_OK(litestore_rollback_tx(ctx));
+    EXPECT_LS_OK(litestore_bulk_end(ctx));
+    EXPECT_TRUE(readObjects().empty());
+}
+
+TEST_F(LitestoreBulkTest, only_appends_are_allowed)
+{
+    ASSERT_LS_OK(litestore_create(ctx, slice("old"), blob("v")));
+    ASSERT_LS_OK(litestore_bulk_begin(ctx, 0));
+    EXPECT_LS_OK(litestore_bulk_append(ctx, slice("a"), blob("v")));
+    EXPECT_LS_ERR(litestore_create(ctx, slice("b"), blob("v")));
+    EXPECT_LS_ERR(litestore_create_null(ctx, slice("b")));
+    EXPECT_LS_ERR(litestore_update(ctx, slice("old"), blob("w")));
+    EXPECT_LS_ERR(litestore_delete(ctx, slice("old")));
+    EXPECT_LS_ERR(litestore_kv_set(ctx, slice("kv"), slice("f"), blob("v")));
+    EXPECT_LS_ERR(litestore_merge(ctx, slice("old"), LITESTORE_MERGE_APPEND,
+                                  blob("w")));
+    EXPECT_LS_ERR(litestore_incr(ctx, slice("n"), 1, NULL));
+    EXPECT_LS_ERR(litestore_expire(ctx, slice("old"), 1));
+    EXPECT_LS_OK(litestore_bulk_append(ctx, slice("c"), blob("v")));
+    ASSERT_LS_OK(litestore_bulk_end(ctx));
+
+    EXPECT_EQ(3u, readObjects().size());
+    EXPECT_EQ("v", readValue(ctx, "old"));
+    EXPECT_LS_OK(litestore_delete(ctx, slice("old")));
+}
+
+TEST_F(LitestoreBulkTest, failed_begin_restores_the_settings)
+{
+    char journal[] = "journal_mode";
+    sqlite3_set_authorizer(db, &denyPragma, journal);
+    EXPECT_LS_ERR(litestore_bulk_begin(ctx, 0));
+    char synchronous[] = "synchronous";
+    sqlite3_set_authorizer(db, &denyPragma, synchronous);
+    EXPECT_LS_ERR(litestore_bulk_begin(ctx, 0));
+    sqlite3_set_authorizer(db, NULL, NULL);
+
+    EXPECT_EQ("1", query(db, "PRAGMA foreign_keys;"));
+    EXPECT_EQ("2", query(db, "PRAGMA synchronous;"));
+    EXPECT_LS_ERR(litestore_bulk_append(ctx, slice("a"), blob("v")));
+    ASSERT_LS_OK(litestore_bulk_begin(ctx, 0));
+    EXPECT_LS_OK(litestore_bulk_end(ctx));
+}
+
+TEST_F(LitestoreBulkTest, not_inside_transaction)
+{
+    ASSERT_LS_OK(litestore_begin_tx(ctx));
+    EXPECT_LS_ERR(litestore_bulk_begin(ctx, 0));
+    EXPECT_LS_ERR(litestore_bulk_append(ctx, slice("a"), blob("v")));
+    EXPECT_LS_ERR(litestore_bulk_end(ctx));
+    EXPECT_LS_OK(litestore_rollback_tx(ctx));
+}
+
+}  // namespace ls
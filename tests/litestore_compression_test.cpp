@@ -0,0 +1,237 @@
+/**
+ * Copyright (c) 2014 Markku Linnoskivi
+ *
+ * See the file LICENSE.txt for copying permission.
+ */
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <sqlite3.h>
+
+#include "litestore/litestore.h"
+#include "litestore_test_common.h"
+
+
+namespace ls
+{
+using namespace ::testing;
+
+namespace
+{
+
+std::string jsonLike(size_t size)
+{
+    std::string value;
+    for (int i = 0; value.size() < size; ++i)
+    {
+        value += "{\"id\": " + std::to_string(i)
+            + ", \"name\": \"object\", \"tags\": [\"a\", \"b\"]},";
+    }
+    value.resize(size);
+    return value;
+}
+
+std::string randomBytes(size_t size, unsigned int seed)
+{
+    std::mt19937 rng(seed);
+    std::string value(size, '\0');
+    for (size_t i = 0; i < size; ++i)
+    {
+        value[i] = static_cast<char>(rng());
+    }
+    return value;
+}
+
+// A codec that stores the value reversed, for testing the registry.
+size_t reverseBound(size_t size, void*)
+{
+    return size;
+}
+
+int reverse(const void* src, size_t srcSize, void* dst, size_t dstCap,
+            size_t* dstSize, void*)
+{
+    if (dstCap < srcSize)
+    {
+        return LITESTORE_ERR;
+    }
+    const char* s = static_cast<const char*>(src);
+    std::reverse_copy(s, s + srcSize, static_cast<char*>(dst));
+    // pretend it compresses well
+    *dstSize = srcSize / 2;
+    return LITESTORE_OK;
+}
+
+int unreverse(const void* src, size_t srcSize, void* dst, size_t dstSize,
+              void*)
+{
+    (void)src;
+    (void)srcSize;
+    memset(dst, 'r', dstSize);
+    return LITESTORE_OK;
+}
+
+const litestore_codec reverseCodec = {
+    7, &reverseBound, &reverse, &unreverse, NULL
+};
+
+void collectError(const int, const char* desc, void* user_data)
+{
+    static_cast<std::vector<std::string>*>(user_data)->push_back(desc);
+}
+
+struct LitestoreCompressionTest : LitestoreTest
+{
+    LitestoreCompressionTest()
+        : LitestoreTest()
+    {
+        litestore_set_compression(ctx, LITESTORE_CODEC_LZ);
+    }
+    // codec and size as stored
+    std::pair<int, int> stored(const std::string& key)
+    {
+        std::pair<int, int> result(-1, -1);
+        sqlite3_stmt* stmt = NULL;
+        sqlite3_prepare_v2(
+            db,
+            "SELECT r.codec, length(r.raw_value) FROM raw_data r "
+            "JOIN objects o ON o.id = r.id WHERE o.name = ?;",
+            -1, &stmt, NULL);
+        sqlite3_bind_text(stmt, 1, key.c_str(), -1, SQLITE_STATIC);
+        if (sqlite3_step(stmt) == SQLITE_ROW)
+        {
+            result.first = sqlite3_column_int(stmt, 0);
+            result.second = sqlite3_column_int(stmt, 1);
+        }
+        sqlite3_finalize(stmt);
+        return result;
+    }
+};
+
+}  // namespace
+
+TEST_F(LitestoreCompressionTest, compressible_value_is_compressed)
+{
+    const std::string value = jsonLike(10000);
+    ASSERT_LS_OK(litestore_create(ctx, slice("json"), blob(value)));
+    EXPECT_EQ(LITESTORE_CODEC_LZ, stored("json").first);
+    EXPECT_LT(stored("json").second, 10000 / 3);
+    EXPECT_EQ(value, readValue(ctx, "json"));
+
+    const std::string updated = jsonLike(5000);
+    ASSERT_LS_OK(litestore_update(ctx, slice("json"), blob(updated)));
+    EXPECT_EQ(updated, readValue(ctx, "json"));
+}
+
+TEST_F(LitestoreCompressionTest, small_and_random_values_are_not)
+{
+    const std::string random = randomBytes(10000, 1);
+    ASSERT_LS_OK(litestore_create(ctx, slice("random"), blob(random)));
+    ASSERT_LS_OK(litestore_create(ctx, slice("small"), blob("aaaaaaaaaaaa")));
+    EXPECT_EQ(LITESTORE_CODEC_NONE, stored("random").first);
+    EXPECT_EQ(LITESTORE_CODEC_NONE, stored("small").first);
+    EXPECT_EQ(random, readValue(ctx, "random"));
+    EXPECT_EQ("aaaaaaaaaaaa", readValue(ctx, "small"));
+}
+
+TEST_F(LitestoreCompressionTest, compression_can_be_turned_off)
+{
+    const std::string value = jsonLike(1000);
+    ASSERT_LS_OK(litestore_create(ctx, slice("lz"), blob(value)));
+    ASSERT_LS_OK(litestore_set_compression(ctx, LITESTORE_CODEC_NONE));
+    ASSERT_LS_OK(litestore_create(ctx, slice("none"), blob(value)));
+    EXPECT_EQ(LITESTORE_CODEC_LZ, stored("lz").first);
+    EXPECT_EQ(LITESTORE_CODEC_NONE, stored("none").first);
+    // reading does not depend on the current codec
+    EXPECT_EQ(value, readValue(ctx, "lz"));
+    EXPECT_LS_ERR(litestore_set_compression(ctx, 42));
+}
+
+TEST_F(LitestoreCompressionTest, lz_round_trips)
+{
+    std::mt19937 rng(3);
+    ASSERT_LS_OK(litestore_begin_tx(ctx));
+    for (int i = 0; i < 200; ++i)
+    {
+        // runs of repeated and random bytes, of varying sizes
+        std::string value;
+        const size_t size = rng() % 70000 + 1;
+        while (value.size() < size)
+        {
+            const size_t run = rng() % 300 + 1;
+            value += (rng() % 2) ? std::string(run, static_cast<char>(rng()))
+                : randomBytes(run, static_cast<unsigned int>(rng()));
+        }
+        value.resize(size);
+        const std::string key(std::to_string(i));
+        ASSERT_LS_OK(litestore_create(ctx, slice(key), blob(value)));
+        ASSERT_EQ(value, readValue(ctx, key)) << "size " << size;
+    }
+    ASSERT_LS_OK(litestore_commit_tx(ctx));
+}
+
+TEST(LitestoreCodec, user_codec)
+{
+    const std::string file("litestore_codec_test.db");
+    remove(file.c_str());
+
+    litestore_opts opts = litestore_opts();
+    opts.error_callback = &ignoreError;
+    opts.codecs = &reverseCodec;
+    opts.codec_count = 1;
+    opts.compression = reverseCodec.id;
+    litestore* ctx = NULL;
+    ASSERT_LS_OK(litestore_open(file.c_str(), opts, &ctx));
+    const std::string value(100, 'v');
+    ASSERT_LS_OK(litestore_create(ctx, slice("key"), blob(value)));
+    std::string read;
+    ASSERT_LS_OK(litestore_read(ctx, slice("key"), &str2str, &read));
+    EXPECT_EQ(std::string(100, 'r'), read);
+    litestore_close(ctx);
+
+    // without the codec the value can not be read
+    litestore_opts noCodec = litestore_opts();
+    noCodec.error_callback = &ignoreError;
+    ASSERT_LS_OK(litestore_open(file.c_str(), noCodec, &ctx));
+    EXPECT_LS_ERR(litestore_read(ctx, slice("key"), &str2str, &read));
+    litestore_close(ctx);
+    remove(file.c_str());
+
+    // unknown codec for writes
+    noCodec.compression = reverseCodec.id;
+    EXPECT_LS_ERR(litestore_open(":memory:", noCodec, &ctx));
+}
+
+TEST(LitestoreCodec, codec_ids_must_be_unique)
+{
+    std::vector<std::string> errors;
+    litestore_codec codecs[2] = {reverseCodec, reverseCodec};
+    litestore_opts opts = litestore_opts();
+    opts.error_callback = &collectError;
+    opts.err_user_data = &errors;
+    opts.codecs = codecs;
+    opts.codec_count = 2;
+    litestore* ctx = NULL;
+    EXPECT_LS_ERR(litestore_open(":memory:", opts, &ctx));
+    EXPECT_FALSE(ctx);
+    ASSERT_EQ(1u, errors.size());
+    EXPECT_EQ("codecs: duplicate codec id", errors[0]);
+
+    // the built-in ids
+    codecs[1].id = LITESTORE_CODEC_LZ;
+    EXPECT_LS_ERR(litestore_open(":memory:", opts, &ctx));
+    codecs[1].id = LITESTORE_CODEC_NONE;
+    EXPECT_LS_ERR(litestore_open(":memory:", opts, &ctx));
+    ASSERT_EQ(3u, errors.size());
+    EXPECT_EQ("codecs: user codec ids are 3..255", errors[2]);
+
+    codecs[1].id = 8;
+    ASSERT_LS_OK(litestore_open(":memory:", opts, &ctx));
+    litestore_close(ctx);
+}
+
+}  // namespace ls
@@ -0,0 +1,160 @@
+/**
+ * Copyright (c) 2014 Markku Linnoskivi
+ *
+ * See the file LICENSE.txt for copying permission.
+ */
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <string>
+
+#include <sqlite3.h>
+
+#include "litestore/litestore.h"
+#include "litestore_test_common.h"
+
+
+namespace ls
+{
+using namespace ::testing;
+
+namespace
+{
+
+struct LitestoreDedupTest : Test
+{
+    LitestoreDedupTest()
+        : ctx(NULL),
+          db(NULL)
+    {
+        open(":memory:", true);
+    }
+    virtual ~LitestoreDedupTest()
+    {
+        litestore_close(ctx);
+    }
+    void open(const std::string& file, bool dedup)
+    {
+        litestore_opts opts = litestore_opts();
+        opts.dedup = dedup ? 1 : 0;
+        if (litestore_open(file.c_str(), opts, &ctx) != LITESTORE_OK)
+        {
+            throw std::runtime_error("Faild to open DB!");
+        }
+        db = static_cast<sqlite3*>(litestore_native_ctx(ctx));
+    }
+    std::string query(const std::string& sql)
+    {
+        std::string result;
+        sqlite3_stmt* stmt = NULL;
+        sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, NULL);
+        if (sqlite3_step(stmt) == SQLITE_ROW)
+        {
+            const unsigned char* text = sqlite3_column_text(stmt, 0);
+            result = text ? reinterpret_cast<const char*>(text) : "NULL";
+        }
+        sqlite3_finalize(stmt);
+        return result;
+    }
+
+    litestore* ctx;
+    sqlite3* db;
+};
+
+}  // namespace
+
+TEST_F(LitestoreDedupTest, equal_values_are_stored_once)
+{
+    const std::string value(1000, 'v');
+    ASSERT_LS_OK(litestore_create(ctx, slice("a"), blob(value)));
+    ASSERT_LS_OK(litestore_create(ctx, slice("b"), blob(value)));
+    ASSERT_LS_OK(litestore_update(ctx, slice("c"), blob(value)));
+
+    EXPECT_EQ("1", query("SELECT count(*) FROM shared_data;"));
+    EXPECT_EQ("3", query("SELECT refs FROM shared_data;"));
+    EXPECT_EQ("0", query("SELECT sum(length(raw_value)) FROM raw_data;"));
+    EXPECT_EQ(value, readValue(ctx, "a"));
+    EXPECT_EQ(value, readValue(ctx, "b"));
+    EXPECT_EQ(value, readValue(ctx, "c"));
+}
+
+TEST_F(LitestoreDedupTest, references_are_counted)
+{
+    const std::string first(100, '1');
+    const std::string second(100, '2');
+    ASSERT_LS_OK(litestore_create(ctx, slice("a"), blob(first)));
+    ASSERT_LS_OK(litestore_create(ctx, slice("b"), blob(first)));
+    ASSERT_LS_OK(litestore_create(ctx, slice("c"), blob(first)));
+
+    ASSERT_LS_OK(litestore_update(ctx, slice("a"), blob(second)));
+    EXPECT_EQ("2,1", query("SELECT group_concat(refs) FROM "
+                           "(SELECT refs FROM shared_data ORDER BY id);"));
+    // same value again is not a new reference
+    ASSERT_LS_OK(litestore_update(ctx, slice("a"), blob(second)));
+    EXPECT_EQ("1", query("SELECT refs FROM shared_data WHERE id = 2;"));
+
+    ASSERT_LS_OK(litestore_delete(ctx, slice("b")));
+    ASSERT_LS_OK(litestore_update_null(ctx, slice("c")));
+    EXPECT_EQ("1", query("SELECT count(*) FROM shared_data;"));
+    ASSERT_LS_OK(litestore_delete(ctx, slice("a")));
+    EXPECT_EQ("0", query("SELECT count(*) FROM shared_data;"));
+    EXPECT_EQ("<missing>", readValue(ctx, "a"));
+}
+
+TEST_F(LitestoreDedupTest, small_values_are_not_shared)
+{
+    const std::string value(10, 's');
+    ASSERT_LS_OK(litestore_create(ctx, slice("a"), blob(value)));
+    ASSERT_LS_OK(litestore_create(ctx, slice("b"), blob(value)));
+    EXPECT_EQ("0", query("SELECT count(*) FROM shared_data;"));
+    EXPECT_EQ(value, readValue(ctx, "b"));
+}
+
+TEST_F(LitestoreDedupTest, values_are_hashed_with_sha256)
+{
+    ASSERT_LS_OK(litestore_create(ctx, slice("a"),
+                                  blob(std::string(100, 'a'))));
+    ASSERT_LS_OK(litestore_create(ctx, slice("x"),
+                                  blob(std::string(120, 'x'))));
+    EXPECT_EQ("2816597888E4A0D3A36B82B83316AB32"
+              "680EB8F00F8CD3B904D681246D285A0E",
+              query("SELECT hex(hash) FROM shared_data WHERE id = 1;"));
+    EXPECT_EQ("13F05A0B594787F5ECD315EDC96141BD"
+              "3243203D1B7D4F0836F37308B276BA98",
+              query("SELECT hex(hash) FROM shared_data WHERE id = 2;"));
+}
+
+TEST_F(LitestoreDedupTest, shared_values_are_compressed)
+{
+    ASSERT_LS_OK(litestore_set_compression(ctx, LITESTORE_CODEC_LZ));
+    const std::string value(10000, 'c');
+    ASSERT_LS_OK(litestore_create(ctx, slice("a"), blob(value)));
+    ASSERT_LS_OK(litestore_create(ctx, slice("b"), blob(value)));
+    EXPECT_EQ("1", query("SELECT codec FROM shared_data;"));
+    EXPECT_EQ(value, readValue(ctx, "b"));
+}
+
+TEST_F(LitestoreDedupTest, store_can_be_used_without_dedup)
+{
+    const std::string file("litestore_dedup_test.db");
+    remove(file.c_str());
+    litestore_close(ctx);
+    open(file, true);
+    const std::string value(100, 'v');
+    ASSERT_LS_OK(litestore_create(ctx, slice("a"), blob(value)));
+    ASSERT_LS_OK(litestore_create(ctx, slice("b"), blob(value)));
+    litestore_close(ctx);
+
+    open(file, false);
+    EXPECT_EQ(value, readValue(ctx, "a"));
+    const std::string other(100, 'o');
+    ASSERT_LS_OK(litestore_update(ctx, slice("a"), blob(other)));
+    EXPECT_EQ("1", query("SELECT refs FROM shared_data;"));
+    EXPECT_EQ(other, readValue(ctx, "a"));
+    EXPECT_EQ(value, readValue(ctx, "b"));
+    litestore_close(ctx);
+    ctx = NULL;
+    remove(file.c_str());
+}
+
+}  // namespace ls
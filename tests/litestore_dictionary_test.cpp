@@ -0,0 +1,205 @@
+/**
+ * Copyright (c) 2014 Markku Linnoskivi
+ *
+ * See the file LICENSE.txt for copying permission.
+ */
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <random>
+#include <string>
+
+#include <sqlite3.h>
+
+#include "litestore/litestore.h"
+#include "litestore_test_common.h"
+
+
+namespace ls
+{
+using namespace ::testing;
+
+namespace
+{
+
+// Small structured values, alike to each other but not within themselves.
+std::string record(std::mt19937& rng)
+{
+    static const char* const cities[] = {
+        "Helsinki", "Tampere", "Turku", "Oulu", "Espoo", "Vantaa"
+    };
+    return "{\"user_id\": " + std::to_string(rng() % 1000000)
+        + ", \"display_name\": \"user" + std::to_string(rng() % 10000)
+        + "\", \"email_verified\": " + (rng() % 2 ? "true" : "false")
+        + ", \"home_city\": \"" + cities[rng() % 6]
+        + "\", \"created_at\": \"2014-0" + std::to_string(rng() % 9 + 1)
+        + "-1" + std::to_string(rng() % 10) + "T12:00:00Z\""
+        + ", \"preferences\": {\"newsletter\": false, \"theme\": \"dark\"}}";
+}
+
+struct LitestoreDictionaryTest : LitestoreTest
+{
+    LitestoreDictionaryTest()
+        : LitestoreTest(),
+          rng(5)
+    {}
+    void populate(const std::string& prefix, int count)
+    {
+        ASSERT_LS_OK(litestore_begin_tx(ctx));
+        for (int i = 0; i < count; ++i)
+        {
+            const std::string key(prefix + std::to_string(i));
+            const std::string value(record(rng));
+            ASSERT_LS_OK(litestore_create(ctx, slice(key), blob(value)));
+        }
+        ASSERT_LS_OK(litestore_commit_tx(ctx));
+    }
+    // total stored bytes and the number of values with the codec
+    std::pair<int, int> stored(int codec)
+    {
+        std::pair<int, int> result(0, 0);
+        sqlite3_stmt* stmt = NULL;
+        sqlite3_prepare_v2(
+            db,
+            "SELECT total(length(raw_value)), total(codec = ?)"
+            " FROM raw_data;",
+            -1, &stmt, NULL);
+        sqlite3_bind_int(stmt, 1, codec);
+        if (sqlite3_step(stmt) == SQLITE_ROW)
+        {
+            result.first = sqlite3_column_int(stmt, 0);
+            result.second = sqlite3_column_int(stmt, 1);
+        }
+        sqlite3_finalize(stmt);
+        return result;
+    }
+    void reencode()
+    {
+        int rv = LITESTORE_IN_PROGRESS;
+        int steps = 0;
+        while (rv == LITESTORE_IN_PROGRESS)
+        {
+            rv = litestore_reencode_step(ctx, 100);
+            ++steps;
+        }
+        ASSERT_LS_OK(rv);
+        EXPECT_GT(steps, 1);
+    }
+
+    std::mt19937 rng;
+};
+
+}  // namespace
+
+TEST_F(LitestoreDictionaryTest, dictionary_compresses_small_values)
+{
+    populate("plain", 500);
+    const int plainSize = stored(LITESTORE_CODEC_NONE).first;
+
+    ASSERT_LS_OK(litestore_dict_train(ctx, 200, 4096));
+    ASSERT_LS_OK(litestore_set_compression(ctx, LITESTORE_CODEC_LZ_DICT));
+    reencode();
+    const std::pair<int, int> dict = stored(LITESTORE_CODEC_LZ_DICT);
+    EXPECT_EQ(500, dict.second);
+    EXPECT_LT(dict.first, plainSize / 2);
+
+    // new values as well
+    populate("new", 10);
+    EXPECT_EQ(510, stored(LITESTORE_CODEC_LZ_DICT).second);
+
+    std::mt19937 replay(5);
+    for (int i = 0; i < 500; ++i)
+    {
+        std::string value;
+        ASSERT_LS_OK(litestore_read(ctx, slice("plain" + std::to_string(i)),
+                                    &str2str, &value));
+        ASSERT_EQ(record(replay), value);
+    }
+}
+
+TEST_F(LitestoreDictionaryTest, values_stay_readable_across_dictionaries)
+{
+    populate("a", 300);
+    ASSERT_LS_OK(litestore_set_compression(ctx, LITESTORE_CODEC_LZ_DICT));
+    // without a dictionary, plain LZ is used
+    const std::string first(record(rng));
+    ASSERT_LS_OK(litestore_create(ctx, slice("first"), blob(first)));
+
+    ASSERT_LS_OK(litestore_dict_train(ctx, 100, 1024));
+    const std::string second(record(rng));
+    ASSERT_LS_OK(litestore_create(ctx, slice("second"), blob(second)));
+    ASSERT_LS_OK(litestore_dict_train(ctx, 100, 2048));
+    ASSERT_LS_OK(litestore_dict_train(ctx, 100, 2048));
+    const std::string third(record(rng));
+    ASSERT_LS_OK(litestore_create(ctx, slice("third"), blob(third)));
+
+    std::string value;
+    ASSERT_LS_OK(litestore_read(ctx, slice("first"), &str2str, &value));
+    EXPECT_EQ(first, value);
+    ASSERT_LS_OK(litestore_read(ctx, slice("second"), &str2str, &value));
+    EXPECT_EQ(second, value);
+    ASSERT_LS_OK(litestore_read(ctx, slice("third"), &str2str, &value));
+    EXPECT_EQ(third, value);
+
+    // back to uncompressed
+    ASSERT_LS_OK(litestore_set_compression(ctx, LITESTORE_CODEC_NONE));
+    reencode();
+    EXPECT_EQ(303, stored(LITESTORE_CODEC_NONE).second);
+    ASSERT_LS_OK(litestore_read(ctx, slice("second"), &str2str, &value));
+    EXPECT_EQ(second, value);
+}
+
+TEST_F(LitestoreDictionaryTest, invalid_training)
+{
+    litestore_close(ctx);
+    litestore_opts opts = litestore_opts();
+    opts.error_callback = &ignoreError;
+    ASSERT_LS_OK(litestore_open(":memory:", opts, &ctx));
+    db = static_cast<sqlite3*>(litestore_native_ctx(ctx));
+    // nothing to train with
+    EXPECT_LS_ERR(litestore_dict_train(ctx, 100, 1024));
+    populate("a", 10);
+    EXPECT_LS_ERR(litestore_dict_train(ctx, 0, 1024));
+    EXPECT_LS_ERR(litestore_dict_train(ctx, 100, 100));
+    EXPECT_LS_ERR(litestore_dict_train(ctx, 100, 1 << 20));
+    ASSERT_LS_OK(litestore_begin_tx(ctx));
+    EXPECT_LS_ERR(litestore_dict_train(ctx, 100, 1024));
+    ASSERT_LS_OK(litestore_rollback_tx(ctx));
+    EXPECT_LS_OK(litestore_dict_train(ctx, 100, 1024));
+}
+
+TEST(LitestoreDictionary, dictionary_is_persisted)
+{
+    const std::string file("litestore_dictionary_test.db");
+    remove(file.c_str());
+
+    litestore_opts opts = litestore_opts();
+    opts.compression = LITESTORE_CODEC_LZ_DICT;
+    litestore* ctx = NULL;
+    ASSERT_LS_OK(litestore_open(file.c_str(), opts, &ctx));
+    std::mt19937 rng(9);
+    for (int i = 0; i < 100; ++i)
+    {
+        const std::string value(record(rng));
+        ASSERT_LS_OK(litestore_create(ctx, slice(std::to_string(i)),
+                                      blob(value)));
+    }
+    ASSERT_LS_OK(litestore_dict_train(ctx, 100, 2048));
+    const std::string value(record(rng));
+    ASSERT_LS_OK(litestore_create(ctx, slice("trained"), blob(value)));
+    litestore_close(ctx);
+
+    ASSERT_LS_OK(litestore_open(file.c_str(), opts, &ctx));
+    std::string read;
+    ASSERT_LS_OK(litestore_read(ctx, slice("trained"), &str2str, &read));
+    EXPECT_EQ(value, read);
+    // the latest dictionary is used after reopening
+    const std::string again(record(rng));
+    ASSERT_LS_OK(litestore_create(ctx, slice("again"), blob(again)));
+    ASSERT_LS_OK(litestore_read(ctx, slice("again"), &str2str, &read));
+    EXPECT_EQ(again, read);
+    litestore_close(ctx);
+    remove(file.c_str());
+}
+
+}  // namespace ls
@@ -0,0 +1,156 @@
+/**
+ * Copyright (c) 2014 Markku Linnoskivi
+ *
+ * See the file LICENSE.txt for copying permission.
+ */
+#include <gtest/gtest.h>
+
+#include <ctime>
+#include <string>
+
+#include <sqlite3.h>
+
+#include "litestore/litestore.h"
+#include "litestore_test_common.h"
+
+
+namespace ls
+{
+using namespace ::testing;
+
+namespace
+{
+
+int countKeys(litestore_slice_t, const int, void* user_data)
+{
+    ++*static_cast<int*>(user_data);
+    return LITESTORE_OK;
+}
+
+struct LitestoreExpiryTest : LitestoreTest
+{
+    LitestoreExpiryTest()
+        : LitestoreTest(),
+          now(static_cast<long long>(time(NULL)))
+    {}
+    int count(const std::string& table)
+    {
+        int n = -1;
+        sqlite3_stmt* stmt = NULL;
+        sqlite3_prepare_v2(db, ("SELECT count(*) FROM " + table).c_str(),
+                           -1, &stmt, NULL);
+        if (sqlite3_step(stmt) == SQLITE_ROW)
+        {
+            n = sqlite3_column_int(stmt, 0);
+        }
+        sqlite3_finalize(stmt);
+        return n;
+    }
+
+    const long long now;
+};
+
+}  // namespace
+
+TEST_F(LitestoreExpiryTest, expired_keys_are_unknown)
+{
+    ASSERT_LS_OK(litestore_create(ctx, slice("old"), blob("value")));
+    ASSERT_LS_OK(litestore_create(ctx, slice("new"), blob("value")));
+    ASSERT_LS_OK(litestore_create_int(ctx, slice("int"), 1));
+    ASSERT_LS_OK(litestore_expire(ctx, slice("old"), now - 1));
+    ASSERT_LS_OK(litestore_expire(ctx, slice("new"), now + 3600));
+    ASSERT_LS_OK(litestore_expire(ctx, slice("int"), now - 1));
+
+    long long expiresAt = 0;
+    EXPECT_EQ("<missing>", readValue(ctx, "old"));
+    EXPECT_EQ(LITESTORE_UNKNOWN_ENTITY,
+              litestore_expires_at(ctx, slice("old"), &expiresAt));
+    EXPECT_EQ(LITESTORE_UNKNOWN_ENTITY,
+              litestore_expire(ctx, slice("old"), 0));
+    EXPECT_EQ("value", readValue(ctx, "new"));
+    ASSERT_LS_OK(litestore_expires_at(ctx, slice("new"), &expiresAt));
+    EXPECT_EQ(now + 3600, expiresAt);
+
+    int keys = 0;
+    ASSERT_LS_OK(litestore_read_keys(ctx, slice("*"), &countKeys, &keys));
+    EXPECT_EQ(1, keys);
+
+    // an expired counter starts over
+    long long value = 0;
+    ASSERT_LS_OK(litestore_incr(ctx, slice("int"), 5, &value));
+    EXPECT_EQ(5, value);
+    ASSERT_LS_OK(litestore_expires_at(ctx, slice("int"), &expiresAt));
+    EXPECT_EQ(0, expiresAt);
+}
+
+TEST_F(LitestoreExpiryTest, expired_keys_are_replaced)
+{
+    ASSERT_LS_OK(litestore_create(ctx, slice("a"), blob("a")));
+    ASSERT_LS_OK(litestore_create(ctx, slice("b"), blob("b")));
+    ASSERT_LS_OK(litestore_expire(ctx, slice("a"), now - 1));
+    ASSERT_LS_OK(litestore_expire(ctx, slice("b"), now - 1));
+
+    ASSERT_LS_OK(litestore_create(ctx, slice("a"), blob("new a")));
+    EXPECT_EQ("new a", readValue(ctx, "a"));
+    ASSERT_LS_OK(litestore_update(ctx, slice("b"), blob("new b")));
+    EXPECT_EQ("new b", readValue(ctx, "b"));
+    long long expiresAt = -1;
+    ASSERT_LS_OK(litestore_expires_at(ctx, slice("b"), &expiresAt));
+    EXPECT_EQ(0, expiresAt);
+    EXPECT_EQ(0, count("expiry"));
+    EXPECT_LS_ERR(litestore_create(ctx, slice("a"), blob("again")));
+}
+
+TEST_F(LitestoreExpiryTest, expiry_is_kept_over_updates)
+{
+    ASSERT_LS_OK(litestore_create(ctx, slice("a"), blob("a")));
+    EXPECT_EQ(LITESTORE_UNKNOWN_ENTITY,
+              litestore_expire(ctx, slice("none"), now + 10));
+    ASSERT_LS_OK(litestore_expire(ctx, slice("a"), now + 10));
+    ASSERT_LS_OK(litestore_update(ctx, slice("a"), blob("b")));
+    long long expiresAt = 0;
+    ASSERT_LS_OK(litestore_expires_at(ctx, slice("a"), &expiresAt));
+    EXPECT_EQ(now + 10, expiresAt);
+
+    ASSERT_LS_OK(litestore_expire(ctx, slice("a"), 0));
+    ASSERT_LS_OK(litestore_expires_at(ctx, slice("a"), &expiresAt));
+    EXPECT_EQ(0, expiresAt);
+    EXPECT_EQ(0, count("expiry"));
+}
+
+TEST_F(LitestoreExpiryTest, expired_keys_are_purged_in_steps)
+{
+    ASSERT_LS_OK(litestore_begin_tx(ctx));
+    for (int i = 0; i < 100; ++i)
+    {
+        const std::string key("key" + std::to_string(i));
+        ASSERT_LS_OK(litestore_create(ctx, slice(key), blob(key)));
+        if (i % 5 < 3)
+        {
+            ASSERT_LS_OK(litestore_expire(ctx, slice(key), now - i));
+        }
+        else if (i % 5 == 3)
+        {
+            ASSERT_LS_OK(litestore_expire(ctx, slice(key), now + 3600));
+        }
+    }
+    ASSERT_LS_OK(litestore_commit_tx(ctx));
+
+    int rv = LITESTORE_IN_PROGRESS;
+    int steps = 0;
+    while (rv == LITESTORE_IN_PROGRESS)
+    {
+        rv = litestore_expire_step(ctx, 25);
+        ++steps;
+    }
+    ASSERT_LS_OK(rv);
+    EXPECT_EQ(3, steps);
+    EXPECT_EQ(40, count("objects"));
+    EXPECT_EQ(40, count("raw_data"));
+    EXPECT_EQ(20, count("expiry"));
+    EXPECT_EQ("key3", readValue(ctx, "key3"));
+    EXPECT_EQ("key4", readValue(ctx, "key4"));
+    EXPECT_LS_ERR(litestore_expire_step(ctx, 0));
+}
+
+}  // namespace ls
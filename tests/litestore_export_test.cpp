@@ -0,0 +1,194 @@
+/**
+ * Copyright (c) 2014 Markku Linnoskivi
+ *
+ * See the file LICENSE.txt for copying permission.
+ */
+#include <gtest/gtest.h>
+
+#include <unistd.h>
+
+#include <cstdio>
+#include <string>
+
+#include "litestore/litestore.h"
+#include "litestore_test_common.h"
+
+
+namespace ls
+{
+using namespace ::testing;
+
+namespace
+{
+
+struct LitestoreExportTest : LitestoreTest
+{
+    LitestoreExportTest()
+        : LitestoreTest(),
+          file(tmpfile()),
+          target(NULL)
+    {
+        litestore_opts opts = litestore_opts();
+        opts.error_callback = &errorCB;
+        opts.err_user_data = this;
+        if (!file || litestore_open(":memory:", opts, &target) != LITESTORE_OK)
+        {
+            throw std::runtime_error("Faild to open DB!");
+        }
+    }
+    ~LitestoreExportTest()
+    {
+        litestore_close(target);
+        fclose(file);
+    }
+    int fd()
+    {
+        return fileno(file);
+    }
+    void rewind()
+    {
+        lseek(fd(), 0, SEEK_SET);
+    }
+
+    FILE* file;
+    litestore* target;
+};
+
+}  // namespace
+
+TEST_F(LitestoreExportTest, round_trip)
+{
+    const std::string big(3 << 20, 'b');
+    ASSERT_LS_OK(litestore_begin_tx(ctx));
+    for (int i = 0; i < 1000; ++i)
+    {
+        const std::string key("key" + std::to_string(i));
+        ASSERT_LS_OK(litestore_create(ctx, slice(key), blob(key + "value")));
+    }
+    ASSERT_LS_OK(litestore_create(ctx, slice("big"), blob(big)));
+    ASSERT_LS_OK(litestore_create_null(ctx, slice("null")));
+    ASSERT_LS_OK(litestore_commit_tx(ctx));
+
+    ASSERT_LS_OK(litestore_export(ctx, fd()));
+    rewind();
+    ASSERT_LS_OK(litestore_import(target, fd()));
+    EXPECT_TRUE(errors.empty());
+
+    EXPECT_EQ("key0value", readValue(target, "key0"));
+    EXPECT_EQ("key999value", readValue(target, "key999"));
+    EXPECT_EQ(big, readValue(target, "big"));
+    EXPECT_LS_OK(litestore_read_null(target, slice("null")));
+
+    litestore_stats_t stats;
+    ASSERT_LS_OK(litestore_stats_get(target, &stats));
+    EXPECT_EQ(1, stats.exec[LITESTORE_OP_IMPORT].count);
+}
+
+TEST_F(LitestoreExportTest, merged_values)
+{
+    ASSERT_LS_OK(litestore_create(ctx, slice("a"), blob("a")));
+    ASSERT_LS_OK(litestore_merge(ctx, slice("a"), LITESTORE_MERGE_APPEND,
+                                 blob("bc")));
+    ASSERT_LS_OK(litestore_merge(ctx, slice("b"), LITESTORE_MERGE_APPEND,
+                                 blob("b")));
+    ASSERT_LS_OK(litestore_export(ctx, fd()));
+    rewind();
+    ASSERT_LS_OK(litestore_import(target, fd()));
+    EXPECT_EQ("abc", readValue(target, "a"));
+    EXPECT_EQ("b", readValue(target, "b"));
+}
+
+TEST_F(LitestoreExportTest, empty_merged_value)
+{
+    ASSERT_LS_OK(litestore_merge(ctx, slice("e"), LITESTORE_MERGE_APPEND,
+                                 blob("")));
+    ASSERT_LS_OK(litestore_export(ctx, fd()));
+    rewind();
+    ASSERT_LS_OK(litestore_import(target, fd()));
+    EXPECT_TRUE(errors.empty());
+    EXPECT_EQ("", readValue(target, "e"));
+
+    // still a raw value
+    ASSERT_LS_OK(litestore_merge(target, slice("e"), LITESTORE_MERGE_APPEND,
+                                 blob("x")));
+    EXPECT_EQ("x", readValue(target, "e"));
+}
+
+TEST_F(LitestoreExportTest, json_documents)
+{
+    ASSERT_LS_OK(litestore_create_json(ctx, slice("doc"),
+                                       slice("{\"a\": [1, 2]}")));
+    ASSERT_LS_OK(litestore_export(ctx, fd()));
+    rewind();
+    ASSERT_LS_OK(litestore_import(target, fd()));
+    std::string value;
+    ASSERT_LS_OK(litestore_read_json(target, slice("doc"), &str2str, &value));
+    EXPECT_EQ("{\"a\":[1,2]}", value);
+}
+
+TEST_F(LitestoreExportTest, empty_store)
+{
+    ASSERT_LS_OK(litestore_export(ctx, fd()));
+    rewind();
+    EXPECT_LS_OK(litestore_import(target, fd()));
+}
+
+TEST_F(LitestoreExportTest, corrupt_block_is_rejected)
+{
+    ASSERT_LS_OK(litestore_create(ctx, slice("a"), blob("value")));
+    ASSERT_LS_OK(litestore_create(ctx, slice("b"), blob("value")));
+    ASSERT_LS_OK(litestore_export(ctx, fd()));
+    // flip a byte of the last value
+    const off_t size = lseek(fd(), 0, SEEK_END);
+    const char c = 'x';
+    ASSERT_EQ(1, pwrite(fd(), &c, 1, size - 8 - 2));
+    rewind();
+    EXPECT_LS_ERR(litestore_import(target, fd()));
+    EXPECT_EQ("<missing>", readValue(target, "a"));
+}
+
+TEST_F(LitestoreExportTest, corrupt_block_length_is_rejected)
+{
+    ASSERT_LS_OK(litestore_create(ctx, slice("a"), blob("value")));
+    ASSERT_LS_OK(litestore_export(ctx, fd()));
+    // the length of the first block, after the 12 byte header
+    const unsigned char huge[] = {0xff, 0xff, 0xff, 0xff};
+    ASSERT_EQ(4, pwrite(fd(), huge, 4, 12));
+    rewind();
+    EXPECT_LS_ERR(litestore_import(target, fd()));
+    ASSERT_FALSE(errors.empty());
+    EXPECT_EQ("import: corrupt block", errors[0]);
+
+    // in bounds, but past the end of the input
+    const unsigned char large[] = {0x00, 0x00, 0x00, 0x10};
+    ASSERT_EQ(4, pwrite(fd(), large, 4, 12));
+    rewind();
+    errors.clear();
+    EXPECT_LS_ERR(litestore_import(target, fd()));
+    ASSERT_FALSE(errors.empty());
+    EXPECT_EQ("import: truncated input", errors[0]);
+    EXPECT_EQ("<missing>", readValue(target, "a"));
+}
+
+TEST_F(LitestoreExportTest, existing_key_discards_import)
+{
+    ASSERT_LS_OK(litestore_create(ctx, slice("a"), blob("new")));
+    ASSERT_LS_OK(litestore_create(ctx, slice("b"), blob("new")));
+    ASSERT_LS_OK(litestore_export(ctx, fd()));
+    ASSERT_LS_OK(litestore_create(target, slice("b"), blob("old")));
+    rewind();
+    EXPECT_LS_ERR(litestore_import(target, fd()));
+    EXPECT_EQ("<missing>", readValue(target, "a"));
+    EXPECT_EQ("old", readValue(target, "b"));
+}
+
+TEST_F(LitestoreExportTest, not_an_export)
+{
+    const std::string junk("junk junk junk");
+    ASSERT_EQ(static_cast<ssize_t>(junk.size()),
+              write(fd(), junk.c_str(), junk.size()));
+    rewind();
+    EXPECT_LS_ERR(litestore_import(target, fd()));
+}
+
+}  // namespace ls
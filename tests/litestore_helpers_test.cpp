@@ -5,6 +5,9 @@
  */
 #include <gtest/gtest.h>
 
+#include <climits>
+#include <string>
+
 #include "litestore/litestore_helpers.h"
 
 TEST(LitestoreHelpers, make_blob_returns_object)
@@ -47,3 +50,80 @@ TEST(LitestoreHelpers, slice_str_returns_object)
     EXPECT_EQ(strlen(orig), slice.length);
     EXPECT_EQ(orig, slice.data);
 }
+
+namespace
+{
+
+std::string keyInt(long long value)
+{
+    char buf[LITESTORE_KEY_INT_SIZE];
+    return std::string(buf, litestore_key_int(value, buf));
+}
+
+std::string keyStr(const std::string& str)
+{
+    const litestore_slice_t s = litestore_slice(str.data(), 0, str.size());
+    std::string key(litestore_key_str(s, NULL), '\0');
+    litestore_key_str(s, &key[0]);
+    return key;
+}
+
+}  // namespace
+
+TEST(LitestoreHelpers, key_int_preserves_order)
+{
+    const long long values[] = {LLONG_MIN, -1000, -1, 0, 1, 255, 256,
+                                LLONG_MAX};
+    for (size_t i = 0; i + 1 < sizeof(values) / sizeof(values[0]); ++i)
+    {
+        EXPECT_LT(keyInt(values[i]), keyInt(values[i + 1]));
+    }
+    for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); ++i)
+    {
+        const std::string key = keyInt(values[i]);
+        long long value = 0;
+        EXPECT_EQ(8u, litestore_key_read_int(
+                      litestore_slice(key.data(), 0, key.size()), &value));
+        EXPECT_EQ(values[i], value);
+    }
+    long long value = 0;
+    EXPECT_EQ(0u, litestore_key_read_int(litestore_slice_str("short"),
+                                         &value));
+}
+
+TEST(LitestoreHelpers, key_str_preserves_order)
+{
+    // a shorter string sorts first, whatever the next component is
+    EXPECT_LT(keyStr("a") + keyInt(LLONG_MAX), keyStr("a\x01"));
+    EXPECT_LT(keyStr("a") + keyInt(LLONG_MAX), keyStr(std::string("a\0", 2)));
+    EXPECT_LT(keyStr(std::string("a\0", 2)), keyStr("a\x01"));
+    EXPECT_LT(keyStr("ab"), keyStr("b"));
+    EXPECT_EQ(std::string("a\0\xff" "b\0\x01", 6),
+              keyStr(std::string("a\0b", 3)));
+}
+
+TEST(LitestoreHelpers, key_str_round_trip)
+{
+    const std::string str("\0a\xff\0", 4);
+    const std::string key = keyStr(str) + keyInt(7);
+    char buf[16];
+    size_t length = 0;
+    const size_t read = litestore_key_read_str(
+        litestore_slice(key.data(), 0, key.size()), buf, &length);
+    ASSERT_EQ(key.size() - 8, read);
+    EXPECT_EQ(str, std::string(buf, length));
+
+    EXPECT_EQ(0u, litestore_key_read_str(litestore_slice_str("abc"),
+                                         NULL, &length));
+    EXPECT_EQ(0u, litestore_key_read_str(
+                  litestore_slice("a\0\x02", 0, 3), NULL, &length));
+}
+
+TEST(LitestoreHelpers, key_prefix_end)
+{
+    char key[] = "ab\xff\xff";
+    EXPECT_EQ(2u, litestore_key_prefix_end(key, 4));
+    EXPECT_EQ("ac", std::string(key, 2));
+    char all[] = "\xff";
+    EXPECT_EQ(0u, litestore_key_prefix_end(all, 1));
+}
@@ -0,0 +1,280 @@
+/**
+ * Copyright (c) 2014 Markku Linnoskivi
+ *
+ * See the file LICENSE.txt for copying permission.
+ */
+#include <gtest/gtest.h>
+
+#include <ctime>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <sqlite3.h>
+
+#include "litestore/litestore.h"
+#include "litestore/litestore_helpers.h"
+#include "litestore_test_common.h"
+
+
+namespace ls
+{
+using namespace ::testing;
+
+namespace
+{
+
+const int FIELDS = 1;
+const int LENGTH = 2;
+
+typedef std::vector<std::string> Keys;
+
+// "a=1;b=2" has the terms "a=1" and "b=2", "bad" can not be indexed.
+int extractFields(litestore_blob_t value,
+                  litestore_index_term_fn add_term, void* terms,
+                  void* user_data)
+{
+    if (!*static_cast<bool*>(user_data))
+    {
+        return LITESTORE_OK;
+    }
+    const std::string v(static_cast<const char*>(value.data), value.size);
+    if (v == "bad")
+    {
+        return LITESTORE_ERR;
+    }
+    size_t begin = 0;
+    while (begin < v.size())
+    {
+        size_t end = v.find(';', begin);
+        if (end == std::string::npos)
+        {
+            end = v.size();
+        }
+        if ((*add_term)(litestore_make_blob(v.data() + begin, end - begin),
+                        terms) != LITESTORE_OK)
+        {
+            return LITESTORE_ERR;
+        }
+        begin = end + 1;
+    }
+    return LITESTORE_OK;
+}
+
+int extractLength(litestore_blob_t value,
+                  litestore_index_term_fn add_term, void* terms,
+                  void*)
+{
+    char term[LITESTORE_KEY_INT_SIZE];
+    litestore_key_int(static_cast<long long>(value.size), term);
+    return (*add_term)(litestore_make_blob(term, sizeof(term)), terms);
+}
+
+int collect(litestore_slice_t key, const int, void* user_data)
+{
+    static_cast<Keys*>(user_data)->push_back(
+        std::string(key.data, key.length));
+    return LITESTORE_OK;
+}
+
+std::string lengthTerm(long long length)
+{
+    char term[LITESTORE_KEY_INT_SIZE];
+    return std::string(term, litestore_key_int(length, term));
+}
+
+struct LitestoreIndexTest : Test
+{
+    LitestoreIndexTest()
+        : ctx(NULL),
+          db(NULL),
+          enabled(true)
+    {
+        litestore_index fields = {FIELDS, &extractFields, &enabled};
+        litestore_index length = {LENGTH, &extractLength, NULL};
+        indexes[0] = fields;
+        indexes[1] = length;
+        litestore_opts opts = litestore_opts();
+        opts.error_callback = &ignoreError;
+        opts.indexes = indexes;
+        opts.index_count = 2;
+        if (litestore_open(":memory:", opts, &ctx) != LITESTORE_OK)
+        {
+            throw std::runtime_error("Faild to open DB!");
+        }
+        db = static_cast<sqlite3*>(litestore_native_ctx(ctx));
+    }
+    virtual ~LitestoreIndexTest()
+    {
+        litestore_close(ctx);
+    }
+    Keys find(const std::string& term)
+    {
+        Keys keys;
+        litestore_index_find(ctx, FIELDS, blob(term), &collect, &keys);
+        return keys;
+    }
+    int terms()
+    {
+        int count = -1;
+        sqlite3_stmt* stmt = NULL;
+        sqlite3_prepare_v2(db, "SELECT count(*) FROM value_index;",
+                           -1, &stmt, NULL);
+        if (sqlite3_step(stmt) == SQLITE_ROW)
+        {
+            count = sqlite3_column_int(stmt, 0);
+        }
+        sqlite3_finalize(stmt);
+        return count;
+    }
+
+    litestore* ctx;
+    sqlite3* db;
+    bool enabled;
+    litestore_index indexes[2];
+};
+
+}  // namespace
+
+TEST_F(LitestoreIndexTest, find_by_term)
+{
+    ASSERT_LS_OK(litestore_create(ctx, slice("c"), blob("color=red;size=L")));
+    ASSERT_LS_OK(litestore_create(ctx, slice("a"), blob("color=blue")));
+    ASSERT_LS_OK(litestore_create(ctx, slice("b"), blob("color=red")));
+
+    Keys keys = find("color=red");
+    ASSERT_EQ(2u, keys.size());
+    EXPECT_EQ("c", keys[0]);
+    EXPECT_EQ("b", keys[1]);
+    EXPECT_EQ(Keys(1, "c"), find("size=L"));
+    EXPECT_TRUE(find("color=green").empty());
+    EXPECT_LS_ERR(litestore_index_find(ctx, FIELDS,
+                                       litestore_make_blob(NULL, 0),
+                                       &collect, &keys));
+
+    // updates replace the terms
+    ASSERT_LS_OK(litestore_update(ctx, slice("c"), blob("color=green")));
+    EXPECT_EQ(Keys(1, "b"), find("color=red"));
+    EXPECT_EQ(Keys(1, "c"), find("color=green"));
+    EXPECT_TRUE(find("size=L").empty());
+
+    ASSERT_LS_OK(litestore_delete(ctx, slice("b")));
+    EXPECT_TRUE(find("color=red").empty());
+    ASSERT_LS_OK(litestore_update_null(ctx, slice("c")));
+    EXPECT_TRUE(find("color=green").empty());
+    // a=color=blue and its length
+    EXPECT_EQ(2, terms());
+
+    ASSERT_LS_OK(litestore_expire(ctx, slice("a"),
+                                  static_cast<long long>(time(NULL)) - 1));
+    EXPECT_TRUE(find("color=blue").empty());
+}
+
+TEST_F(LitestoreIndexTest, range_of_terms)
+{
+    ASSERT_LS_OK(litestore_begin_tx(ctx));
+    for (int i = 1; i <= 9; ++i)
+    {
+        ASSERT_LS_OK(litestore_create(ctx, slice("key" + std::to_string(i)),
+                                      blob(std::string(i, 'x'))));
+    }
+    ASSERT_LS_OK(litestore_commit_tx(ctx));
+
+    Keys keys;
+    ASSERT_LS_OK(litestore_index_range(ctx, LENGTH,
+                                       blob(lengthTerm(3)),
+                                       blob(lengthTerm(6)),
+                                       &collect, &keys));
+    ASSERT_EQ(3u, keys.size());
+    EXPECT_EQ("key3", keys[0]);
+    EXPECT_EQ("key5", keys[2]);
+
+    keys.clear();
+    ASSERT_LS_OK(litestore_index_range(ctx, LENGTH,
+                                       blob(lengthTerm(8)),
+                                       litestore_make_blob(NULL, 0),
+                                       &collect, &keys));
+    EXPECT_EQ(2u, keys.size());
+    keys.clear();
+    ASSERT_LS_OK(litestore_index_range(ctx, LENGTH,
+                                       litestore_make_blob(NULL, 0),
+                                       litestore_make_blob(NULL, 0),
+                                       &collect, &keys));
+    EXPECT_EQ(9u, keys.size());
+    keys.clear();
+    ASSERT_LS_OK(litestore_index_range(ctx, FIELDS,
+                                       litestore_make_blob(NULL, 0),
+                                       litestore_make_blob(NULL, 0),
+                                       &collect, &keys));
+    EXPECT_EQ(9u, keys.size());
+}
+
+TEST_F(LitestoreIndexTest, failed_extract_fails_the_write)
+{
+    ASSERT_LS_OK(litestore_create(ctx, slice("a"), blob("color=red")));
+    EXPECT_LS_ERR(litestore_create(ctx, slice("b"), blob("bad")));
+    EXPECT_LS_ERR(litestore_update(ctx, slice("a"), blob("bad")));
+
+    std::string value;
+    EXPECT_LS_ERR(litestore_read(ctx, slice("b"), &str2str, &value));
+    ASSERT_LS_OK(litestore_read(ctx, slice("a"), &str2str, &value));
+    EXPECT_EQ("color=red", value);
+    EXPECT_EQ(Keys(1, "a"), find("color=red"));
+}
+
+TEST_F(LitestoreIndexTest, build_step_indexes_old_values)
+{
+    enabled = false;
+    ASSERT_LS_OK(litestore_begin_tx(ctx));
+    for (int i = 0; i < 10; ++i)
+    {
+        ASSERT_LS_OK(litestore_create(ctx, slice("key" + std::to_string(i)),
+                                      blob("n=" + std::to_string(i % 2))));
+    }
+    ASSERT_LS_OK(litestore_create_kv(ctx, slice("kv")));
+    ASSERT_LS_OK(litestore_merge(ctx, slice("merged"),
+                                 LITESTORE_MERGE_APPEND, blob("n=")));
+    ASSERT_LS_OK(litestore_merge(ctx, slice("merged"),
+                                 LITESTORE_MERGE_APPEND, blob("1")));
+    ASSERT_LS_OK(litestore_commit_tx(ctx));
+    EXPECT_TRUE(find("n=1").empty());
+
+    enabled = true;
+    int rv = LITESTORE_IN_PROGRESS;
+    int steps = 0;
+    while (rv == LITESTORE_IN_PROGRESS)
+    {
+        rv = litestore_index_build_step(ctx, 4);
+        ++steps;
+    }
+    ASSERT_LS_OK(rv);
+    EXPECT_EQ(3, steps);
+    EXPECT_EQ(6u, find("n=1").size());
+    EXPECT_EQ(5u, find("n=0").size());
+    EXPECT_LS_ERR(litestore_index_build_step(ctx, 0));
+}
+
+TEST_F(LitestoreIndexTest, merged_values_are_indexed_when_compacted)
+{
+    ASSERT_LS_OK(litestore_merge(ctx, slice("a"),
+                                 LITESTORE_MERGE_APPEND, blob("x=1")));
+    EXPECT_TRUE(find("x=1").empty());
+    while (litestore_merge_compact_step(ctx, 10) == LITESTORE_IN_PROGRESS)
+    {}
+    EXPECT_EQ(Keys(1, "a"), find("x=1"));
+}
+
+TEST(LitestoreIndex, open_needs_extractors)
+{
+    litestore_index index = {FIELDS, NULL, NULL};
+    litestore_opts opts = litestore_opts();
+    opts.indexes = &index;
+    opts.index_count = 1;
+    litestore* ctx = NULL;
+    EXPECT_LS_ERR(litestore_open(":memory:", opts, &ctx));
+    EXPECT_FALSE(ctx);
+    opts.indexes = NULL;
+    EXPECT_LS_ERR(litestore_open(":memory:", opts, &ctx));
+}
+
+}  // namespace ls
@@ -0,0 +1,203 @@
+/**
+ * Copyright (c) 2014 Markku Linnoskivi
+ *
+ * See the file LICENSE.txt for copying permission.
+ */
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include <sqlite3.h>
+
+#include "litestore/litestore.h"
+#include "litestore_test_common.h"
+
+
+namespace ls
+{
+using namespace ::testing;
+
+namespace
+{
+
+typedef std::vector<std::string> Keys;
+
+int collect(litestore_slice_t key, const int type, void* user_data)
+{
+    EXPECT_EQ(LITESTORE_JSON_T, type);
+    static_cast<Keys*>(user_data)->push_back(
+        std::string(key.data, key.length));
+    return LITESTORE_OK;
+}
+
+int denyDropIndex(void*, int action, const char*, const char*, const char*,
+                  const char*)
+{
+    return action == SQLITE_DROP_INDEX ? SQLITE_DENY : SQLITE_OK;
+}
+
+struct LitestoreJsonTest : LitestoreTest
+{
+    std::string read(const std::string& key)
+    {
+        std::string value;
+        if (litestore_read_json(ctx, slice(key), &str2str, &value)
+            != LITESTORE_OK)
+        {
+            return "<missing>";
+        }
+        return value;
+    }
+    std::string path(const std::string& key, const std::string& p)
+    {
+        std::string value;
+        const int rv = litestore_read_json_path(ctx, slice(key), slice(p),
+                                                &str2str, &value);
+        if (rv == LITESTORE_UNKNOWN_ENTITY)
+        {
+            return "<none>";
+        }
+        return rv == LITESTORE_OK ? value : "<error>";
+    }
+    std::string plan(const std::string& sql)
+    {
+        std::string details;
+        sqlite3_stmt* stmt = NULL;
+        sqlite3_prepare_v2(db, ("EXPLAIN QUERY PLAN " + sql).c_str(), -1,
+                           &stmt, NULL);
+        while (sqlite3_step(stmt) == SQLITE_ROW)
+        {
+            details += reinterpret_cast<const char*>(
+                sqlite3_column_text(stmt, 3));
+        }
+        sqlite3_finalize(stmt);
+        return details;
+    }
+};
+
+}  // namespace
+
+TEST_F(LitestoreJsonTest, documents_are_validated)
+{
+    ASSERT_LS_OK(litestore_create_json(
+                     ctx, slice("doc"), slice("{ \"a\" : [1, 2], \"b\": null }")));
+    EXPECT_EQ("{\"a\":[1,2],\"b\":null}", read("doc"));
+    EXPECT_LS_ERR(litestore_create_json(ctx, slice("bad"), slice("{\"a\":")));
+    EXPECT_LS_ERR(litestore_create_json(ctx, slice("empty"),
+                                        litestore_slice(NULL, 0, 0)));
+    EXPECT_EQ("<missing>", read("bad"));
+    EXPECT_LS_ERR(litestore_update_json(ctx, slice("doc"), slice("[1,")));
+    EXPECT_EQ("{\"a\":[1,2],\"b\":null}", read("doc"));
+
+    // other types are replaced, and replace
+    ASSERT_LS_OK(litestore_create(ctx, slice("raw"), blob("raw")));
+    ASSERT_LS_OK(litestore_update_json(ctx, slice("raw"), slice("[]")));
+    EXPECT_EQ("[]", read("raw"));
+    ASSERT_LS_OK(litestore_update_int(ctx, slice("doc"), 1));
+    EXPECT_EQ("<missing>", read("doc"));
+    ASSERT_LS_OK(litestore_delete(ctx, slice("raw")));
+    EXPECT_EQ("<missing>", read("raw"));
+}
+
+TEST_F(LitestoreJsonTest, paths_are_extracted)
+{
+    ASSERT_LS_OK(litestore_create_json(
+                     ctx, slice("doc"),
+                     slice("{\"user\":{\"name\":\"x\",\"age\":42},"
+                           "\"tags\":[\"a\",\"b\"],\"none\":null}")));
+    EXPECT_EQ("\"x\"", path("doc", "$.user.name"));
+    EXPECT_EQ("42", path("doc", "$.user.age"));
+    EXPECT_EQ("{\"name\":\"x\",\"age\":42}", path("doc", "$.user"));
+    EXPECT_EQ("[\"a\",\"b\"]", path("doc", "$.tags"));
+    EXPECT_EQ("\"b\"", path("doc", "$.tags[1]"));
+    EXPECT_EQ("null", path("doc", "$.none"));
+    EXPECT_EQ("<none>", path("doc", "$.missing"));
+    EXPECT_EQ("<error>", path("doc", "bad path"));
+    EXPECT_EQ("<error>", path("missing", "$.user"));
+}
+
+TEST_F(LitestoreJsonTest, index_find_and_range)
+{
+    ASSERT_LS_OK(litestore_begin_tx(ctx));
+    for (int i = 0; i < 10; ++i)
+    {
+        const std::string doc("{\"age\":" + std::to_string(i * 10)
+                              + ",\"color\":\""
+                              + (i % 2 ? "red" : "blue") + "\"}");
+        ASSERT_LS_OK(litestore_create_json(
+                         ctx, slice("user" + std::to_string(i)), slice(doc)));
+    }
+    ASSERT_LS_OK(litestore_create_json(ctx, slice("other"), slice("{}")));
+    ASSERT_LS_OK(litestore_create(ctx, slice("raw"), blob("{\"age\":0}")));
+    // the index is not changed in a transaction
+    litestore_json_index* age = NULL;
+    EXPECT_LS_ERR(litestore_json_index_open(ctx, slice("$.age"), &age));
+    ASSERT_LS_OK(litestore_commit_tx(ctx));
+
+    litestore_json_index* color = NULL;
+    ASSERT_LS_OK(litestore_json_index_open(ctx, slice("$.age"), &age));
+    ASSERT_LS_OK(litestore_json_index_open(ctx, slice("$.color"), &color));
+    litestore_json_index* again = NULL;
+    ASSERT_LS_OK(litestore_json_index_open(ctx, slice("$.age"), &again));
+    EXPECT_EQ(age, again);
+    EXPECT_LS_ERR(litestore_json_index_open(ctx, slice("age"), &again));
+
+    Keys keys;
+    ASSERT_LS_OK(litestore_json_find(color, slice("\"red\""),
+                                     &collect, &keys));
+    ASSERT_EQ(5u, keys.size());
+    EXPECT_EQ("user1", keys[0]);
+    keys.clear();
+    ASSERT_LS_OK(litestore_json_find(age, slice("30"), &collect, &keys));
+    EXPECT_EQ(Keys(1, "user3"), keys);
+
+    keys.clear();
+    ASSERT_LS_OK(litestore_json_range(age, slice("25"), slice("55"),
+                                      &collect, &keys));
+    ASSERT_EQ(3u, keys.size());
+    EXPECT_EQ("user3", keys[0]);
+    EXPECT_EQ("user5", keys[2]);
+    keys.clear();
+    ASSERT_LS_OK(litestore_json_range(age, litestore_slice(NULL, 0, 0),
+                                      litestore_slice(NULL, 0, 0),
+                                      &collect, &keys));
+    EXPECT_EQ(10u, keys.size());
+
+    // updates are indexed by the store
+    ASSERT_LS_OK(litestore_update_json(ctx, slice("user3"),
+                                       slice("{\"age\":31}")));
+    keys.clear();
+    ASSERT_LS_OK(litestore_json_find(age, slice("30"), &collect, &keys));
+    EXPECT_TRUE(keys.empty());
+
+    EXPECT_NE(std::string::npos,
+              plan("SELECT id FROM json_data"
+                   " WHERE json_extract(doc, '$.age') = 30;")
+              .find("json_path_1"));
+    // a failed drop keeps the handle
+    sqlite3_set_authorizer(db, &denyDropIndex, NULL);
+    EXPECT_LS_ERR(litestore_json_index_drop(ctx, slice("$.age")));
+    sqlite3_set_authorizer(db, NULL, NULL);
+    keys.clear();
+    ASSERT_LS_OK(litestore_json_find(age, slice("31"), &collect, &keys));
+    EXPECT_EQ(Keys(1, "user3"), keys);
+
+    ASSERT_LS_OK(litestore_json_index_drop(ctx, slice("$.age")));
+    EXPECT_EQ(LITESTORE_UNKNOWN_ENTITY,
+              litestore_json_index_drop(ctx, slice("$.age")));
+    EXPECT_EQ(std::string::npos,
+              plan("SELECT id FROM json_data"
+                   " WHERE json_extract(doc, '$.age') = 30;")
+              .find("json_path_1"));
+
+    // ids are not reused
+    ASSERT_LS_OK(litestore_json_index_drop(ctx, slice("$.color")));
+    ASSERT_LS_OK(litestore_json_index_open(ctx, slice("$.age"), &age));
+    EXPECT_NE(std::string::npos,
+              plan("SELECT id FROM json_data"
+                   " WHERE json_extract(doc, '$.age') = 30;")
+              .find("json_path_3"));
+}
+
+}  // namespace ls
@@ -0,0 +1,218 @@
+/**
+ * Copyright (c) 2014 Markku Linnoskivi
+ *
+ * See the file LICENSE.txt for copying permission.
+ */
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <vector>
+#include <string>
+
+#include <sqlite3.h>
+
+#include "litestore/litestore.h"
+#include "litestore_test_common.h"
+
+
+namespace ls
+{
+using namespace ::testing;
+
+namespace
+{
+
+int collect(litestore_slice_t field, litestore_blob_t value, void* user_data)
+{
+    std::vector<std::pair<std::string, std::string> >* fields =
+        static_cast<std::vector<std::pair<std::string, std::string> >*>(
+            user_data);
+    fields->push_back(
+        std::make_pair(std::string(field.data, field.length),
+                       std::string(static_cast<const char*>(value.data),
+                                   value.size)));
+    return fields->size() < 3 ? LITESTORE_OK : LITESTORE_ERR;
+}
+
+struct LitestoreKvTest : LitestoreTest
+{
+    std::string get(litestore* c,
+                    const std::string& key,
+                    const std::string& field)
+    {
+        std::string value;
+        const int rv = litestore_kv_get(c, slice(key), slice(field),
+                                        &str2str, &value);
+        if (rv == LITESTORE_UNKNOWN_ENTITY)
+        {
+            return "<missing>";
+        }
+        return rv == LITESTORE_OK ? value : "<error>";
+    }
+    std::string get(const std::string& key, const std::string& field)
+    {
+        return get(ctx, key, field);
+    }
+    int count(const std::string& sql)
+    {
+        int result = -1;
+        sqlite3_stmt* stmt = NULL;
+        sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, NULL);
+        if (sqlite3_step(stmt) == SQLITE_ROW)
+        {
+            result = sqlite3_column_int(stmt, 0);
+        }
+        sqlite3_finalize(stmt);
+        return result;
+    }
+};
+
+}  // namespace
+
+TEST_F(LitestoreKvTest, set_and_get)
+{
+    ASSERT_LS_OK(litestore_kv_set(ctx, slice("map"), slice("a"), blob("1")));
+    ASSERT_LS_OK(litestore_kv_set(ctx, slice("map"), slice("b"), blob("2")));
+    ASSERT_LS_OK(litestore_kv_set(ctx, slice("map"), slice("a"), blob("3")));
+    ASSERT_LS_OK(litestore_kv_set(ctx, slice("map"), slice("e"), blob("")));
+
+    EXPECT_EQ("3", get("map", "a"));
+    EXPECT_EQ("2", get("map", "b"));
+    EXPECT_EQ("", get("map", "e"));
+    EXPECT_EQ("<missing>", get("map", "c"));
+    EXPECT_EQ("<error>", get("nomap", "a"));
+    EXPECT_EQ(3, count("SELECT count(*) FROM kv_data;"));
+
+    const Objects objs = readObjects();
+    ASSERT_EQ(1u, objs.size());
+    EXPECT_EQ(LITESTORE_KV_T, objs[0].type);
+}
+
+TEST_F(LitestoreKvTest, one_row_per_field_write)
+{
+    ASSERT_LS_OK(litestore_create_kv(ctx, slice("map")));
+    ASSERT_LS_OK(litestore_begin_tx(ctx));
+    for (int i = 0; i < 10000; ++i)
+    {
+        ASSERT_LS_OK(litestore_kv_set(ctx, slice("map"),
+                                      slice(std::to_string(i)),
+                                      blob("value")));
+    }
+    ASSERT_LS_OK(litestore_commit_tx(ctx));
+
+    const int before = sqlite3_total_changes(db);
+    ASSERT_LS_OK(litestore_kv_set(ctx, slice("map"), slice("5000"),
+                                  blob("new")));
+    // INSERT OR REPLACE: the old row out, the new one in
+    EXPECT_GE(2, sqlite3_total_changes(db) - before);
+    EXPECT_EQ("new", get("map", "5000"));
+    EXPECT_EQ("value", get("map", "4999"));
+}
+
+TEST_F(LitestoreKvTest, delete_field)
+{
+    ASSERT_LS_OK(litestore_kv_set(ctx, slice("map"), slice("a"), blob("1")));
+    ASSERT_LS_OK(litestore_kv_set(ctx, slice("map"), slice("b"), blob("2")));
+
+    EXPECT_LS_OK(litestore_kv_delete(ctx, slice("map"), slice("a")));
+    EXPECT_EQ(LITESTORE_UNKNOWN_ENTITY,
+              litestore_kv_delete(ctx, slice("map"), slice("a")));
+    EXPECT_EQ(LITESTORE_UNKNOWN_ENTITY,
+              litestore_kv_delete(ctx, slice("nomap"), slice("a")));
+    EXPECT_EQ("<missing>", get("map", "a"));
+    EXPECT_EQ("2", get("map", "b"));
+    // an empty map remains
+    EXPECT_LS_OK(litestore_kv_delete(ctx, slice("map"), slice("b")));
+    EXPECT_TRUE(contains("map"));
+
+    ASSERT_LS_OK(litestore_create(ctx, slice("raw"), blob("raw")));
+    EXPECT_LS_ERR(litestore_kv_delete(ctx, slice("raw"), slice("a")));
+}
+
+TEST_F(LitestoreKvTest, iterate_in_field_order)
+{
+    const char* fields[] = {"d", "b", "a", "c"};
+    for (int i = 0; i < 4; ++i)
+    {
+        ASSERT_LS_OK(litestore_kv_set(ctx, slice("map"), slice(fields[i]),
+                                      blob(std::string(i + 1, 'x'))));
+    }
+    ASSERT_LS_OK(litestore_kv_set(ctx, slice("other"), slice("0"), blob("")));
+
+    // the callback stops after three
+    std::vector<std::pair<std::string, std::string> > read;
+    EXPECT_LS_ERR(litestore_kv_iterate(ctx, slice("map"), &collect, &read));
+    ASSERT_EQ(3u, read.size());
+    EXPECT_EQ("a", read[0].first);
+    EXPECT_EQ("xxx", read[0].second);
+    EXPECT_EQ("b", read[1].first);
+    EXPECT_EQ("c", read[2].first);
+    EXPECT_EQ("xxxx", read[2].second);
+
+    read.clear();
+    ASSERT_LS_OK(litestore_create_kv(ctx, slice("empty")));
+    EXPECT_LS_OK(litestore_kv_iterate(ctx, slice("empty"), &collect, &read));
+    EXPECT_TRUE(read.empty());
+    EXPECT_LS_ERR(litestore_kv_iterate(ctx, slice("nomap"), &collect, &read));
+}
+
+TEST_F(LitestoreKvTest, type_changes)
+{
+    ASSERT_LS_OK(litestore_create(ctx, slice("key"), blob("raw")));
+    ASSERT_LS_OK(litestore_kv_set(ctx, slice("key"), slice("a"), blob("1")));
+    EXPECT_EQ(0, count("SELECT count(*) FROM raw_data;"));
+    EXPECT_EQ("1", get("key", "a"));
+    std::string value;
+    EXPECT_LS_ERR(litestore_read(ctx, slice("key"), &str2str, &value));
+
+    ASSERT_LS_OK(litestore_update(ctx, slice("key"), blob("raw")));
+    EXPECT_EQ(0, count("SELECT count(*) FROM kv_data;"));
+    EXPECT_LS_OK(litestore_read(ctx, slice("key"), &str2str, &value));
+    EXPECT_EQ("raw", value);
+
+    ASSERT_LS_OK(litestore_kv_set(ctx, slice("key"), slice("a"), blob("1")));
+    ASSERT_LS_OK(litestore_update_null(ctx, slice("key")));
+    EXPECT_EQ(0, count("SELECT count(*) FROM kv_data;"));
+    EXPECT_LS_OK(litestore_read_null(ctx, slice("key")));
+
+    EXPECT_LS_ERR(litestore_create_kv(ctx, slice("key")));
+}
+
+TEST_F(LitestoreKvTest, delete_cascades)
+{
+    ASSERT_LS_OK(litestore_kv_set(ctx, slice("map"), slice("a"), blob("1")));
+    ASSERT_LS_OK(litestore_kv_set(ctx, slice("map"), slice("b"), blob("2")));
+    ASSERT_LS_OK(litestore_delete(ctx, slice("map")));
+    EXPECT_EQ(0, count("SELECT count(*) FROM kv_data;"));
+}
+
+TEST_F(LitestoreKvTest, export_and_import)
+{
+    ASSERT_LS_OK(litestore_kv_set(ctx, slice("map"), slice("a"), blob("1")));
+    ASSERT_LS_OK(litestore_kv_set(ctx, slice("map"), slice("b"),
+                                  blob(std::string(1000, 'b'))));
+    ASSERT_LS_OK(litestore_kv_set(ctx, slice("map"), slice("e"), blob("")));
+    ASSERT_LS_OK(litestore_create_kv(ctx, slice("empty")));
+    ASSERT_LS_OK(litestore_create(ctx, slice("raw"), blob("raw")));
+
+    FILE* file = tmpfile();
+    ASSERT_TRUE(file != NULL);
+    ASSERT_LS_OK(litestore_export(ctx, fileno(file)));
+    rewind(file);
+
+    litestore* target = NULL;
+    ASSERT_LS_OK(litestore_open(":memory:", litestore_opts(), &target));
+    EXPECT_LS_OK(litestore_import(target, fileno(file)));
+    fclose(file);
+
+    EXPECT_EQ("1", get(target, "map", "a"));
+    EXPECT_EQ(std::string(1000, 'b'), get(target, "map", "b"));
+    EXPECT_EQ("", get(target, "map", "e"));
+    EXPECT_EQ("<missing>", get(target, "empty", "a"));
+    std::string value;
+    EXPECT_LS_OK(litestore_read(target, slice("raw"), &str2str, &value));
+    EXPECT_EQ("raw", value);
+    litestore_close(target);
+}
+
+}  // namespace ls
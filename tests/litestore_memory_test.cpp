@@ -0,0 +1,268 @@
+/**
+ * Copyright (c) 2014 Markku Linnoskivi
+ *
+ * See the file LICENSE.txt for copying permission.
+ */
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include <sqlite3.h>
+
+#include "litestore/litestore.h"
+#include "litestore_test_common.h"
+
+
+namespace ls
+{
+using namespace ::testing;
+
+namespace
+{
+
+struct CountingAllocator
+{
+    CountingAllocator()
+        : allocs(0),
+          frees(0)
+    {}
+    int allocs;
+    int frees;
+};
+
+void* countingMalloc(size_t size, void* user_data)
+{
+    ++static_cast<CountingAllocator*>(user_data)->allocs;
+    return malloc(size);
+}
+
+void* countingRealloc(void* ptr, size_t size, void* user_data)
+{
+    if (!ptr)
+    {
+        ++static_cast<CountingAllocator*>(user_data)->allocs;
+    }
+    return realloc(ptr, size);
+}
+
+void countingFree(void* ptr, void* user_data)
+{
+    if (ptr)
+    {
+        ++static_cast<CountingAllocator*>(user_data)->frees;
+    }
+    free(ptr);
+}
+
+sqlite3_int64 pragmaValue(sqlite3* db, const std::string& pragma)
+{
+    sqlite3_int64 value = -1;
+    sqlite3_stmt* stmt = NULL;
+    const std::string sql("PRAGMA " + pragma + ";");
+    sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, NULL);
+    if (sqlite3_step(stmt) == SQLITE_ROW)
+    {
+        value = sqlite3_column_int64(stmt, 0);
+    }
+    sqlite3_finalize(stmt);
+    return value;
+}
+
+// The library remembers the applied allocator, keep the addresses unique.
+CountingAllocator processCounter;
+litestore_allocator processAllocator = {
+    &countingMalloc, &countingRealloc, &countingFree, &processCounter};
+CountingAllocator lateCounter;
+litestore_allocator lateAllocator = {
+    &countingMalloc, &countingRealloc, &countingFree, &lateCounter};
+
+}  // namespace
+
+TEST(LitestoreMemory, lookaside_serves_small_allocations)
+{
+    litestore_opts opts = litestore_opts();
+    opts.lookaside_slot_size = 256;
+    opts.lookaside_slots = 64;
+    litestore* ctx = NULL;
+    ASSERT_LS_OK(litestore_open(":memory:", opts, &ctx));
+
+    const std::string key("key");
+    const std::string value("value");
+    EXPECT_LS_OK(litestore_create(ctx, slice(key), blob(value)));
+
+    if (sqlite3_compileoption_used("SQLITE_OMIT_LOOKASIDE"))
+    {
+        litestore_close(ctx);
+        return;  // linked against an SQLite without lookaside support
+    }
+
+    int current = 0;
+    int hits = 0;
+    sqlite3* db = static_cast<sqlite3*>(litestore_native_ctx(ctx));
+    ASSERT_EQ(SQLITE_OK,
+              sqlite3_db_status(db, SQLITE_DBSTATUS_LOOKASIDE_HIT,
+                                &current, &hits, 0));
+    // the slots in use are not checked, SQLite 3.31 and later split the
+    // buffer into slots of two sizes
+    EXPECT_GT(hits, 0);
+
+    litestore_close(ctx);
+}
+
+TEST(LitestoreMemory, allocator_is_used_by_sqlite)
+{
+    // Process wide, SQLite must not be initialized while configuring.
+    ASSERT_LS_OK(litestore_shutdown());
+
+    litestore_opts opts = litestore_opts();
+    opts.allocator = &processAllocator;
+    litestore* ctx = NULL;
+    ASSERT_LS_OK(litestore_open(":memory:", opts, &ctx));
+
+    const std::string key("key");
+    const std::string value("value");
+    EXPECT_LS_OK(litestore_create(ctx, slice(key), blob(value)));
+    litestore_close(ctx);
+    ASSERT_LS_OK(litestore_shutdown());
+
+    EXPECT_GT(processCounter.allocs, 1);
+    EXPECT_EQ(processCounter.allocs, processCounter.frees);
+}
+
+TEST(LitestoreMemory, allocator_fails_after_initialization)
+{
+    litestore_opts opts = litestore_opts();
+    opts.error_callback = &ignoreError;
+    litestore* first = NULL;
+    ASSERT_LS_OK(litestore_open(":memory:", opts, &first));
+
+    opts.allocator = &lateAllocator;
+    litestore* second = NULL;
+    EXPECT_LS_ERR(litestore_open(":memory:", opts, &second));
+    EXPECT_EQ(NULL, second);
+    EXPECT_EQ(lateCounter.allocs, lateCounter.frees);
+
+    litestore_close(first);
+}
+
+TEST(LitestoreMemory, page_cache_options_are_applied)
+{
+    const std::string file("litestore_memory_test.db");
+    remove(file.c_str());
+
+    litestore_opts opts = litestore_opts();
+    opts.page_size = 8192;
+    opts.cache_size = -512;
+    opts.mmap_size = 1 << 20;
+    litestore* ctx = NULL;
+    ASSERT_LS_OK(litestore_open(file.c_str(), opts, &ctx));
+    sqlite3* db = static_cast<sqlite3*>(litestore_native_ctx(ctx));
+
+    EXPECT_EQ(8192, pragmaValue(db, "page_size"));
+    EXPECT_EQ(-512, pragmaValue(db, "cache_size"));
+    if (!sqlite3_compileoption_used("SQLITE_OMIT_MMAP"))
+    {
+        EXPECT_EQ(1 << 20, pragmaValue(db, "mmap_size"));
+    }
+    litestore_close(ctx);
+
+    // page size is fixed once the store exists
+    opts.page_size = 4096;
+    ASSERT_LS_OK(litestore_open(file.c_str(), opts, &ctx));
+    db = static_cast<sqlite3*>(litestore_native_ctx(ctx));
+    EXPECT_EQ(8192, pragmaValue(db, "page_size"));
+    litestore_close(ctx);
+
+    remove(file.c_str());
+}
+
+TEST(LitestoreMemory, connection_stays_within_budget)
+{
+    const std::string file("litestore_memory_test.db");
+    remove(file.c_str());
+
+    litestore_opts opts = litestore_opts();
+    opts.memory_budget = 256 * 1024;
+    litestore* ctx = NULL;
+    ASSERT_LS_OK(litestore_open(file.c_str(), opts, &ctx));
+
+    const std::string value(1000, 'v');
+    ASSERT_LS_OK(litestore_begin_tx(ctx));
+    for (int i = 0; i < 2000; ++i)
+    {
+        ASSERT_LS_OK(litestore_create(ctx, slice(std::to_string(i)),
+                                      blob(value)));
+    }
+    ASSERT_LS_OK(litestore_commit_tx(ctx));
+
+    litestore_memory_t usage;
+    ASSERT_LS_OK(litestore_memory_usage(ctx, &usage));
+    EXPECT_EQ(opts.memory_budget, usage.memory_budget);
+    EXPECT_LE(usage.cache_used + usage.stmt_used, usage.memory_budget);
+    EXPECT_GT(usage.process_used, 0);
+    EXPECT_GE(usage.process_highwater, usage.process_used);
+
+    litestore_close(ctx);
+    remove(file.c_str());
+}
+
+TEST(LitestoreMemory, small_budget_sizes_the_cache)
+{
+    litestore_opts opts = litestore_opts();
+    opts.memory_budget = 100;
+    litestore* ctx = NULL;
+    ASSERT_LS_OK(litestore_open(":memory:", opts, &ctx));
+    sqlite3* db = static_cast<sqlite3*>(litestore_native_ctx(ctx));
+    EXPECT_EQ(-1, pragmaValue(db, "cache_size"));
+    litestore_close(ctx);
+}
+
+TEST(LitestoreMemory, soft_heap_limit_is_applied)
+{
+    litestore_opts opts = litestore_opts();
+    opts.soft_heap_limit = 8 * 1024 * 1024;
+    litestore* ctx = NULL;
+    ASSERT_LS_OK(litestore_open(":memory:", opts, &ctx));
+
+    litestore_memory_t usage;
+    ASSERT_LS_OK(litestore_memory_usage(ctx, &usage));
+    EXPECT_EQ(opts.soft_heap_limit, usage.soft_heap_limit);
+
+    litestore_close(ctx);
+    ASSERT_LS_OK(litestore_shutdown());
+}
+
+TEST(LitestoreMemory, hard_heap_limit_fails_allocations)
+{
+    ASSERT_LS_OK(litestore_shutdown());
+
+    litestore_opts opts = litestore_opts();
+    opts.error_callback = &ignoreError;
+    opts.hard_heap_limit = 2 * 1024 * 1024;
+    litestore* ctx = NULL;
+    ASSERT_LS_OK(litestore_open(":memory:", opts, &ctx));
+    // the high water mark survives shutdown, drop earlier tests' usage
+    sqlite3_int64 current = 0;
+    sqlite3_int64 highwater = 0;
+    sqlite3_status64(SQLITE_STATUS_MEMORY_USED, &current, &highwater, 1);
+
+    const std::string value(64 * 1024, 'v');
+    int rv = LITESTORE_OK;
+    for (int i = 0; i < 100 && rv == LITESTORE_OK; ++i)
+    {
+        rv = litestore_create(ctx, slice(std::to_string(i)), blob(value));
+    }
+    EXPECT_LS_ERR(rv);
+
+    litestore_memory_t usage;
+    ASSERT_LS_OK(litestore_memory_usage(ctx, &usage));
+    EXPECT_EQ(opts.hard_heap_limit, usage.hard_heap_limit);
+    EXPECT_LE(usage.process_highwater, usage.hard_heap_limit);
+
+    litestore_close(ctx);
+    ASSERT_LS_OK(litestore_shutdown());
+}
+
+}  // namespace ls
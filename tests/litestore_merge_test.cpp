@@ -0,0 +1,222 @@
+/**
+ * Copyright (c) 2014 Markku Linnoskivi
+ *
+ * See the file LICENSE.txt for copying permission.
+ */
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <set>
+#include <string>
+
+#include <sqlite3.h>
+
+#include "litestore/litestore.h"
+#include "litestore_test_common.h"
+
+
+namespace ls
+{
+using namespace ::testing;
+
+namespace
+{
+
+const int SET_UNION = 3;
+
+// A set of bytes, kept sorted.
+size_t unionBound(litestore_blob_t value,
+                  const litestore_blob_t* operands, size_t count,
+                  void*)
+{
+    size_t size = value.size;
+    for (size_t i = 0; i < count; ++i)
+    {
+        size += operands[i].size;
+    }
+    return size;
+}
+
+int unionMerge(litestore_blob_t value,
+               const litestore_blob_t* operands, size_t count,
+               void* dst, size_t dst_cap, size_t* dst_size,
+               void* user_data)
+{
+    const char* v = static_cast<const char*>(value.data);
+    std::set<char> s(v, v + value.size);
+    for (size_t i = 0; i < count; ++i)
+    {
+        const char* o = static_cast<const char*>(operands[i].data);
+        s.insert(o, o + operands[i].size);
+    }
+    const std::string result(s.begin(), s.end());
+    if (result.size() > dst_cap)
+    {
+        return LITESTORE_ERR;
+    }
+    memcpy(dst, result.data(), result.size());
+    *dst_size = result.size();
+    ++*static_cast<int*>(user_data);
+    return LITESTORE_OK;
+}
+
+std::string u64(unsigned long long v)
+{
+    std::string s(8, '\0');
+    for (int i = 0; i < 8; ++i)
+    {
+        s[i] = static_cast<char>((v >> (8 * i)) & 0xff);
+    }
+    return s;
+}
+
+struct LitestoreMergeTest : Test
+{
+    LitestoreMergeTest()
+        : ctx(NULL),
+          db(NULL),
+          merges(0)
+    {
+        litestore_merge_operator op = {SET_UNION, &unionBound, &unionMerge,
+                                       &merges};
+        setUnion = op;
+        litestore_opts opts = litestore_opts();
+        opts.error_callback = &ignoreError;
+        opts.merge_operators = &setUnion;
+        opts.merge_operator_count = 1;
+        if (litestore_open(":memory:", opts, &ctx) != LITESTORE_OK)
+        {
+            throw std::runtime_error("Faild to open DB!");
+        }
+        db = static_cast<sqlite3*>(litestore_native_ctx(ctx));
+    }
+    virtual ~LitestoreMergeTest()
+    {
+        litestore_close(ctx);
+    }
+    int operands()
+    {
+        int count = -1;
+        sqlite3_stmt* stmt = NULL;
+        sqlite3_prepare_v2(db, "SELECT count(*) FROM merge_operands;",
+                           -1, &stmt, NULL);
+        if (sqlite3_step(stmt) == SQLITE_ROW)
+        {
+            count = sqlite3_column_int(stmt, 0);
+        }
+        sqlite3_finalize(stmt);
+        return count;
+    }
+    int merge(const std::string& key, int op, const std::string& operand)
+    {
+        return litestore_merge(ctx, slice(key), op, blob(operand));
+    }
+
+    litestore* ctx;
+    sqlite3* db;
+    int merges;
+    litestore_merge_operator setUnion;
+};
+
+}  // namespace
+
+TEST_F(LitestoreMergeTest, append)
+{
+    ASSERT_LS_OK(litestore_create(ctx, slice("log"), blob("a")));
+    ASSERT_LS_OK(merge("log", LITESTORE_MERGE_APPEND, "b"));
+    ASSERT_LS_OK(merge("log", LITESTORE_MERGE_APPEND, "cd"));
+    ASSERT_LS_OK(merge("log", LITESTORE_MERGE_APPEND, ""));
+    EXPECT_EQ(3, operands());
+    EXPECT_EQ("abcd", readValue(ctx, "log"));
+
+    // a missing key starts from an empty value
+    ASSERT_LS_OK(merge("new", LITESTORE_MERGE_APPEND, "x"));
+    EXPECT_EQ("x", readValue(ctx, "new"));
+}
+
+TEST_F(LitestoreMergeTest, add)
+{
+    ASSERT_LS_OK(merge("counter", LITESTORE_MERGE_ADD, u64(5)));
+    ASSERT_LS_OK(merge("counter", LITESTORE_MERGE_ADD, u64(-7)));
+    ASSERT_LS_OK(merge("counter", LITESTORE_MERGE_ADD, u64(10)));
+    EXPECT_EQ(u64(8), readValue(ctx, "counter"));
+    ASSERT_LS_OK(litestore_update(ctx, slice("counter"), blob(u64(100))));
+    EXPECT_EQ(0, operands());
+    ASSERT_LS_OK(merge("counter", LITESTORE_MERGE_ADD, u64(1)));
+    EXPECT_EQ(u64(101), readValue(ctx, "counter"));
+}
+
+TEST_F(LitestoreMergeTest, user_operator)
+{
+    ASSERT_LS_OK(merge("set", SET_UNION, "ca"));
+    ASSERT_LS_OK(merge("set", SET_UNION, "b"));
+    ASSERT_LS_OK(merge("set", SET_UNION, "ac"));
+    EXPECT_EQ("abc", readValue(ctx, "set"));
+    // consecutive operands are merged in one call
+    EXPECT_EQ(1, merges);
+
+    ASSERT_LS_OK(merge("set", LITESTORE_MERGE_APPEND, "a"));
+    ASSERT_LS_OK(merge("set", SET_UNION, "d"));
+    EXPECT_EQ("abcd", readValue(ctx, "set"));
+}
+
+TEST_F(LitestoreMergeTest, compaction)
+{
+    ASSERT_LS_OK(litestore_begin_tx(ctx));
+    for (int i = 0; i < 10; ++i)
+    {
+        const std::string key("key" + std::to_string(i));
+        for (int j = 0; j < 3; ++j)
+        {
+            ASSERT_LS_OK(merge(key, LITESTORE_MERGE_APPEND,
+                               std::to_string(j)));
+        }
+    }
+    ASSERT_LS_OK(litestore_commit_tx(ctx));
+    EXPECT_EQ(30, operands());
+
+    int rv = LITESTORE_IN_PROGRESS;
+    int steps = 0;
+    while (rv == LITESTORE_IN_PROGRESS)
+    {
+        rv = litestore_merge_compact_step(ctx, 3);
+        ++steps;
+    }
+    ASSERT_LS_OK(rv);
+    EXPECT_EQ(4, steps);
+    EXPECT_EQ(0, operands());
+    for (int i = 0; i < 10; ++i)
+    {
+        ASSERT_EQ("012", readValue(ctx, "key" + std::to_string(i)));
+    }
+    EXPECT_LS_OK(litestore_merge_compact_step(ctx, 3));
+}
+
+TEST_F(LitestoreMergeTest, operands_are_deleted)
+{
+    ASSERT_LS_OK(merge("a", LITESTORE_MERGE_APPEND, "1"));
+    ASSERT_LS_OK(merge("b", LITESTORE_MERGE_APPEND, "2"));
+    ASSERT_LS_OK(litestore_delete(ctx, slice("a")));
+    EXPECT_EQ(1, operands());
+    EXPECT_EQ("<missing>", readValue(ctx, "a"));
+    ASSERT_LS_OK(litestore_update_null(ctx, slice("b")));
+    EXPECT_EQ(0, operands());
+    EXPECT_LS_OK(litestore_read_null(ctx, slice("b")));
+}
+
+TEST_F(LitestoreMergeTest, invalid)
+{
+    ASSERT_LS_OK(litestore_create_kv(ctx, slice("kv")));
+    EXPECT_LS_ERR(merge("kv", LITESTORE_MERGE_APPEND, "a"));
+    EXPECT_LS_ERR(merge("a", 42, "a"));
+    EXPECT_LS_ERR(litestore_merge(ctx, slice("a"), LITESTORE_MERGE_APPEND,
+                                  litestore_make_blob(NULL, 0)));
+    EXPECT_EQ("<missing>", readValue(ctx, "a"));
+    EXPECT_LS_ERR(litestore_merge_compact_step(ctx, 0));
+
+    // the sum needs 8 byte operands
+    ASSERT_LS_OK(merge("counter", LITESTORE_MERGE_ADD, "short"));
+    EXPECT_EQ("<missing>", readValue(ctx, "counter"));
+}
+
+}  // namespace ls
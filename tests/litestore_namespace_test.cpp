@@ -0,0 +1,211 @@
+/**
+ * Copyright (c) 2014 Markku Linnoskivi
+ *
+ * See the file LICENSE.txt for copying permission.
+ */
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <sqlite3.h>
+
+#include "litestore/litestore.h"
+#include "litestore_test_common.h"
+
+
+namespace ls
+{
+using namespace ::testing;
+
+namespace
+{
+
+typedef std::vector<std::pair<std::string, std::string> > Pairs;
+
+int collect(litestore_slice_t key, litestore_blob_t value, void* user_data)
+{
+    Pairs* pairs = static_cast<Pairs*>(user_data);
+    pairs->push_back(std::make_pair(
+                         std::string(key.data, key.length),
+                         std::string(static_cast<const char*>(value.data),
+                                     value.size)));
+    return pairs->size() < 3 ? LITESTORE_OK : LITESTORE_ERR;
+}
+
+int denyDrop(void*, int action, const char*, const char*, const char*,
+             const char*)
+{
+    return action == SQLITE_DROP_TABLE ? SQLITE_DENY : SQLITE_OK;
+}
+
+struct LitestoreNamespaceTest : LitestoreTest
+{
+    std::string get(litestore_ns* ns, const std::string& key)
+    {
+        std::string value;
+        if (litestore_ns_get(ns, slice(key), &str2str, &value)
+            != LITESTORE_OK)
+        {
+            return "<missing>";
+        }
+        return value;
+    }
+    bool tableExists(const std::string& name)
+    {
+        sqlite3_stmt* stmt = NULL;
+        sqlite3_prepare_v2(db, "SELECT 1 FROM sqlite_master WHERE name = ?;",
+                           -1, &stmt, NULL);
+        sqlite3_bind_text(stmt, 1, name.c_str(), -1, SQLITE_STATIC);
+        const bool exists = sqlite3_step(stmt) == SQLITE_ROW;
+        sqlite3_finalize(stmt);
+        return exists;
+    }
+};
+
+}  // namespace
+
+TEST_F(LitestoreNamespaceTest, keys_are_separate)
+{
+    litestore_ns* users = NULL;
+    litestore_ns* groups = NULL;
+    ASSERT_LS_OK(litestore_ns_open(ctx, slice("users"), &users));
+    ASSERT_LS_OK(litestore_ns_open(ctx, slice("groups"), &groups));
+    litestore_ns* again = NULL;
+    ASSERT_LS_OK(litestore_ns_open(ctx, slice("users"), &again));
+    EXPECT_EQ(users, again);
+
+    ASSERT_LS_OK(litestore_create(ctx, slice("a"), blob("object")));
+    ASSERT_LS_OK(litestore_ns_put(users, slice("a"), blob("user")));
+    ASSERT_LS_OK(litestore_ns_put(groups, slice("a"), blob("group")));
+    EXPECT_EQ("user", get(users, "a"));
+    EXPECT_EQ("group", get(groups, "a"));
+    ASSERT_LS_OK(litestore_ns_put(users, slice("a"), blob("")));
+    EXPECT_EQ("", get(users, "a"));
+
+    ASSERT_LS_OK(litestore_ns_delete(groups, slice("a")));
+    EXPECT_EQ(LITESTORE_UNKNOWN_ENTITY,
+              litestore_ns_get(groups, slice("a"), &str2str, NULL));
+    EXPECT_EQ(LITESTORE_UNKNOWN_ENTITY,
+              litestore_ns_delete(groups, slice("a")));
+    EXPECT_EQ("", get(users, "a"));
+}
+
+TEST_F(LitestoreNamespaceTest, scan_is_ordered)
+{
+    litestore_ns* ns = NULL;
+    ASSERT_LS_OK(litestore_ns_open(ctx, slice("ns"), &ns));
+    ASSERT_LS_OK(litestore_begin_tx(ctx));
+    const char* keys[] = {"d", "b", "a", "e", "c"};
+    for (int i = 0; i < 5; ++i)
+    {
+        ASSERT_LS_OK(litestore_ns_put(ns, slice(keys[i]),
+                                      blob(std::string(keys[i]) + "v")));
+    }
+    ASSERT_LS_OK(litestore_commit_tx(ctx));
+
+    Pairs pairs;
+    // the callback stops after three
+    EXPECT_LS_ERR(litestore_ns_scan(ns, slice("b"), &collect, &pairs));
+    ASSERT_EQ(3u, pairs.size());
+    EXPECT_EQ("b", pairs[0].first);
+    EXPECT_EQ("bv", pairs[0].second);
+    EXPECT_EQ("d", pairs[2].first);
+
+    pairs.clear();
+    ASSERT_LS_OK(litestore_ns_scan(ns, slice("d"), &collect, &pairs));
+    ASSERT_EQ(2u, pairs.size());
+    EXPECT_EQ("e", pairs[1].first);
+    pairs.clear();
+    EXPECT_LS_ERR(litestore_ns_scan(ns, litestore_slice(NULL, 0, 0),
+                                    &collect, &pairs));
+    EXPECT_EQ("a", pairs[0].first);
+}
+
+TEST_F(LitestoreNamespaceTest, drop_removes_the_table)
+{
+    litestore_ns* ns = NULL;
+    ASSERT_LS_OK(litestore_ns_open(ctx, slice("ns"), &ns));
+    ASSERT_LS_OK(litestore_ns_put(ns, slice("a"), blob("a")));
+    EXPECT_TRUE(tableExists("ns_1"));
+
+    ASSERT_LS_OK(litestore_begin_tx(ctx));
+    EXPECT_LS_ERR(litestore_ns_drop(ctx, slice("ns")));
+    ASSERT_LS_OK(litestore_rollback_tx(ctx));
+    ASSERT_LS_OK(litestore_ns_drop(ctx, slice("ns")));
+    EXPECT_FALSE(tableExists("ns_1"));
+    EXPECT_EQ(LITESTORE_UNKNOWN_ENTITY,
+              litestore_ns_drop(ctx, slice("ns")));
+
+    // a new, empty namespace, the id is not reused
+    ASSERT_LS_OK(litestore_ns_open(ctx, slice("ns"), &ns));
+    EXPECT_EQ("<missing>", get(ns, "a"));
+    EXPECT_TRUE(tableExists("ns_2"));
+    EXPECT_FALSE(tableExists("ns_1"));
+}
+
+TEST_F(LitestoreNamespaceTest, failed_drop_keeps_the_handle)
+{
+    litestore_ns* ns = NULL;
+    ASSERT_LS_OK(litestore_ns_open(ctx, slice("ns"), &ns));
+    ASSERT_LS_OK(litestore_ns_put(ns, slice("a"), blob("a")));
+
+    sqlite3_set_authorizer(db, &denyDrop, NULL);
+    EXPECT_LS_ERR(litestore_ns_drop(ctx, slice("ns")));
+    sqlite3_set_authorizer(db, NULL, NULL);
+    EXPECT_TRUE(tableExists("ns_1"));
+    EXPECT_EQ("a", get(ns, "a"));
+    ASSERT_LS_OK(litestore_ns_put(ns, slice("b"), blob("b")));
+    EXPECT_EQ("b", get(ns, "b"));
+}
+
+TEST_F(LitestoreNamespaceTest, compression_is_per_namespace)
+{
+    litestore_ns* plain = NULL;
+    litestore_ns* packed = NULL;
+    ASSERT_LS_OK(litestore_ns_open(ctx, slice("plain"), &plain));
+    ASSERT_LS_OK(litestore_ns_open(ctx, slice("packed"), &packed));
+    ASSERT_LS_OK(litestore_ns_set_compression(packed, LITESTORE_CODEC_LZ));
+    EXPECT_LS_ERR(litestore_ns_set_compression(packed, 42));
+
+    const std::string value(10000, 'x');
+    ASSERT_LS_OK(litestore_ns_put(plain, slice("v"), blob(value)));
+    ASSERT_LS_OK(litestore_ns_put(packed, slice("v"), blob(value)));
+    EXPECT_EQ(value, get(plain, "v"));
+    EXPECT_EQ(value, get(packed, "v"));
+
+    sqlite3_stmt* stmt = NULL;
+    sqlite3_prepare_v2(db,
+                       "SELECT (SELECT codec FROM ns_1),"
+                       " (SELECT codec FROM ns_2);",
+                       -1, &stmt, NULL);
+    ASSERT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+    EXPECT_EQ(LITESTORE_CODEC_NONE, sqlite3_column_int(stmt, 0));
+    EXPECT_EQ(LITESTORE_CODEC_LZ, sqlite3_column_int(stmt, 1));
+    sqlite3_finalize(stmt);
+}
+
+TEST(LitestoreNamespace, namespaces_are_persisted)
+{
+    const std::string file("litestore_namespace_test.db");
+    remove(file.c_str());
+
+    litestore* ctx = NULL;
+    litestore_ns* ns = NULL;
+    ASSERT_LS_OK(litestore_open(file.c_str(), litestore_opts(), &ctx));
+    ASSERT_LS_OK(litestore_ns_open(ctx, slice("ns"), &ns));
+    ASSERT_LS_OK(litestore_ns_put(ns, slice("key"), blob("value")));
+    litestore_close(ctx);
+
+    ASSERT_LS_OK(litestore_open(file.c_str(), litestore_opts(), &ctx));
+    ASSERT_LS_OK(litestore_ns_open(ctx, slice("ns"), &ns));
+    std::string value;
+    ASSERT_LS_OK(litestore_ns_get(ns, slice("key"), &str2str, &value));
+    EXPECT_EQ("value", value);
+    litestore_close(ctx);
+    remove(file.c_str());
+}
+
+}  // namespace ls
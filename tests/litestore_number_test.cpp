@@ -0,0 +1,164 @@
+/**
+ * Copyright (c) 2014 Markku Linnoskivi
+ *
+ * See the file LICENSE.txt for copying permission.
+ */
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <string>
+
+#include <sqlite3.h>
+
+#include "litestore/litestore.h"
+#include "litestore_test_common.h"
+
+
+namespace ls
+{
+using namespace ::testing;
+
+namespace
+{
+
+int countStatements(unsigned, void* user_data, void*, void*)
+{
+    ++*static_cast<int*>(user_data);
+    return 0;
+}
+
+typedef LitestoreTest LitestoreNumberTest;
+
+}  // namespace
+
+TEST_F(LitestoreNumberTest, create_read_update)
+{
+    long long i = 0;
+    double f = 0;
+    ASSERT_LS_OK(litestore_create_int(ctx, slice("int"), -42));
+    ASSERT_LS_OK(litestore_create_float(ctx, slice("float"), 0.5));
+    EXPECT_LS_ERR(litestore_create_int(ctx, slice("int"), 1));
+
+    ASSERT_LS_OK(litestore_read_int(ctx, slice("int"), &i));
+    EXPECT_EQ(-42, i);
+    ASSERT_LS_OK(litestore_read_float(ctx, slice("float"), &f));
+    EXPECT_EQ(0.5, f);
+    EXPECT_LS_ERR(litestore_read_int(ctx, slice("float"), &i));
+    EXPECT_LS_ERR(litestore_read_float(ctx, slice("int"), &f));
+    EXPECT_LS_ERR(litestore_read_int(ctx, slice("none"), &i));
+
+    ASSERT_LS_OK(litestore_update_int(ctx, slice("int"),
+                                      std::numeric_limits<long long>::max()));
+    ASSERT_LS_OK(litestore_read_int(ctx, slice("int"), &i));
+    EXPECT_EQ(std::numeric_limits<long long>::max(), i);
+    // int to float and back
+    ASSERT_LS_OK(litestore_update_float(ctx, slice("int"), 1.25));
+    ASSERT_LS_OK(litestore_read_float(ctx, slice("int"), &f));
+    EXPECT_EQ(1.25, f);
+    ASSERT_LS_OK(litestore_update_int(ctx, slice("int"), 3));
+    ASSERT_LS_OK(litestore_read_int(ctx, slice("int"), &i));
+    EXPECT_EQ(3, i);
+    ASSERT_LS_OK(litestore_update_int(ctx, slice("new"), 7));
+    ASSERT_LS_OK(litestore_read_int(ctx, slice("new"), &i));
+    EXPECT_EQ(7, i);
+
+    EXPECT_LS_ERR(litestore_update_float(ctx, slice("float"), std::nan("")));
+}
+
+TEST_F(LitestoreNumberTest, incr)
+{
+    long long value = 0;
+    ASSERT_LS_OK(litestore_incr(ctx, slice("counter"), 5, &value));
+    EXPECT_EQ(5, value);
+    ASSERT_LS_OK(litestore_incr(ctx, slice("counter"), -7, &value));
+    EXPECT_EQ(-2, value);
+    ASSERT_LS_OK(litestore_incr(ctx, slice("counter"), 1, NULL));
+    ASSERT_LS_OK(litestore_read_int(ctx, slice("counter"), &value));
+    EXPECT_EQ(-1, value);
+
+    double f = 0;
+    ASSERT_LS_OK(litestore_incr_float(ctx, slice("sum"), 0.25, &f));
+    ASSERT_LS_OK(litestore_incr_float(ctx, slice("sum"), 0.5, &f));
+    EXPECT_EQ(0.75, f);
+
+    // type mismatch
+    EXPECT_LS_ERR(litestore_incr(ctx, slice("sum"), 1, &value));
+    EXPECT_LS_ERR(litestore_incr_float(ctx, slice("counter"), 1, &f));
+    ASSERT_LS_OK(litestore_create(ctx, slice("raw"), blob("1")));
+    EXPECT_LS_ERR(litestore_incr(ctx, slice("raw"), 1, &value));
+    std::string raw;
+    EXPECT_LS_OK(litestore_read(ctx, slice("raw"), &str2str, &raw));
+    EXPECT_EQ("1", raw);
+}
+
+TEST_F(LitestoreNumberTest, incr_overflow_fails)
+{
+    long long value = 0;
+    ASSERT_LS_OK(litestore_create_int(ctx, slice("counter"),
+                                      std::numeric_limits<long long>::max()));
+    EXPECT_LS_ERR(litestore_incr(ctx, slice("counter"), 1, &value));
+    ASSERT_LS_OK(litestore_read_int(ctx, slice("counter"), &value));
+    EXPECT_EQ(std::numeric_limits<long long>::max(), value);
+}
+
+TEST_F(LitestoreNumberTest, incr_is_a_single_statement)
+{
+    ASSERT_LS_OK(litestore_incr(ctx, slice("counter"), 1, NULL));
+    int statements = 0;
+    sqlite3_trace_v2(db, SQLITE_TRACE_STMT, &countStatements, &statements);
+    ASSERT_LS_OK(litestore_begin_tx(ctx));
+    statements = 0;
+    ASSERT_LS_OK(litestore_incr(ctx, slice("counter"), 1, NULL));
+    EXPECT_EQ(1, statements);
+    ASSERT_LS_OK(litestore_commit_tx(ctx));
+    sqlite3_trace_v2(db, 0, NULL, NULL);
+}
+
+TEST_F(LitestoreNumberTest, other_types_are_replaced)
+{
+    ASSERT_LS_OK(litestore_kv_set(ctx, slice("key"), slice("a"), blob("1")));
+    ASSERT_LS_OK(litestore_update_int(ctx, slice("key"), 1));
+    ASSERT_LS_OK(litestore_update(ctx, slice("key"), blob("raw")));
+    ASSERT_LS_OK(litestore_update_float(ctx, slice("key"), 2.5));
+    ASSERT_LS_OK(litestore_update_null(ctx, slice("key")));
+    ASSERT_LS_OK(litestore_create_int(ctx, slice("deleted"), 1));
+    ASSERT_LS_OK(litestore_delete(ctx, slice("deleted")));
+
+    sqlite3_stmt* stmt = NULL;
+    sqlite3_prepare_v2(db,
+                       "SELECT (SELECT count(*) FROM num_data)"
+                       " + (SELECT count(*) FROM raw_data)"
+                       " + (SELECT count(*) FROM kv_data);",
+                       -1, &stmt, NULL);
+    ASSERT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+    EXPECT_EQ(0, sqlite3_column_int(stmt, 0));
+    sqlite3_finalize(stmt);
+}
+
+TEST_F(LitestoreNumberTest, export_and_import)
+{
+    ASSERT_LS_OK(litestore_create_int(ctx, slice("int"), -1234567890123LL));
+    ASSERT_LS_OK(litestore_create_float(ctx, slice("float"), -0.1));
+
+    FILE* file = tmpfile();
+    ASSERT_TRUE(file != NULL);
+    ASSERT_LS_OK(litestore_export(ctx, fileno(file)));
+    rewind(file);
+
+    litestore* target = NULL;
+    ASSERT_LS_OK(litestore_open(":memory:", litestore_opts(), &target));
+    EXPECT_LS_OK(litestore_import(target, fileno(file)));
+    fclose(file);
+
+    long long i = 0;
+    double f = 0;
+    ASSERT_LS_OK(litestore_read_int(target, slice("int"), &i));
+    EXPECT_EQ(-1234567890123LL, i);
+    ASSERT_LS_OK(litestore_read_float(target, slice("float"), &f));
+    EXPECT_EQ(-0.1, f);
+    litestore_close(target);
+}
+
+}  // namespace ls
@@ -0,0 +1,186 @@
+/**
+ * Copyright (c) 2014 Markku Linnoskivi
+ *
+ * See the file LICENSE.txt for copying permission.
+ */
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <sqlite3.h>
+
+#include "litestore/litestore.h"
+#include "litestore_schema.h"
+#include "litestore_test_common.h"
+
+
+namespace ls
+{
+using namespace ::testing;
+
+namespace
+{
+
+const int currentVersion = LITESTORE_CURRENT_VERSION;
+
+// The schema steps, a store of version n has the first n applied.
+const char* const schemaSteps[] = {
+    LITESTORE_SCHEMA_V1 "INSERT INTO meta (schema_version) VALUES (1);",
+    LITESTORE_SCHEMA_V2,
+    LITESTORE_SCHEMA_V3,
+    LITESTORE_SCHEMA_V4,
+    LITESTORE_SCHEMA_V5,
+    LITESTORE_SCHEMA_V6,
+    LITESTORE_SCHEMA_V7,
+    LITESTORE_SCHEMA_V8,
+    LITESTORE_SCHEMA_V9,
+    LITESTORE_SCHEMA_V10,
+    LITESTORE_SCHEMA_V11,
+    LITESTORE_SCHEMA_V12,
+    LITESTORE_SCHEMA_V13,
+    LITESTORE_SCHEMA_V14
+};
+
+/**
+ * The query plan of a statement, one line per step.
+ * Parameters are bound to a key prefix pattern, so that GLOB can use
+ * the index as it does for the key listing.
+ */
+std::vector<std::string> queryPlan(sqlite3* db, const std::string& sql)
+{
+    std::vector<std::string> plan;
+    const std::string explain("EXPLAIN QUERY PLAN " + sql);
+    sqlite3_stmt* stmt = NULL;
+    if (sqlite3_prepare_v2(db, explain.c_str(), -1, &stmt, NULL)
+        != SQLITE_OK)
+    {
+        throw std::runtime_error("Failed to explain: " + sql);
+    }
+    for (int i = 1; i <= sqlite3_bind_parameter_count(stmt); ++i)
+    {
+        sqlite3_bind_text(stmt, i, "key*", -1, SQLITE_STATIC);
+    }
+    while (sqlite3_step(stmt) == SQLITE_ROW)
+    {
+        plan.push_back(reinterpret_cast<const char*>(
+                           sqlite3_column_text(stmt, 3)));
+    }
+    sqlite3_finalize(stmt);
+    return plan;
+}
+
+/**
+ * Check the plans of all the statements prepared by the store.
+ *
+ * @return Number of statements checked.
+ */
+int expectIndexedPlans(litestore* ctx)
+{
+    sqlite3* db = static_cast<sqlite3*>(litestore_native_ctx(ctx));
+    int checked = 0;
+    for (sqlite3_stmt* s = sqlite3_next_stmt(db, NULL); s;
+         s = sqlite3_next_stmt(db, s))
+    {
+        const std::string sql(sqlite3_sql(s));
+        const std::vector<std::string> plan = queryPlan(db, sql);
+        for (size_t i = 0; i < plan.size(); ++i)
+        {
+            // "SCAN TABLE x" before SQLite 3.24, "SCAN x" after
+            EXPECT_NE(0, plan[i].compare(0, 5, "SCAN "))
+                << sql << ": " << plan[i];
+            EXPECT_EQ(std::string::npos, plan[i].find("TEMP B-TREE"))
+                << sql << ": " << plan[i];
+        }
+        ++checked;
+    }
+    return checked;
+}
+
+int schemaVersion(litestore* ctx)
+{
+    sqlite3* db = static_cast<sqlite3*>(litestore_native_ctx(ctx));
+    sqlite3_stmt* stmt = NULL;
+    int version = -1;
+    sqlite3_prepare_v2(db, "SELECT schema_version FROM meta;", -1, &stmt,
+                       NULL);
+    if (sqlite3_step(stmt) == SQLITE_ROW)
+    {
+        version = sqlite3_column_int(stmt, 0);
+    }
+    sqlite3_finalize(stmt);
+    return version;
+}
+
+}  // namespace
+
+TEST(LitestoreQueryPlan, new_store_uses_indexes)
+{
+    litestore* ctx = NULL;
+    ASSERT_LS_OK(litestore_open(":memory:", litestore_opts(), &ctx));
+    EXPECT_EQ(currentVersion, schemaVersion(ctx));
+    EXPECT_EQ(51, expectIndexedPlans(ctx));
+    litestore_close(ctx);
+}
+
+TEST(LitestoreQueryPlan, namespaces_use_indexes)
+{
+    litestore* ctx = NULL;
+    litestore_ns* ns = NULL;
+    ASSERT_LS_OK(litestore_open(":memory:", litestore_opts(), &ctx));
+    ASSERT_LS_OK(litestore_ns_open(ctx, slice("ns"), &ns));
+    EXPECT_EQ(55, expectIndexedPlans(ctx));
+    litestore_close(ctx);
+}
+
+TEST(LitestoreQueryPlan, json_indexes_use_indexes)
+{
+    litestore* ctx = NULL;
+    litestore_json_index* index = NULL;
+    ASSERT_LS_OK(litestore_open(":memory:", litestore_opts(), &ctx));
+    ASSERT_LS_OK(litestore_json_index_open(ctx, slice("$.user.age"),
+                                           &index));
+    EXPECT_EQ(53, expectIndexedPlans(ctx));
+    litestore_close(ctx);
+}
+
+TEST(LitestoreQueryPlan, stored_versions_are_migrated)
+{
+    const std::string file("litestore_query_plan_test.db");
+    ASSERT_EQ(sizeof(schemaSteps) / sizeof(schemaSteps[0]),
+              static_cast<size_t>(currentVersion));
+
+    for (int version = 1; version < currentVersion; ++version)
+    {
+        SCOPED_TRACE("schema version " + std::to_string(version));
+        remove(file.c_str());
+
+        sqlite3* db = NULL;
+        ASSERT_EQ(SQLITE_OK, sqlite3_open(file.c_str(), &db));
+        for (int i = 0; i < version; ++i)
+        {
+            ASSERT_EQ(SQLITE_OK,
+                      sqlite3_exec(db, schemaSteps[i], NULL, NULL, NULL));
+        }
+        ASSERT_EQ(SQLITE_OK,
+                  sqlite3_exec(
+                      db,
+                      "INSERT INTO objects (id, name, type)"
+                      " VALUES (1, 'key', 1);"
+                      "INSERT INTO raw_data (id, raw_value) VALUES (1, 'v');",
+                      NULL, NULL, NULL));
+        sqlite3_close(db);
+
+        litestore* ctx = NULL;
+        ASSERT_LS_OK(litestore_open(file.c_str(), litestore_opts(), &ctx));
+        EXPECT_EQ(currentVersion, schemaVersion(ctx));
+        EXPECT_EQ(51, expectIndexedPlans(ctx));
+        EXPECT_EQ("v", readValue(ctx, "key"));
+        EXPECT_LS_OK(litestore_delete(ctx, slice("key")));
+        litestore_close(ctx);
+    }
+    remove(file.c_str());
+}
+
+}  // namespace ls
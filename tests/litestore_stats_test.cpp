@@ -0,0 +1,204 @@
+/**
+ * Copyright (c) 2014 Markku Linnoskivi
+ *
+ * See the file LICENSE.txt for copying permission.
+ */
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+
+#include "litestore/litestore.h"
+#include "litestore_test_common.h"
+
+
+namespace ls
+{
+using namespace ::testing;
+
+namespace
+{
+
+int ignoreValue(litestore_blob_t, void*)
+{
+    return LITESTORE_OK;
+}
+
+struct LitestoreStatsTest : LitestoreTest
+{
+    litestore_stats_t stats()
+    {
+        litestore_stats_t s;
+        if (litestore_stats_get(ctx, &s) != LITESTORE_OK)
+        {
+            throw std::runtime_error("stats_get failed");
+        }
+        return s;
+    }
+};
+
+}  // namespace
+
+TEST_F(LitestoreStatsTest, nothing_recorded_after_open)
+{
+    const litestore_stats_t s = stats();
+    for (int op = 0; op < LITESTORE_OP_COUNT; ++op)
+    {
+        EXPECT_EQ(0, s.exec[op].count);
+        EXPECT_EQ(0, s.lock_wait[op].count);
+    }
+}
+
+TEST_F(LitestoreStatsTest, operations_are_recorded)
+{
+    const std::string value("value");
+    EXPECT_LS_OK(litestore_create(ctx, slice("a"), blob(value)));
+    EXPECT_LS_OK(litestore_create_null(ctx, slice("b")));
+    EXPECT_LS_OK(litestore_read(ctx, slice("a"), &ignoreValue, NULL));
+    EXPECT_LS_OK(litestore_update(ctx, slice("a"), blob(value)));
+    // update of a missing key creates, counted as one update
+    EXPECT_LS_OK(litestore_update(ctx, slice("c"), blob(value)));
+    EXPECT_LS_OK(litestore_delete(ctx, slice("a")));
+
+    const litestore_stats_t s = stats();
+    EXPECT_EQ(2, s.exec[LITESTORE_OP_CREATE].count);
+    EXPECT_EQ(1, s.exec[LITESTORE_OP_READ].count);
+    EXPECT_EQ(2, s.exec[LITESTORE_OP_UPDATE].count);
+    EXPECT_EQ(1, s.exec[LITESTORE_OP_DELETE].count);
+    // implicit transactions are part of the operations
+    EXPECT_EQ(0, s.exec[LITESTORE_OP_BEGIN_TX].count);
+    EXPECT_EQ(0, s.exec[LITESTORE_OP_COMMIT_TX].count);
+    EXPECT_EQ(1, s.lock_wait[LITESTORE_OP_READ].count);
+    EXPECT_EQ(0, s.lock_wait[LITESTORE_OP_READ].max_ns);
+
+    const litestore_histogram_t& create = s.exec[LITESTORE_OP_CREATE];
+    long long bucketTotal = 0;
+    for (int i = 0; i < LITESTORE_HISTOGRAM_BUCKETS; ++i)
+    {
+        bucketTotal += create.buckets[i];
+    }
+    EXPECT_EQ(create.count, bucketTotal);
+    EXPECT_GT(create.max_ns, 0);
+    EXPECT_GE(create.total_ns, create.max_ns);
+}
+
+TEST_F(LitestoreStatsTest, explicit_transactions_are_recorded)
+{
+    EXPECT_LS_OK(litestore_begin_tx(ctx));
+    EXPECT_LS_OK(litestore_create_null(ctx, slice("a")));
+    EXPECT_LS_OK(litestore_commit_tx(ctx));
+    EXPECT_LS_OK(litestore_begin_tx(ctx));
+    EXPECT_LS_OK(litestore_rollback_tx(ctx));
+
+    const litestore_stats_t s = stats();
+    EXPECT_EQ(2, s.exec[LITESTORE_OP_BEGIN_TX].count);
+    EXPECT_EQ(1, s.exec[LITESTORE_OP_COMMIT_TX].count);
+    EXPECT_EQ(1, s.exec[LITESTORE_OP_ROLLBACK_TX].count);
+    EXPECT_EQ(1, s.exec[LITESTORE_OP_CREATE].count);
+}
+
+TEST_F(LitestoreStatsTest, reset_clears)
+{
+    EXPECT_LS_OK(litestore_create_null(ctx, slice("a")));
+    EXPECT_LS_OK(litestore_stats_reset(ctx));
+
+    const litestore_stats_t s = stats();
+    EXPECT_EQ(0, s.exec[LITESTORE_OP_CREATE].count);
+    EXPECT_EQ(0, s.exec[LITESTORE_OP_CREATE].max_ns);
+}
+
+TEST(LitestoreHistogram, percentiles_are_ordered)
+{
+    litestore_histogram_t h = litestore_histogram_t();
+    EXPECT_EQ(0, litestore_histogram_percentile(&h, 50.0));
+
+    litestore* ctx = NULL;
+    ASSERT_LS_OK(litestore_open(":memory:", litestore_opts(), &ctx));
+    for (int i = 0; i < 100; ++i)
+    {
+        ASSERT_LS_OK(litestore_create_null(ctx, slice(std::to_string(i))));
+    }
+    litestore_stats_t s;
+    ASSERT_LS_OK(litestore_stats_get(ctx, &s));
+    litestore_close(ctx);
+
+    const litestore_histogram_t& c = s.exec[LITESTORE_OP_CREATE];
+    const long long p50 = litestore_histogram_percentile(&c, 50.0);
+    const long long p99 = litestore_histogram_percentile(&c, 99.0);
+    EXPECT_GT(p50, 0);
+    EXPECT_LE(p50, p99);
+    EXPECT_LE(p99, c.max_ns);
+    EXPECT_EQ(c.max_ns, litestore_histogram_percentile(&c, 100.0));
+}
+
+TEST(LitestoreLockWait, lock_wait_is_separated)
+{
+    const std::string file("litestore_stats_test.db");
+    remove(file.c_str());
+
+    litestore_opts opts = litestore_opts();
+    opts.busy_timeout = 5000;
+    litestore* holder = NULL;
+    litestore* waiter = NULL;
+    ASSERT_LS_OK(litestore_open(file.c_str(), opts, &holder));
+    ASSERT_LS_OK(litestore_open(file.c_str(), opts, &waiter));
+
+    ASSERT_LS_OK(litestore_begin_tx(holder));
+    ASSERT_LS_OK(litestore_create_null(holder, slice("held")));
+    std::thread release([holder]() {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            litestore_commit_tx(holder);
+        });
+    EXPECT_LS_OK(litestore_create_null(waiter, slice("waited")));
+    release.join();
+
+    litestore_stats_t s;
+    ASSERT_LS_OK(litestore_stats_get(waiter, &s));
+    const long long ms = 1000000;
+    EXPECT_GE(s.lock_wait[LITESTORE_OP_CREATE].max_ns, 50 * ms);
+    EXPECT_LT(s.exec[LITESTORE_OP_CREATE].max_ns, 50 * ms);
+
+    litestore_close(waiter);
+    litestore_close(holder);
+    remove(file.c_str());
+}
+
+TEST(LitestoreIoStats, io_is_attributed_to_operations)
+{
+    const std::string file("litestore_io_stats_test.db");
+    remove(file.c_str());
+
+    litestore* ctx = NULL;
+    ASSERT_LS_OK(litestore_open(file.c_str(), litestore_opts(), &ctx));
+    const std::string value(1000, 'v');
+    EXPECT_LS_OK(litestore_create(ctx, slice("a"), blob(value)));
+    litestore_io_stats_t io;
+    ASSERT_LS_OK(litestore_io_stats(ctx, &io));
+    EXPECT_GT(io.ops[LITESTORE_OP_CREATE].cache_write, 0);
+    EXPECT_EQ(0, io.ops[LITESTORE_OP_READ].cache_hit);
+    EXPECT_GT(io.schema_used, 0);
+    EXPECT_GT(io.stmt_used, 0);
+    EXPECT_EQ(0, io.wal_size);
+    litestore_close(ctx);
+
+    // fresh connection, pages come from the file
+    ASSERT_LS_OK(litestore_open(file.c_str(), litestore_opts(), &ctx));
+    EXPECT_LS_OK(litestore_read(ctx, slice("a"), &ignoreValue, NULL));
+    ASSERT_LS_OK(litestore_io_stats(ctx, &io));
+    const litestore_io_counters_t& read = io.ops[LITESTORE_OP_READ];
+    EXPECT_GT(read.cache_miss, 0);
+    EXPECT_EQ(0, read.cache_write);
+    EXPECT_GE(io.total.cache_miss, read.cache_miss);
+    EXPECT_GE(io.total.cache_hit, read.cache_hit);
+
+    ASSERT_LS_OK(litestore_stats_reset(ctx));
+    ASSERT_LS_OK(litestore_io_stats(ctx, &io));
+    EXPECT_EQ(0, io.total.cache_miss);
+    EXPECT_EQ(0, io.ops[LITESTORE_OP_READ].cache_miss);
+    litestore_close(ctx);
+    remove(file.c_str());
+}
+
+}  // namespace ls
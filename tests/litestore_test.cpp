@@ -140,7 +140,7 @@ TEST_F(LitestoreRawTest, check_version)
             NULL));
     if (sqlite3_step(s) == SQLITE_ROW)
     {
-        EXPECT_EQ(1, sqlite3_column_int(s, 0));
+        EXPECT_EQ(14, sqlite3_column_int(s, 0));
         sqlite3_finalize(s);
     }
     else
@@ -373,4 +373,76 @@ TEST_F(LitestoreRawTx, read_keys_no_match)
     ASSERT_TRUE(keys.empty());
 }
 
+TEST_F(LitestoreRawTx, binary_keys)
+{
+    const std::string k1("a\0b", 3);
+    const std::string k2("a\xff", 2);
+    const std::string k3("a", 1);
+
+    ASSERT_LS_OK(litestore_create(ctx, slice(k1), blob("v1")));
+    ASSERT_LS_OK(litestore_create(ctx, slice(k2), blob("v2")));
+    ASSERT_LS_OK(litestore_create(ctx, slice(k3), blob("v3")));
+    std::string value;
+    ASSERT_LS_OK(litestore_read(ctx, slice(k1), &void2str, &value));
+    EXPECT_EQ("v1", value);
+    ASSERT_LS_OK(litestore_read(ctx, slice(k2), &void2str, &value));
+    EXPECT_EQ("v2", value);
+
+    std::vector<std::pair<std::string, int> > keys;
+    EXPECT_LS_OK(litestore_read_key_range(
+                     ctx, slice(k3), litestore_slice(NULL, 0, 0),
+                     &vecPushBack, &keys));
+    ASSERT_EQ(3u, keys.size());
+    EXPECT_EQ(k3, keys[0].first);
+    EXPECT_EQ(k1, keys[1].first);
+    EXPECT_EQ(k2, keys[2].first);
+}
+
+TEST_F(LitestoreRawTx, read_key_range_with_composite_keys)
+{
+    for (int tenant = 1; tenant <= 3; ++tenant)
+    {
+        for (long long time = -2; time <= 2; ++time)
+        {
+            char buf[64];
+            size_t size = litestore_key_int(tenant, buf);
+            size += litestore_key_int(time * 1000, buf + size);
+            size += litestore_key_str(slice("event"), buf + size);
+            ASSERT_LS_OK(litestore_create_null(
+                             ctx, litestore_slice(buf, 0, size)));
+        }
+    }
+
+    char first[2 * LITESTORE_KEY_INT_SIZE];
+    char last[LITESTORE_KEY_INT_SIZE];
+    size_t size = litestore_key_int(2, first);
+    size += litestore_key_int(-1000, first + size);
+    const size_t lastSize =
+        litestore_key_prefix_end(last, litestore_key_int(2, last));
+
+    std::vector<std::pair<std::string, int> > keys;
+    EXPECT_LS_OK(litestore_read_key_range(
+                     ctx, litestore_slice(first, 0, size),
+                     litestore_slice(last, 0, lastSize),
+                     &vecPushBack, &keys));
+    ASSERT_EQ(4u, keys.size());
+    long long tenant = 0;
+    long long time = 0;
+    for (size_t i = 0; i < keys.size(); ++i)
+    {
+        const litestore_slice_t k = slice(keys[i].first);
+        ASSERT_EQ(8u, litestore_key_read_int(k, &tenant));
+        ASSERT_EQ(8u, litestore_key_read_int(
+                      litestore_slice(k.data, 8, k.length), &time));
+        EXPECT_EQ(2, tenant);
+        EXPECT_EQ((static_cast<long long>(i) - 1) * 1000, time);
+    }
+
+    keys.clear();
+    EXPECT_LS_OK(litestore_read_key_range(
+                     ctx, litestore_slice(last, 0, lastSize),
+                     litestore_slice(NULL, 0, 0), &vecPushBack, &keys));
+    EXPECT_EQ(5u, keys.size());
+}
+
 }  // namespace ls
@@ -57,7 +57,9 @@ struct LitestoreTest : Test
           db(NULL),
           errors(0)
     {
-        litestore_opts opts = {&errorCB, this};
+        litestore_opts opts = litestore_opts();
+        opts.error_callback = &errorCB;
+        opts.err_user_data = this;
         if (litestore_open(":memory:", opts, &ctx) != LITESTORE_OK)
         {
             throw std::runtime_error("Faild to open DB!");
@@ -142,4 +144,30 @@ litestore_blob_t blob(const std::string& str)
     return litestore_make_blob(str.c_str(), str.length());
 }
 
+// Read callback, copies the value to the std::string in user_data.
+inline
+int str2str(litestore_blob_t value, void* user_data)
+{
+    static_cast<std::string*>(user_data)->assign(
+        static_cast<const char*>(value.data), value.size);
+    return LITESTORE_OK;
+}
+
+// Error callback of stores that are expected to fail.
+inline
+void ignoreError(const int, const char*, void*)
+{}
+
+// The raw value of a key, "<missing>" if it can not be read.
+inline
+std::string readValue(litestore* ctx, const std::string& key)
+{
+    std::string value;
+    if (litestore_read(ctx, slice(key), &str2str, &value) != LITESTORE_OK)
+    {
+        return "<missing>";
+    }
+    return value;
+}
+
 }  // namespace ns
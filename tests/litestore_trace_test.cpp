@@ -0,0 +1,132 @@
+/**
+ * Copyright (c) 2014 Markku Linnoskivi
+ *
+ * See the file LICENSE.txt for copying permission.
+ */
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include "litestore/litestore.h"
+#include "litestore_test_common.h"
+
+
+namespace ls
+{
+using namespace ::testing;
+
+namespace
+{
+
+struct Trace
+{
+    std::string operation;
+    std::string sql;
+    long long elapsed_ns;
+    int rows;
+    int vm_steps;
+};
+
+void collect(const litestore_trace_info* info, void* user_data)
+{
+    Trace t;
+    t.operation = info->operation;
+    t.sql = info->sql;
+    t.elapsed_ns = info->elapsed_ns;
+    t.rows = info->rows;
+    t.vm_steps = info->vm_steps;
+    static_cast<std::vector<Trace>*>(user_data)->push_back(t);
+}
+
+bool isTx(const Trace& t)
+{
+    return t.operation.find("_tx") != std::string::npos;
+}
+
+int ignoreValue(litestore_blob_t, void*)
+{
+    return LITESTORE_OK;
+}
+
+struct LitestoreTraceTest : Test
+{
+    LitestoreTraceTest()
+        : ctx(NULL)
+    {
+        litestore_opts opts = litestore_opts();
+        opts.trace_callback = &collect;
+        opts.trace_user_data = &traces;
+        if (litestore_open(":memory:", opts, &ctx) != LITESTORE_OK)
+        {
+            throw std::runtime_error("Failed to open");
+        }
+        traces.clear();
+    }
+    ~LitestoreTraceTest()
+    {
+        litestore_close(ctx);
+    }
+
+    std::vector<Trace> traces;
+    litestore* ctx;
+};
+
+}  // namespace
+
+TEST_F(LitestoreTraceTest, statements_are_reported_per_operation)
+{
+    const std::string value("value");
+    EXPECT_LS_OK(litestore_create(ctx, slice("a"), blob(value)));
+    ASSERT_FALSE(traces.empty());
+    // the implicit transaction is reported as its own operations
+    EXPECT_EQ("begin_tx", traces.front().operation);
+    EXPECT_EQ("commit_tx", traces.back().operation);
+    for (size_t i = 1; i + 1 < traces.size(); ++i)
+    {
+        EXPECT_EQ("gen_create", traces[i].operation);
+        EXPECT_FALSE(traces[i].sql.empty());
+        EXPECT_GT(traces[i].vm_steps, 0);
+    }
+
+    traces.clear();
+    EXPECT_LS_OK(litestore_read(ctx, slice("a"), &ignoreValue, NULL));
+    ASSERT_FALSE(traces.empty());
+    bool valueRead = false;
+    for (size_t i = 1; i + 1 < traces.size(); ++i)
+    {
+        EXPECT_EQ("gen_read", traces[i].operation);
+        if (traces[i].sql.find("raw_data") != std::string::npos)
+        {
+            valueRead = true;
+            EXPECT_EQ(1, traces[i].rows);
+        }
+    }
+    EXPECT_TRUE(valueRead);
+}
+
+TEST_F(LitestoreTraceTest, innermost_operation_is_reported)
+{
+    // update of a missing key goes through create
+    EXPECT_LS_OK(litestore_update(ctx, slice("a"), blob("value")));
+    bool updated = false;
+    bool created = false;
+    for (size_t i = 0; i < traces.size(); ++i)
+    {
+        updated = updated || traces[i].operation == "gen_update";
+        created = created || traces[i].operation == "gen_create";
+        EXPECT_TRUE(isTx(traces[i]) || updated);
+    }
+    EXPECT_TRUE(updated);
+    EXPECT_TRUE(created);
+}
+
+TEST(LitestoreTrace, disabled_by_default)
+{
+    litestore* ctx = NULL;
+    ASSERT_LS_OK(litestore_open(":memory:", litestore_opts(), &ctx));
+    EXPECT_LS_OK(litestore_create_null(ctx, slice("a")));
+    litestore_close(ctx);
+}
+
+}  // namespace ls
@@ -0,0 +1,279 @@
+/**
+ * Copyright (c) 2014 Markku Linnoskivi
+ *
+ * See the file LICENSE.txt for copying permission.
+ */
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <fstream>
+#include <string>
+
+#include <sqlite3.h>
+
+#include "litestore/litestore.h"
+#include "litestore_test_common.h"
+
+
+namespace ls
+{
+using namespace ::testing;
+
+namespace
+{
+
+bool exists(const std::string& path)
+{
+    return std::ifstream(path.c_str()).good();
+}
+
+std::string largeValue(int i)
+{
+    return std::string(4000, static_cast<char>('a' + i % 26))
+        + std::to_string(i);
+}
+
+struct LitestoreValueLogTest : Test
+{
+    LitestoreValueLogTest()
+        : file("litestore_value_log_test.db"),
+          ctx(NULL)
+    {
+        removeAll();
+        open();
+    }
+    virtual ~LitestoreValueLogTest()
+    {
+        litestore_close(ctx);
+        removeAll();
+    }
+    litestore* openStore()
+    {
+        litestore_opts opts = litestore_opts();
+        opts.error_callback = &ignoreError;
+        opts.value_log_threshold = 1024;
+        opts.value_log_segment_size = 64 * 1024;
+        litestore* store = NULL;
+        if (litestore_open(file.c_str(), opts, &store) != LITESTORE_OK)
+        {
+            throw std::runtime_error("Faild to open DB!");
+        }
+        return store;
+    }
+    void open()
+    {
+        ctx = openStore();
+    }
+    void reopen()
+    {
+        litestore_close(ctx);
+        open();
+    }
+    std::string segment(int n) const
+    {
+        return file + "-vlog." + std::to_string(n);
+    }
+    void removeAll()
+    {
+        remove(file.c_str());
+        remove((file + "-wal").c_str());
+        remove((file + "-shm").c_str());
+        for (int i = 1; i < 100; ++i)
+        {
+            remove(segment(i).c_str());
+        }
+    }
+    void populate(int count)
+    {
+        ASSERT_LS_OK(litestore_begin_tx(ctx));
+        for (int i = 0; i < count; ++i)
+        {
+            const std::string value(largeValue(i));
+            ASSERT_LS_OK(litestore_update(ctx, slice(std::to_string(i)),
+                                          blob(value)));
+        }
+        ASSERT_LS_OK(litestore_commit_tx(ctx));
+    }
+    litestore_vlog_stats_t stats()
+    {
+        litestore_vlog_stats_t s;
+        if (litestore_vlog_stats(ctx, &s) != LITESTORE_OK)
+        {
+            throw std::runtime_error("vlog_stats failed");
+        }
+        return s;
+    }
+
+    const std::string file;
+    litestore* ctx;
+};
+
+}  // namespace
+
+TEST_F(LitestoreValueLogTest, large_values_are_logged)
+{
+    populate(100);
+    ASSERT_LS_OK(litestore_create(ctx, slice("small"), blob("small")));
+
+    const litestore_vlog_stats_t s = stats();
+    EXPECT_GT(s.segments, 1);
+    EXPECT_EQ(s.size, s.live);
+    EXPECT_GE(s.live, 100 * 4000);
+    EXPECT_TRUE(exists(segment(1)));
+    sqlite3* db = static_cast<sqlite3*>(litestore_native_ctx(ctx));
+    sqlite3_stmt* stmt = NULL;
+    sqlite3_prepare_v2(db, "SELECT total(length(raw_value)) FROM raw_data;",
+                       -1, &stmt, NULL);
+    ASSERT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+    EXPECT_EQ(5, sqlite3_column_int(stmt, 0));
+    sqlite3_finalize(stmt);
+
+    reopen();
+    for (int i = 0; i < 100; ++i)
+    {
+        ASSERT_EQ(largeValue(i), readValue(ctx, std::to_string(i)));
+    }
+    EXPECT_EQ("small", readValue(ctx, "small"));
+}
+
+TEST_F(LitestoreValueLogTest, rolled_back_values_are_not_referenced)
+{
+    populate(10);
+    const litestore_vlog_stats_t before = stats();
+    ASSERT_LS_OK(litestore_begin_tx(ctx));
+    const std::string value(largeValue(42));
+    ASSERT_LS_OK(litestore_update(ctx, slice("1"), blob(value)));
+    ASSERT_LS_OK(litestore_create(ctx, slice("new"), blob(value)));
+    ASSERT_LS_OK(litestore_rollback_tx(ctx));
+
+    EXPECT_EQ(before.live, stats().live);
+    EXPECT_EQ(largeValue(1), readValue(ctx, "1"));
+    EXPECT_EQ("<missing>", readValue(ctx, "new"));
+    // appended after the garbage
+    ASSERT_LS_OK(litestore_create(ctx, slice("new"), blob(value)));
+    EXPECT_EQ(value, readValue(ctx, "new"));
+}
+
+TEST_F(LitestoreValueLogTest, rolled_back_values_are_garbage)
+{
+    populate(10);
+    ASSERT_LS_OK(litestore_begin_tx(ctx));
+    for (int i = 10; i < 16; ++i)
+    {
+        ASSERT_LS_OK(litestore_create(ctx, slice(std::to_string(i)),
+                                      blob(largeValue(i))));
+    }
+    ASSERT_LS_OK(litestore_rollback_tx(ctx));
+    EXPECT_EQ(1, stats().segments);
+
+    // the next segment is started after the garbage
+    ASSERT_LS_OK(litestore_create(ctx, slice("new"), blob(largeValue(16))));
+    const litestore_vlog_stats_t s = stats();
+    EXPECT_EQ(2, s.segments);
+    EXPECT_GE(s.size - s.live, 6 * 4000);
+}
+
+TEST_F(LitestoreValueLogTest, garbage_is_collected)
+{
+    populate(100);
+    const int segments = stats().segments;
+    // overwrite with small values and delete most of them
+    for (int i = 0; i < 100; ++i)
+    {
+        const std::string key(std::to_string(i));
+        if (i % 10 == 0)
+        {
+            continue;
+        }
+        ASSERT_LS_OK(i % 2 ? litestore_delete(ctx, slice(key))
+                     : litestore_update(ctx, slice(key), blob("tiny")));
+    }
+    EXPECT_LT(stats().live * 5, stats().size);
+
+    int rv = LITESTORE_IN_PROGRESS;
+    int steps = 0;
+    while (rv == LITESTORE_IN_PROGRESS)
+    {
+        rv = litestore_vlog_gc_step(ctx, 3);
+        ++steps;
+    }
+    ASSERT_LS_OK(rv);
+    EXPECT_GT(steps, 2);
+
+    const litestore_vlog_stats_t s = stats();
+    EXPECT_LT(s.segments, segments);
+    EXPECT_FALSE(exists(segment(1)));
+    EXPECT_GE(s.live * 2, s.size - 64 * 1024);
+    reopen();
+    for (int i = 0; i < 100; i += 10)
+    {
+        ASSERT_EQ(largeValue(i), readValue(ctx, std::to_string(i)));
+    }
+    EXPECT_EQ("tiny", readValue(ctx, "2"));
+    EXPECT_EQ("<missing>", readValue(ctx, "3"));
+}
+
+TEST_F(LitestoreValueLogTest, emptied_segments_outlive_older_snapshots)
+{
+    sqlite3* db = static_cast<sqlite3*>(litestore_native_ctx(ctx));
+    ASSERT_EQ(SQLITE_OK, sqlite3_exec(db, "PRAGMA journal_mode = WAL;",
+                                      NULL, NULL, NULL));
+    populate(100);
+    // a reader holding a snapshot, the store's own transactions write
+    litestore* reader = openStore();
+    sqlite3* rdb = static_cast<sqlite3*>(litestore_native_ctx(reader));
+    ASSERT_EQ(SQLITE_OK, sqlite3_exec(rdb,
+                                      "BEGIN; SELECT count(*) FROM objects;",
+                                      NULL, NULL, NULL));
+
+    for (int i = 1; i < 100; ++i)
+    {
+        if (i % 10)
+        {
+            ASSERT_LS_OK(litestore_delete(ctx, slice(std::to_string(i))));
+        }
+    }
+    int rv = LITESTORE_IN_PROGRESS;
+    while (rv == LITESTORE_IN_PROGRESS)
+    {
+        rv = litestore_vlog_gc_step(ctx, 10);
+    }
+    ASSERT_LS_OK(rv);
+    EXPECT_LT(stats().segments, 3);
+
+    // the reader still sees the values in the emptied segments
+    EXPECT_TRUE(exists(segment(1)));
+    EXPECT_EQ(largeValue(0), readValue(reader, "0"));
+    EXPECT_EQ(largeValue(1), readValue(reader, "1"));
+    ASSERT_EQ(SQLITE_OK, sqlite3_exec(rdb, "COMMIT;", NULL, NULL, NULL));
+
+    ASSERT_LS_OK(litestore_vlog_gc_step(ctx, 10));
+    EXPECT_FALSE(exists(segment(1)));
+    EXPECT_EQ(largeValue(0), readValue(reader, "0"));
+    litestore_close(reader);
+}
+
+TEST_F(LitestoreValueLogTest, corruption_is_detected)
+{
+    populate(1);
+    {
+        std::fstream log(segment(1).c_str(),
+                         std::ios::in | std::ios::out | std::ios::binary);
+        log.seekp(100);
+        log.put('X');
+    }
+    reopen();
+    EXPECT_EQ("<missing>", readValue(ctx, "0"));
+}
+
+TEST(LitestoreValueLog, needs_a_store_file)
+{
+    litestore_opts opts = litestore_opts();
+    opts.error_callback = &ignoreError;
+    opts.value_log_threshold = 1024;
+    litestore* ctx = NULL;
+    EXPECT_LS_ERR(litestore_open(":memory:", opts, &ctx));
+    EXPECT_EQ(NULL, ctx);
+}
+
+}  // namespace ls
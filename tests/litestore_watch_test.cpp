@@ -0,0 +1,249 @@
+/**
+ * Copyright (c) 2014 Markku Linnoskivi
+ *
+ * See the file LICENSE.txt for copying permission.
+ */
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include <sqlite3.h>
+
+#include "litestore/litestore.h"
+#include "litestore_test_common.h"
+
+
+namespace ls
+{
+using namespace ::testing;
+
+namespace
+{
+
+// A delivery, "<key>:<event>" per change.
+typedef std::vector<std::string> Changes;
+typedef std::vector<Changes> Calls;
+
+std::string change(const std::string& key, const int event)
+{
+    return key + ":" + std::to_string(event);
+}
+
+void record(const litestore_change_t* changes, size_t count, void* user_data)
+{
+    Changes c;
+    for (size_t i = 0; i < count; ++i)
+    {
+        c.push_back(change(std::string(changes[i].key,
+                                       changes[i].key_length),
+                           changes[i].event));
+    }
+    static_cast<Calls*>(user_data)->push_back(c);
+}
+
+struct Echo
+{
+    litestore* ctx;
+    Calls calls;
+    int watchRv;
+};
+
+// Writes "echo" once, and tries to watch.
+void echo(const litestore_change_t* changes, size_t count, void* user_data)
+{
+    Echo* e = static_cast<Echo*>(user_data);
+    record(changes, count, &e->calls);
+    if (e->calls.size() == 1)
+    {
+        litestore_create(e->ctx, slice("echo"), blob("e"));
+        e->watchRv = litestore_watch(e->ctx, litestore_slice(NULL, 0, 0),
+                                     &record, NULL);
+    }
+}
+
+struct LitestoreWatchTest : LitestoreTest
+{
+    bool logExists()
+    {
+        sqlite3_stmt* stmt = NULL;
+        sqlite3_prepare_v2(db,
+                           "SELECT 1 FROM sqlite_temp_master"
+                           " WHERE name = 'watch_log';",
+                           -1, &stmt, NULL);
+        const bool exists = sqlite3_step(stmt) == SQLITE_ROW;
+        sqlite3_finalize(stmt);
+        return exists;
+    }
+};
+
+}  // namespace
+
+TEST_F(LitestoreWatchTest, changes_are_delivered_per_transaction)
+{
+    Calls calls;
+    ASSERT_LS_OK(litestore_watch(ctx, litestore_slice(NULL, 0, 0),
+                                 &record, &calls));
+
+    ASSERT_LS_OK(litestore_begin_tx(ctx));
+    ASSERT_LS_OK(litestore_create(ctx, slice("b"), blob("b")));
+    ASSERT_LS_OK(litestore_create(ctx, slice("a"), blob("a")));
+    ASSERT_LS_OK(litestore_update(ctx, slice("a"), blob("aa")));
+    ASSERT_LS_OK(litestore_create(ctx, slice("c"), blob("c")));
+    ASSERT_LS_OK(litestore_delete(ctx, slice("c")));
+    EXPECT_TRUE(calls.empty());
+    ASSERT_LS_OK(litestore_commit_tx(ctx));
+    ASSERT_EQ(1u, calls.size());
+    Changes expected;
+    expected.push_back(change("a", LITESTORE_CREATED));
+    expected.push_back(change("b", LITESTORE_CREATED));
+    EXPECT_EQ(expected, calls[0]);
+
+    // writes outside of a transaction, of all types
+    ASSERT_LS_OK(litestore_update(ctx, slice("b"), blob("bb")));
+    ASSERT_LS_OK(litestore_create_kv(ctx, slice("kv")));
+    ASSERT_LS_OK(litestore_kv_set(ctx, slice("kv"), slice("f"), blob("v")));
+    ASSERT_LS_OK(litestore_create_array(ctx, slice("arr")));
+    ASSERT_LS_OK(litestore_array_append(ctx, slice("arr"), blob("i"), NULL));
+    ASSERT_LS_OK(litestore_delete(ctx, slice("a")));
+    ASSERT_EQ(7u, calls.size());
+    EXPECT_EQ(Changes(1, change("b", LITESTORE_UPDATED)), calls[1]);
+    EXPECT_EQ(Changes(1, change("kv", LITESTORE_CREATED)), calls[2]);
+    EXPECT_EQ(Changes(1, change("kv", LITESTORE_UPDATED)), calls[3]);
+    EXPECT_EQ(Changes(1, change("arr", LITESTORE_UPDATED)), calls[5]);
+    EXPECT_EQ(Changes(1, change("a", LITESTORE_DELETED)), calls[6]);
+
+    // reads and failed writes change nothing
+    litestore_create(ctx, slice("b"), blob("b"));
+    std::string value;
+    ASSERT_LS_OK(litestore_read(ctx, slice("b"), &str2str, &value));
+    EXPECT_EQ(7u, calls.size());
+}
+
+TEST_F(LitestoreWatchTest, recreated_keys_are_updated)
+{
+    Calls calls;
+    ASSERT_LS_OK(litestore_create(ctx, slice("a"), blob("a")));
+    ASSERT_LS_OK(litestore_create(ctx, slice("b"), blob("b")));
+    ASSERT_LS_OK(litestore_watch(ctx, litestore_slice(NULL, 0, 0),
+                                 &record, &calls));
+
+    ASSERT_LS_OK(litestore_begin_tx(ctx));
+    ASSERT_LS_OK(litestore_delete(ctx, slice("a")));
+    ASSERT_LS_OK(litestore_create(ctx, slice("a"), blob("aa")));
+    ASSERT_LS_OK(litestore_delete(ctx, slice("b")));
+    ASSERT_LS_OK(litestore_create_null(ctx, slice("b")));
+    ASSERT_LS_OK(litestore_commit_tx(ctx));
+    ASSERT_EQ(1u, calls.size());
+    Changes expected;
+    expected.push_back(change("a", LITESTORE_UPDATED));
+    expected.push_back(change("b", LITESTORE_UPDATED));
+    EXPECT_EQ(expected, calls[0]);
+}
+
+TEST_F(LitestoreWatchTest, maintenance_rewrites_are_not_delivered)
+{
+    Calls calls;
+    const std::string value(1000, 'x');
+    ASSERT_LS_OK(litestore_create(ctx, slice("a"), blob(value)));
+    ASSERT_LS_OK(litestore_merge(ctx, slice("n"), LITESTORE_MERGE_APPEND,
+                                 blob("1")));
+    ASSERT_LS_OK(litestore_watch(ctx, litestore_slice(NULL, 0, 0),
+                                 &record, &calls));
+
+    ASSERT_LS_OK(litestore_set_compression(ctx, LITESTORE_CODEC_LZ));
+    int rv = LITESTORE_IN_PROGRESS;
+    while (rv == LITESTORE_IN_PROGRESS)
+    {
+        rv = litestore_reencode_step(ctx, 100);
+    }
+    ASSERT_LS_OK(rv);
+    ASSERT_LS_OK(litestore_merge_compact_step(ctx, 100));
+    EXPECT_TRUE(calls.empty());
+    EXPECT_EQ(value, readValue(ctx, "a"));
+    EXPECT_EQ("1", readValue(ctx, "n"));
+
+    ASSERT_LS_OK(litestore_update(ctx, slice("a"), blob("a")));
+    ASSERT_EQ(1u, calls.size());
+    EXPECT_EQ(Changes(1, change("a", LITESTORE_UPDATED)), calls[0]);
+}
+
+TEST_F(LitestoreWatchTest, prefixes_filter_the_keys)
+{
+    Calls users;
+    Calls all;
+    ASSERT_LS_OK(litestore_watch(ctx, slice("user:"), &record, &users));
+    ASSERT_LS_OK(litestore_watch(ctx, litestore_slice(NULL, 0, 0),
+                                 &record, &all));
+
+    ASSERT_LS_OK(litestore_begin_tx(ctx));
+    ASSERT_LS_OK(litestore_create(ctx, slice("user:2"), blob("2")));
+    ASSERT_LS_OK(litestore_create(ctx, slice("group:1"), blob("1")));
+    ASSERT_LS_OK(litestore_create(ctx, slice("user:1"), blob("1")));
+    ASSERT_LS_OK(litestore_create(ctx, slice("user"), blob("u")));
+    ASSERT_LS_OK(litestore_commit_tx(ctx));
+    ASSERT_EQ(1u, users.size());
+    ASSERT_EQ(2u, users[0].size());
+    EXPECT_EQ(change("user:1", LITESTORE_CREATED), users[0][0]);
+    EXPECT_EQ(change("user:2", LITESTORE_CREATED), users[0][1]);
+    ASSERT_EQ(1u, all.size());
+    EXPECT_EQ(4u, all[0].size());
+
+    ASSERT_LS_OK(litestore_delete(ctx, slice("group:1")));
+    EXPECT_EQ(1u, users.size());
+    EXPECT_EQ(2u, all.size());
+}
+
+TEST_F(LitestoreWatchTest, rollbacks_are_not_delivered)
+{
+    Calls calls;
+    ASSERT_LS_OK(litestore_watch(ctx, litestore_slice(NULL, 0, 0),
+                                 &record, &calls));
+    ASSERT_LS_OK(litestore_begin_tx(ctx));
+    ASSERT_LS_OK(litestore_create(ctx, slice("a"), blob("a")));
+    ASSERT_LS_OK(litestore_rollback_tx(ctx));
+    EXPECT_TRUE(calls.empty());
+
+    ASSERT_LS_OK(litestore_create(ctx, slice("b"), blob("b")));
+    ASSERT_EQ(1u, calls.size());
+    EXPECT_EQ(Changes(1, change("b", LITESTORE_CREATED)), calls[0]);
+}
+
+TEST_F(LitestoreWatchTest, callbacks_may_write)
+{
+    Echo e;
+    e.ctx = ctx;
+    e.watchRv = LITESTORE_OK;
+    ASSERT_LS_OK(litestore_watch(ctx, litestore_slice(NULL, 0, 0),
+                                 &echo, &e));
+    ASSERT_LS_OK(litestore_create(ctx, slice("a"), blob("a")));
+    EXPECT_EQ(LITESTORE_ERR, e.watchRv);
+    ASSERT_EQ(2u, e.calls.size());
+    EXPECT_EQ(Changes(1, change("a", LITESTORE_CREATED)), e.calls[0]);
+    EXPECT_EQ(Changes(1, change("echo", LITESTORE_CREATED)), e.calls[1]);
+}
+
+TEST_F(LitestoreWatchTest, unwatch)
+{
+    Calls calls;
+    EXPECT_FALSE(logExists());
+    ASSERT_LS_OK(litestore_watch(ctx, slice("a"), &record, &calls));
+    ASSERT_LS_OK(litestore_watch(ctx, slice("b"), &record, &calls));
+    EXPECT_TRUE(logExists());
+
+    ASSERT_LS_OK(litestore_begin_tx(ctx));
+    EXPECT_LS_ERR(litestore_watch(ctx, slice("c"), &record, &calls));
+    EXPECT_LS_ERR(litestore_unwatch(ctx, &record, &calls));
+    ASSERT_LS_OK(litestore_commit_tx(ctx));
+
+    EXPECT_EQ(LITESTORE_UNKNOWN_ENTITY,
+              litestore_unwatch(ctx, &record, NULL));
+    ASSERT_LS_OK(litestore_unwatch(ctx, &record, &calls));
+    EXPECT_EQ(LITESTORE_UNKNOWN_ENTITY,
+              litestore_unwatch(ctx, &record, &calls));
+    EXPECT_FALSE(logExists());
+    ASSERT_LS_OK(litestore_create(ctx, slice("a"), blob("a")));
+    EXPECT_TRUE(calls.empty());
+}
+
+}  // namespace ls